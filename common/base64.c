@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include "base64.h"
 
+#ifdef GM_BASE64_SIMD
+#include <immintrin.h>
+#endif
+
 /*
  * http://freecode-freecode.blogspot.com/2008/02/base64c.html
  */
@@ -12,6 +16,182 @@
  */
 const char *BASE64_CHARS = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
+#define BASE64_SKIP -1  /**< character is ignored while decoding */
+#define BASE64_END  -2  /**< padding or end of string, decoding stops here */
+
+/**
+ * values of all characters for decoding
+ */
+static const signed char BASE64_VALUES[256] = {
+    -2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -2, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+#ifdef GM_BASE64_SIMD
+#define GM_TARGET(isa) __attribute__((target(isa)))
+
+/**
+ * same 128bit value in both lanes
+ */
+#define DUP128(x) _mm256_inserti128_si256(_mm256_castsi128_si256(x), (x), 1)
+
+static int base64_simd = -1;
+
+/**
+ * encode 12 bytes into 16 characters, reads 16 bytes
+ *
+ * @param source the source buffer
+ * @param target the target buffer
+ */
+static GM_TARGET("ssse3") void _base64_encode_ssse3(const unsigned char *source, char *target) {
+    __m128i in = _mm_loadu_si128((const __m128i *)source);
+    __m128i indices, result, less;
+
+    /* spread 3 bytes over 4 bytes and move the 6 bit groups into place */
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    indices = _mm_or_si128(
+        _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040)),
+        _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010)));
+
+    /* translate values into characters by adding a per range offset */
+    result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    less   = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+    result = _mm_shuffle_epi8(_mm_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52,
+                                            '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0), result);
+    _mm_storeu_si128((__m128i *)target, _mm_add_epi8(result, indices));
+}
+
+/**
+ * encode 24 bytes into 32 characters, reads 28 bytes
+ *
+ * @param source the source buffer
+ * @param target the target buffer
+ */
+static GM_TARGET("avx2") void _base64_encode_avx2(const unsigned char *source, char *target) {
+    __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)source)),
+                                         _mm_loadu_si128((const __m128i *)(source+12)), 1);
+    __m256i indices, result, less;
+
+    in = _mm256_shuffle_epi8(in, DUP128(_mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1)));
+    indices = _mm256_or_si256(
+        _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040)),
+        _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010)));
+
+    result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    less   = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    result = _mm256_shuffle_epi8(DUP128(_mm_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52,
+                                                      '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0)), result);
+    _mm256_storeu_si256((__m256i *)target, _mm256_add_epi8(result, indices));
+}
+
+/**
+ * decode 16 characters into 12 bytes, writes 16 bytes
+ *
+ * @param source the encoded data
+ * @param target the target buffer
+ * @return 1 on success, 0 if there are invalid characters
+ */
+static GM_TARGET("ssse3") int _base64_decode_ssse3(const char *source, unsigned char *target) {
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    __m128i in = _mm_loadu_si128((const __m128i *)source);
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+    __m128i lo_nibbles = _mm_and_si128(in, mask_2f);
+    __m128i lo, hi, roll;
+
+    /* every valid character has no common bit in both lookups */
+    lo = _mm_shuffle_epi8(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a), lo_nibbles);
+    hi = _mm_shuffle_epi8(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10), hi_nibbles);
+    if(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0)
+        return 0;
+
+    /* translate characters into values, '/' needs a special case */
+    roll = _mm_shuffle_epi8(_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0),
+                            _mm_add_epi8(_mm_cmpeq_epi8(in, mask_2f), hi_nibbles));
+    in = _mm_add_epi8(in, roll);
+
+    /* pack 4 times 6 bits into 3 bytes */
+    in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+    in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+    in = _mm_shuffle_epi8(in, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    _mm_storeu_si128((__m128i *)target, in);
+    return 1;
+}
+
+/**
+ * decode 32 characters into 24 bytes, writes 32 bytes
+ *
+ * @param source the encoded data
+ * @param target the target buffer
+ * @return 1 on success, 0 if there are invalid characters
+ */
+static GM_TARGET("avx2") int _base64_decode_avx2(const char *source, unsigned char *target) {
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    __m256i in = _mm256_loadu_si256((const __m256i *)source);
+    __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask_2f);
+    __m256i lo_nibbles = _mm256_and_si256(in, mask_2f);
+    __m256i lo, hi, roll;
+
+    lo = _mm256_shuffle_epi8(DUP128(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                                  0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a)), lo_nibbles);
+    hi = _mm256_shuffle_epi8(DUP128(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                                  0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10)), hi_nibbles);
+    if(_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256())) != 0)
+        return 0;
+
+    roll = _mm256_shuffle_epi8(DUP128(_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0)),
+                               _mm256_add_epi8(_mm256_cmpeq_epi8(in, mask_2f), hi_nibbles));
+    in = _mm256_add_epi8(in, roll);
+
+    in = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+    in = _mm256_madd_epi16(in, _mm256_set1_epi32(0x00011000));
+    in = _mm256_shuffle_epi8(in, DUP128(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)));
+    in = _mm256_permutevar8x32_epi32(in, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm256_storeu_si256((__m256i *)target, in);
+    return 1;
+}
+#endif
+
+/**
+ * select the base64 implementation
+ *
+ * @param level BASE64_SCALAR, BASE64_SSSE3, BASE64_AVX2 or -1 for the best supported one
+ * @return the level which is used from now on
+ */
+int base64_set_simd(int level) {
+#ifdef GM_BASE64_SIMD
+    int supported = BASE64_SCALAR;
+    if(__builtin_cpu_supports("ssse3"))
+        supported = BASE64_SSSE3;
+    if(__builtin_cpu_supports("avx2"))
+        supported = BASE64_AVX2;
+    if(level < 0 || level > supported)
+        level = supported;
+    base64_simd = level;
+    return level;
+#else
+    (void)level;
+    return BASE64_SCALAR;
+#endif
+}
+
 /**
  * encode three bytes using base64 (RFC 3548)
  *
@@ -47,9 +227,42 @@ int base64_encode(unsigned char *source, size_t sourcelen, char *target, size_t
     if ((sourcelen+2)/3*4 > targetlen-1)
         return 0;
 
+    base64_encode_part(source, sourcelen, target);
+
+    return 1;
+}
+
+/**
+ * encode an array of bytes without size check. Parts with a multiple of three
+ * bytes can be encoded one after another and simply be concatenated.
+ *
+ * @param source the source buffer
+ * @param sourcelen the length of the source buffer
+ * @param target the target buffer, must hold (sourcelen+2)/3*4+1 characters
+ * @return number of characters written, not counting the terminating zero
+ */
+size_t base64_encode_part(const unsigned char *source, size_t sourcelen, char *target) {
+    char *start = target;
+
+#ifdef GM_BASE64_SIMD
+    if (base64_simd < 0)
+        base64_set_simd(-1);
+    if (base64_simd >= BASE64_AVX2) {
+        for (; sourcelen >= 28; sourcelen -= 24, source += 24, target += 32)
+            _base64_encode_avx2(source, target);
+    }
+    if (base64_simd >= BASE64_SSSE3) {
+        for (; sourcelen >= 16; sourcelen -= 12, source += 12, target += 16)
+            _base64_encode_ssse3(source, target);
+    }
+#endif
+
     /* encode all full triples */
     while (sourcelen >= 3) {
-        _base64_encode_triple(source, target);
+        target[0] = BASE64_CHARS[source[0] >> 2];
+        target[1] = BASE64_CHARS[(source[0] & 0x03) << 4 | source[1] >> 4];
+        target[2] = BASE64_CHARS[(source[1] & 0x0f) << 2 | source[2] >> 6];
+        target[3] = BASE64_CHARS[source[2] & 0x3f];
         sourcelen -= 3;
         source += 3;
         target += 4;
@@ -71,7 +284,7 @@ int base64_encode(unsigned char *source, size_t sourcelen, char *target, size_t
     /* terminate the string */
     target[0] = 0;
 
-    return 1;
+    return target - start;
 }
 
 /**
@@ -157,46 +370,84 @@ int _base64_decode_triple(char quadruple[4], unsigned char *result) {
  * @return length of converted data on success, -1 otherwise
  */
 size_t base64_decode(char *source, unsigned char *target, size_t targetlen) {
-    char *src, *tmpptr;
-    char quadruple[4], tmpresult[3];
-    int i, tmplen = 3;
-    size_t converted = 0;
+    size_t converted = base64_decode_part(&source, source+strlen(source), target, targetlen);
 
-    /* concatinate '===' to the source to handle unpadded base64 data */
-    src = (char *)malloc(strlen(source)+5);
-    if (src == NULL)
-        return -1;
-    strcpy(src, source);
-    strcat(src, "====");
-    tmpptr = src;
-
-    /* convert as long as we get a full result */
-    while (tmplen == 3) {
-        /* get 4 characters to convert */
-        for (i=0; i<4; i++) {
-            /* skip invalid characters - we won't reach the end */
-            while (*tmpptr != '=' && _base64_char_value(*tmpptr)<0)
-                tmpptr++;
-
-            quadruple[i] = *(tmpptr++);
-        }
+    /* check if there is data left which did not fit into the target buffer */
+    if (converted + 3 > targetlen) {
+        while (BASE64_VALUES[(unsigned char)*source] == BASE64_SKIP)
+            source++;
+        if (BASE64_VALUES[(unsigned char)*source] >= 0)
+            return -1;
+    }
 
-        /* convert the characters */
-        tmplen = _base64_decode_triple(quadruple, (unsigned char*)tmpresult);
+    return converted;
+}
 
-        /* check if the fit in the result buffer */
-        if ((int)targetlen < tmplen) {
-            free(src);
-            return -1;
+/**
+ * decode the next part of base64 encoded data
+ *
+ * @param source pointer to the encoded data (zero terminated), will be advanced
+ * @param end pointer to the terminating zero of the encoded data
+ * @param target pointer to the target buffer
+ * @param targetlen length of the target buffer, should be a multiple of three
+ * @return length of converted data, less than targetlen once the end of the
+ *         data has been reached
+ */
+size_t base64_decode_part(char **source, char *end, unsigned char *target, size_t targetlen) {
+    const unsigned char *src = (const unsigned char *)*source;
+    size_t converted = 0;
+    int a, b, c, d, n, value[4];
+
+#ifdef GM_BASE64_SIMD
+    if (base64_simd < 0)
+        base64_set_simd(-1);
+#else
+    (void)end;
+#endif
+
+    while (converted + 3 <= targetlen) {
+#ifdef GM_BASE64_SIMD
+        /* vectorized blocks, anything unusual is left to the scalar code */
+        if (base64_simd >= BASE64_AVX2 && (const unsigned char *)end - src >= 32 && converted + 32 <= targetlen
+            && _base64_decode_avx2((const char *)src, target+converted)) {
+            src += 32;
+            converted += 24;
+            continue;
+        }
+        if (base64_simd >= BASE64_SSSE3 && (const unsigned char *)end - src >= 16 && converted + 16 <= targetlen
+            && _base64_decode_ssse3((const char *)src, target+converted)) {
+            src += 16;
+            converted += 12;
+            continue;
+        }
+#endif
+        /* fast path for four valid characters */
+        if ((a = BASE64_VALUES[src[0]]) >= 0 && (b = BASE64_VALUES[src[1]]) >= 0 &&
+            (c = BASE64_VALUES[src[2]]) >= 0 && (d = BASE64_VALUES[src[3]]) >= 0) {
+            target[converted++] = a << 2 | b >> 4;
+            target[converted++] = (b << 4 | c >> 2) & 0xff;
+            target[converted++] = (c << 6 | d) & 0xff;
+            src += 4;
+            continue;
         }
 
-        /* put the partial result in the result buffer */
-        memcpy(target, tmpresult, tmplen);
-        target += tmplen;
-        targetlen -= tmplen;
-        converted += tmplen;
+        /* skip invalid characters, stop at padding or the end of the string */
+        for (n = 0; n < 4; src++) {
+            int v = BASE64_VALUES[*src];
+            if (v == BASE64_END)
+                break;
+            if (v >= 0)
+                value[n++] = v;
+        }
+        if (n >= 2)
+            target[converted++] = value[0] << 2 | value[1] >> 4;
+        if (n >= 3)
+            target[converted++] = (value[1] << 4 | value[2] >> 2) & 0xff;
+        if (n < 4)
+            break;
+        target[converted++] = (value[2] << 6 | value[3]) & 0xff;
     }
 
-    free(src);
+    *source = (char *)src;
     return converted;
 }
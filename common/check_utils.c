@@ -22,14 +22,43 @@
  *****************************************************************************/
 
 #include "config.h"
+#include <poll.h>
+#include <sys/syscall.h>
 #include "check_utils.h"
 #include "utils.h"
 #include "epn_utils.h"
 #include "gearman_utils.h"
 #include "popenRWE.h"
+#include "native_checks.h"
+#include "plugin_modules.h"
+#include "rusage_stats.h"
+#include "plugin_cgroup.h"
 
 pid_t current_child_pid = 0;
 
+/* resource usage of the plugin reaped by the last run_check() */
+static struct rusage run_check_rusage;
+static int run_check_has_rusage = FALSE;
+
+/* deadline of the running check, run_check() waits forever without one */
+static struct timeval check_deadline = { 0, 0 };
+static int run_check_timed_out = FALSE;
+static int plugin_own_group = FALSE;
+
+/* timed out plugins which got a SIGTERM and are killed when their grace time is over */
+typedef struct timed_out_check_struct {
+    pid_t          pid;
+    int            killed;
+    struct timeval kill_at;
+} timed_out_check_t;
+static timed_out_check_t timed_out_checks[GM_MAX_TIMED_OUT_CHECKS];
+static int timed_out_checks_num = 0;
+
+/* killed plugins which have not been reaped yet, they are only waited for */
+static pid_t * unreaped_checks = NULL;
+static int unreaped_checks_num = 0;
+static int unreaped_checks_size = 0;
+
 /* convert number to signal name */
 char *nr2signal(int sig) {
     char * signame = NULL;
@@ -80,7 +109,7 @@ char *extract_check_result(FILE *fp, int trimmed) {
     char *output;
     char *escaped;
 
-    output   = gm_malloc(sizeof(char*)*GM_BUFFERSIZE);
+    output   = gm_malloc(GM_BUFFERSIZE);
     output[0]='\x0';
     read_filepointer(&output, fp);
 
@@ -90,42 +119,270 @@ char *extract_check_result(FILE *fp, int trimmed) {
 }
 
 
+/* milliseconds until the deadline, -1 without deadline and 0 when it has passed */
+static int deadline_ms(struct timeval * deadline) {
+    struct timeval now;
+    long long usec;
+
+    if(deadline == NULL || deadline->tv_sec == 0)
+        return -1;
+    gettimeofday(&now, NULL);
+    usec = ((long long)deadline->tv_sec - now.tv_sec) * 1000000 + (deadline->tv_usec - now.tv_usec);
+    if(usec <= 0)
+        return 0;
+    return (int)((usec + 999) / 1000);
+}
+
+
+/* set a deadline the given number of seconds from now */
+static void set_deadline(struct timeval * deadline, double seconds) {
+    gettimeofday(deadline, NULL);
+    double2timeval(timeval2double(deadline) + seconds, deadline);
+}
+
+
+/* read stdout and stderr of a plugin at the same time until both are closed,
+ * returns GM_ERROR when the deadline passed before */
+static int read_check_pipes(int fd_out, char ** out, int fd_err, char ** err, struct timeval * deadline) {
+    struct pollfd pfd[2];
+    char * buf[2];
+    int size[2]  = { 0, 0 };
+    int total[2] = { GM_BUFFERSIZE, GM_BUFFERSIZE };
+    int x, wait_ms, open_fds = 2, rc = GM_OK;
+    ssize_t bytes;
+
+    pfd[0].fd = fd_out;
+    pfd[1].fd = fd_err;
+    for(x = 0; x < 2; x++) {
+        pfd[x].events = POLLIN;
+        buf[x]        = gm_malloc(total[x]);
+        buf[x][0]     = '\x0';
+    }
+
+    while(open_fds > 0) {
+        wait_ms = deadline_ms(deadline);
+        if(wait_ms == 0) {
+            rc = GM_ERROR;
+            break;
+        }
+        if(poll(pfd, 2, wait_ms) < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        for(x = 0; x < 2; x++) {
+            if(pfd[x].fd < 0 || pfd[x].revents == 0)
+                continue;
+            if(total[x] - size[x] < GM_BUFFERSIZE/2) {
+                total[x] += GM_BUFFERSIZE;
+                buf[x]    = gm_realloc(buf[x], total[x]);
+            }
+            bytes = read(pfd[x].fd, buf[x]+size[x], total[x]-size[x]-1);
+            if(bytes < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            if(bytes <= 0) {
+                pfd[x].fd = -1;
+                open_fds--;
+                continue;
+            }
+            size[x] += bytes;
+            buf[x][size[x]] = '\x0';
+            if(size[x] >= GM_MAX_OUTPUT) {
+                gm_log( GM_LOG_INFO, "plugin output exceeds %d bytes, cutting off\n", GM_MAX_OUTPUT );
+                open_fds = 0;
+                break;
+            }
+        }
+    }
+
+    *out = buf[0];
+    *err = buf[1];
+    return rc;
+}
+
+
+/* wait until a process exited or the deadline passed, returns the pid, 0 on timeout or -1 */
+static pid_t wait_for_process(pid_t pid, int * status, struct rusage * usage, struct timeval * deadline) {
+    struct pollfd pfd;
+    pid_t rc;
+    int wait_ms;
+
+    if(deadline_ms(deadline) < 0)
+        return wait4(pid, status, 0, usage);
+
+    /* the process usually exits right after closing its output */
+    if((rc = wait4(pid, status, WNOHANG, usage)) != 0)
+        return rc;
+
+    /* a pidfd gets readable on exit, otherwise check every few milliseconds */
+    pfd.fd     = -1;
+    pfd.events = POLLIN;
+#ifdef SYS_pidfd_open
+    pfd.fd = syscall(SYS_pidfd_open, pid, 0);
+#endif
+    while((rc = wait4(pid, status, WNOHANG, usage)) == 0) {
+        wait_ms = deadline_ms(deadline);
+        if(wait_ms == 0)
+            break;
+        if(pfd.fd < 0 && wait_ms > 10)
+            wait_ms = 10;
+        poll(&pfd, pfd.fd < 0 ? 0 : 1, wait_ms);
+    }
+    if(pfd.fd >= 0)
+        close(pfd.fd);
+
+    return rc;
+}
+
+
+/* remember a killed process until it can be reaped */
+static void add_unreaped_check(pid_t pid) {
+    if(unreaped_checks_num == unreaped_checks_size) {
+        unreaped_checks_size = unreaped_checks_size == 0 ? 16 : 2 * unreaped_checks_size;
+        unreaped_checks      = gm_realloc(unreaped_checks, unreaped_checks_size * sizeof(pid_t));
+    }
+    unreaped_checks[unreaped_checks_num++] = pid;
+    return;
+}
+
+
+/* terminate a timed out process and kill it later if it does not exit */
+static void add_timed_out_check(pid_t pid, int terminate) {
+    timed_out_check_t * entry;
+
+    if(terminate == TRUE && plugin_cgroup_kill() != GM_OK) {
+        gm_log( GM_LOG_TRACE, "send SIGTERM to %d\n", pid);
+        kill(-pid, SIGTERM);
+        kill(pid, SIGTERM);
+    }
+
+    if(timed_out_checks_num == GM_MAX_TIMED_OUT_CHECKS) {
+        gm_log( GM_LOG_TRACE, "too many timed out checks, send SIGKILL to %d\n", pid);
+        kill(-pid, SIGKILL);
+        kill(pid, SIGKILL);
+        add_unreaped_check(pid);
+        return;
+    }
+
+    /* processes which are not terminated by us get more time to finish by themselves */
+    entry         = &timed_out_checks[timed_out_checks_num++];
+    entry->pid    = pid;
+    entry->killed = FALSE;
+    set_deadline(&entry->kill_at, (terminate == TRUE ? 1 : 2) * GM_TIMEOUT_KILL_GRACE / 1000.0);
+
+    return;
+}
+
+
+/* reap timed out plugins and kill them when their grace time is over */
+int reap_timed_out_checks(int wait) {
+    timed_out_check_t * entry;
+    int x, wait_ms, next;
+
+    while(1) {
+        for(x = 0; x < unreaped_checks_num; x++) {
+            if(waitpid(unreaped_checks[x], NULL, WNOHANG) != 0)
+                unreaped_checks[x--] = unreaped_checks[--unreaped_checks_num];
+        }
+
+        next = -1;
+        for(x = 0; x < timed_out_checks_num; x++) {
+            entry = &timed_out_checks[x];
+
+            /* reaped, remaining processes of its group are killed right away */
+            if(waitpid(entry->pid, NULL, WNOHANG) != 0) {
+                kill(-entry->pid, SIGKILL);
+                timed_out_checks[x--] = timed_out_checks[--timed_out_checks_num];
+                continue;
+            }
+
+            wait_ms = deadline_ms(&entry->kill_at);
+            if(wait_ms == 0 && entry->killed == FALSE) {
+                gm_log( GM_LOG_TRACE, "send SIGKILL to %d\n", entry->pid);
+                kill(-entry->pid, SIGKILL);
+                kill(entry->pid, SIGKILL);
+                entry->killed = TRUE;
+                set_deadline(&entry->kill_at, GM_TIMEOUT_KILL_GRACE / 1000.0);
+                wait_ms = GM_TIMEOUT_KILL_GRACE;
+            }
+            /* not even killable, probably stuck in the kernel */
+            else if(wait_ms == 0) {
+                gm_log( GM_LOG_INFO, "timed out plugin %d does not exit after SIGKILL, reaping it later\n", entry->pid);
+                add_unreaped_check(entry->pid);
+                timed_out_checks[x--] = timed_out_checks[--timed_out_checks_num];
+                continue;
+            }
+            if(next < 0 || wait_ms < next)
+                next = wait_ms;
+        }
+
+        if(wait == FALSE || next < 0)
+            return next;
+
+        /* there is no notification when a plugin exits, check every few milliseconds */
+        poll(NULL, 0, next > 10 ? 10 : next);
+    }
+}
+
+
+/* run in the forked plugin process right before the plugin is started */
+void setup_plugin_process() {
+    /* timeouts have to terminate the plugin without hitting the worker */
+    if(plugin_own_group == TRUE)
+        setpgid(0,0);
+    plugin_cgroup_enter();
+    return;
+}
+
+
+/* write buffered log lines before leaving a forked process, _exit() would drop them */
+static void flush_and_exit(int code) {
+    gm_log_flush();
+    _exit(code);
+}
+
+/* verify restricted paths
+ * make sure our command does not contain any bash special characters
+ * and starts with one of the allowed paths
+ */
+int check_restricted_command(const char * command_line, char ** output) {
+    if(!mod_gm_opt->restrict_path_num)
+        return(GM_OK);
+    if(*command_line != '/') {
+        if(output != NULL)
+            gm_asprintf(output, "ERROR: restricted paths in affect, but command does not start with an absolute path: %.*s...\n", 8, command_line);
+        return(GM_ERROR);
+    }
+    if(strpbrk(command_line,mod_gm_opt->restrict_command_characters) != NULL) {
+        if(output != NULL)
+            gm_asprintf(output, "ERROR: restricted paths in affect, but command contains forbidden character(s): %.*s...\n", 8, command_line);
+        return(GM_ERROR);
+    }
+    if(!gm_trie_match(mod_gm_opt->restrict_path_trie, command_line)) {
+        if(output != NULL)
+            gm_asprintf(output, "ERROR: command does not start with any of the restricted paths: %.*s...\n", 8, command_line);
+        return(GM_ERROR);
+    }
+    return(GM_OK);
+}
+
+
 /* run a check */
 int run_check(char *processed_command, char **ret, char **err) {
     char *argv[MAX_CMD_ARGS];
-    FILE *fp;
+    char *output, *error;
     pid_t pid;
     int pipe_stdout[2], pipe_stderr[2], pipe_rwe[3];
+    int fd_out, fd_err;
     int retval;
-    int i;
-    int restricted_ok = FALSE;
     sigset_t mask;
 
-    /* verify restricted paths
-     * make sure our command does not contain any bash special characters
-     * and starts with one of the allowed paths
-     */
-    if(mod_gm_opt->restrict_path_num) {
-        if(*processed_command != '/') {
-            *err = gm_strdup("");
-            gm_asprintf(ret, "ERROR: restricted paths in affect, but command does not start with an absolute path: %.*s...\n", 8, processed_command);
-            return(GM_EXIT_UNKNOWN);
-        }
-        if(strpbrk(processed_command,mod_gm_opt->restrict_command_characters) != NULL) {
-            *err = gm_strdup("");
-            gm_asprintf(ret, "ERROR: restricted paths in affect, but command contains forbidden character(s): %.*s...\n", 8, processed_command);
-            return(GM_EXIT_UNKNOWN);
-        }
-        for(i=0;i<mod_gm_opt->restrict_path_num;i++) {
-            if(starts_with(mod_gm_opt->restrict_path[i], processed_command)) {
-                restricted_ok = TRUE;
-            }
-        }
-        if(!restricted_ok) {
-            *err = gm_strdup("");
-            gm_asprintf(ret, "ERROR: command does not start with any of the restricted paths: %.*s...\n", 8, processed_command);
-            return(GM_EXIT_UNKNOWN);
-        }
+    run_check_has_rusage = FALSE;
+    run_check_timed_out  = FALSE;
+
+    if(check_restricted_command(processed_command, ret) != GM_OK) {
+        *err = gm_strdup("");
+        return(GM_EXIT_UNKNOWN);
     }
 
 #ifdef EMBEDDEDPERL
@@ -146,19 +403,19 @@ int run_check(char *processed_command, char **ret, char **err) {
 
         parse_command_line(processed_command,argv);
         if(!argv[0])
-            _exit(STATE_UNKNOWN);
+            flush_and_exit(STATE_UNKNOWN);
 
         if(pipe(pipe_stdout)) {
             gm_log( GM_LOG_ERROR, "error creating pipe: %s\n", strerror(errno));
-            _exit(STATE_UNKNOWN);
+            flush_and_exit(STATE_UNKNOWN);
         }
         if(pipe(pipe_stderr)) {
             gm_log( GM_LOG_ERROR, "error creating pipe: %s\n", strerror(errno));
-            _exit(STATE_UNKNOWN);
+            flush_and_exit(STATE_UNKNOWN);
         }
         if((pid=fork())<0){
             gm_log( GM_LOG_ERROR, "fork error\n");
-            _exit(STATE_UNKNOWN);
+            flush_and_exit(STATE_UNKNOWN);
         }
         else if(!pid){
             /* remove all customn signal handler */
@@ -168,94 +425,129 @@ int run_check(char *processed_command, char **ret, char **err) {
             /* child process */
             if((dup2(pipe_stdout[1],STDOUT_FILENO)<0)){
                 gm_log( GM_LOG_ERROR, "dup2 error\n");
-                _exit(STATE_UNKNOWN);
+                flush_and_exit(STATE_UNKNOWN);
             }
             if((dup2(pipe_stderr[1],STDERR_FILENO)<0)){
                 gm_log( GM_LOG_ERROR, "dup2 error\n");
-                _exit(STATE_UNKNOWN);
+                flush_and_exit(STATE_UNKNOWN);
             }
             close(pipe_stdout[1]);
             close(pipe_stderr[1]);
             current_child_pid = getpid();
+            setup_plugin_process();
             execvp(argv[0], argv);
             if(errno == 2)
-                _exit(127);
+                flush_and_exit(127);
             if(errno == 13)
-                _exit(126);
-            _exit(STATE_UNKNOWN);
+                flush_and_exit(126);
+            flush_and_exit(STATE_UNKNOWN);
         }
 
         /* parent */
-        /* prepare stdout pipe reading */
         close(pipe_stdout[1]);
-        fp=fdopen(pipe_stdout[0],"r");
-        if(!fp){
-            gm_log( GM_LOG_ERROR, "fdopen error\n");
-            _exit(STATE_UNKNOWN);
-        }
-        *ret = extract_check_result(fp, GM_DISABLED);
-        fclose(fp);
-
-        /* prepare stderr pipe reading */
         close(pipe_stderr[1]);
-        fp=fdopen(pipe_stderr[0],"r");
-        if(!fp){
-            gm_log( GM_LOG_ERROR, "fdopen error\n");
-            _exit(STATE_UNKNOWN);
-        }
-        *err = extract_check_result(fp, GM_ENABLED);
-        fclose(fp);
-
-        close(pipe_stdout[0]);
-        close(pipe_stderr[0]);
-        if(waitpid(pid,&retval,0)!=pid)
-            retval=-1;
+        fd_out = pipe_stdout[0];
+        fd_err = pipe_stderr[0];
     }
     else {
         /* use the slower popen when there were shell characters */
         gm_log( GM_LOG_TRACE, "using popen, found shell characters\n" );
         current_child_pid = getpid();
         pid = popenRWE(pipe_rwe, processed_command);
-
-        /* extract check result */
-        fp=fdopen(pipe_rwe[1],"r");
-        if(!fp){
-            gm_log( GM_LOG_ERROR, "fdopen error\n");
-            _exit(STATE_UNKNOWN);
-        }
-        *ret = extract_check_result(fp, GM_DISABLED);
-        fclose(fp);
-
-        /* extract check stderr */
-        fp=fdopen(pipe_rwe[2],"r");
-        if(!fp){
-            gm_log( GM_LOG_ERROR, "fdopen error\n");
-            _exit(STATE_UNKNOWN);
+        if(pid < 0) {
+            gm_log( GM_LOG_ERROR, "popen error: %s\n", strerror(errno));
+            flush_and_exit(STATE_UNKNOWN);
         }
-        *err = extract_check_result(fp, GM_ENABLED);
-        fclose(fp);
+        close(pipe_rwe[0]);
+        fd_out = pipe_rwe[1];
+        fd_err = pipe_rwe[2];
+    }
 
-        /* close the process */
-        retval=pcloseRWE(pid, pipe_rwe);
+    /* read stdout and stderr together, so a plugin cannot block on a full stderr pipe */
+    retval = GM_EXIT_UNKNOWN;
+    if(read_check_pipes(fd_out, &output, fd_err, &error, &check_deadline) != GM_OK)
+        run_check_timed_out = TRUE;
+    close(fd_out);
+    close(fd_err);
+    if(run_check_timed_out == FALSE && wait_for_process(pid, &retval, &run_check_rusage, &check_deadline) == pid)
+        run_check_has_rusage = TRUE;
+    else
+        run_check_timed_out = TRUE;
+
+    /* the plugin is killed in the background, the result is not delayed by that */
+    if(run_check_timed_out == TRUE) {
+        retval = GM_EXIT_UNKNOWN;
+        add_timed_out_check(pid, TRUE);
     }
 
+    *ret = gm_escape_newlines(output, GM_DISABLED);
+    *err = gm_escape_newlines(error, GM_ENABLED);
+    free(output);
+    free(error);
+
     return retval;
 }
 
 
+/* record finish time, timeouts and source of a check result */
+void finish_check_result(gm_job_t * exec_job, char * identifier) {
+    char source[GM_BUFFERSIZE];
+    struct timeval end_time;
+
+    /* record check result info */
+    gettimeofday(&end_time, NULL);
+    exec_job->finish_time = end_time;
+
+    /* did we have a timeout? */
+    if(exec_job->early_timeout == 1 || exec_job->timeout < timeval2double(&end_time) - timeval2double(&exec_job->start_time)) {
+        exec_job->return_code   = mod_gm_opt->timeout_return;
+        exec_job->early_timeout = 1;
+        free(exec_job->output);
+        if ( !strcmp( exec_job->type, "service" ) ) {
+            gm_asprintf(&exec_job->output, "(Service Check Timed Out On Worker: %s)", identifier);
+        }
+        else {
+            gm_asprintf(&exec_job->output, "(Host Check Timed Out On Worker: %s)", identifier);
+        }
+    }
+
+    snprintf( source, sizeof( source )-1, "Mod-Gearman Worker @ %s", identifier);
+    if(exec_job->source != NULL)
+        free(exec_job->source);
+    exec_job->source = gm_strdup(source);
+}
+
+/* log a check which ran into its timeout */
+static void log_check_timeout(gm_job_t * exec_job) {
+    if ( !strcmp( exec_job->type, "service" ) ) {
+        gm_log( GM_LOG_INFO, "timeout (%gs) hit for servicecheck: %s - %s\n", exec_job->timeout, exec_job->host_name, exec_job->service_description);
+    }
+    else if ( !strcmp( exec_job->type, "host" ) ) {
+        gm_log( GM_LOG_INFO, "timeout (%gs) hit for hostcheck: %s\n", exec_job->timeout, exec_job->host_name);
+    }
+    else if ( !strcmp( exec_job->type, "eventhandler" ) ) {
+        gm_log( GM_LOG_INFO, "timeout (%gs) hit for eventhandler: %s\n", exec_job->timeout, exec_job->command_line);
+    }
+    return;
+}
+
+
 /* execute this command with given timeout */
 int execute_safe_command(gm_job_t * exec_job, int fork_exec, char * identifier) {
-    int pipe_stdout[2] , pipe_stderr[2];
+    int pipe_stdout[2] , pipe_stderr[2], pipe_rusage[2] = { -1, -1 };
     int return_code;
     int pclose_result;
-    int x;
+    int x, read_rc;
+    int timed_out = FALSE;
     char *plugin_output, *plugin_error, *bufdup;
-    char source[GM_BUFFERSIZE];
-    struct timeval start_time,end_time;
+    struct timeval start_time, parent_deadline;
     pid_t pid    = 0;
-    source[0]    = '\x0';
 
-    gm_log( GM_LOG_TRACE, "execute_safe_command(%d, %s)\n", exec_job->timeout, exec_job->command_line );
+    gm_log( GM_LOG_TRACE, "execute_safe_command(%g, %s)\n", exec_job->timeout, exec_job->command_line );
+
+    /* reap plugins of previous checks which got killed in the background */
+    reap_timed_out_checks(FALSE);
+    exec_job->early_timeout = 0;
 
     /* mark all filehandles to close on exec */
     for(x = 0; x<=64; x++)
@@ -269,12 +561,53 @@ int execute_safe_command(gm_job_t * exec_job, int fork_exec, char * identifier)
         exec_job->start_time = start_time;
     }
 
+    /* built-in checks run inside this process, no fork required */
+    if(is_native_check(exec_job->command_line)) {
+        if(exec_job->output != NULL)
+            free(exec_job->output);
+        exec_job->output = NULL;
+        /* they never start with a path, so restrict_path refuses them as well */
+        if(mod_gm_opt->builtin_checks != GM_ENABLED) {
+            gm_asprintf(&exec_job->output, "ERROR: built-in checks are disabled on this worker: %.*s...\n", 8, exec_job->command_line);
+            exec_job->return_code = STATE_UNKNOWN;
+        }
+        else if(check_restricted_command(exec_job->command_line, &exec_job->output) != GM_OK)
+            exec_job->return_code = STATE_UNKNOWN;
+        else
+            exec_job->return_code = run_native_check(exec_job->command_line, exec_job->timeout, &exec_job->output);
+        free(exec_job->error);
+        exec_job->error       = gm_strdup("");
+        finish_check_result(exec_job, identifier);
+        return(GM_OK);
+    }
+
+    /* plugin module checks are called directly or by the isolation helper */
+    if(is_plugin_module_check(exec_job->command_line)) {
+        run_plugin_module_check(exec_job, identifier);
+        free(exec_job->error);
+        exec_job->error = gm_strdup("");
+        finish_check_result(exec_job, identifier);
+        return(GM_OK);
+    }
+
+    /* plugins run into their timeout at this deadline, the worker is not interrupted */
+    set_deadline(&check_deadline, exec_job->timeout);
+    plugin_own_group = fork_exec == GM_DISABLED ? TRUE : FALSE;
+
     /* fork a child process */
     if(fork_exec == GM_ENABLED) {
         if(pipe(pipe_stdout) != 0)
             perror("pipe stdout");
         if(pipe(pipe_stderr) != 0)
             perror("pipe stderr");
+        if(mod_gm_opt->plugin_rusage == GM_ENABLED && pipe(pipe_rusage) != 0)
+            perror("pipe rusage");
+
+        /* plugins must not keep the result pipes open after a timeout */
+        fcntl(pipe_stdout[1], F_SETFD, FD_CLOEXEC);
+        fcntl(pipe_stderr[1], F_SETFD, FD_CLOEXEC);
+        if(pipe_rusage[1] != -1)
+            fcntl(pipe_rusage[1], F_SETFD, FD_CLOEXEC);
 
         pid=fork();
 
@@ -298,9 +631,12 @@ int execute_safe_command(gm_job_t * exec_job, int fork_exec, char * identifier)
         if( fork_exec == GM_ENABLED ) {
             close(pipe_stdout[0]);
             close(pipe_stderr[0]);
+            if(pipe_rusage[0] != -1)
+                close(pipe_rusage[0]);
         }
+        /* last resort only, run_check() stops waiting for the plugin at the deadline */
         signal(SIGALRM, check_alarm_handler);
-        alarm(exec_job->timeout);
+        alarm((unsigned int)exec_job->timeout + 1 + GM_TIMEOUT_KILL_GRACE/1000);
 
         /* run the plugin check command */
         pclose_result = run_check(exec_job->command_line, &plugin_output, &plugin_error);
@@ -319,10 +655,32 @@ int execute_safe_command(gm_job_t * exec_job, int fork_exec, char * identifier)
                     perror("write");
             }
 
+            /* the parent only sees the rusage of this process */
+            if(pipe_rusage[1] != -1 && run_check_has_rusage == TRUE) {
+                if(write(pipe_rusage[1], &run_check_rusage, sizeof(run_check_rusage)) <= 0)
+                    perror("write rusage");
+            }
+
             return_code = real_exit_code(pclose_result);
             free(plugin_output);
             free(plugin_error);
-            _exit(return_code);
+
+            /* hand out the result before killing the timed out plugin */
+            if(run_check_timed_out == TRUE) {
+                close(pipe_stdout[1]);
+                close(pipe_stderr[1]);
+                if(pipe_rusage[1] != -1)
+                    close(pipe_rusage[1]);
+                alarm(0);
+                reap_timed_out_checks(TRUE);
+            }
+            flush_and_exit(return_code);
+        }
+        timed_out = run_check_timed_out;
+
+        if(mod_gm_opt->plugin_rusage == GM_ENABLED && run_check_has_rusage == TRUE) {
+            exec_job->rusage     = run_check_rusage;
+            exec_job->has_rusage = TRUE;
         }
     }
 
@@ -332,18 +690,33 @@ int execute_safe_command(gm_job_t * exec_job, int fork_exec, char * identifier)
         if( fork_exec == GM_ENABLED) {
             gm_log( GM_LOG_TRACE, "started check with pid: %d\n", pid);
 
+            current_child_pid = pid;
             close(pipe_stdout[1]);
             close(pipe_stderr[1]);
-
-            waitpid(pid, &return_code, 0);
-            gm_log( GM_LOG_TRACE, "finished check from pid: %d with status: %d\n", pid, return_code);
-            /* get all lines of plugin output */
-            plugin_output = gm_malloc(GM_BUFFERSIZE);
-            plugin_output[0]='\x0';
-            plugin_error  = gm_malloc(GM_BUFFERSIZE);
-            plugin_error[0]='\x0';
-            read_pipe(&plugin_output, pipe_stdout[0]);
-            read_pipe(&plugin_error, pipe_stderr[0]);
+            if(pipe_rusage[1] != -1)
+                close(pipe_rusage[1]);
+
+            /* the child sends its result right after the timeout, give it some grace time before giving up */
+            double2timeval(timeval2double(&check_deadline) + GM_TIMEOUT_KILL_GRACE / 1000.0, &parent_deadline);
+            read_rc = read_check_pipes(pipe_stdout[0], &plugin_output, pipe_stderr[0], &plugin_error, &parent_deadline);
+            timed_out = read_rc != GM_OK || deadline_ms(&check_deadline) == 0;
+
+            /* a timed out child still reaps its plugin, it is not waited for */
+            return_code = GM_EXIT_UNKNOWN;
+            if(timed_out == TRUE)
+                x = waitpid(pid, &return_code, WNOHANG);
+            else
+                x = wait_for_process(pid, &return_code, NULL, &parent_deadline);
+            if(x == pid) {
+                gm_log( GM_LOG_TRACE, "finished check from pid: %d with status: %d\n", pid, return_code);
+                if(pipe_rusage[0] != -1 && read(pipe_rusage[0], &exec_job->rusage, sizeof(exec_job->rusage)) == sizeof(exec_job->rusage))
+                    exec_job->has_rusage = TRUE;
+            }
+            else {
+                add_timed_out_check(pid, read_rc != GM_OK || timed_out == FALSE ? TRUE : FALSE);
+            }
+            if(pipe_rusage[0] != -1)
+                close(pipe_rusage[0]);
         }
         return_code = real_exit_code(return_code);
 
@@ -391,30 +764,18 @@ int execute_safe_command(gm_job_t * exec_job, int fork_exec, char * identifier)
         }
     }
     alarm(0);
-    current_child_pid = 0;
-    pid               = 0;
-
-    /* record check result info */
-    gettimeofday(&end_time, NULL);
-    exec_job->finish_time = end_time;
+    current_child_pid        = 0;
+    pid                      = 0;
+    check_deadline.tv_sec    = 0;
+    check_deadline.tv_usec   = 0;
 
-    /* did we have a timeout? */
-    if(exec_job->timeout < ((int)end_time.tv_sec - (int)exec_job->start_time.tv_sec)) {
-        exec_job->return_code   = mod_gm_opt->timeout_return;
+    if(timed_out == TRUE) {
+        log_check_timeout(exec_job);
         exec_job->early_timeout = 1;
-        free(exec_job->output);
-        if ( !strcmp( exec_job->type, "service" ) ) {
-            gm_asprintf(&exec_job->output, "(Service Check Timed Out On Worker: %s)", identifier);
-        }
-        else {
-            gm_asprintf(&exec_job->output, "(Host Check Timed Out On Worker: %s)", identifier);
-        }
     }
 
-    snprintf( source, sizeof( source )-1, "Mod-Gearman Worker @ %s", identifier);
-    if(exec_job->source != NULL)
-        free(exec_job->source);
-    exec_job->source = gm_strdup(source);
+    finish_check_result(exec_job, identifier);
+    rusage_stats_store(exec_job);
 
     return(GM_OK);
 }
@@ -427,33 +788,24 @@ void check_alarm_handler(int sig) {
     gm_log( GM_LOG_TRACE, "check_alarm_handler(%i)\n", sig );
     pid = getpid();
     if(current_job != NULL && mod_gm_opt->fork_on_exec == GM_DISABLED) {
-        /* create a useful log message*/
-        if ( !strcmp( current_job->type, "service" ) ) {
-            gm_log( GM_LOG_INFO, "timeout (%is) hit for servicecheck: %s - %s\n", current_job->timeout, current_job->host_name, current_job->service_description);
-        }
-        else if ( !strcmp( current_job->type, "host" ) ) {
-            gm_log( GM_LOG_INFO, "timeout (%is) hit for hostcheck: %s\n", current_job->timeout, current_job->host_name);
-        }
-        else if ( !strcmp( current_job->type, "eventhandler" ) ) {
-            gm_log( GM_LOG_INFO, "timeout (%is) hit for eventhandler: %s\n", current_job->timeout, current_job->command_line);
-        }
+        log_check_timeout(current_job);
         send_timeout_result(current_job);
-        gearman_job_send_complete(current_gearman_job, NULL, 0);
+        if(current_gearman_job != NULL)
+            gearman_job_send_complete(current_gearman_job, NULL, 0);
     }
 
-    signal(SIGTERM, SIG_IGN);
-    gm_log( GM_LOG_TRACE, "send SIGTERM to %d\n", pid);
-    kill(-pid, SIGTERM);
-    kill(pid, SIGTERM);
-    signal(SIGTERM, SIG_DFL);
-    sleep(1);
-
-    signal(SIGINT, SIG_IGN);
-    gm_log( GM_LOG_TRACE, "send SIGINT to %d\n", pid);
-    kill(-pid, SIGINT);
-    kill(pid, SIGINT);
-    signal(SIGINT, SIG_DFL);
-    sleep(1);
+    /* the cgroup contains the whole process tree of the plugin, even
+     * processes which left its process group */
+    if(plugin_cgroup_kill() == GM_OK) {
+        gm_log( GM_LOG_TRACE, "killed plugin cgroup of %d\n", pid);
+    }
+    else {
+        signal(SIGTERM, SIG_IGN);
+        gm_log( GM_LOG_TRACE, "send SIGTERM to %d\n", pid);
+        kill(-pid, SIGTERM);
+        kill(pid, SIGTERM);
+        signal(SIGTERM, SIG_DFL);
+    }
 
     /* skip sigkill in test mode */
     if(getenv("MODGEARMANTEST") == NULL) {
@@ -469,20 +821,33 @@ void check_alarm_handler(int sig) {
 void kill_child_checks(void) {
     int retval;
     pid_t pid;
+    struct timeval deadline;
 
     signal(SIGINT, SIG_IGN);
     pid = getpid();
+
+    /* processes which left the process group are only found by their cgroup */
+    plugin_cgroup_kill();
+
+    /* plugins which are already in their grace time get killed right away */
+    while(timed_out_checks_num > 0) {
+        timed_out_checks_num--;
+        kill(-timed_out_checks[timed_out_checks_num].pid, SIGKILL);
+        kill(timed_out_checks[timed_out_checks_num].pid, SIGKILL);
+    }
+
     if(current_child_pid > 0 && current_child_pid != pid) {
         gm_log( GM_LOG_TRACE, "kill_child_checks(): send SIGINT to %d\n", current_child_pid);
         kill(-current_child_pid, SIGINT);
         kill(current_child_pid, SIGINT);
-        sleep(1);
-        if(waitpid(current_child_pid,&retval,WNOHANG)!=0) {
+        set_deadline(&deadline, GM_TIMEOUT_KILL_GRACE / 1000.0);
+        if(wait_for_process(current_child_pid, &retval, NULL, &deadline) != 0) {
             signal(SIGINT, SIG_DFL);
             return;
         }
         if(pid_alive(current_child_pid)) {
             gm_log( GM_LOG_TRACE, "kill_child_checks(): send SIGKILL to %d\n", current_child_pid);
+            kill(-current_child_pid, SIGKILL);
             kill(current_child_pid, SIGKILL);
         }
     }
@@ -557,12 +922,14 @@ int parse_command_line(char *cmd, char *argv[MAX_CMD_ARGS]) {
         argv[argc++]=parsed_cmd;
         switch(*cmd){
         case '\'':
+            ++cmd;
             while((*cmd)&&(*cmd!='\''))
                 *(parsed_cmd++)=*(cmd++);
             if(*cmd)
                 ++cmd;
             break;
         case '"':
+            ++cmd;
             while((*cmd)&&(*cmd!='"')){
                 if((*cmd=='\\')&&cmd[1]&&strchr("\"\\\n",cmd[1]))
                     ++cmd;
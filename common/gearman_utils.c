@@ -29,7 +29,7 @@ int mod_gm_con_errors = 0;
 struct timeval mod_gm_error_time;
 
 /* create the gearman worker */
-int create_worker( gm_server_t * server_list[GM_LISTSIZE], gearman_worker_st *worker ) {
+int create_worker( gm_server_t ** server_list, gearman_worker_st *worker ) {
     int x = 0;
 
     gearman_return_t ret;
@@ -69,7 +69,7 @@ int worker_add_function( gearman_worker_st * worker, char * queue, gearman_worke
 
 
 /* create the gearman duplicate client */
-int create_client_dup( gm_server_t * server_list[GM_LISTSIZE], gearman_client_st *client ) {
+int create_client_dup( gm_server_t ** server_list, gearman_client_st *client ) {
     gearman_return_t ret;
     int x = 0;
 
@@ -98,7 +98,7 @@ int create_client_dup( gm_server_t * server_list[GM_LISTSIZE], gearman_client_st
 }
 
 /* create the gearman client */
-int create_client( gm_server_t * server_list[GM_LISTSIZE], gearman_client_st *client ) {
+int create_client( gm_server_t ** server_list, gearman_client_st *client ) {
     gearman_return_t ret;
     int x = 0;
 
@@ -130,12 +130,29 @@ int create_client( gm_server_t * server_list[GM_LISTSIZE], gearman_client_st *cl
 
 
 /* create a task and send it */
-int add_job_to_queue( gearman_client_st *client, gm_server_t * server_list[GM_LISTSIZE], char * queue, char * uniq, char * data, int priority, int retries, int transport_mode, int send_now ) {
+int add_job_to_queue( gearman_client_st *client, gm_server_t ** server_list, char * queue, char * uniq, char * data, int priority, int retries, int transport_mode, int send_now ) {
+    char * crypted_data;
+    int size, rc;
+
+    gm_log( GM_LOG_TRACE, "add_job_to_queue(%s, %s, %d, %d, %d, %d)\n", queue, uniq, priority, retries, transport_mode, send_now );
+    gm_log( GM_LOG_TRACE, "%d --->%s<---\n", strlen(data), data );
+
+    size = mod_gm_encrypt(&crypted_data, data, transport_mode);
+    gm_log( GM_LOG_TRACE, "%d +++>\n%s\n<+++\n", size, crypted_data );
+
+    rc = add_encoded_job_to_queue( client, server_list, queue, uniq, crypted_data, size, priority, retries, send_now );
+    free(crypted_data);
+    return rc;
+}
+
+
+/* create a task from already encoded data and send it */
+int add_encoded_job_to_queue( gearman_client_st *client, gm_server_t ** server_list, char * queue, char * uniq, char * encoded, int size, int priority, int retries, int send_now ) {
     gearman_task_st *task = NULL;
     gearman_return_t ret1 = GEARMAN_SUCCESS;
     gearman_return_t ret2 = GEARMAN_SUCCESS;
-    char * crypted_data;
-    int size, free_uniq;
+    char * workload;
+    int free_uniq;
     struct timeval now;
 
     /* check too long queue names */
@@ -153,26 +170,27 @@ int add_job_to_queue( gearman_client_st *client, gm_server_t * server_list[GM_LI
 
     signal(SIGPIPE, SIG_IGN);
 
-    gm_log( GM_LOG_TRACE, "add_job_to_queue(%s, %s, %d, %d, %d, %d)\n", queue, uniq, priority, retries, transport_mode, send_now );
-    gm_log( GM_LOG_TRACE, "%d --->%s<---\n", strlen(data), data );
-
-    size = mod_gm_encrypt(&crypted_data, data, transport_mode);
-    gm_log( GM_LOG_TRACE, "%d +++>\n%s\n<+++\n", size, crypted_data );
+    /* the task takes ownership of the workload, so the caller can reuse
+     * the encoded data for retries and duplicate servers */
+    workload = gm_malloc(size+1);
+    memcpy(workload, encoded, size);
+    workload[size] = '\x0';
 
     if( priority == GM_JOB_PRIO_LOW ) {
-        task = gearman_client_add_task_low_background( client, NULL, NULL, queue, uniq, ( void * )crypted_data, ( size_t )size, &ret1 );
-        gearman_task_give_workload(task,crypted_data,size);
+        task = gearman_client_add_task_low_background( client, NULL, NULL, queue, uniq, ( void * )workload, ( size_t )size, &ret1 );
+        gearman_task_give_workload(task,workload,size);
     }
     else if( priority == GM_JOB_PRIO_NORMAL ) {
-        task = gearman_client_add_task_background( client, NULL, NULL, queue, uniq, ( void * )crypted_data, ( size_t )size, &ret1 );
-        gearman_task_give_workload(task,crypted_data,size);
+        task = gearman_client_add_task_background( client, NULL, NULL, queue, uniq, ( void * )workload, ( size_t )size, &ret1 );
+        gearman_task_give_workload(task,workload,size);
     }
     else if( priority == GM_JOB_PRIO_HIGH ) {
-        task = gearman_client_add_task_high_background( client, NULL, NULL, queue, uniq, ( void * )crypted_data, ( size_t )size, &ret1 );
-        gearman_task_give_workload(task,crypted_data,size);
+        task = gearman_client_add_task_high_background( client, NULL, NULL, queue, uniq, ( void * )workload, ( size_t )size, &ret1 );
+        gearman_task_give_workload(task,workload,size);
     }
     else {
         gm_log( GM_LOG_ERROR, "add_job_to_queue() wrong priority: %d\n", priority );
+        free(workload);
     }
 
     if(send_now != TRUE)
@@ -210,7 +228,7 @@ int add_job_to_queue( gearman_client_st *client, gm_server_t * server_list[GM_LI
         if(retries > 0) {
             retries--;
             gm_log( GM_LOG_TRACE, "add_job_to_queue() retrying... %d\n", retries );
-            ret2 = add_job_to_queue( client, server_list, queue, uniq, data, priority, retries, transport_mode, send_now );
+            ret2 = add_encoded_job_to_queue( client, server_list, queue, uniq, encoded, size, priority, retries, send_now );
             if(free_uniq)
                 free(uniq);
             return(ret2);
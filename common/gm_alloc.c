@@ -13,12 +13,15 @@
 #define log_vasprintf_error() gm_log( GM_LOG_ERROR, "Error: Failed to vasprintf in %s", __func__)
 
 #define CHECK_AND_RETURN(_ptr)  \
+    gm_alloc_count++;           \
     if (_ptr == NULL) {         \
         log_mem_error();        \
         exit(2);                \
     }                           \
     return _ptr;
 
+unsigned long gm_alloc_count = 0;
+
 void *gm_malloc(size_t size) {
     void *ptr = malloc(size);
     CHECK_AND_RETURN(ptr);
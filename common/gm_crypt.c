@@ -28,9 +28,28 @@
 #include <gm_crypt.h>
 #include "common.h"
 
+#ifdef GM_AESNI
+#include <cpuid.h>
+#include <wmmintrin.h>
+#endif
+
 int encryption_initialized = 0;
 unsigned char key[KEYLENGTH(KEYBITS)];
 
+/* key schedules are expanded once in mod_gm_aes_init() */
+static unsigned long rk_enc[RKLENGTH(KEYBITS)];
+static unsigned long rk_dec[RKLENGTH(KEYBITS)];
+static int nrounds = 0;
+static int use_aesni = 0;
+
+#ifdef GM_AESNI
+static unsigned char aesni_enc[(NROUNDS(KEYBITS)+1)*BLOCKSIZE] __attribute__((aligned(16)));
+static unsigned char aesni_dec[(NROUNDS(KEYBITS)+1)*BLOCKSIZE] __attribute__((aligned(16)));
+static void aesni_setup(void);
+static void aesni_encrypt_blocks(unsigned char * data, int blocks);
+static void aesni_decrypt_blocks(unsigned char * data, int blocks);
+#endif
+
 
 /* initialize encryption */
 void mod_gm_aes_init(char * password) {
@@ -40,49 +59,81 @@ void mod_gm_aes_init(char * password) {
     for (i = 0; i < 32; i++)
         key[i] = *password != 0 ? *password++ : 0;
 
+    nrounds = rijndaelSetupEncrypt(rk_enc, key, KEYBITS);
+    rijndaelSetupDecrypt(rk_dec, key, KEYBITS);
+
+#ifdef GM_AESNI
+    aesni_setup();
+#endif
+    use_aesni = mod_gm_aes_hw_available();
+
     encryption_initialized = 1;
     return;
 }
 
 
+/* returns true if the cpu supports aes instructions */
+int mod_gm_aes_hw_available(void) {
+#ifdef GM_AESNI
+    unsigned int eax, ebx, ecx, edx;
+    if(__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES))
+        return 1;
+#endif
+    return 0;
+}
+
+
+/* switch between aes instructions and the lookup tables */
+int mod_gm_aes_use_hw(int enable) {
+    use_aesni = enable && mod_gm_aes_hw_available();
+    return use_aesni;
+}
+
+
+/* encrypt a number of blocks in place */
+void mod_gm_aes_encrypt_blocks(unsigned char * data, int blocks) {
+    assert(encryption_initialized == 1);
+#ifdef GM_AESNI
+    if(use_aesni) {
+        aesni_encrypt_blocks(data, blocks);
+        return;
+    }
+#endif
+    for(; blocks > 0; blocks--, data += BLOCKSIZE)
+        rijndaelEncrypt(rk_enc, nrounds, data, data);
+    return;
+}
+
+
+/* decrypt a number of blocks in place */
+void mod_gm_aes_decrypt_blocks(unsigned char * data, int blocks) {
+    assert(encryption_initialized == 1);
+#ifdef GM_AESNI
+    if(use_aesni) {
+        aesni_decrypt_blocks(data, blocks);
+        return;
+    }
+#endif
+    for(; blocks > 0; blocks--, data += BLOCKSIZE)
+        rijndaelDecrypt(rk_dec, nrounds, data, data);
+    return;
+}
+
+
 /* encrypt text with given key */
 int mod_gm_aes_encrypt(unsigned char ** encrypted, char * text) {
-    unsigned long rk[RKLENGTH(KEYBITS)];
-    int nrounds;
-    int i = 0;
-    int k = 0;
     unsigned char *enc;
     int size;
     int totalsize;
 
-    assert(encryption_initialized == 1);
-
-    nrounds   = rijndaelSetupEncrypt(rk, key, KEYBITS);
+    /* zero padded, there is always at least one trailing zero byte */
     size      = strlen(text);
     totalsize = size + BLOCKSIZE-size%BLOCKSIZE;
-    if(size%BLOCKSIZE == 0) {
-        size += BLOCKSIZE;
-    }
     enc       = (unsigned char *) gm_malloc(sizeof(unsigned char)*totalsize);
-    while(size > 0) {
-        unsigned char plaintext[BLOCKSIZE];
-        unsigned char ciphertext[BLOCKSIZE];
-        int j;
-        for (j = 0; j < BLOCKSIZE; j++) {
-            int c = text[i];
-            if(c == 0)
-                break;
-            plaintext[j] = c;
-            i++;
-        }
+    memcpy(enc, text, size);
+    memset(enc+size, 0, totalsize-size);
 
-        for (; j < BLOCKSIZE; j++)
-            plaintext[j] = '\x0';
-        rijndaelEncrypt(rk, nrounds, plaintext, ciphertext);
-        for (j = 0; j < BLOCKSIZE; j++)
-            enc[k++] = ciphertext[j];
-        size -=BLOCKSIZE;
-    }
+    mod_gm_aes_encrypt_blocks(enc, totalsize/BLOCKSIZE);
 
     *encrypted = enc;
     return totalsize;
@@ -91,34 +142,149 @@ int mod_gm_aes_encrypt(unsigned char ** encrypted, char * text) {
 
 /* decrypt text with given key */
 void mod_gm_aes_decrypt(char ** text, unsigned char * encrypted, int size) {
-    char *decr;
-    unsigned long rk[RKLENGTH(KEYBITS)];
-    int nrounds;
-    int i = 0;
+    unsigned char *decr = (unsigned char *) *text;
+    int blocks = size / BLOCKSIZE;
 
-    decr = gm_malloc(sizeof(char*)*size+GM_BUFFERSIZE);
+    memmove(decr, encrypted, blocks*BLOCKSIZE);
+    mod_gm_aes_decrypt_blocks(decr, blocks);
+    decr[blocks*BLOCKSIZE] = '\0';
+    return;
+}
 
-    assert(encryption_initialized == 1);
-    nrounds = rijndaelSetupDecrypt(rk, key, KEYBITS);
-    decr[0] = '\0';
-
-    while(1) {
-        unsigned char plaintext[BLOCKSIZE];
-        unsigned char ciphertext[BLOCKSIZE];
-        int j;
-        for (j = 0; j < BLOCKSIZE; j++) {
-            int c = encrypted[i];
-            ciphertext[j] = c;
-            i++;
+
+#ifdef GM_AESNI
+#define GM_AESNI_TARGET __attribute__((target("aes,sse2")))
+
+/* expand the next two round keys of the aes-256 key schedule */
+#define AESNI_EXPAND(ks, i, rcon) \
+    t2 = _mm_aeskeygenassist_si128(t3, rcon); \
+    t1 = aesni_assist1(t1, t2); \
+    _mm_store_si128((__m128i*)(ks + (i)*BLOCKSIZE), t1); \
+    if((i) < NROUNDS(KEYBITS)) { \
+        t3 = aesni_assist2(t1, t3); \
+        _mm_store_si128((__m128i*)(ks + ((i)+1)*BLOCKSIZE), t3); \
+    }
+
+static inline GM_AESNI_TARGET __m128i aesni_assist1(__m128i t1, __m128i t2) {
+    __m128i t4;
+    t2 = _mm_shuffle_epi32(t2, 0xff);
+    t4 = _mm_slli_si128(t1, 4);
+    t1 = _mm_xor_si128(t1, t4);
+    t4 = _mm_slli_si128(t4, 4);
+    t1 = _mm_xor_si128(t1, t4);
+    t4 = _mm_slli_si128(t4, 4);
+    t1 = _mm_xor_si128(t1, t4);
+    return _mm_xor_si128(t1, t2);
+}
+
+static inline GM_AESNI_TARGET __m128i aesni_assist2(__m128i t1, __m128i t3) {
+    __m128i t2, t4;
+    t4 = _mm_aeskeygenassist_si128(t1, 0x00);
+    t2 = _mm_shuffle_epi32(t4, 0xaa);
+    t4 = _mm_slli_si128(t3, 4);
+    t3 = _mm_xor_si128(t3, t4);
+    t4 = _mm_slli_si128(t4, 4);
+    t3 = _mm_xor_si128(t3, t4);
+    t4 = _mm_slli_si128(t4, 4);
+    t3 = _mm_xor_si128(t3, t4);
+    return _mm_xor_si128(t3, t2);
+}
+
+/* expand encryption and decryption key schedule */
+static GM_AESNI_TARGET void aesni_setup(void) {
+    __m128i t1, t2, t3;
+    int i;
+
+    if(!mod_gm_aes_hw_available())
+        return;
+
+    t1 = _mm_loadu_si128((const __m128i*)key);
+    t3 = _mm_loadu_si128((const __m128i*)(key+BLOCKSIZE));
+    _mm_store_si128((__m128i*)aesni_enc, t1);
+    _mm_store_si128((__m128i*)(aesni_enc+BLOCKSIZE), t3);
+    AESNI_EXPAND(aesni_enc,  2, 0x01);
+    AESNI_EXPAND(aesni_enc,  4, 0x02);
+    AESNI_EXPAND(aesni_enc,  6, 0x04);
+    AESNI_EXPAND(aesni_enc,  8, 0x08);
+    AESNI_EXPAND(aesni_enc, 10, 0x10);
+    AESNI_EXPAND(aesni_enc, 12, 0x20);
+    AESNI_EXPAND(aesni_enc, 14, 0x40);
+
+    /* equivalent inverse cipher uses the reversed and mixed round keys */
+    memcpy(aesni_dec, aesni_enc + NROUNDS(KEYBITS)*BLOCKSIZE, BLOCKSIZE);
+    for(i = 1; i < NROUNDS(KEYBITS); i++) {
+        t1 = _mm_load_si128((const __m128i*)(aesni_enc + (NROUNDS(KEYBITS)-i)*BLOCKSIZE));
+        _mm_store_si128((__m128i*)(aesni_dec + i*BLOCKSIZE), _mm_aesimc_si128(t1));
+    }
+    memcpy(aesni_dec + NROUNDS(KEYBITS)*BLOCKSIZE, aesni_enc, BLOCKSIZE);
+    return;
+}
+
+/* encrypt blocks in place, four blocks are interleaved to fill the pipeline */
+static GM_AESNI_TARGET void aesni_encrypt_blocks(unsigned char * data, int blocks) {
+    __m128i ks[NROUNDS(KEYBITS)+1];
+    __m128i b0, b1, b2, b3;
+    int r;
+
+    for(r = 0; r <= NROUNDS(KEYBITS); r++)
+        ks[r] = _mm_load_si128((const __m128i*)(aesni_enc + r*BLOCKSIZE));
+
+    for(; blocks >= 4; blocks -= 4, data += 4*BLOCKSIZE) {
+        b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data)), ks[0]);
+        b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data+BLOCKSIZE)), ks[0]);
+        b2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data+2*BLOCKSIZE)), ks[0]);
+        b3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data+3*BLOCKSIZE)), ks[0]);
+        for(r = 1; r < NROUNDS(KEYBITS); r++) {
+            b0 = _mm_aesenc_si128(b0, ks[r]);
+            b1 = _mm_aesenc_si128(b1, ks[r]);
+            b2 = _mm_aesenc_si128(b2, ks[r]);
+            b3 = _mm_aesenc_si128(b3, ks[r]);
         }
-        rijndaelDecrypt(rk, nrounds, ciphertext, plaintext);
-        strncat(decr, (char*)plaintext, BLOCKSIZE);
-        size -= BLOCKSIZE;
-        if(size < BLOCKSIZE)
-            break;
+        _mm_storeu_si128((__m128i*)(data),             _mm_aesenclast_si128(b0, ks[r]));
+        _mm_storeu_si128((__m128i*)(data+BLOCKSIZE),   _mm_aesenclast_si128(b1, ks[r]));
+        _mm_storeu_si128((__m128i*)(data+2*BLOCKSIZE), _mm_aesenclast_si128(b2, ks[r]));
+        _mm_storeu_si128((__m128i*)(data+3*BLOCKSIZE), _mm_aesenclast_si128(b3, ks[r]));
+    }
+    for(; blocks > 0; blocks--, data += BLOCKSIZE) {
+        b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)data), ks[0]);
+        for(r = 1; r < NROUNDS(KEYBITS); r++)
+            b0 = _mm_aesenc_si128(b0, ks[r]);
+        _mm_storeu_si128((__m128i*)data, _mm_aesenclast_si128(b0, ks[r]));
     }
+    return;
+}
+
+/* decrypt blocks in place, four blocks are interleaved to fill the pipeline */
+static GM_AESNI_TARGET void aesni_decrypt_blocks(unsigned char * data, int blocks) {
+    __m128i ks[NROUNDS(KEYBITS)+1];
+    __m128i b0, b1, b2, b3;
+    int r;
+
+    for(r = 0; r <= NROUNDS(KEYBITS); r++)
+        ks[r] = _mm_load_si128((const __m128i*)(aesni_dec + r*BLOCKSIZE));
 
-    strcpy(*text, decr);
-    free(decr);
+    for(; blocks >= 4; blocks -= 4, data += 4*BLOCKSIZE) {
+        b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data)), ks[0]);
+        b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data+BLOCKSIZE)), ks[0]);
+        b2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data+2*BLOCKSIZE)), ks[0]);
+        b3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data+3*BLOCKSIZE)), ks[0]);
+        for(r = 1; r < NROUNDS(KEYBITS); r++) {
+            b0 = _mm_aesdec_si128(b0, ks[r]);
+            b1 = _mm_aesdec_si128(b1, ks[r]);
+            b2 = _mm_aesdec_si128(b2, ks[r]);
+            b3 = _mm_aesdec_si128(b3, ks[r]);
+        }
+        _mm_storeu_si128((__m128i*)(data),             _mm_aesdeclast_si128(b0, ks[r]));
+        _mm_storeu_si128((__m128i*)(data+BLOCKSIZE),   _mm_aesdeclast_si128(b1, ks[r]));
+        _mm_storeu_si128((__m128i*)(data+2*BLOCKSIZE), _mm_aesdeclast_si128(b2, ks[r]));
+        _mm_storeu_si128((__m128i*)(data+3*BLOCKSIZE), _mm_aesdeclast_si128(b3, ks[r]));
+    }
+    for(; blocks > 0; blocks--, data += BLOCKSIZE) {
+        b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)data), ks[0]);
+        for(r = 1; r < NROUNDS(KEYBITS); r++)
+            b0 = _mm_aesdec_si128(b0, ks[r]);
+        _mm_storeu_si128((__m128i*)data, _mm_aesdeclast_si128(b0, ks[r]));
+    }
     return;
 }
+#endif
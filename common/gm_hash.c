@@ -0,0 +1,183 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/* include header */
+#include "common.h"
+#include "gm_hash.h"
+#include "gm_alloc.h"
+
+#define GM_HASH_INITIAL_SIZE 16
+
+/* fnv-1a hash of a string */
+static size_t hash_key(const char * key) {
+    size_t h = 2166136261u;
+    const unsigned char * c;
+    for(c = (const unsigned char *)key; *c != '\x0'; c++) {
+        h ^= *c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+
+/* get the entry for a key, either the used one or the free one to use */
+static gm_hash_entry_t * find_entry(gm_hash_entry_t * entries, size_t size, const char * key) {
+    size_t indx = hash_key(key) & (size - 1);
+    while(entries[indx].key != NULL && strcmp(entries[indx].key, key))
+        indx = (indx + 1) & (size - 1);
+    return &entries[indx];
+}
+
+
+/* create an empty hash table */
+gm_hash_t * gm_hash_new() {
+    gm_hash_t * hash = gm_malloc(sizeof(gm_hash_t));
+    hash->size    = GM_HASH_INITIAL_SIZE;
+    hash->num     = 0;
+    hash->entries = gm_calloc(hash->size, sizeof(gm_hash_entry_t));
+    return hash;
+}
+
+
+/* add key unless it exists, grows the table when it gets 3/4 full */
+int gm_hash_add(gm_hash_t * hash, const char * key, int value) {
+    gm_hash_entry_t * entry;
+    size_t x;
+
+    if((hash->num + 1) * 4 > hash->size * 3) {
+        size_t size = hash->size * 2;
+        gm_hash_entry_t * entries = gm_calloc(size, sizeof(gm_hash_entry_t));
+        for(x = 0; x < hash->size; x++) {
+            if(hash->entries[x].key != NULL)
+                *find_entry(entries, size, hash->entries[x].key) = hash->entries[x];
+        }
+        free(hash->entries);
+        hash->entries = entries;
+        hash->size    = size;
+    }
+
+    entry = find_entry(hash->entries, hash->size, key);
+    if(entry->key != NULL)
+        return GM_ERROR;
+
+    entry->key   = gm_strdup(key);
+    entry->value = value;
+    hash->num++;
+
+    return GM_OK;
+}
+
+
+/* look up a key */
+int gm_hash_get(gm_hash_t * hash, const char * key, int dfl) {
+    gm_hash_entry_t * entry;
+
+    if(hash == NULL || key == NULL || hash->num == 0)
+        return dfl;
+
+    entry = find_entry(hash->entries, hash->size, key);
+    if(entry->key == NULL)
+        return dfl;
+
+    return entry->value;
+}
+
+
+/* free hash table */
+void gm_hash_free(gm_hash_t * hash) {
+    size_t x;
+
+    if(hash == NULL)
+        return;
+
+    for(x = 0; x < hash->size; x++)
+        free(hash->entries[x].key);
+    free(hash->entries);
+    free(hash);
+
+    return;
+}
+
+
+/* add a prefix to the trie */
+void gm_trie_add(gm_trie_t ** trie, const char * prefix) {
+    gm_trie_t ** level = trie;
+    gm_trie_t * node   = NULL;
+    const unsigned char * c;
+
+    if(prefix == NULL || *prefix == '\x0')
+        return;
+
+    for(c = (const unsigned char *)prefix; *c != '\x0'; c++) {
+        for(node = *level; node != NULL && node->chr != *c; node = node->next)
+            ;
+        if(node == NULL) {
+            node        = gm_calloc(1, sizeof(gm_trie_t));
+            node->chr   = *c;
+            node->next  = *level;
+            *level      = node;
+        }
+        level = &node->child;
+    }
+    node->terminal = TRUE;
+
+    return;
+}
+
+
+/* check if the string starts with any prefix of the trie */
+int gm_trie_match(gm_trie_t * trie, const char * str) {
+    gm_trie_t * node;
+    const unsigned char * c;
+
+    if(str == NULL)
+        return FALSE;
+
+    for(c = (const unsigned char *)str; *c != '\x0'; c++) {
+        for(node = trie; node != NULL && node->chr != *c; node = node->next)
+            ;
+        if(node == NULL)
+            return FALSE;
+        if(node->terminal)
+            return TRUE;
+        trie = node->child;
+    }
+
+    return FALSE;
+}
+
+
+/* free the trie */
+void gm_trie_free(gm_trie_t * trie) {
+    gm_trie_t * next;
+
+    while(trie != NULL) {
+        next = trie->next;
+        gm_trie_free(trie->child);
+        free(trie);
+        trie = next;
+    }
+
+    return;
+}
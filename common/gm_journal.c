@@ -0,0 +1,422 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/* include header */
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "utils.h"
+#include "gm_journal.h"
+#include "gm_alloc.h"
+
+#define GM_JOURNAL_BUCKETS      4096
+
+/* record states in the file */
+#define GM_JOURNAL_IN_FLIGHT    1
+#define GM_JOURNAL_DONE         2
+
+typedef struct gm_journal_header_struct {
+    char              magic[8];
+    volatile uint64_t used;
+} gm_journal_header_t;
+
+typedef struct gm_journal_record_struct {
+    uint32_t          size;
+    volatile uint32_t state;
+    int64_t           next_check;
+    int64_t           core_time_sec;
+    int64_t           core_time_usec;
+    char              names[];
+} gm_journal_record_t;
+
+/* in memory index of all records in flight */
+typedef struct gm_journal_entry_struct {
+    uint64_t                         offset;
+    uint32_t                         hash;
+    int                              type;
+    struct gm_journal_entry_struct * next;
+} gm_journal_entry_t;
+
+static pthread_mutex_t       journal_mutex   = PTHREAD_MUTEX_INITIALIZER;
+static gm_journal_header_t * journal         = NULL;
+static char                * records         = NULL;
+static gm_journal_entry_t ** buckets         = NULL;
+static size_t                buckets_size    = 0;
+static size_t                entries_num     = 0;
+static int                   journal_max_age = 0;
+static int                   journal_full    = FALSE;
+
+static unsigned long long adopted_checks     = 0;
+static unsigned long long expired_checks     = 0;
+static unsigned long long adopted_results    = 0;
+static unsigned long long expired_results    = 0;
+static unsigned long long suppressed_checks  = 0;
+
+/* fnv-1a hash of host name and service description */
+static uint32_t hash_names(const char * host_name, const char * service_description) {
+    uint32_t h = 2166136261u;
+    const unsigned char * c;
+    for(c = (const unsigned char *)host_name; *c != '\x0'; c++) {
+        h ^= *c;
+        h *= 16777619u;
+    }
+    h *= 16777619u;
+    for(c = (const unsigned char *)service_description; *c != '\x0'; c++) {
+        h ^= *c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+
+/* returns true if the record belongs to this host or service */
+static int record_matches(gm_journal_record_t * rec, const char * host_name, const char * service_description) {
+    if(strcmp(rec->names, host_name))
+        return FALSE;
+    return !strcmp(rec->names + strlen(rec->names) + 1, service_description);
+}
+
+
+/* add entry to the index, doubles the buckets when there are more entries than buckets */
+static void insert_entry(gm_journal_entry_t * entry) {
+    gm_journal_entry_t ** grown;
+    gm_journal_entry_t * moved;
+    size_t x, size;
+
+    if(entries_num >= buckets_size) {
+        size  = buckets_size * 2;
+        grown = gm_calloc(size, sizeof(gm_journal_entry_t *));
+        for(x = 0; x < buckets_size; x++) {
+            while((moved = buckets[x]) != NULL) {
+                buckets[x]  = moved->next;
+                moved->next = grown[moved->hash & (size - 1)];
+                grown[moved->hash & (size - 1)] = moved;
+            }
+        }
+        free(buckets);
+        buckets      = grown;
+        buckets_size = size;
+    }
+
+    entry->next = buckets[entry->hash & (buckets_size - 1)];
+    buckets[entry->hash & (buckets_size - 1)] = entry;
+    entries_num++;
+}
+
+
+/* move all records still in flight to the start of the journal, too old ones are dropped */
+static void compact_journal(void) {
+    gm_journal_entry_t ** link;
+    gm_journal_entry_t * entry;
+    gm_journal_record_t * rec;
+    char * kept;
+    uint64_t used = 0;
+    time_t now = time(NULL);
+    size_t x;
+
+    kept = gm_malloc(journal->used + 1);
+    for(x = 0; x < buckets_size; x++) {
+        link = &buckets[x];
+        while((entry = *link) != NULL) {
+            rec = (gm_journal_record_t *)(records + entry->offset);
+            if(entry->type == GM_JOURNAL_EXPIRED || rec->core_time_sec < now - journal_max_age) {
+                *link = entry->next;
+                free(entry);
+                entries_num--;
+                continue;
+            }
+            memcpy(kept + used, rec, rec->size);
+            entry->offset = used;
+            used         += rec->size;
+            link          = &entry->next;
+        }
+    }
+
+    /* a crash while copying loses the kept records but never adopts garbage */
+    journal->used = 0;
+    memcpy(records, kept, used);
+    journal->used = used;
+    free(kept);
+
+    gm_log( GM_LOG_DEBUG, "compacted journal, %d checks in flight\n", (int)entries_num);
+}
+
+
+/* append a record and add it to the index */
+static int append_record(const char * host_name, const char * service_description, int64_t next_check, int64_t core_time_sec, int64_t core_time_usec, int type) {
+    gm_journal_record_t * rec;
+    gm_journal_entry_t * entry;
+    size_t host_len    = strlen(host_name);
+    size_t service_len = strlen(service_description);
+    uint32_t size      = (sizeof(gm_journal_record_t) + host_len + service_len + 2 + 7) & ~7;
+
+    if(journal->used + size > GM_JOURNAL_SIZE - sizeof(gm_journal_header_t)) {
+        compact_journal();
+        if(journal->used + size > GM_JOURNAL_SIZE - sizeof(gm_journal_header_t)) {
+            if(journal_full == FALSE)
+                gm_log( GM_LOG_ERROR, "journal is full, %d checks in flight\n", (int)entries_num);
+            journal_full = TRUE;
+            return GM_ERROR;
+        }
+    }
+    journal_full = FALSE;
+
+    rec = (gm_journal_record_t *)(records + journal->used);
+    memset(rec, 0, size);
+    rec->size           = size;
+    rec->state          = GM_JOURNAL_IN_FLIGHT;
+    rec->next_check     = next_check;
+    rec->core_time_sec  = core_time_sec;
+    rec->core_time_usec = core_time_usec;
+    memcpy(rec->names, host_name, host_len);
+    memcpy(rec->names + host_len + 1, service_description, service_len);
+
+    entry         = gm_malloc(sizeof(gm_journal_entry_t));
+    entry->offset = journal->used;
+    entry->hash   = hash_names(host_name, service_description);
+    entry->type   = type;
+    insert_entry(entry);
+
+    /* the record counts only after it has been written completely */
+    journal->used += size;
+
+    return GM_OK;
+}
+
+
+/* map journal and read back checks of the previous core */
+int gm_journal_open(const char * path, int max_age) {
+    gm_journal_record_t * rec;
+    struct stat st;
+    void * map;
+    char * old = NULL;
+    char * service_description;
+    uint64_t old_used = 0;
+    uint64_t offset;
+    size_t names_len;
+    time_t now = time(NULL);
+    int fd, type;
+
+    if(journal != NULL)
+        return GM_OK;
+
+    if((fd = open(path, O_RDWR | O_CREAT, 0600)) < 0) {
+        gm_log( GM_LOG_ERROR, "failed to open journal %s: %s\n", path, strerror(errno));
+        return GM_ERROR;
+    }
+    if(fstat(fd, &st) != 0 || (st.st_size != GM_JOURNAL_SIZE && ftruncate(fd, GM_JOURNAL_SIZE) != 0)) {
+        gm_log( GM_LOG_ERROR, "failed to resize journal %s: %s\n", path, strerror(errno));
+        close(fd);
+        return GM_ERROR;
+    }
+    map = mmap(NULL, GM_JOURNAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        gm_log( GM_LOG_ERROR, "failed to map journal %s: %s\n", path, strerror(errno));
+        return GM_ERROR;
+    }
+
+    pthread_mutex_lock(&journal_mutex);
+    journal         = map;
+    records         = (char *)map + sizeof(gm_journal_header_t);
+    journal_max_age = max_age;
+    buckets_size    = GM_JOURNAL_BUCKETS;
+    buckets         = gm_calloc(buckets_size, sizeof(gm_journal_entry_t *));
+    entries_num     = 0;
+
+    if(!memcmp(journal->magic, GM_JOURNAL_MAGIC, sizeof(journal->magic)) && journal->used <= GM_JOURNAL_SIZE - sizeof(gm_journal_header_t)) {
+        old_used = journal->used;
+        old      = gm_malloc(old_used + 1);
+        memcpy(old, records, old_used);
+    }
+    memcpy(journal->magic, GM_JOURNAL_MAGIC, sizeof(journal->magic));
+    journal->used = 0;
+
+    /* append all records still in flight again, so they survive the next restart too */
+    for(offset = 0; offset + sizeof(gm_journal_record_t) <= old_used; offset += rec->size) {
+        rec = (gm_journal_record_t *)(old + offset);
+        if(rec->size < sizeof(gm_journal_record_t) || rec->size % 8 != 0 || offset + rec->size > old_used)
+            break;
+        if(rec->state != GM_JOURNAL_IN_FLIGHT)
+            continue;
+        names_len = rec->size - sizeof(gm_journal_record_t);
+        if(memchr(rec->names, '\x0', names_len) == NULL || strlen(rec->names) + 1 >= names_len)
+            continue;
+        service_description = rec->names + strlen(rec->names) + 1;
+        if(memchr(service_description, '\x0', names_len - strlen(rec->names) - 1) == NULL)
+            continue;
+
+        type = rec->core_time_sec < now - max_age ? GM_JOURNAL_EXPIRED : GM_JOURNAL_ADOPTED;
+        if(append_record(rec->names, service_description, rec->next_check, rec->core_time_sec, rec->core_time_usec, type) != GM_OK)
+            break;
+        if(type == GM_JOURNAL_ADOPTED)
+            adopted_checks++;
+        else
+            expired_checks++;
+    }
+    free(old);
+    pthread_mutex_unlock(&journal_mutex);
+
+    if(adopted_checks + expired_checks > 0)
+        gm_log( GM_LOG_INFO, "journal %s: %llu checks of the previous core are still in flight, %llu are too old\n", path, adopted_checks, expired_checks);
+    else
+        gm_log( GM_LOG_DEBUG, "opened journal %s\n", path);
+
+    return GM_OK;
+}
+
+
+/* journal a submitted check */
+int gm_journal_add(const char * host_name, const char * service_description, time_t next_check, struct timeval * core_time) {
+    int rc = GM_ERROR;
+
+    pthread_mutex_lock(&journal_mutex);
+    if(journal != NULL)
+        rc = append_record(host_name, service_description != NULL ? service_description : "", next_check, core_time->tv_sec, core_time->tv_usec, GM_JOURNAL_CURRENT);
+    pthread_mutex_unlock(&journal_mutex);
+
+    return rc;
+}
+
+
+/* mark the check of a result as done and return its type */
+int gm_journal_done(const char * host_name, const char * service_description, time_t next_check) {
+    gm_journal_entry_t ** link;
+    gm_journal_entry_t * entry;
+    gm_journal_record_t * rec;
+    uint32_t hash;
+    int type = GM_JOURNAL_NONE;
+
+    if(service_description == NULL)
+        service_description = "";
+
+    pthread_mutex_lock(&journal_mutex);
+    if(journal == NULL) {
+        pthread_mutex_unlock(&journal_mutex);
+        return GM_JOURNAL_NONE;
+    }
+
+    hash = hash_names(host_name, service_description);
+    for(link = &buckets[hash & (buckets_size - 1)]; (entry = *link) != NULL; link = &entry->next) {
+        rec = (gm_journal_record_t *)(records + entry->offset);
+        if(entry->hash != hash || rec->next_check != next_check || !record_matches(rec, host_name, service_description))
+            continue;
+
+        type = entry->type;
+        if(type == GM_JOURNAL_ADOPTED && rec->core_time_sec < time(NULL) - journal_max_age)
+            type = GM_JOURNAL_EXPIRED;
+        if(type == GM_JOURNAL_ADOPTED)
+            adopted_results++;
+        else if(type == GM_JOURNAL_EXPIRED)
+            expired_results++;
+
+        rec->state = GM_JOURNAL_DONE;
+        *link      = entry->next;
+        free(entry);
+        entries_num--;
+        break;
+    }
+    pthread_mutex_unlock(&journal_mutex);
+
+    return type;
+}
+
+
+/* returns true if an adopted check is still in flight */
+int gm_journal_in_flight(const char * host_name, const char * service_description) {
+    gm_journal_entry_t * entry;
+    gm_journal_record_t * rec;
+    uint32_t hash;
+    int in_flight = FALSE;
+
+    if(adopted_checks == 0)
+        return FALSE;
+
+    if(service_description == NULL)
+        service_description = "";
+
+    pthread_mutex_lock(&journal_mutex);
+    if(journal == NULL) {
+        pthread_mutex_unlock(&journal_mutex);
+        return FALSE;
+    }
+
+    hash = hash_names(host_name, service_description);
+    for(entry = buckets[hash & (buckets_size - 1)]; entry != NULL; entry = entry->next) {
+        rec = (gm_journal_record_t *)(records + entry->offset);
+        if(entry->hash != hash || entry->type != GM_JOURNAL_ADOPTED || !record_matches(rec, host_name, service_description))
+            continue;
+
+        /* lost on the way, let the core run it again */
+        if(rec->core_time_sec < time(NULL) - journal_max_age) {
+            entry->type = GM_JOURNAL_EXPIRED;
+            continue;
+        }
+        in_flight = TRUE;
+        suppressed_checks++;
+        break;
+    }
+    pthread_mutex_unlock(&journal_mutex);
+
+    return in_flight;
+}
+
+
+/* log statistics and unmap journal */
+void gm_journal_close() {
+    gm_journal_entry_t * entry;
+    size_t x;
+
+    pthread_mutex_lock(&journal_mutex);
+    if(journal == NULL) {
+        pthread_mutex_unlock(&journal_mutex);
+        return;
+    }
+
+    msync(journal, GM_JOURNAL_SIZE, MS_ASYNC);
+    munmap(journal, GM_JOURNAL_SIZE);
+    journal = NULL;
+    records = NULL;
+
+    for(x = 0; x < buckets_size; x++) {
+        while((entry = buckets[x]) != NULL) {
+            buckets[x] = entry->next;
+            free(entry);
+        }
+    }
+    free(buckets);
+    buckets      = NULL;
+    buckets_size = 0;
+    entries_num  = 0;
+    pthread_mutex_unlock(&journal_mutex);
+
+    if(adopted_checks + expired_checks > 0)
+        gm_log( GM_LOG_INFO, "journal: adopted %llu results of the previous core, %llu checks were not run again, %llu too old results discarded\n", adopted_results, suppressed_checks, expired_results);
+
+    return;
+}
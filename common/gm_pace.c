@@ -0,0 +1,215 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/* include header */
+#include "common.h"
+#include "utils.h"
+#include "gm_pace.h"
+#include "gm_alloc.h"
+#include "gm_hash.h"
+
+/* checks held back by the token bucket of their queue */
+typedef struct gm_paced_check_struct {
+    char                         * uniq;
+    char                         * data;
+    int                            prio;
+    struct timeval                 deferred;
+    struct gm_paced_check_struct * next;
+} gm_paced_check_t;
+
+/* token bucket and deferred checks of a queue */
+typedef struct gm_pace_queue_struct {
+    char             * queue;
+    int                rate;
+    int                burst;
+    double             tokens;
+    struct timeval     refill;
+    gm_paced_check_t * first;
+    gm_paced_check_t * last;
+    int                num;
+    int                backlog_checks;
+    struct timeval     backlog_start;
+} gm_pace_queue_t;
+
+static gm_pace_queue_t * pace_queues         = NULL;
+static int               pace_queues_num     = 0;
+static int               paced_num           = 0;
+static gm_hash_t       * pace_queues_index   = NULL;
+static unsigned long long paced_checks       = 0;
+static unsigned long long paced_checks_lost  = 0;
+static double            paced_delay_sum     = 0;
+static double            paced_delay_max     = 0;
+static int               paced_backlog_max   = 0;
+
+
+/* send a check unless its queue exceeds the submit rate, then defer it */
+int gm_pace_check(char * queue, int rate, int burst, char * uniq, char * data, int prio, gm_pace_submit_t submit) {
+    gm_pace_queue_t * pace;
+    gm_paced_check_t * check;
+    int indx;
+
+    if(rate <= 0)
+        return submit( queue, uniq, data, prio );
+
+    if(pace_queues_index == NULL)
+        pace_queues_index = gm_hash_new();
+    indx = gm_hash_get(pace_queues_index, queue, -1);
+    if(indx == -1) {
+        indx        = pace_queues_num++;
+        pace_queues = gm_realloc(pace_queues, pace_queues_num * sizeof(gm_pace_queue_t));
+        pace        = &pace_queues[indx];
+        memset(pace, 0, sizeof(gm_pace_queue_t));
+        pace->queue  = gm_strdup(queue);
+        pace->rate   = rate;
+        pace->burst  = burst > 0 ? burst : rate;
+        pace->tokens = pace->burst;
+        gettimeofday(&pace->refill, NULL);
+        gm_hash_add(pace_queues_index, queue, indx);
+    }
+
+    gm_pace_release(FALSE, submit);
+    pace = &pace_queues[indx];
+
+    /* keep the order, new checks only pass if nothing is waiting */
+    if(pace->num == 0 && pace->tokens >= 1) {
+        pace->tokens--;
+        return submit( queue, uniq, data, prio );
+    }
+
+    check       = gm_malloc(sizeof(gm_paced_check_t));
+    check->uniq = uniq != NULL ? gm_strdup(uniq) : NULL;
+    check->data = gm_strdup(data);
+    check->prio = prio;
+    check->next = NULL;
+    gettimeofday(&check->deferred, NULL);
+    if(pace->last != NULL)
+        pace->last->next = check;
+    else
+        pace->first = check;
+    pace->last = check;
+
+    if(pace->num == 0) {
+        gm_log( GM_LOG_DEBUG, "queue %s exceeds its submit rate of %d/s, deferring checks\n", queue, pace->rate );
+        pace->backlog_checks = 0;
+        pace->backlog_start  = check->deferred;
+    }
+    pace->num++;
+    pace->backlog_checks++;
+    paced_num++;
+    paced_checks++;
+    if(pace->num > paced_backlog_max)
+        paced_backlog_max = pace->num;
+
+    return GM_OK;
+}
+
+
+/* refill the token buckets and send deferred checks, or all of them */
+int gm_pace_release(int all, gm_pace_submit_t submit) {
+    gm_pace_queue_t * pace;
+    gm_paced_check_t * check;
+    struct timeval now;
+    double elapsed, delay;
+    char * data;
+    size_t len;
+    int x;
+
+    if(pace_queues_num == 0)
+        return 0;
+
+    gettimeofday(&now, NULL);
+    for(x = 0; x < pace_queues_num; x++) {
+        pace = &pace_queues[x];
+
+        elapsed = (double)(now.tv_sec - pace->refill.tv_sec) + (double)(now.tv_usec - pace->refill.tv_usec) / 1000000;
+        if(elapsed > 0) {
+            pace->tokens += elapsed * pace->rate;
+            if(pace->tokens > pace->burst)
+                pace->tokens = pace->burst;
+        }
+        pace->refill = now;
+
+        while(pace->first != NULL && (all || pace->tokens >= 1)) {
+            check       = pace->first;
+            pace->first = check->next;
+            if(pace->first == NULL)
+                pace->last = NULL;
+            pace->num--;
+            paced_num--;
+            if(pace->tokens >= 1)
+                pace->tokens--;
+
+            delay = (double)(now.tv_sec - check->deferred.tv_sec) + (double)(now.tv_usec - check->deferred.tv_usec) / 1000000;
+            paced_delay_sum += delay;
+            if(delay > paced_delay_max)
+                paced_delay_max = delay;
+
+            /* the delay is intended, so it must not count against max_age on the worker */
+            len = strlen(check->data);
+            while(len > 0 && check->data[len-1] == '\n')
+                len--;
+            gm_asprintf(&data, "%.*s\ncore_time=%i.%i\n\n\n", (int)len, check->data, (int)now.tv_sec, (int)now.tv_usec);
+
+            if(submit( pace->queue, check->uniq, data, check->prio ) != GM_OK) {
+                /* the core treats this check as orphaned later */
+                gm_log( GM_LOG_ERROR, "sending deferred check to queue %s failed\n", pace->queue );
+                paced_checks_lost++;
+            }
+            free(data);
+            free(check->uniq);
+            free(check->data);
+            free(check);
+
+            if(pace->num == 0)
+                gm_log( GM_LOG_INFO, "submit rate of queue %s deferred %d checks for %.1fs\n",
+                        pace->queue, pace->backlog_checks,
+                        (double)(now.tv_sec - pace->backlog_start.tv_sec) + (double)(now.tv_usec - pace->backlog_start.tv_usec) / 1000000 );
+        }
+    }
+
+    return paced_num;
+}
+
+
+/* log statistics and free all queues */
+void gm_pace_free() {
+    int x;
+
+    if(paced_checks > 0)
+        gm_log( GM_LOG_INFO, "deferred %llu checks to keep the submit rate, delay avg %.2fs, max %.2fs, max backlog %d checks, lost %llu checks\n",
+                paced_checks, paced_delay_sum / paced_checks, paced_delay_max, paced_backlog_max, paced_checks_lost );
+    for(x = 0; x < pace_queues_num; x++)
+        free(pace_queues[x].queue);
+    free(pace_queues);
+    gm_hash_free(pace_queues_index);
+    pace_queues       = NULL;
+    pace_queues_num   = 0;
+    pace_queues_index = NULL;
+    paced_checks      = 0;
+    paced_checks_lost = 0;
+    paced_delay_sum   = 0;
+    paced_delay_max   = 0;
+    paced_backlog_max = 0;
+    return;
+}
@@ -0,0 +1,302 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/* include header */
+#include "common.h"
+#include "utils.h"
+#include "gm_wire.h"
+#include "gm_crypt.h"
+#include "gm_alloc.h"
+#include <sys/time.h>
+#include <zlib.h>
+
+static char empty_key[] = "";
+
+gm_wire_stats_t gm_wire_stats;
+
+/* write a 32 bit big endian number */
+static void put_uint32(unsigned char * p, unsigned int v) {
+    p[0] = (v >> 24) & 0xff;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8)  & 0xff;
+    p[3] =  v        & 0xff;
+}
+
+/* read a 32 bit big endian number */
+static unsigned int get_uint32(const unsigned char * p) {
+    return (unsigned int)p[0] << 24 | (unsigned int)p[1] << 16 | (unsigned int)p[2] << 8 | (unsigned int)p[3];
+}
+
+/* add the time since start to the statistics */
+static void count_usec(struct timeval * start) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    __sync_fetch_and_add(&gm_wire_stats.usec, (unsigned long long)((now.tv_sec - start->tv_sec) * 1000000 + now.tv_usec - start->tv_usec));
+}
+
+/* compress the records of a frame, returns a new frame or NULL if that does not save anything */
+static unsigned char * compress_body(unsigned char * frame, size_t body_len, size_t * compressed_len) {
+    struct timeval start;
+    uLongf zlen = compressBound(body_len);
+    unsigned char * compressed = gm_malloc(GM_WIRE_HEADER_SIZE + 4 + zlen + BLOCKSIZE);
+
+    gettimeofday(&start, NULL);
+    if(compress2(compressed + GM_WIRE_HEADER_SIZE + 4, &zlen, frame + GM_WIRE_HEADER_SIZE, body_len, Z_BEST_SPEED) != Z_OK || 4 + zlen >= body_len) {
+        free(compressed);
+        count_usec(&start);
+        return NULL;
+    }
+    put_uint32(compressed + GM_WIRE_HEADER_SIZE, body_len);
+    *compressed_len = 4 + zlen;
+
+    __sync_fetch_and_add(&gm_wire_stats.compressed, 1);
+    __sync_fetch_and_add(&gm_wire_stats.raw_bytes, body_len);
+    __sync_fetch_and_add(&gm_wire_stats.compressed_bytes, *compressed_len);
+    count_usec(&start);
+    return compressed;
+}
+
+/* decompress the records of a frame, returns a new buffer or NULL for invalid data */
+static unsigned char * decompress_body(unsigned char * body, size_t * body_len) {
+    struct timeval start;
+    unsigned char * records;
+    uLongf raw_len;
+
+    if(*body_len < 4)
+        return NULL;
+    raw_len = get_uint32(body);
+    if(raw_len == 0 || raw_len > GM_WIRE_MAX_RECORDS)
+        return NULL;
+
+    gettimeofday(&start, NULL);
+    records = gm_malloc(raw_len + 1);
+    if(uncompress(records, &raw_len, body + 4, *body_len - 4) != Z_OK || raw_len != get_uint32(body)) {
+        free(records);
+        count_usec(&start);
+        return NULL;
+    }
+    *body_len = raw_len;
+    count_usec(&start);
+    return records;
+}
+
+
+/* convert key=value lines into a binary frame */
+int gm_wire_encode(char ** encoded, char * text, int encrypt, int compress) {
+    size_t text_len = strlen(text);
+    unsigned char * frame;
+    unsigned char * p;
+    char * line;
+    char * end = text + text_len;
+    size_t body_len, total, lines = 1;
+    int records = 0, ended = FALSE;
+    int flags = encrypt ? GM_WIRE_ENCRYPTED : 0;
+
+    /* every line grows by at most its record overhead */
+    for(line = text; (line = memchr(line, '\n', end - line)) != NULL; line++)
+        lines++;
+    frame = gm_malloc(GM_WIRE_HEADER_SIZE + text_len + lines * 8 + BLOCKSIZE);
+    p     = frame + GM_WIRE_HEADER_SIZE;
+    line  = text;
+
+    while(line < end) {
+        char * eol = memchr(line, '\n', end - line);
+        char * eq;
+        size_t klen;
+        if(eol == NULL)
+            eol = end;
+
+        /* an empty line ends the result */
+        if(eol == line) {
+            if(records > 0 && !ended)
+                *p++ = GM_WIRE_END;
+            ended = TRUE;
+            line = eol + 1;
+            continue;
+        }
+
+        /* key lengths are a single byte */
+        eq   = memchr(line, '=', eol - line);
+        klen = (eq != NULL ? eq : eol) - line;
+        if(klen > 255) {
+            gm_log( GM_LOG_ERROR, "key of %d bytes is too long for the binary format\n", (int)klen );
+            free(frame);
+            *encoded = NULL;
+            return -1;
+        }
+        *p++ = GM_WIRE_FIELD;
+        *p++ = klen;
+        memcpy(p, line, klen);
+        p += klen;
+        *p++ = '\x0';
+        if(eq == NULL) {
+            put_uint32(p, GM_WIRE_NULL);
+            p += 4;
+        } else {
+            size_t vlen = eol - eq - 1;
+            put_uint32(p, vlen);
+            p += 4;
+            memcpy(p, eq + 1, vlen);
+            p += vlen;
+            *p++ = '\x0';
+        }
+        records++;
+        ended = FALSE;
+        line = eol + 1;
+    }
+
+    body_len = p - (frame + GM_WIRE_HEADER_SIZE);
+
+    /* compression is done before encryption, encrypted data does not compress */
+    if(compress) {
+        unsigned char * compressed = compress_body(frame, body_len, &body_len);
+        if(compressed != NULL) {
+            free(frame);
+            frame  = compressed;
+            p      = frame + GM_WIRE_HEADER_SIZE + body_len;
+            flags |= GM_WIRE_COMPRESSED;
+        }
+    }
+
+    total = body_len;
+    if(encrypt) {
+        total = (body_len + BLOCKSIZE - 1) / BLOCKSIZE * BLOCKSIZE;
+        memset(p, 0, total - body_len);
+        mod_gm_aes_encrypt_blocks(frame + GM_WIRE_HEADER_SIZE, total / BLOCKSIZE);
+    }
+
+    frame[0] = GM_WIRE_VERSION;
+    frame[1] = flags;
+    put_uint32(frame + 2, body_len);
+
+    *encoded = (char *)frame;
+    return GM_WIRE_HEADER_SIZE + total;
+}
+
+
+/* check, decrypt and decompress a binary frame */
+int gm_wire_decode(char ** decoded, char * data, int size, int mode) {
+    const unsigned char * frame = (const unsigned char *)data;
+    unsigned char * body = (unsigned char *)*decoded;
+    unsigned char * p;
+    unsigned char * end;
+    size_t body_len, payload;
+    int encrypted;
+
+    body[0] = '\x0';
+    if(size < GM_WIRE_HEADER_SIZE || frame[0] != GM_WIRE_VERSION || frame[1] & ~(GM_WIRE_ENCRYPTED|GM_WIRE_COMPRESSED))
+        return GM_ERROR;
+
+    encrypted = frame[1] & GM_WIRE_ENCRYPTED;
+    body_len  = get_uint32(frame + 2);
+    payload   = size - GM_WIRE_HEADER_SIZE;
+    if(body_len > payload)
+        return GM_ERROR;
+
+    if(encrypted) {
+        if(mode == GM_ENCODE_ONLY || payload % BLOCKSIZE != 0)
+            return GM_ERROR;
+        memcpy(body, frame + GM_WIRE_HEADER_SIZE, payload);
+        mod_gm_aes_decrypt_blocks(body, payload / BLOCKSIZE);
+    } else {
+        if(mode == GM_ENCODE_AND_ENCRYPT)
+            return GM_ERROR;
+        memcpy(body, frame + GM_WIRE_HEADER_SIZE, body_len);
+    }
+
+    if(frame[1] & GM_WIRE_COMPRESSED) {
+        unsigned char * records = decompress_body(body, &body_len);
+        if(records == NULL) {
+            body[0] = '\x0';
+            return GM_ERROR;
+        }
+        free(*decoded);
+        *decoded = (char *)records;
+        body     = records;
+    }
+
+    /* verify all records once, so gm_wire_next() can trust them */
+    p   = body;
+    end = body + body_len;
+    while(p < end) {
+        if(*p == GM_WIRE_END) {
+            p++;
+            continue;
+        }
+        if(*p != GM_WIRE_FIELD || end - p < 7 || (size_t)(end - p) < 2 + (size_t)p[1] + 5 || p[2 + p[1]] != '\x0')
+            break;
+        p += 2 + p[1] + 1;
+        if(get_uint32(p) == GM_WIRE_NULL) {
+            p += 4;
+            continue;
+        }
+        if((size_t)(end - p) < 4 + (size_t)get_uint32(p) + 1 || p[4 + get_uint32(p)] != '\x0')
+            break;
+        p += 4 + get_uint32(p) + 1;
+    }
+    if(p != end || body_len == 0) {
+        body[0] = '\x0';
+        return GM_ERROR;
+    }
+
+    body[body_len] = '\x0';
+    return GM_OK;
+}
+
+
+/* get the next key/value pair of a text or binary payload */
+int gm_wire_next(char ** data, char ** key, char ** value) {
+    unsigned char * p = (unsigned char *)*data;
+    unsigned int vlen;
+
+    if(p == NULL)
+        return FALSE;
+
+    /* text: key=value lines */
+    if(*p != GM_WIRE_FIELD && *p != GM_WIRE_END) {
+        char * line = strsep(data, "\n");
+        *key   = strsep(&line, "=");
+        *value = strsep(&line, "\x0");
+        return TRUE;
+    }
+
+    if(*p == GM_WIRE_END) {
+        *key   = empty_key;
+        *value = NULL;
+        p++;
+    } else {
+        *key = (char *)p + 2;
+        p   += 2 + p[1] + 1;
+        vlen = get_uint32(p);
+        p   += 4;
+        if(vlen == GM_WIRE_NULL) {
+            *value = NULL;
+        } else {
+            *value = (char *)p;
+            p     += vlen + 1;
+        }
+    }
+    *data = *p == '\x0' ? NULL : (char *)p;
+    return TRUE;
+}
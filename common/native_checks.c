@@ -0,0 +1,796 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "config.h"
+#include "common.h"
+#include "check_utils.h"
+#include "native_checks.h"
+#include "gm_alloc.h"
+#include "utils.h"
+
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define NATIVE_TCP      1
+#define NATIVE_HTTP     2
+#define NATIVE_DNS      3
+
+/* parsed arguments of a built-in check */
+typedef struct native_opts {
+    int type;
+    char * host;
+    char * address;
+    int port;
+    double warning;
+    double critical;
+    int has_warning;
+    int has_critical;
+    char * string;
+    char * expect;
+    char * uri;
+    char * expected_address;
+    int ssl;
+    int mismatch;
+    struct timeval start;
+    double timeout;
+} native_opts_t;
+
+/* long options of the monitoring plugins */
+static const struct {
+    const char * name;
+    char flag;
+} native_long_opts[] = {
+    { "hostname",           'H' },
+    { "IP-address",         'I' },
+    { "port",               'p' },
+    { "warning",            'w' },
+    { "critical",           'c' },
+    { "timeout",            't' },
+    { "send",               's' },
+    { "string",             's' },
+    { "server",             's' },
+    { "expect",             'e' },
+    { "url",                'u' },
+    { "expected-address",   'a' },
+    { "ssl",                'S' },
+    { "mismatch",           'M' },
+    { NULL,                 0   }
+};
+
+static const char * native_state_text[] = { "OK", "WARNING", "CRITICAL", "UNKNOWN" };
+
+/* return type of a built-in check command line */
+static int native_check_type(const char * command_line) {
+    const char * name;
+    size_t len;
+    if(command_line == NULL)
+        return 0;
+    while(isspace(*command_line))
+        command_line++;
+    if(*command_line != NATIVE_CHECK_PREFIX)
+        return 0;
+    name = command_line + 1;
+    len  = strcspn(name, " \t\n");
+    if(len == 3 && !strncmp(name, "tcp", 3))
+        return NATIVE_TCP;
+    if(len == 4 && !strncmp(name, "http", 4))
+        return NATIVE_HTTP;
+    if(len == 3 && !strncmp(name, "dns", 3))
+        return NATIVE_DNS;
+    return 0;
+}
+
+/* check whether a command line is run by the built-in check engine */
+int is_native_check(const char * command_line) {
+    return(native_check_type(command_line) != 0 ? TRUE : FALSE);
+}
+
+/* seconds since the check started */
+static double native_elapsed(native_opts_t * opts) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return((double)(now.tv_sec - opts->start.tv_sec) + (double)(now.tv_usec - opts->start.tv_usec) / 1000000);
+}
+
+/* wait until the socket is ready, returns GM_ERROR on timeout */
+static int wait_socket(native_opts_t * opts, int fd, short events) {
+    struct pollfd pfd;
+    int remaining, rc;
+    while(1) {
+        remaining = (int)((opts->timeout - native_elapsed(opts)) * 1000);
+        if(remaining <= 0) {
+            errno = ETIMEDOUT;
+            return(GM_ERROR);
+        }
+        pfd.fd      = fd;
+        pfd.events  = events;
+        pfd.revents = 0;
+        rc = poll(&pfd, 1, remaining);
+        if(rc > 0)
+            return(GM_OK);
+        if(rc < 0 && errno != EINTR)
+            return(GM_ERROR);
+    }
+}
+
+/* resolve address and port, name lookups give up at the check timeout */
+static int native_resolve(native_opts_t * opts, const char * address, const char * port, int socktype, struct addrinfo ** res) {
+    struct addrinfo hints;
+    int rc;
+#ifdef HAVE_GETADDRINFO_A
+    struct lookup {
+        struct gaicb cb;
+        struct addrinfo hints;
+    } * lookup;
+    struct gaicb * list[1];
+    struct timespec wait;
+    double remaining;
+#endif
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+
+    /* addresses do not need a lookup */
+    hints.ai_flags = AI_NUMERICHOST;
+    if(getaddrinfo(address, port, &hints, res) == 0)
+        return(GM_OK);
+    hints.ai_flags = 0;
+
+#ifdef HAVE_GETADDRINFO_A
+    lookup = gm_malloc(sizeof(struct lookup));
+    memset(lookup, 0, sizeof(struct lookup));
+    lookup->hints         = hints;
+    lookup->cb.ar_name    = address;
+    lookup->cb.ar_service = port;
+    lookup->cb.ar_request = &lookup->hints;
+    list[0] = &lookup->cb;
+    if(getaddrinfo_a(GAI_NOWAIT, list, 1, NULL) != 0) {
+        free(lookup);
+        return(GM_ERROR);
+    }
+    while((rc = gai_error(&lookup->cb)) == EAI_INPROGRESS) {
+        remaining = opts->timeout - native_elapsed(opts);
+        if(remaining <= 0) {
+            /* a running lookup cannot be canceled and still belongs to the resolver thread */
+            if(gai_cancel(&lookup->cb) == EAI_CANCELED)
+                free(lookup);
+            errno = ETIMEDOUT;
+            return(GM_ERROR);
+        }
+        wait.tv_sec  = (time_t)remaining;
+        wait.tv_nsec = (long)((remaining - (double)wait.tv_sec) * 1000000000);
+        gai_suspend((const struct gaicb * const *)list, 1, &wait);
+    }
+    *res = lookup->cb.ar_result;
+    free(lookup);
+#else
+    /* without getaddrinfo_a the name lookup is not covered by the timeout */
+    opts = opts;
+    rc = getaddrinfo(address, port, &hints, res);
+#endif
+    if(rc != 0) {
+        errno = 0;
+        return(GM_ERROR);
+    }
+    return(GM_OK);
+}
+
+/* returns the state for a response time */
+static int check_time_thresholds(native_opts_t * opts, double elapsed) {
+    if(opts->has_critical && elapsed > opts->critical)
+        return(STATE_CRITICAL);
+    if(opts->has_warning && elapsed > opts->warning)
+        return(STATE_WARNING);
+    return(STATE_OK);
+}
+
+/* format a threshold for performance data */
+static void format_threshold(char * buf, size_t size, int has_value, double value) {
+    buf[0] = '\x0';
+    if(has_value)
+        snprintf(buf, size, "%f", value);
+}
+
+/* set output of a failed socket operation */
+static int socket_error(native_opts_t * opts, char ** output) {
+    if(errno == ETIMEDOUT) {
+        gm_asprintf(output, "CRITICAL - Socket timeout after %g seconds", opts->timeout);
+        return(STATE_CRITICAL);
+    }
+    gm_asprintf(output, "connect to address %s and port %d: %s", opts->address, opts->port, strerror(errno));
+    return(STATE_CRITICAL);
+}
+
+/* parse the arguments of a built-in check */
+static int parse_native_args(native_opts_t * opts, char ** argv, char ** output) {
+    int i, x;
+    char flag;
+    char * arg;
+    char * value;
+    char * eq;
+    char * end;
+    double timeout;
+
+    for(i = 1; argv[i] != NULL; i++) {
+        arg   = argv[i];
+        value = NULL;
+        flag  = 0;
+        if(arg[0] != '-' || arg[1] == '\x0') {
+            gm_asprintf(output, "UNKNOWN - invalid argument: %s", arg);
+            return(GM_ERROR);
+        }
+        if(arg[1] == '-') {
+            eq = strchr(arg, '=');
+            for(x = 0; native_long_opts[x].name != NULL; x++) {
+                size_t len = eq != NULL ? (size_t)(eq - arg - 2) : strlen(arg + 2);
+                if(strlen(native_long_opts[x].name) == len && !strncmp(arg + 2, native_long_opts[x].name, len)) {
+                    flag = native_long_opts[x].flag;
+                    break;
+                }
+            }
+            if(eq != NULL)
+                value = eq + 1;
+        } else {
+            flag = arg[1];
+            if(arg[2] != '\x0')
+                value = arg + 2;
+        }
+        if(flag == 'S') {
+            opts->ssl = TRUE;
+            continue;
+        }
+        if(value == NULL)
+            value = argv[++i];
+        if(value == NULL) {
+            gm_asprintf(output, "UNKNOWN - option %s requires an argument", arg);
+            return(GM_ERROR);
+        }
+        switch(flag) {
+            case 'H': opts->host             = value; break;
+            case 'I': opts->address          = value; break;
+            case 'p': opts->port             = atoi(value); break;
+            case 's': opts->string           = value; break;
+            case 'e': opts->expect           = value; break;
+            case 'u': opts->uri              = value; break;
+            case 'a': opts->expected_address = value; break;
+            case 'w': opts->warning          = atof(value);
+                      opts->has_warning      = TRUE;
+                      break;
+            case 'c': opts->critical         = atof(value);
+                      opts->has_critical     = TRUE;
+                      break;
+            case 't': timeout = strtod(value, &end);
+                      if(end == value || *end != '\x0' || timeout <= 0) {
+                          gm_asprintf(output, "UNKNOWN - timeout interval must be a positive number: %s", value);
+                          return(GM_ERROR);
+                      }
+                      if(timeout < opts->timeout)
+                          opts->timeout = timeout;
+                      break;
+            case 'M': if(!strcmp(value, "ok"))
+                          opts->mismatch = STATE_OK;
+                      else if(!strcmp(value, "warn"))
+                          opts->mismatch = STATE_WARNING;
+                      else if(!strcmp(value, "crit"))
+                          opts->mismatch = STATE_CRITICAL;
+                      else {
+                          gm_asprintf(output, "UNKNOWN - invalid mismatch state, use ok, warn or crit: %s", value);
+                          return(GM_ERROR);
+                      }
+                      break;
+            default:
+                gm_asprintf(output, "UNKNOWN - invalid argument: %s", arg);
+                return(GM_ERROR);
+        }
+    }
+
+    if(opts->host == NULL) {
+        gm_asprintf(output, "UNKNOWN - no hostname given");
+        return(GM_ERROR);
+    }
+    if(opts->address == NULL)
+        opts->address = opts->host;
+    return(GM_OK);
+}
+
+/* non-blocking connect to address and port */
+static int native_connect(native_opts_t * opts, int * fd, char ** output) {
+    struct addrinfo *res, *ai;
+    char port[16];
+    int err, sock = -1;
+    socklen_t errlen;
+
+    snprintf(port, sizeof(port), "%d", opts->port);
+    if(native_resolve(opts, opts->address, port, SOCK_STREAM, &res) != GM_OK) {
+        if(errno == ETIMEDOUT)
+            return(socket_error(opts, output));
+        gm_asprintf(output, "Invalid hostname, address or socket: %s", opts->address);
+        return(STATE_UNKNOWN);
+    }
+
+    err = ECONNREFUSED;
+    for(ai = res; ai != NULL; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if(sock < 0) {
+            err = errno;
+            continue;
+        }
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+        fcntl(sock, F_SETFD, FD_CLOEXEC);
+        if(connect(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        if(errno == EINPROGRESS) {
+            if(wait_socket(opts, sock, POLLOUT) != GM_OK) {
+                err = errno;
+                close(sock);
+                sock = -1;
+                break;
+            }
+            errlen = sizeof(err);
+            if(getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &errlen) == 0 && err == 0)
+                break;
+        } else {
+            err = errno;
+        }
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+
+    if(sock < 0) {
+        errno = err;
+        return(socket_error(opts, output));
+    }
+    *fd = sock;
+    return(STATE_OK);
+}
+
+/* write the complete buffer */
+static int native_send(native_opts_t * opts, int fd, const char * buf, size_t len) {
+    ssize_t written;
+    while(len > 0) {
+        if(wait_socket(opts, fd, POLLOUT) != GM_OK)
+            return(GM_ERROR);
+        written = send(fd, buf, len, MSG_NOSIGNAL);
+        if(written < 0) {
+            if(errno == EAGAIN || errno == EINTR)
+                continue;
+            return(GM_ERROR);
+        }
+        buf += written;
+        len -= written;
+    }
+    return(GM_OK);
+}
+
+/* tcp responses are complete once the expected string has been read */
+static int tcp_response_complete(native_opts_t * opts, const char * buf, int len) {
+    return(len > 0 && strstr(buf, opts->expect) != NULL);
+}
+
+/* http responses are complete after the header and content-length bytes */
+static int http_response_complete(native_opts_t * opts, const char * buf, int len) {
+    const char * body = strstr(buf, "\r\n\r\n");
+    const char * header;
+    (void)opts;
+    if(body == NULL)
+        return(FALSE);
+    header = strcasestr(buf, "\r\nContent-Length:");
+    if(header == NULL || header > body)
+        return(FALSE);
+    return(len - (body + 4 - buf) >= atoi(header + 17));
+}
+
+/* read the response until it is complete, the peer closes or the buffer is full */
+static int native_read(native_opts_t * opts, int fd, char * buf, int * len, int (*complete)(native_opts_t *, const char *, int)) {
+    ssize_t got;
+    *len = 0;
+    buf[0] = '\x0';
+    while(*len < NATIVE_MAX_RESPONSE) {
+        if(complete != NULL && complete(opts, buf, *len))
+            return(GM_OK);
+        if(wait_socket(opts, fd, POLLIN) != GM_OK)
+            return(GM_ERROR);
+        got = recv(fd, buf + *len, NATIVE_MAX_RESPONSE - *len, 0);
+        if(got < 0) {
+            if(errno == EAGAIN || errno == EINTR)
+                continue;
+            return(GM_ERROR);
+        }
+        if(got == 0)
+            break;
+        *len += got;
+        buf[*len] = '\x0';
+    }
+    return(GM_OK);
+}
+
+/* check a tcp port, optionally send a string and expect a response */
+static int run_tcp_check(native_opts_t * opts, char ** output) {
+    char buf[NATIVE_MAX_RESPONSE+1];
+    char warn[32], crit[32];
+    int fd = -1, len, rc;
+    double elapsed;
+
+    if(opts->port <= 0) {
+        gm_asprintf(output, "UNKNOWN - no port given");
+        return(STATE_UNKNOWN);
+    }
+    rc = native_connect(opts, &fd, output);
+    if(rc != STATE_OK)
+        return(rc);
+
+    if(opts->string != NULL && native_send(opts, fd, opts->string, strlen(opts->string)) != GM_OK) {
+        rc = socket_error(opts, output);
+        close(fd);
+        return(rc);
+    }
+    if(opts->expect != NULL) {
+        if(native_read(opts, fd, buf, &len, tcp_response_complete) != GM_OK) {
+            rc = socket_error(opts, output);
+            close(fd);
+            return(rc);
+        }
+        /* like check_tcp, an unexpected response is a warning unless -M says otherwise */
+        if(strstr(buf, opts->expect) == NULL && opts->mismatch != STATE_OK) {
+            buf[strcspn(buf, "\r\n")] = '\x0';
+            gm_asprintf(output, "TCP %s - Unexpected response from host/socket: %s", native_state_text[opts->mismatch], buf);
+            close(fd);
+            return(opts->mismatch);
+        }
+    }
+    close(fd);
+
+    elapsed = native_elapsed(opts);
+    rc      = check_time_thresholds(opts, elapsed);
+    format_threshold(warn, sizeof(warn), opts->has_warning, opts->warning);
+    format_threshold(crit, sizeof(crit), opts->has_critical, opts->critical);
+    gm_asprintf(output, "TCP %s - %.3f second response time on %s port %d|time=%fs;%s;%s;0.000000;%f",
+                native_state_text[rc], elapsed, opts->host, opts->port, elapsed, warn, crit, opts->timeout);
+    return(rc);
+}
+
+/* fetch an url and check the status line and content */
+static int run_http_check(native_opts_t * opts, char ** output) {
+    char buf[NATIVE_MAX_RESPONSE+1];
+    char status_line[256];
+    char * request;
+    char * body;
+    int fd = -1, len, rc, status;
+    double elapsed;
+
+    if(opts->ssl) {
+        gm_asprintf(output, "HTTP UNKNOWN - ssl is not supported by built-in checks, use check_http instead");
+        return(STATE_UNKNOWN);
+    }
+    if(opts->port <= 0)
+        opts->port = 80;
+    if(opts->uri == NULL)
+        opts->uri = "/";
+
+    rc = native_connect(opts, &fd, output);
+    if(rc != STATE_OK)
+        return(rc);
+
+    gm_asprintf(&request, "GET %s HTTP/1.0\r\nHost: %s\r\nUser-Agent: mod_gearman/%s\r\nConnection: close\r\n\r\n",
+                opts->uri, opts->host, GM_VERSION);
+    if(native_send(opts, fd, request, strlen(request)) != GM_OK
+       || native_read(opts, fd, buf, &len, http_response_complete) != GM_OK) {
+        rc = socket_error(opts, output);
+        free(request);
+        close(fd);
+        return(rc);
+    }
+    free(request);
+    close(fd);
+    elapsed = native_elapsed(opts);
+
+    snprintf(status_line, sizeof(status_line), "%.*s", (int)strcspn(buf, "\r\n"), buf);
+    if(strncmp(status_line, "HTTP/", 5) || sscanf(status_line, "HTTP/%*s %d", &status) != 1) {
+        gm_asprintf(output, "HTTP CRITICAL - Invalid HTTP response received from host on port %d", opts->port);
+        return(STATE_CRITICAL);
+    }
+
+    if(opts->expect != NULL) {
+        if(strstr(status_line, opts->expect) == NULL) {
+            gm_asprintf(output, "HTTP CRITICAL - Invalid HTTP response received from host on port %d: %s", opts->port, status_line);
+            return(STATE_CRITICAL);
+        }
+        rc = STATE_OK;
+    }
+    else if(status >= 500)
+        rc = STATE_CRITICAL;
+    else if(status >= 400)
+        rc = STATE_WARNING;
+    else
+        rc = STATE_OK;
+
+    if(opts->string != NULL) {
+        body = strstr(buf, "\r\n\r\n");
+        if(body == NULL || strstr(body + 4, opts->string) == NULL) {
+            gm_asprintf(output, "HTTP CRITICAL: %s - string '%s' not found on 'http://%s:%d%s' - %d bytes in %.3f second response time |time=%fs;;;0.000000;%f size=%dB;;;0",
+                        status_line, opts->string, opts->host, opts->port, opts->uri, len, elapsed, elapsed, opts->timeout, len);
+            return(STATE_CRITICAL);
+        }
+    }
+
+    if(check_time_thresholds(opts, elapsed) > rc)
+        rc = check_time_thresholds(opts, elapsed);
+    gm_asprintf(output, "HTTP %s: %s%s - %d bytes in %.3f second response time |time=%fs;;;0.000000;%f size=%dB;;;0",
+                native_state_text[rc], opts->expect != NULL ? "Status line output matched - " : "", status_line,
+                len, elapsed, elapsed, opts->timeout, len);
+    return(rc);
+}
+
+/* returns the first name server from resolv.conf */
+static void default_name_server(char * server, size_t size) {
+    char line[GM_BUFFERSIZE];
+    char name[256];
+    FILE * fp;
+    snprintf(server, size, "127.0.0.1");
+    fp = fopen(NATIVE_RESOLV_CONF, "r");
+    if(fp == NULL)
+        return;
+    while(fgets(line, sizeof(line), fp) != NULL) {
+        if(sscanf(line, "nameserver %255s", name) == 1) {
+            snprintf(server, size, "%s", name);
+            break;
+        }
+    }
+    fclose(fp);
+}
+
+/* skip a possibly compressed name in a dns message, returns -1 on errors */
+static int dns_skip_name(const unsigned char * msg, int len, int offset) {
+    while(offset < len) {
+        if(msg[offset] == 0)
+            return(offset + 1);
+        if((msg[offset] & 0xC0) == 0xC0)
+            return(offset + 2);
+        offset += msg[offset] + 1;
+    }
+    return(-1);
+}
+
+/* check whether an address is part of a comma separated address list */
+static int address_in_list(const char * addr, size_t len, const char * list) {
+    const char * item;
+    size_t item_len;
+
+    for(item = list; *item != '\x0'; item += item_len) {
+        while(*item == ',' || *item == ' ')
+            item++;
+        item_len = strcspn(item, ", ");
+        if(item_len == len && !strncmp(item, addr, len))
+            return(TRUE);
+    }
+    return(FALSE);
+}
+
+/* check whether both comma separated address lists contain the same addresses */
+static int same_addresses(const char * list, const char * other) {
+    const char * addr;
+    size_t len;
+    int pass;
+
+    for(pass = 0; pass < 2; pass++) {
+        for(addr = list; *addr != '\x0'; addr += len) {
+            while(*addr == ',' || *addr == ' ')
+                addr++;
+            len = strcspn(addr, ", ");
+            if(len > 0 && !address_in_list(addr, len, other))
+                return(FALSE);
+        }
+        addr  = list;
+        list  = other;
+        other = addr;
+    }
+    return(TRUE);
+}
+
+/* resolve an A record with a single udp query */
+static int run_dns_check(native_opts_t * opts, char ** output) {
+    unsigned char query[512], answer[NATIVE_MAX_RESPONSE];
+    char server[256], port[16], addr[INET_ADDRSTRLEN];
+    char addresses[GM_BUFFERSIZE];
+    char warn[32], crit[32];
+    struct addrinfo *res;
+    char * colon;
+    const char * label;
+    int fd, len, qlen, offset, count, rc;
+    size_t label_len;
+    unsigned short id, type, rdlen;
+    double elapsed;
+
+    /* name server */
+    if(opts->string != NULL)
+        snprintf(server, sizeof(server), "%s", opts->string);
+    else
+        default_name_server(server, sizeof(server));
+    snprintf(port, sizeof(port), "%d", opts->port > 0 ? opts->port : NATIVE_DNS_PORT);
+    colon = strchr(server, ':');
+    if(colon != NULL && strchr(colon + 1, ':') == NULL) {
+        *colon = '\x0';
+        snprintf(port, sizeof(port), "%s", colon + 1);
+    }
+    opts->address = server;
+    opts->port    = atoi(port);
+
+    /* header with recursion desired and a single question */
+    id = (unsigned short)(getpid() ^ opts->start.tv_usec);
+    memset(query, 0, 12);
+    query[0] = id >> 8;
+    query[1] = id & 0xFF;
+    query[2] = 0x01;
+    query[5] = 1;
+    qlen     = 12;
+    for(label = opts->host; *label != '\x0'; label += label_len) {
+        if(*label == '.')
+            label++;
+        label_len = strcspn(label, ".");
+        if(label_len == 0)
+            continue;
+        if(label_len > 63 || qlen + (int)label_len + 6 > (int)sizeof(query)) {
+            gm_asprintf(output, "DNS UNKNOWN - invalid hostname: %s", opts->host);
+            return(STATE_UNKNOWN);
+        }
+        query[qlen++] = label_len;
+        memcpy(query + qlen, label, label_len);
+        qlen += label_len;
+    }
+    query[qlen++] = 0;
+    query[qlen++] = 0;
+    query[qlen++] = 1;
+    query[qlen++] = 0;
+    query[qlen++] = 1;
+
+    if(native_resolve(opts, server, port, SOCK_DGRAM, &res) != GM_OK) {
+        if(errno == ETIMEDOUT)
+            return(socket_error(opts, output));
+        gm_asprintf(output, "Invalid hostname, address or socket: %s", server);
+        return(STATE_UNKNOWN);
+    }
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if(fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+        freeaddrinfo(res);
+        if(fd >= 0)
+            close(fd);
+        return(socket_error(opts, output));
+    }
+    freeaddrinfo(res);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if(native_send(opts, fd, (char *)query, qlen) != GM_OK) {
+        close(fd);
+        return(socket_error(opts, output));
+    }
+    /* ignore stray datagrams which do not answer our query */
+    while(1) {
+        if(wait_socket(opts, fd, POLLIN) != GM_OK) {
+            close(fd);
+            return(socket_error(opts, output));
+        }
+        len = recv(fd, answer, sizeof(answer), 0);
+        if(len < 0 && (errno == EAGAIN || errno == EINTR))
+            continue;
+        if(len < 0) {
+            close(fd);
+            return(socket_error(opts, output));
+        }
+        if(len >= 12 && answer[0] == query[0] && answer[1] == query[1] && (answer[2] & 0x80))
+            break;
+    }
+    close(fd);
+    elapsed = native_elapsed(opts);
+
+    if((answer[3] & 0x0F) == 3) {
+        gm_asprintf(output, "Domain %s was not found by the server", opts->host);
+        return(STATE_CRITICAL);
+    }
+    if((answer[3] & 0x0F) != 0) {
+        gm_asprintf(output, "DNS CRITICAL - server %s returned error code %d", server, answer[3] & 0x0F);
+        return(STATE_CRITICAL);
+    }
+
+    /* collect all A records of the answer section */
+    addresses[0] = '\x0';
+    offset = 12;
+    for(count = (answer[4] << 8) | answer[5]; count > 0 && offset > 0; count--) {
+        offset = dns_skip_name(answer, len, offset);
+        if(offset > 0)
+            offset += 4;
+    }
+    for(count = (answer[6] << 8) | answer[7]; count > 0 && offset > 0; count--) {
+        offset = dns_skip_name(answer, len, offset);
+        if(offset < 0 || offset + 10 > len)
+            break;
+        type   = (answer[offset] << 8) | answer[offset+1];
+        rdlen  = (answer[offset+8] << 8) | answer[offset+9];
+        offset += 10;
+        if(offset + rdlen > len)
+            break;
+        if(type == 1 && rdlen == 4) {
+            inet_ntop(AF_INET, answer + offset, addr, sizeof(addr));
+            if(addresses[0] != '\x0')
+                strncat(addresses, ",", sizeof(addresses) - strlen(addresses) - 1);
+            strncat(addresses, addr, sizeof(addresses) - strlen(addresses) - 1);
+        }
+        offset += rdlen;
+    }
+
+    if(addresses[0] == '\x0') {
+        gm_asprintf(output, "DNS CRITICAL - '%s' returned no address", opts->host);
+        return(STATE_CRITICAL);
+    }
+    if(opts->expected_address != NULL && !same_addresses(opts->expected_address, addresses)) {
+        gm_asprintf(output, "DNS CRITICAL - expected '%s' but got '%s'", opts->expected_address, addresses);
+        return(STATE_CRITICAL);
+    }
+
+    rc = check_time_thresholds(opts, elapsed);
+    format_threshold(warn, sizeof(warn), opts->has_warning, opts->warning);
+    format_threshold(crit, sizeof(crit), opts->has_critical, opts->critical);
+    gm_asprintf(output, "DNS %s: %.3f seconds response time. %s returns %s|time=%fs;%s;%s;0.000000",
+                native_state_text[rc], elapsed, opts->host, addresses, elapsed, warn, crit);
+    return(rc);
+}
+
+/* run a built-in check */
+int run_native_check(const char * command_line, double timeout, char ** output) {
+    native_opts_t opts;
+    char * argv[MAX_CMD_ARGS];
+    char * cmd;
+    int rc;
+
+    memset(&opts, 0, sizeof(opts));
+    gettimeofday(&opts.start, NULL);
+    opts.mismatch = STATE_WARNING;
+    opts.type    = native_check_type(command_line);
+    opts.timeout = timeout > 0 ? timeout : mod_gm_opt->job_timeout;
+
+    cmd = gm_strdup(command_line);
+    parse_command_line(cmd, argv);
+    if(parse_native_args(&opts, argv, output) != GM_OK) {
+        free(cmd);
+        return(STATE_UNKNOWN);
+    }
+
+    gm_log( GM_LOG_TRACE, "run_native_check(%s, %d)\n", argv[0], (int)opts.timeout );
+    switch(opts.type) {
+        case NATIVE_TCP:  rc = run_tcp_check(&opts, output);  break;
+        case NATIVE_HTTP: rc = run_http_check(&opts, output); break;
+        case NATIVE_DNS:  rc = run_dns_check(&opts, output);  break;
+        default:
+            gm_asprintf(output, "UNKNOWN - unknown built-in check: %s", argv[0]);
+            rc = STATE_UNKNOWN;
+    }
+    free(cmd);
+    return(rc);
+}
@@ -0,0 +1,518 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "config.h"
+#include "common.h"
+#include "check_utils.h"
+#include "plugin_modules.h"
+#include "gm_alloc.h"
+#include "utils.h"
+
+#include <dlfcn.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* request from a worker to its isolation helper */
+typedef struct plugin_request {
+    int check;                      /* index of the registered check */
+    double timeout;
+} plugin_request_t;
+
+/* response of the isolation helper, followed by the plugin output */
+typedef struct plugin_response {
+    int      return_code;
+    uint64_t cpu_usec;
+} plugin_response_t;
+
+static char              * plugin_names[GM_PLUGIN_MAX_CHECKS];
+static char              * plugin_paths[GM_PLUGIN_MAX_CHECKS];
+static gm_plugin_check_t   plugin_checks[GM_PLUGIN_MAX_CHECKS];
+static int                 plugin_checks_num    = 0;
+static char             ** plugin_loaded        = NULL;
+static int                 plugin_loaded_num    = 0;
+static gm_plugin_stats_t * plugin_stats         = NULL;
+static pid_t               plugin_helper_pid    = 0;
+static int                 plugin_helper_fd     = -1;
+
+/* passed to gm_plugin_init() of each module */
+static int register_plugin_check(const char * name, gm_plugin_check_t check) {
+    int i;
+
+    if(name == NULL || *name == '\0' || check == NULL || strchr(name, ' ') != NULL) {
+        gm_log( GM_LOG_ERROR, "plugin module registered an invalid check\n");
+        return(-1);
+    }
+    for(i = 0; i < plugin_checks_num; i++) {
+        if(!strcmp(plugin_names[i], name)) {
+            gm_log( GM_LOG_ERROR, "plugin module check '%s' has already been registered\n", name);
+            return(-1);
+        }
+    }
+    if(plugin_checks_num >= GM_PLUGIN_MAX_CHECKS) {
+        gm_log( GM_LOG_ERROR, "cannot register plugin module check '%s', limit of %d checks reached\n", name, GM_PLUGIN_MAX_CHECKS);
+        return(-1);
+    }
+
+    plugin_names[plugin_checks_num]  = gm_strdup(name);
+    plugin_checks[plugin_checks_num] = check;
+    plugin_checks_num++;
+    gm_log( GM_LOG_DEBUG, "registered plugin module check: %s\n", name);
+    return(0);
+}
+
+
+/* with restrict_path only modules below one of the allowed paths may be used */
+static int plugin_module_allowed(const char * path) {
+    if(!mod_gm_opt->restrict_path_num)
+        return(TRUE);
+    return(*path == '/' && gm_trie_match(mod_gm_opt->restrict_path_trie, path));
+}
+
+
+/* load a single module, registered checks are removed again on errors */
+static int load_plugin_module(const char * path) {
+    void * handle;
+    int (*init)(int, gm_plugin_register_t);
+    int registered = plugin_checks_num;
+
+    if(!plugin_module_allowed(path)) {
+        gm_log( GM_LOG_ERROR, "plugin module %s is not below any of the restricted paths\n", path);
+        return(GM_ERROR);
+    }
+
+    if((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+        gm_log( GM_LOG_ERROR, "failed to load plugin module %s: %s\n", path, dlerror());
+        return(GM_ERROR);
+    }
+
+    *(void **)(&init) = dlsym(handle, GM_PLUGIN_INIT_SYMBOL);
+    if(init == NULL) {
+        gm_log( GM_LOG_ERROR, "plugin module %s has no %s() function\n", path, GM_PLUGIN_INIT_SYMBOL);
+        dlclose(handle);
+        return(GM_ERROR);
+    }
+
+    if(init(GM_PLUGIN_ABI_VERSION, register_plugin_check) != 0) {
+        gm_log( GM_LOG_ERROR, "failed to initialize plugin module %s\n", path);
+        while(plugin_checks_num > registered)
+            free(plugin_names[--plugin_checks_num]);
+        dlclose(handle);
+        return(GM_ERROR);
+    }
+
+    gm_log( GM_LOG_DEBUG, "loaded plugin module %s with %d checks\n", path, plugin_checks_num - registered);
+    while(registered < plugin_checks_num)
+        plugin_paths[registered++] = gm_strdup(path);
+    return(GM_OK);
+}
+
+
+/* load all configured modules which are not loaded yet */
+int load_plugin_modules() {
+    int i, j, id;
+    int rc = GM_OK;
+
+    if(plugin_loaded == NULL)
+        plugin_loaded = gm_calloc(1, sizeof(char *));
+
+    for(i = 0; i < mod_gm_opt->plugin_modules_num; i++) {
+        for(j = 0; j < plugin_loaded_num; j++) {
+            if(!strcmp(plugin_loaded[j], mod_gm_opt->plugin_modules[i]))
+                break;
+        }
+        if(j < plugin_loaded_num)
+            continue;
+        if(load_plugin_module(mod_gm_opt->plugin_modules[i]) != GM_OK) {
+            rc = GM_ERROR;
+            continue;
+        }
+        add_list_item(&plugin_loaded, &plugin_loaded_num, NULL, mod_gm_opt->plugin_modules[i]);
+    }
+
+    /* statistics are shared by all workers forked afterwards */
+    if(plugin_checks_num > 0 && plugin_stats == NULL) {
+        id = shmget(IPC_PRIVATE, sizeof(gm_plugin_stats_t) * GM_PLUGIN_MAX_CHECKS, IPC_CREAT | 0600);
+        if(id < 0 || (plugin_stats = shmat(id, NULL, 0)) == (void *) -1) {
+            gm_log( GM_LOG_ERROR, "failed to create plugin module statistics: %s\n", strerror(errno));
+            plugin_stats = NULL;
+        } else {
+            memset((void *)plugin_stats, 0, sizeof(gm_plugin_stats_t) * GM_PLUGIN_MAX_CHECKS);
+        }
+        if(id >= 0 && shmctl(id, IPC_RMID, 0) == -1)
+            gm_log( GM_LOG_ERROR, "failed to mark plugin module statistics for removal: %s\n", strerror(errno));
+    }
+
+    return(rc);
+}
+
+
+/* check whether this command line calls a module check */
+int is_plugin_module_check(const char * command_line) {
+    if(command_line == NULL)
+        return(FALSE);
+    return(strncmp(command_line, GM_PLUGIN_PREFIX, strlen(GM_PLUGIN_PREFIX)) == 0);
+}
+
+
+/* return index of a registered check or -1 */
+static int find_plugin_check(const char * name) {
+    int i;
+    if(name == NULL)
+        return(-1);
+    for(i = 0; i < plugin_checks_num; i++) {
+        if(!strcmp(plugin_names[i], name))
+            return(i);
+    }
+    return(-1);
+}
+
+
+/* microseconds between two timevals */
+static uint64_t elapsed_usec(struct timeval * start, struct timeval * end) {
+    int64_t usec = (int64_t)(end->tv_sec - start->tv_sec) * 1000000 + (end->tv_usec - start->tv_usec);
+    return(usec > 0 ? (uint64_t)usec : 0);
+}
+
+
+/* call a registered check and measure its cpu usage */
+static int call_plugin_check(int check, char * args, double timeout, char * output, uint64_t * cpu_usec) {
+    char * argv[MAX_CMD_ARGS];
+    gm_plugin_call_t call;
+    struct rusage before, after;
+    int rc;
+
+    memset(&call, 0, sizeof(call));
+    call.abi_version = GM_PLUGIN_ABI_VERSION;
+    call.argv        = argv;
+    parse_command_line(args, argv);
+    while(argv[call.argc] != NULL)
+        call.argc++;
+    call.output      = output;
+    call.output_size = GM_PLUGIN_OUTPUT_SIZE;
+    gettimeofday(&call.deadline, NULL);
+    double2timeval(timeval2double(&call.deadline) + timeout, &call.deadline);
+    output[0] = '\0';
+
+    getrusage(RUSAGE_SELF, &before);
+    rc = plugin_checks[check](&call);
+    getrusage(RUSAGE_SELF, &after);
+    output[GM_PLUGIN_OUTPUT_SIZE-1] = '\0';
+
+    *cpu_usec = elapsed_usec(&before.ru_utime, &after.ru_utime) + elapsed_usec(&before.ru_stime, &after.ru_stime);
+    return(rc);
+}
+
+
+/* main loop of the isolation helper, returns when the worker closes the socket */
+static void plugin_helper_loop(int fd) {
+    char * request  = gm_malloc(sizeof(plugin_request_t) + GM_BUFFERSIZE + 1);
+    char * response = gm_malloc(sizeof(plugin_response_t) + GM_PLUGIN_OUTPUT_SIZE);
+    plugin_request_t  req;
+    plugin_response_t res;
+    ssize_t size;
+
+    while((size = recv(fd, request, sizeof(plugin_request_t) + GM_BUFFERSIZE, 0)) > 0) {
+        if(size < (ssize_t)sizeof(plugin_request_t))
+            break;
+        memcpy(&req, request, sizeof(req));
+        if(req.check < 0 || req.check >= plugin_checks_num)
+            break;
+        request[size] = '\0';
+
+        res.return_code = call_plugin_check(req.check, request + sizeof(req), req.timeout, response + sizeof(res), &res.cpu_usec);
+        memcpy(response, &res, sizeof(res));
+        if(send(fd, response, sizeof(res) + strlen(response + sizeof(res)), 0) < 0)
+            break;
+    }
+
+    free(request);
+    free(response);
+}
+
+
+/* fork the isolation helper of this worker */
+static int start_plugin_helper(void) {
+    int fd[2];
+    pid_t pid;
+
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fd) != 0) {
+        gm_log( GM_LOG_ERROR, "failed to create plugin helper socket: %s\n", strerror(errno));
+        return(GM_ERROR);
+    }
+
+    pid = fork();
+    if(pid < 0) {
+        gm_log( GM_LOG_ERROR, "failed to fork plugin helper: %s\n", strerror(errno));
+        close(fd[0]);
+        close(fd[1]);
+        return(GM_ERROR);
+    }
+
+    if(pid == 0) {
+        alarm(0);
+        signal(SIGALRM, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        close(fd[0]);
+        plugin_helper_loop(fd[1]);
+        gm_log_flush();
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(fd[1]);
+    plugin_helper_fd  = fd[0];
+    plugin_helper_pid = pid;
+    gm_log( GM_LOG_TRACE, "started plugin helper: %d\n", pid);
+    return(GM_OK);
+}
+
+
+/* kill and reap the isolation helper, returns its wait status */
+static int stop_plugin_helper(int sig) {
+    int status = 0;
+
+    if(plugin_helper_pid > 0) {
+        if(sig != 0)
+            kill(plugin_helper_pid, sig);
+        while(waitpid(plugin_helper_pid, &status, 0) < 0 && errno == EINTR)
+            ;
+    }
+    if(plugin_helper_fd >= 0)
+        close(plugin_helper_fd);
+    plugin_helper_fd  = -1;
+    plugin_helper_pid = 0;
+    return(status);
+}
+
+
+/* set the timeout result like finish_check_result() does for plugins */
+static void set_plugin_timeout(gm_job_t * job, char * identifier) {
+    job->return_code   = mod_gm_opt->timeout_return;
+    job->early_timeout = 1;
+    if ( !strcmp( job->type, "service" ) ) {
+        gm_asprintf(&job->output, "(Service Check Timed Out On Worker: %s)", identifier);
+    }
+    else {
+        gm_asprintf(&job->output, "(Host Check Timed Out On Worker: %s)", identifier);
+    }
+}
+
+
+/* run a check in the isolation helper, which is replaced after crashes and timeouts */
+static int run_isolated_check(gm_job_t * job, int check, char * args, char * identifier, uint64_t * cpu_usec) {
+    char * buffer;
+    plugin_request_t  req;
+    plugin_response_t res;
+    struct timeval now, deadline;
+    struct pollfd pfd;
+    size_t args_len = strlen(args);
+    ssize_t size = -1;
+    int attempt, wait_ms, status;
+    char * signame;
+
+    buffer = gm_malloc(sizeof(res) + GM_PLUGIN_OUTPUT_SIZE + 1);
+    req.check   = check;
+    req.timeout = job->timeout;
+    memcpy(buffer, &req, sizeof(req));
+    memcpy(buffer + sizeof(req), args, args_len);
+
+    /* a helper which died between two checks is replaced once */
+    for(attempt = 0; attempt < 2; attempt++) {
+        if(plugin_helper_pid <= 0 && start_plugin_helper() != GM_OK)
+            break;
+        size = send(plugin_helper_fd, buffer, sizeof(req) + args_len, MSG_NOSIGNAL);
+        if(size >= 0)
+            break;
+        stop_plugin_helper(SIGKILL);
+    }
+    if(size < 0) {
+        gm_asprintf(&job->output, "UNKNOWN - plugin helper is not available (worker: %s)", identifier);
+        job->return_code = STATE_UNKNOWN;
+        free(buffer);
+        return(GM_ERROR);
+    }
+
+    gettimeofday(&deadline, NULL);
+    double2timeval(timeval2double(&deadline) + job->timeout, &deadline);
+    pfd.fd     = plugin_helper_fd;
+    pfd.events = POLLIN;
+    size       = -1;
+    while(1) {
+        gettimeofday(&now, NULL);
+        wait_ms = (int)((deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_usec - now.tv_usec) / 1000);
+        if(wait_ms <= 0)
+            break;
+        if(poll(&pfd, 1, wait_ms) < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        if(pfd.revents != 0) {
+            size = recv(plugin_helper_fd, buffer, sizeof(res) + GM_PLUGIN_OUTPUT_SIZE, 0);
+            break;
+        }
+    }
+
+    /* timeout */
+    if(size < 0) {
+        gm_log( GM_LOG_INFO, "timeout (%gs) hit for plugin module check: %s\n", job->timeout, job->command_line);
+        stop_plugin_helper(SIGKILL);
+        set_plugin_timeout(job, identifier);
+        free(buffer);
+        return(GM_ERROR);
+    }
+
+    /* crash */
+    if(size < (ssize_t)sizeof(res)) {
+        status = stop_plugin_helper(0);
+        if(WIFSIGNALED(status)) {
+            signame = nr2signal(WTERMSIG(status));
+            gm_asprintf(&job->output, "CRITICAL: Return code of %d is out of bounds. Plugin exited by signal %s. (worker: %s)", 128+WTERMSIG(status), signame, identifier);
+            free(signame);
+        } else {
+            gm_asprintf(&job->output, "CRITICAL: Return code of %d is out of bounds. (worker: %s)", WEXITSTATUS(status), identifier);
+        }
+        job->return_code = STATE_CRITICAL;
+        free(buffer);
+        return(GM_ERROR);
+    }
+
+    memcpy(&res, buffer, sizeof(res));
+    buffer[size] = '\0';
+    job->output      = gm_strdup(buffer + sizeof(res));
+    job->return_code = res.return_code;
+    *cpu_usec        = res.cpu_usec;
+    free(buffer);
+    return(GM_OK);
+}
+
+
+/* run a module check and set return code and output of the job */
+int run_plugin_module_check(gm_job_t * job, char * identifier) {
+    char * args, * name, * bufdup;
+    char * output = NULL;
+    struct timeval start, end;
+    uint64_t cpu_usec = 0;
+    int check, rc;
+
+    if(job->output != NULL)
+        free(job->output);
+    job->output = NULL;
+
+    /* resolve the check name, everything after it is passed to the module */
+    args  = gm_strdup(job->command_line + strlen(GM_PLUGIN_PREFIX));
+    name  = gm_strndup(args, strcspn(args, " \t"));
+    check = find_plugin_check(name);
+    if(check < 0) {
+        gm_asprintf(&job->output, "UNKNOWN - no plugin module provides check '%s'", name);
+        job->return_code = STATE_UNKNOWN;
+        free(name);
+        free(args);
+        return(GM_OK);
+    }
+
+    /* restrict_path may have been added by a reload after the module was loaded */
+    if(!plugin_module_allowed(plugin_paths[check])) {
+        gm_asprintf(&job->output, "ERROR: plugin module of check '%s' is not below any of the restricted paths", name);
+        job->return_code = STATE_UNKNOWN;
+        free(name);
+        free(args);
+        return(GM_OK);
+    }
+
+    /* the isolation helper cannot receive more, truncated arguments would change the check */
+    if(strlen(args) > GM_BUFFERSIZE) {
+        gm_asprintf(&job->output, "UNKNOWN - arguments of plugin module check '%s' exceed %d bytes", name, GM_BUFFERSIZE);
+        job->return_code = STATE_UNKNOWN;
+        free(name);
+        free(args);
+        return(GM_OK);
+    }
+
+    gm_log( GM_LOG_TRACE, "run_plugin_module_check(%g, %s)\n", job->timeout, job->command_line );
+    gettimeofday(&start, NULL);
+    /* with fork_on_exec the timeout alarm would not send a result, so the helper is used as well */
+    if(mod_gm_opt->plugin_isolation == GM_ENABLED || mod_gm_opt->fork_on_exec == GM_ENABLED) {
+        rc = run_isolated_check(job, check, args, identifier, &cpu_usec);
+    }
+    else {
+        /* modules are expected to respect the deadline, the alarm only catches hanging ones */
+        output = gm_malloc(GM_PLUGIN_OUTPUT_SIZE);
+        signal(SIGALRM, check_alarm_handler);
+        alarm((unsigned int)(job->timeout + 0.999));
+        job->return_code = call_plugin_check(check, args, job->timeout, output, &cpu_usec);
+        alarm(0);
+        job->output = gm_strdup(output);
+        free(output);
+        rc = GM_OK;
+    }
+    gettimeofday(&end, NULL);
+
+    /* invalid return codes */
+    if(rc == GM_OK && (job->return_code < 0 || job->return_code > 3)) {
+        gm_log( GM_LOG_DEBUG, "plugin module check exited with return code %d\n", job->return_code);
+        bufdup = job->output;
+        gm_asprintf(&job->output, "CRITICAL: Return code of %d is out of bounds. (worker: %s)\\n%s", job->return_code, identifier, bufdup);
+        free(bufdup);
+        job->return_code = STATE_CRITICAL;
+        rc = GM_ERROR;
+    }
+
+    gm_log( GM_LOG_DEBUG, "plugin module check %s: rc %d, cpu %.3fs, time %.3fs\n", name, job->return_code, (double)cpu_usec / 1000000, (double)elapsed_usec(&start, &end) / 1000000);
+    if(plugin_stats != NULL) {
+        __sync_fetch_and_add(&plugin_stats[check].calls, 1);
+        __sync_fetch_and_add(&plugin_stats[check].cpu_usec, cpu_usec);
+        __sync_fetch_and_add(&plugin_stats[check].wall_usec, elapsed_usec(&start, &end));
+        if(rc != GM_OK)
+            __sync_fetch_and_add(&plugin_stats[check].failures, 1);
+    }
+
+    free(name);
+    free(args);
+    return(rc);
+}
+
+
+/* add calls and resource usage of all checks to the status */
+void plugin_modules_append_stats(char * result) {
+    int i, len;
+
+    if(plugin_stats == NULL)
+        return;
+
+    for(i = 0; i < plugin_checks_num; i++) {
+        len = strlen(result);
+        snprintf(result+len, len < GM_BUFFERSIZE ? GM_BUFFERSIZE-len : 0, " so_%s_calls=%lluc so_%s_failed=%lluc so_%s_cpu=%.3fs so_%s_time=%.3fs",
+                 plugin_names[i], (unsigned long long)plugin_stats[i].calls,
+                 plugin_names[i], (unsigned long long)plugin_stats[i].failures,
+                 plugin_names[i], (double)plugin_stats[i].cpu_usec / 1000000,
+                 plugin_names[i], (double)plugin_stats[i].wall_usec / 1000000);
+    }
+
+    return;
+}
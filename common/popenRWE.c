@@ -15,6 +15,7 @@
  */
 
 #include "popenRWE.h"
+#include "check_utils.h"
 
 int popenRWE(int *rwepipe, char *command) {
 	int in[2];
@@ -61,6 +62,7 @@ int popenRWE(int *rwepipe, char *command) {
 			;
 		}
 
+		setup_plugin_process();
 		execl( "/bin/sh", "sh", "-c", command, NULL );
 		_exit(1);
 	} else
@@ -82,11 +84,17 @@ error_in:
 }
 
 int pcloseRWE(int pid, int *rwepipe)
+{
+	return pcloseRWE_rusage(pid, rwepipe, NULL);
+}
+
+int pcloseRWE_rusage(int pid, int *rwepipe, struct rusage *usage)
 {
 	int status;
 	close(rwepipe[0]);
 	close(rwepipe[1]);
 	close(rwepipe[2]);
-	waitpid(pid, &status, 0);
+	if (wait4(pid, &status, 0, usage) != pid)
+		status = -1;
 	return status;
 }
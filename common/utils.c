@@ -25,6 +25,7 @@
 #include "utils.h"
 #include "gm_crypt.h"
 #include "base64.h"
+#include "gm_wire.h"
 #include "gearman_utils.h"
 #include "popenRWE.h"
 #include "polarssl/md5.h"
@@ -111,50 +112,102 @@ void mod_gm_crypt_init(char * key) {
 }
 
 
+/* encrypt a check job or result, the binary format is used only for these */
+int mod_gm_encrypt_payload(char ** encrypted, char * text, int mode, int compress) {
+    size_t size = strlen(text);
+    int binary_size = -1;
+
+    /* compressed payloads are always sent in the binary format */
+    if(mod_gm_opt != NULL && mod_gm_opt->compression_threshold > 0 && size >= (size_t)mod_gm_opt->compression_threshold && compress == TRUE)
+        binary_size = gm_wire_encode(encrypted, text, mode == GM_ENCODE_AND_ENCRYPT, TRUE);
+    else if(mod_gm_opt != NULL && mod_gm_opt->binary_transport == GM_ENABLED)
+        binary_size = gm_wire_encode(encrypted, text, mode == GM_ENCODE_AND_ENCRYPT, FALSE);
+
+    /* payloads which do not fit into the binary format are sent as text */
+    if(binary_size >= 0)
+        return binary_size;
+    return mod_gm_encrypt(encrypted, text, mode);
+}
+
+
 /* encrypt text with given key */
 int mod_gm_encrypt(char ** encrypted, char * text, int mode) {
-    int size;
-    unsigned char * crypted;
+    unsigned char chunk[GM_CRYPT_CHUNK];
+    size_t size = strlen(text);
+    size_t total = size;
+    size_t pos, len;
     char * base64;
-
-    if(mode == GM_ENCODE_AND_ENCRYPT) {
-        size = mod_gm_aes_encrypt(&crypted, text);
-    }
-    else {
-        crypted = (unsigned char*)gm_strdup(text);
-        size    = strlen(text);
+    char * out;
+
+    /* zero padded to full blocks, there is always at least one trailing zero byte */
+    if(mode == GM_ENCODE_AND_ENCRYPT)
+        total = size + BLOCKSIZE - size%BLOCKSIZE;
+
+    /* encrypt chunk by chunk and base64 encode each right into the result */
+    base64 = gm_malloc((total+2)/3*4+1);
+    out    = base64;
+    out[0] = '\x0';
+    for(pos = 0; pos < total; pos += len) {
+        len = total - pos > GM_CRYPT_CHUNK ? GM_CRYPT_CHUNK : total - pos;
+        if(mode == GM_ENCODE_AND_ENCRYPT) {
+            size_t copy = size > pos ? size - pos : 0;
+            if(copy > len)
+                copy = len;
+            memcpy(chunk, text+pos, copy);
+            memset(chunk+copy, 0, len-copy);
+            mod_gm_aes_encrypt_blocks(chunk, len/BLOCKSIZE);
+            out += base64_encode_part(chunk, len, out);
+        } else {
+            out += base64_encode_part((unsigned char*)text+pos, len, out);
+        }
     }
 
-    /* now encode in base64 */
-    base64 = gm_malloc(size*2);
-    base64[0] = 0;
-    base64_encode(crypted, size, base64, size*2);
-    free(crypted);
     *encrypted = base64;
-    return strlen(base64);
+    return out - base64;
 }
 
 
 /* decrypt text with given key */
-void mod_gm_decrypt(char ** decrypted, char * text, int mode) {
-    char *test;
-    int input_size = strlen(text);
-    unsigned char * buffer = gm_malloc(sizeof(unsigned char) * input_size * 2);
-
-    /* first decode from base64 */
-    size_t bsize = base64_decode(text, buffer, input_size);
-    test = gm_strndup((char *)buffer, 5);
-    if(mode == GM_ENCODE_AND_ENCRYPT || (mode == GM_ENCODE_ACCEPT_ALL && strcmp(test, "type="))) {
-        /* then decrypt */
-        mod_gm_aes_decrypt(decrypted, buffer, bsize);
-    }
-    else  {
-        *decrypted[0] = '\x0';
-        buffer[bsize] = '\x0';
-        strncat(*decrypted, (char*)buffer, bsize);
-    }
-    free(test);
-    free(buffer);
+void mod_gm_decrypt(char ** decrypted, char * text, int text_size, int mode) {
+    unsigned char * out = (unsigned char *)*decrypted;
+    char * end;
+    size_t size = 0;
+    size_t done = 0;
+    size_t len;
+    int decrypt = -1;
+
+    /* binary frames are only accepted when this side uses them as well,
+     * so a text peer cannot switch the parser */
+    if(text_size > 0 && text[0] == GM_WIRE_VERSION) {
+        out[0] = '\x0';
+        if(mod_gm_opt == NULL || (mod_gm_opt->binary_transport != GM_ENABLED && mod_gm_opt->compression_threshold == 0)) {
+            gm_log( GM_LOG_ERROR, "discarded binary payload, neither binary_transport nor compression_threshold is enabled\n");
+            return;
+        }
+        if(text_size > 1 && (text[1] & GM_WIRE_COMPRESSED) && mod_gm_opt->compression_threshold == 0) {
+            gm_log( GM_LOG_ERROR, "discarded compressed payload, compression_threshold is not enabled\n");
+            return;
+        }
+        gm_wire_decode(decrypted, text, text_size, mode);
+        return;
+    }
+    end = text + strlen(text);
+
+    /* base64 decode chunk by chunk right into the result and decrypt
+     * each chunk while it is still in the cache */
+    do {
+        len   = base64_decode_part(&text, end, out+size, GM_CRYPT_CHUNK);
+        size += len;
+        if(decrypt == -1) {
+            decrypt = mode == GM_ENCODE_AND_ENCRYPT || (mode == GM_ENCODE_ACCEPT_ALL && strncmp((char*)out, "type=", size < 5 ? size : 5));
+        }
+        if(decrypt) {
+            mod_gm_aes_decrypt_blocks(out+done, (size-done)/BLOCKSIZE);
+            done += (size-done)/BLOCKSIZE*BLOCKSIZE;
+        }
+    } while(len == GM_CRYPT_CHUNK);
+
+    out[decrypt ? done : size] = '\x0';
     return;
 }
 
@@ -235,6 +288,8 @@ int set_default_options(mod_gm_opt_t *opt) {
     opt->perfdata_mode      = GM_PERFDATA_OVERWRITE;
     opt->perfdata_send_all  = GM_DISABLED;
     opt->use_uniq_jobs      = GM_ENABLED;
+    opt->binary_transport   = GM_DISABLED;
+    opt->compression_threshold = 0;
     opt->do_hostchecks      = GM_ENABLED;
     opt->route_eventhandler_like_checks = GM_DISABLED;
     opt->hosts              = GM_DISABLED;
@@ -270,6 +325,39 @@ int set_default_options(mod_gm_opt_t *opt) {
 
     opt->restrict_command_characters = gm_strdup("$&();<>`\"'|");
     opt->workaround_rc_25            = GM_DISABLED;
+    opt->result_batch_size           = GM_DEFAULT_RESULT_BATCH_SIZE;
+    opt->result_batch_delay          = GM_DEFAULT_RESULT_BATCH_DELAY;
+    opt->broker_mode                 = GM_DISABLED;
+    opt->job_deadline                = 0;
+    opt->job_backlog                 = 0;
+    opt->promote_latency_normal      = 0;
+    opt->promote_latency_high        = 0;
+    opt->bulk_job_size               = GM_DEFAULT_BULK_JOB_SIZE;
+    opt->bulk_job_window             = GM_DEFAULT_BULK_JOB_WINDOW;
+    opt->bulk_job_queues_num         = 0;
+    opt->bulk_job_queues_list        = gm_calloc(1, sizeof(char *));
+    opt->bulk_job_queue_sizes        = gm_hash_new();
+    opt->bulk_job_queue_windows      = gm_hash_new();
+    opt->direct_results              = GM_DISABLED;
+    opt->submit_rate                 = 0;
+    opt->submit_burst                = 0;
+    opt->submit_rate_queues_num      = 0;
+    opt->submit_rate_queues_list     = gm_calloc(1, sizeof(char *));
+    opt->submit_rate_queue_rates     = gm_hash_new();
+    opt->submit_rate_queue_bursts    = gm_hash_new();
+    opt->journal_file                = NULL;
+    opt->journal_max_age             = 300;
+    opt->target_limit                = 0;
+    opt->result_cache_ttl            = 0;
+    opt->result_spool                = NULL;
+    opt->result_spool_size           = 16;
+    opt->plugin_rusage               = GM_DISABLED;
+    opt->cgroup_root                 = NULL;
+    opt->cgroup_scope                = GM_CGROUP_SCOPE_CHECK;
+    opt->cgroup_cpu_weight           = 0;
+    opt->cgroup_memory_max           = 0;
+    opt->cgroup_pids_max             = 0;
+    opt->icmp_engine                 = GM_DISABLED;
 
     opt->host               = NULL;
     opt->service            = NULL;
@@ -281,27 +369,38 @@ int set_default_options(mod_gm_opt_t *opt) {
     opt->p1_file                      = NULL;
 #endif
 
-    opt->server_num         = 0;
-    for(i=0;i<GM_LISTSIZE;i++)
-        opt->server_list[i] = NULL;
-    opt->dupserver_num         = 0;
-    for(i=0;i<GM_LISTSIZE;i++)
-        opt->dupserver_list[i] = NULL;
-    opt->perfdata_queues_num = 0;
-    for(i=0;i<GM_LISTSIZE;i++)
-        opt->perfdata_queues_list[i] = NULL;
-    opt->hostgroups_num     = 0;
-    for(i=0;i<GM_LISTSIZE;i++)
-        opt->hostgroups_list[i] = NULL;
-    opt->servicegroups_num  = 0;
-    for(i=0;i<GM_LISTSIZE;i++)
-        opt->servicegroups_list[i] = NULL;
-    opt->local_hostgroups_num     = 0;
-    for(i=0;i<GM_LISTSIZE;i++)
-        opt->local_hostgroups_list[i] = NULL;
-    opt->local_servicegroups_num  = 0;
-    for(i=0;i<GM_LISTSIZE;i++)
-        opt->local_servicegroups_list[i] = NULL;
+    /* all lists are NULL terminated and grow when items are added */
+    opt->server_num                  = 0;
+    opt->server_list                 = gm_calloc(1, sizeof(gm_server_t *));
+    opt->dupserver_num               = 0;
+    opt->dupserver_list              = gm_calloc(1, sizeof(gm_server_t *));
+    opt->perfdata_queues_num         = 0;
+    opt->perfdata_queues_list        = gm_calloc(1, sizeof(char *));
+    opt->hostgroups_num              = 0;
+    opt->hostgroups_list             = gm_calloc(1, sizeof(char *));
+    opt->hostgroups_index            = gm_hash_new();
+    opt->servicegroups_num           = 0;
+    opt->servicegroups_list          = gm_calloc(1, sizeof(char *));
+    opt->servicegroups_index         = gm_hash_new();
+    opt->local_hostgroups_num        = 0;
+    opt->local_hostgroups_list       = gm_calloc(1, sizeof(char *));
+    opt->local_hostgroups_index      = gm_hash_new();
+    opt->local_servicegroups_num     = 0;
+    opt->local_servicegroups_list    = gm_calloc(1, sizeof(char *));
+    opt->local_servicegroups_index   = gm_hash_new();
+    opt->target_limit_hostgroups_num = 0;
+    opt->target_limit_hostgroups_list= gm_calloc(1, sizeof(char *));
+    opt->target_limit_hostgroups     = gm_hash_new();
+    opt->result_cache_commands_num   = 0;
+    opt->result_cache_commands       = gm_calloc(1, sizeof(char *));
+    opt->result_cache_commands_trie  = NULL;
+    opt->icmp_commands_num           = 0;
+    opt->icmp_commands               = gm_calloc(1, sizeof(char *));
+    opt->icmp_commands_trie          = NULL;
+    opt->plugin_modules_num          = 0;
+    opt->plugin_modules              = gm_calloc(1, sizeof(char *));
+    opt->plugin_isolation            = GM_DISABLED;
+    opt->builtin_checks              = GM_ENABLED;
     for(i=0;i<GM_NEBTYPESSIZE;i++) {
         mod_gm_exp_t *mod_gm_exp;
         mod_gm_exp              = gm_malloc(sizeof(mod_gm_exp_t));
@@ -310,9 +409,9 @@ int set_default_options(mod_gm_opt_t *opt) {
     }
     opt->exports_count = 0;
     opt->restrict_path_num      = 0;
+    opt->restrict_path          = gm_calloc(1, sizeof(char *));
+    opt->restrict_path_trie     = NULL;
     opt->gearman_connection_timeout = -1;
-    for(i=0;i<GM_LISTSIZE;i++)
-        opt->restrict_path[i] = NULL;
 
     return(GM_OK);
 }
@@ -391,8 +490,7 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
 
         if (opt->perfdata == GM_ENABLED) {
             //bool, use default queue
-            opt->perfdata_queues_list[opt->perfdata_queues_num] = gm_strdup(GM_PERFDATA_QUEUE);
-            opt->perfdata_queues_num++;
+            add_list_item(&opt->perfdata_queues_list, &opt->perfdata_queues_num, NULL, GM_PERFDATA_QUEUE);
         }
         else if (opt->perfdata == -1) {
             //not a bool, use value string as queue name(s)
@@ -402,8 +500,7 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
             values_original = values = gm_strdup(value);
             char *name;
             while ((name = strsep(&values, ",")) != NULL) {
-                opt->perfdata_queues_list[opt->perfdata_queues_num] = gm_strdup(name);
-                opt->perfdata_queues_num++;
+                add_list_item(&opt->perfdata_queues_list, &opt->perfdata_queues_num, NULL, name);
             }
             free(values_original);
         }
@@ -505,6 +602,12 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
         return(GM_OK);
     }
 
+    /* broker_mode */
+    else if ( !strcmp( key, "broker_mode" ) ) {
+        opt->broker_mode = parse_yes_or_no(value, GM_ENABLED);
+        return(GM_OK);
+    }
+
     /* orphan_host_checks */
     else if ( !strcmp( key, "orphan_host_checks" ) ) {
         opt->orphan_host_checks = parse_yes_or_no(value, GM_ENABLED);
@@ -548,6 +651,17 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
         return(GM_OK);
     }
 
+    /* binary_transport */
+    else if ( !strcmp( key, "binary_transport" ) ) {
+        opt->binary_transport = parse_yes_or_no(value, GM_ENABLED);
+    }
+
+    /* compression_threshold */
+    else if ( !strcmp( key, "compression_threshold" ) ) {
+        opt->compression_threshold = atoi( value );
+        if(opt->compression_threshold < 0) { opt->compression_threshold = 0; }
+    }
+
     /* use_uniq_jobs */
     else if ( !strcmp( key, "use_uniq_jobs" ) ) {
         opt->use_uniq_jobs = parse_yes_or_no(value, GM_ENABLED);
@@ -699,8 +813,8 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
 
     /* job_timeout */
     else if ( !strcmp( key, "job_timeout" ) ) {
-        opt->job_timeout = atoi( value );
-        if(opt->job_timeout < 1) { opt->job_timeout = 1; }
+        opt->job_timeout = atof( value );
+        if(opt->job_timeout <= 0) { opt->job_timeout = 1; }
     }
 
     /* min-worker */
@@ -721,6 +835,18 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
         if(opt->max_age < 0) { opt->max_age = GM_DEFAULT_JOB_MAX_AGE; }
     }
 
+    /* job_deadline */
+    else if ( !strcmp( key, "job_deadline" ) ) {
+        opt->job_deadline = atoi( value );
+        if(opt->job_deadline < 0) { opt->job_deadline = 0; }
+    }
+
+    /* job_backlog */
+    else if ( !strcmp( key, "job_backlog" ) ) {
+        opt->job_backlog = atoi( value );
+        if(opt->job_backlog < 0) { opt->job_backlog = 0; }
+    }
+
     /* idle-timeout */
     else if ( !strcmp( key, "idle-timeout" ) ) {
         opt->idle_timeout = atoi( value );
@@ -764,6 +890,115 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
         }
     }
 
+    /* promote_latency_normal */
+    else if ( !strcmp( key, "promote_latency_normal" ) ) {
+        opt->promote_latency_normal = atoi( value );
+        if(opt->promote_latency_normal < 0) { opt->promote_latency_normal = 0; }
+    }
+
+    /* promote_latency_high */
+    else if ( !strcmp( key, "promote_latency_high" ) ) {
+        opt->promote_latency_high = atoi( value );
+        if(opt->promote_latency_high < 0) { opt->promote_latency_high = 0; }
+    }
+
+    /* direct_results */
+    else if ( !strcmp( key, "direct_results" ) ) {
+        opt->direct_results = parse_yes_or_no(value, GM_ENABLED);
+    }
+
+    /* bulk_job_size */
+    else if ( !strcmp( key, "bulk_job_size" ) ) {
+        opt->bulk_job_size = atoi( value );
+        if(opt->bulk_job_size < 1) { opt->bulk_job_size = GM_DEFAULT_BULK_JOB_SIZE; }
+    }
+
+    /* bulk_job_window */
+    else if ( !strcmp( key, "bulk_job_window" ) ) {
+        opt->bulk_job_window = atoi( value );
+        if(opt->bulk_job_window < 0) { opt->bulk_job_window = GM_DEFAULT_BULK_JOB_WINDOW; }
+    }
+
+    /* bulk_job_queue */
+    else if (   !strcmp( key, "bulk_job_queues" )
+             || !strcmp( key, "bulk_job_queue" ) ) {
+        char *queue;
+        while ( (queue = strsep( &value, "," )) != NULL ) {
+            char *size, *window;
+            queue = trim(queue);
+            if ( !strcmp( queue, "" ) )
+                continue;
+            size = strchr( queue, ':' );
+            if ( size == NULL ) {
+                gm_log( GM_LOG_ERROR, "bulk_job_queue '%s' has no size, please use <queue>:<size>[:<window>]\n", queue );
+                continue;
+            }
+            *size = '\x0';
+            size++;
+            window = strchr( size, ':' );
+            if ( window != NULL ) {
+                *window = '\x0';
+                window++;
+            }
+            queue = trim(queue);
+            if(gm_hash_add(opt->bulk_job_queue_sizes, queue, atoi(size) > 1 ? atoi(size) : 1) == GM_OK)
+                add_list_item(&opt->bulk_job_queues_list, &opt->bulk_job_queues_num, NULL, queue);
+            gm_hash_add(opt->bulk_job_queue_windows, queue, window != NULL && atoi(window) >= 0 ? atoi(window) : -1);
+        }
+    }
+
+    /* submit_rate */
+    else if ( !strcmp( key, "submit_rate" ) ) {
+        opt->submit_rate = atoi( value );
+        if(opt->submit_rate < 0) { opt->submit_rate = 0; }
+    }
+
+    /* submit_burst */
+    else if ( !strcmp( key, "submit_burst" ) ) {
+        opt->submit_burst = atoi( value );
+        if(opt->submit_burst < 0) { opt->submit_burst = 0; }
+    }
+
+    /* submit_rate_queue */
+    else if (   !strcmp( key, "submit_rate_queues" )
+             || !strcmp( key, "submit_rate_queue" ) ) {
+        char *queue;
+        while ( (queue = strsep( &value, "," )) != NULL ) {
+            char *rate, *burst;
+            queue = trim(queue);
+            if ( !strcmp( queue, "" ) )
+                continue;
+            rate = strchr( queue, ':' );
+            if ( rate == NULL ) {
+                gm_log( GM_LOG_ERROR, "submit_rate_queue '%s' has no rate, please use <queue>:<rate>[:<burst>]\n", queue );
+                continue;
+            }
+            *rate = '\x0';
+            rate++;
+            burst = strchr( rate, ':' );
+            if ( burst != NULL ) {
+                *burst = '\x0';
+                burst++;
+            }
+            queue = trim(queue);
+            if(gm_hash_add(opt->submit_rate_queue_rates, queue, atoi(rate) > 0 ? atoi(rate) : 0) == GM_OK)
+                add_list_item(&opt->submit_rate_queues_list, &opt->submit_rate_queues_num, NULL, queue);
+            gm_hash_add(opt->submit_rate_queue_bursts, queue, burst != NULL && atoi(burst) > 0 ? atoi(burst) : 0);
+        }
+    }
+
+    /* journal_file */
+    else if ( !strcmp( key, "journal_file" ) ) {
+        free(opt->journal_file);
+        opt->journal_file = gm_strdup( value );
+    }
+
+    /* journal_max_age */
+    else if ( !strcmp( key, "journal_max_age" ) ) {
+        opt->journal_max_age = atoi( value );
+        if(opt->journal_max_age < 1) { opt->journal_max_age = 1; }
+    }
+
     /* orphan_return */
     else if ( !strcmp( key, "orphan_return" ) ) {
         opt->orphan_return = atoi( value );
@@ -786,7 +1021,7 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
     else if ( !strcmp( key, "server" ) ) {
         char *servername;
         while ( (servername = strsep( &value, "," )) != NULL ) {
-            add_server(&opt->server_num, opt->server_list, servername);
+            add_server(&opt->server_num, &opt->server_list, servername);
         }
     }
 
@@ -794,7 +1029,7 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
     else if ( !strcmp( key, "dupserver" ) ) {
         char *servername;
         while ( (servername = strsep( &value, "," )) != NULL ) {
-            add_server(&opt->dupserver_num, opt->dupserver_list, servername);
+            add_server(&opt->dupserver_num, &opt->dupserver_list, servername);
         }
     }
 
@@ -808,9 +1043,7 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
             if ( strcmp( groupname, "" ) ) {
                 if(strlen(groupname) > 50) {
                     gm_log( GM_LOG_ERROR, "servicegroup name '%s' is too long, please use a maximum of 50 characters\n", groupname );
-                } else {
-                    opt->servicegroups_list[opt->servicegroups_num] = gm_strdup(groupname);
-                    opt->servicegroups_num++;
+                } else if(add_list_item(&opt->servicegroups_list, &opt->servicegroups_num, opt->servicegroups_index, groupname) == GM_OK) {
                     opt->set_queues_by_hand++;
                 }
             }
@@ -826,9 +1059,7 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
             if ( strcmp( groupname, "" ) ) {
                 if(strlen(groupname) > 50) {
                     gm_log( GM_LOG_ERROR, "hostgroup name '%s' is too long, please use a maximum of 50 characters\n", groupname );
-                } else {
-                    opt->hostgroups_list[opt->hostgroups_num] = gm_strdup(groupname);
-                    opt->hostgroups_num++;
+                } else if(add_list_item(&opt->hostgroups_list, &opt->hostgroups_num, opt->hostgroups_index, groupname) == GM_OK) {
                     opt->set_queues_by_hand++;
                 }
             }
@@ -843,8 +1074,7 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
         while ( (groupname = strsep( &value, "," )) != NULL ) {
             groupname = trim(groupname);
             if ( strcmp( groupname, "" ) ) {
-                opt->local_servicegroups_list[opt->local_servicegroups_num] = gm_strdup(groupname);
-                opt->local_servicegroups_num++;
+                add_list_item(&opt->local_servicegroups_list, &opt->local_servicegroups_num, opt->local_servicegroups_index, groupname);
             }
         }
     }
@@ -856,12 +1086,154 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
         while ( (groupname = strsep( &value, "," )) != NULL ) {
             groupname = trim(groupname);
             if ( strcmp( groupname, "" ) ) {
-                opt->local_hostgroups_list[opt->local_hostgroups_num] = gm_strdup(groupname);
-                opt->local_hostgroups_num++;
+                add_list_item(&opt->local_hostgroups_list, &opt->local_hostgroups_num, opt->local_hostgroups_index, groupname);
             }
         }
     }
 
+    /* target_limit */
+    else if ( !strcmp( key, "target_limit" ) ) {
+        opt->target_limit = atoi( value );
+        if(opt->target_limit < 0) { opt->target_limit = 0; }
+    }
+
+    /* target_limit_hostgroup */
+    else if (   !strcmp( key, "target_limit_hostgroups" )
+             || !strcmp( key, "target_limit_hostgroup" ) ) {
+        char *groupname;
+        while ( (groupname = strsep( &value, "," )) != NULL ) {
+            char *limit;
+            groupname = trim(groupname);
+            if ( !strcmp( groupname, "" ) )
+                continue;
+            limit = strrchr( groupname, ':' );
+            if ( limit == NULL ) {
+                gm_log( GM_LOG_ERROR, "target_limit_hostgroup '%s' has no limit, please use <hostgroup>:<limit>\n", groupname );
+                continue;
+            }
+            *limit = '\x0';
+            limit++;
+            groupname = trim(groupname);
+            if(gm_hash_add(opt->target_limit_hostgroups, groupname, atoi(limit) > 0 ? atoi(limit) : 0) == GM_OK)
+                add_list_item(&opt->target_limit_hostgroups_list, &opt->target_limit_hostgroups_num, NULL, groupname);
+        }
+    }
+
+    /* result_cache_ttl */
+    else if ( !strcmp( key, "result_cache_ttl" ) ) {
+        opt->result_cache_ttl = atoi( value );
+        if(opt->result_cache_ttl < 0) { opt->result_cache_ttl = 0; }
+    }
+
+    /* result_cache_command */
+    else if (   !strcmp( key, "result_cache_commands" )
+             || !strcmp( key, "result_cache_command" ) ) {
+        char *command;
+        while ( (command = strsep( &value, "," )) != NULL ) {
+            command = trim(command);
+            if ( strcmp( command, "" ) ) {
+                add_list_item(&opt->result_cache_commands, &opt->result_cache_commands_num, NULL, command);
+                gm_trie_add(&opt->result_cache_commands_trie, command);
+            }
+        }
+    }
+
+    /* result_spool */
+    else if ( !strcmp( key, "result_spool" ) ) {
+        free(opt->result_spool);
+        opt->result_spool = gm_strdup( value );
+    }
+
+    /* result_spool_size */
+    else if ( !strcmp( key, "result_spool_size" ) ) {
+        opt->result_spool_size = atoi( value );
+        if(opt->result_spool_size < 1) { opt->result_spool_size = 1; }
+    }
+
+    /* plugin_rusage */
+    else if ( !strcmp( key, "plugin_rusage" ) ) {
+        opt->plugin_rusage = parse_yes_or_no(value, GM_ENABLED);
+    }
+
+    /* cgroup_root */
+    else if ( !strcmp( key, "cgroup_root" ) ) {
+        free(opt->cgroup_root);
+        opt->cgroup_root = NULL;
+        if ( strcmp( value, "" ) )
+            opt->cgroup_root = gm_strdup( value );
+    }
+
+    /* cgroup_scope */
+    else if ( !strcmp( key, "cgroup_scope" ) ) {
+        if ( !strcmp( value, "queue" ) ) {
+            opt->cgroup_scope = GM_CGROUP_SCOPE_QUEUE;
+        } else if ( !strcmp( value, "check" ) ) {
+            opt->cgroup_scope = GM_CGROUP_SCOPE_CHECK;
+        } else {
+            gm_log( GM_LOG_ERROR, "unknown cgroup_scope '%s', use 'check' or 'queue'\n", value );
+            return(GM_ERROR);
+        }
+    }
+
+    /* cgroup_cpu_weight */
+    else if ( !strcmp( key, "cgroup_cpu_weight" ) ) {
+        opt->cgroup_cpu_weight = atoi( value );
+        if(opt->cgroup_cpu_weight < 0)     { opt->cgroup_cpu_weight = 0; }
+        if(opt->cgroup_cpu_weight > 10000) { opt->cgroup_cpu_weight = 10000; }
+    }
+
+    /* cgroup_memory_max */
+    else if ( !strcmp( key, "cgroup_memory_max" ) ) {
+        opt->cgroup_memory_max = atoi( value );
+        if(opt->cgroup_memory_max < 0) { opt->cgroup_memory_max = 0; }
+    }
+
+    /* cgroup_pids_max */
+    else if ( !strcmp( key, "cgroup_pids_max" ) ) {
+        opt->cgroup_pids_max = atoi( value );
+        if(opt->cgroup_pids_max < 0) { opt->cgroup_pids_max = 0; }
+    }
+
+    /* icmp_engine */
+    else if ( !strcmp( key, "icmp_engine" ) ) {
+        opt->icmp_engine = parse_yes_or_no(value, GM_ENABLED);
+    }
+
+    /* icmp_command */
+    else if (   !strcmp( key, "icmp_commands" )
+             || !strcmp( key, "icmp_command" ) ) {
+        char *command;
+        while ( (command = strsep( &value, "," )) != NULL ) {
+            command = trim(command);
+            if ( strcmp( command, "" ) ) {
+                add_list_item(&opt->icmp_commands, &opt->icmp_commands_num, NULL, command);
+                gm_trie_add(&opt->icmp_commands_trie, command);
+            }
+        }
+    }
+
+    /* plugin_module */
+    else if (   !strcmp( key, "plugin_modules" )
+             || !strcmp( key, "plugin_module" ) ) {
+        char *module;
+        while ( (module = strsep( &value, "," )) != NULL ) {
+            module = trim(module);
+            if ( strcmp( module, "" ) ) {
+                add_list_item(&opt->plugin_modules, &opt->plugin_modules_num, NULL, module);
+            }
+        }
+    }
+
+    /* plugin_isolation */
+    else if ( !strcmp( key, "plugin_isolation" ) ) {
+        opt->plugin_isolation = parse_yes_or_no(value, GM_ENABLED);
+    }
+
+    /* builtin_checks */
+    else if ( !strcmp( key, "builtin_checks" ) ) {
+        opt->builtin_checks = parse_yes_or_no(value, GM_ENABLED);
+    }
+
     /* queue_custom_variable */
     else if ( !strcmp( key, "queue_custom_variable" ) ) {
         /* uppercase custom variable name */
@@ -919,8 +1291,8 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
 
     /* restrict_path */
     else if ( !strcmp( key, "restrict_path" ) || !strcmp( key, "restrictpath" )) {
-        opt->restrict_path[opt->restrict_path_num] = gm_strdup(value);
-        opt->restrict_path_num++;
+        add_list_item(&opt->restrict_path, &opt->restrict_path_num, NULL, value);
+        gm_trie_add(&opt->restrict_path_trie, value);
     }
 
     /* restrict_command_characters */
@@ -929,6 +1301,18 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
         opt->restrict_command_characters = gm_strdup(value);
     }
 
+    /* result_batch_size */
+    else if ( !strcmp( key, "result_batch_size" ) ) {
+        opt->result_batch_size = atoi( value );
+        if(opt->result_batch_size < 1) { opt->result_batch_size = GM_DEFAULT_RESULT_BATCH_SIZE; }
+    }
+
+    /* result_batch_delay */
+    else if ( !strcmp( key, "result_batch_delay" ) ) {
+        opt->result_batch_delay = atoi( value );
+        if(opt->result_batch_delay < 0) { opt->result_batch_delay = GM_DEFAULT_RESULT_BATCH_DELAY; }
+    }
+
     /* timeout while connecting to gearmand server*/
     else if ( !strcmp( key, "gearman_connection_timeout" ) ) {
         opt->gearman_connection_timeout = atoi( value );
@@ -1015,11 +1399,44 @@ void dumpconfig(mod_gm_opt_t *opt, int mode) {
         gm_log( GM_LOG_DEBUG, "logfile:                         %s\n", opt->logfile == NULL ? "no" : opt->logfile);
         gm_log( GM_LOG_DEBUG, "job max num:                     %d\n", opt->max_jobs);
         gm_log( GM_LOG_DEBUG, "job max age:                     %d\n", opt->max_age);
-        gm_log( GM_LOG_DEBUG, "job timeout:                     %d\n", opt->job_timeout);
+        gm_log( GM_LOG_DEBUG, "job deadline:                    %d\n", opt->job_deadline);
+        gm_log( GM_LOG_DEBUG, "job timeout:                     %gs\n", opt->job_timeout);
         gm_log( GM_LOG_DEBUG, "min worker:                      %d\n", opt->min_worker);
         gm_log( GM_LOG_DEBUG, "max worker:                      %d\n", opt->max_worker);
         gm_log( GM_LOG_DEBUG, "spawn rate:                      %d\n", opt->spawn_rate);
         gm_log( GM_LOG_DEBUG, "fork on exec:                    %s\n", opt->fork_on_exec == GM_ENABLED ? "yes" : "no");
+        gm_log( GM_LOG_DEBUG, "broker mode:                     %s\n", opt->broker_mode == GM_ENABLED ? "yes" : "no");
+        if(opt->broker_mode == GM_ENABLED)
+            gm_log( GM_LOG_DEBUG, "job backlog:                     %d\n", opt->job_backlog);
+        gm_log( GM_LOG_DEBUG, "target limit:                    %d\n", opt->target_limit);
+        for(i=0;i<opt->target_limit_hostgroups_num;i++)
+            gm_log( GM_LOG_DEBUG, "target limit hostgroup:          %s -> %d\n", opt->target_limit_hostgroups_list[i], gm_hash_get(opt->target_limit_hostgroups, opt->target_limit_hostgroups_list[i], 0));
+        gm_log( GM_LOG_DEBUG, "result cache ttl:                %ds\n", opt->result_cache_ttl);
+        for(i=0;i<opt->result_cache_commands_num;i++)
+            gm_log( GM_LOG_DEBUG, "result cache command:            %s\n", opt->result_cache_commands[i]);
+        if(opt->result_spool != NULL) {
+            gm_log( GM_LOG_DEBUG, "result spool:                    %s\n", opt->result_spool);
+            gm_log( GM_LOG_DEBUG, "result spool size:               %dMB\n", opt->result_spool_size);
+        }
+        gm_log( GM_LOG_DEBUG, "plugin rusage:                   %s\n", opt->plugin_rusage == GM_ENABLED ? "yes" : "no");
+        if(opt->cgroup_root != NULL) {
+            gm_log( GM_LOG_DEBUG, "cgroup root:                     %s\n", opt->cgroup_root);
+            gm_log( GM_LOG_DEBUG, "cgroup scope:                    %s\n", opt->cgroup_scope == GM_CGROUP_SCOPE_QUEUE ? "queue" : "check");
+            gm_log( GM_LOG_DEBUG, "cgroup cpu weight:               %d\n", opt->cgroup_cpu_weight);
+            gm_log( GM_LOG_DEBUG, "cgroup memory max:               %dMB\n", opt->cgroup_memory_max);
+            gm_log( GM_LOG_DEBUG, "cgroup pids max:                 %d\n", opt->cgroup_pids_max);
+        }
+        gm_log( GM_LOG_DEBUG, "icmp engine:                     %s\n", opt->icmp_engine == GM_ENABLED ? "yes" : "no");
+        for(i=0;i<opt->icmp_commands_num;i++)
+            gm_log( GM_LOG_DEBUG, "icmp command:                    %s\n", opt->icmp_commands[i]);
+        for(i=0;i<opt->plugin_modules_num;i++)
+            gm_log( GM_LOG_DEBUG, "plugin module:                   %s\n", opt->plugin_modules[i]);
+        gm_log( GM_LOG_DEBUG, "plugin isolation:                %s\n", opt->plugin_isolation == GM_ENABLED ? "yes" : "no");
+        gm_log( GM_LOG_DEBUG, "builtin checks:                  %s\n", opt->builtin_checks == GM_ENABLED ? "yes" : "no");
+        if(opt->result_batch_size > 1) {
+            gm_log( GM_LOG_DEBUG, "result batch size:               %d\n", opt->result_batch_size);
+            gm_log( GM_LOG_DEBUG, "result batch delay:              %dms\n", opt->result_batch_delay);
+        }
 #ifndef EMBEDDEDPERL
         gm_log( GM_LOG_DEBUG, "embedded perl:                   not compiled\n");
 #endif
@@ -1042,6 +1459,27 @@ void dumpconfig(mod_gm_opt_t *opt, int mode) {
             gm_log( GM_LOG_DEBUG, "result_worker:                   %d\n", opt->result_workers);
         gm_log( GM_LOG_DEBUG, "do_hostchecks:                   %s\n", opt->do_hostchecks == GM_ENABLED ? "yes" : "no");
         gm_log( GM_LOG_DEBUG, "route_eventhandler_like_checks:  %s\n", opt->route_eventhandler_like_checks == GM_ENABLED ? "yes" : "no");
+        if(opt->promote_latency_normal > 0)
+            gm_log( GM_LOG_DEBUG, "promote_latency_normal:          %d\n", opt->promote_latency_normal);
+        if(opt->promote_latency_high > 0)
+            gm_log( GM_LOG_DEBUG, "promote_latency_high:            %d\n", opt->promote_latency_high);
+        gm_log( GM_LOG_DEBUG, "direct results:                  %s\n", opt->direct_results == GM_ENABLED ? "yes" : "no");
+        if(opt->submit_rate > 0) {
+            gm_log( GM_LOG_DEBUG, "submit rate:                     %d/s\n", opt->submit_rate);
+            gm_log( GM_LOG_DEBUG, "submit burst:                    %d\n", opt->submit_burst > 0 ? opt->submit_burst : opt->submit_rate);
+        }
+        if(opt->journal_file != NULL) {
+            gm_log( GM_LOG_DEBUG, "journal file:                    %s\n", opt->journal_file);
+            gm_log( GM_LOG_DEBUG, "journal max age:                 %ds\n", opt->journal_max_age);
+        }
+        for(i=0;i<opt->submit_rate_queues_num;i++)
+            gm_log( GM_LOG_DEBUG, "submit rate queue:               %s -> %d/s / %d\n", opt->submit_rate_queues_list[i], gm_hash_get(opt->submit_rate_queue_rates, opt->submit_rate_queues_list[i], 0), gm_hash_get(opt->submit_rate_queue_bursts, opt->submit_rate_queues_list[i], 0));
+        if(opt->bulk_job_size > 1) {
+            gm_log( GM_LOG_DEBUG, "bulk job size:                   %d\n", opt->bulk_job_size);
+            gm_log( GM_LOG_DEBUG, "bulk job window:                 %dms\n", opt->bulk_job_window);
+        }
+        for(i=0;i<opt->bulk_job_queues_num;i++)
+            gm_log( GM_LOG_DEBUG, "bulk job queue:                  %s -> %d / %dms\n", opt->bulk_job_queues_list[i], gm_hash_get(opt->bulk_job_queue_sizes, opt->bulk_job_queues_list[i], 1), gm_hash_get(opt->bulk_job_queue_windows, opt->bulk_job_queues_list[i], -1) >= 0 ? gm_hash_get(opt->bulk_job_queue_windows, opt->bulk_job_queues_list[i], -1) : opt->bulk_job_window);
     }
     if(mode == GM_NEB_MODE || mode == GM_SEND_GEARMAN_MODE) {
         gm_log( GM_LOG_DEBUG, "result_queue:                    %s\n", opt->result_queue);
@@ -1098,7 +1536,12 @@ void dumpconfig(mod_gm_opt_t *opt, int mode) {
     if(mode == GM_NEB_MODE) {
         gm_log( GM_LOG_DEBUG, "accept clear result:             %s\n", opt->accept_clear_results == GM_ENABLED ? "yes" : "no");
     }
-    gm_log( GM_LOG_DEBUG, "transport mode:                  %s\n", opt->encryption == GM_ENABLED ? "aes-256+base64" : "base64 only");
+    if(opt->binary_transport == GM_ENABLED)
+        gm_log( GM_LOG_DEBUG, "transport mode:                  %s\n", opt->encryption == GM_ENABLED ? "aes-256+binary" : "binary only");
+    else
+        gm_log( GM_LOG_DEBUG, "transport mode:                  %s\n", opt->encryption == GM_ENABLED ? "aes-256+base64" : "base64 only");
+    if(opt->compression_threshold > 0)
+        gm_log( GM_LOG_DEBUG, "compression threshold:           %d bytes\n", opt->compression_threshold);
     gm_log( GM_LOG_DEBUG, "use uniq jobs:                   %s\n", opt->use_uniq_jobs == GM_ENABLED ? "yes" : "no");
 
     gm_log( GM_LOG_DEBUG, "--------------------------------\n" );
@@ -1106,36 +1549,68 @@ void dumpconfig(mod_gm_opt_t *opt, int mode) {
 }
 
 
+/* free a NULL terminated list and its items */
+static void free_list(char ** list, int num) {
+    int i;
+    if(list == NULL)
+        return;
+    for(i=0;i<num;i++)
+        free(list[i]);
+    free(list);
+    return;
+}
+
+
 /* free options structure */
 void mod_gm_free_opt(mod_gm_opt_t *opt) {
     int i,j;
     if(opt == NULL)
         return;
+    if(opt == mod_gm_opt)
+        gm_log_flush();
     for(i=0;i<opt->server_num;i++) {
         free(opt->server_list[i]->host);
         free(opt->server_list[i]);
     }
+    free(opt->server_list);
     for(i=0;i<opt->dupserver_num;i++) {
         free(opt->dupserver_list[i]->host);
         free(opt->dupserver_list[i]);
     }
-    for(i=0;i<opt->hostgroups_num;i++)
-        free(opt->hostgroups_list[i]);
-    for(i=0;i<opt->servicegroups_num;i++)
-        free(opt->servicegroups_list[i]);
-    for(i=0;i<opt->local_hostgroups_num;i++)
-        free(opt->local_hostgroups_list[i]);
-    for(i=0;i<opt->local_servicegroups_num;i++)
-        free(opt->local_servicegroups_list[i]);
+    free(opt->dupserver_list);
+    free_list(opt->perfdata_queues_list, opt->perfdata_queues_num);
+    free_list(opt->hostgroups_list, opt->hostgroups_num);
+    gm_hash_free(opt->hostgroups_index);
+    free_list(opt->servicegroups_list, opt->servicegroups_num);
+    gm_hash_free(opt->servicegroups_index);
+    free_list(opt->local_hostgroups_list, opt->local_hostgroups_num);
+    gm_hash_free(opt->local_hostgroups_index);
+    free_list(opt->local_servicegroups_list, opt->local_servicegroups_num);
+    gm_hash_free(opt->local_servicegroups_index);
+    free_list(opt->target_limit_hostgroups_list, opt->target_limit_hostgroups_num);
+    gm_hash_free(opt->target_limit_hostgroups);
+    free_list(opt->bulk_job_queues_list, opt->bulk_job_queues_num);
+    gm_hash_free(opt->bulk_job_queue_sizes);
+    gm_hash_free(opt->bulk_job_queue_windows);
+    free_list(opt->submit_rate_queues_list, opt->submit_rate_queues_num);
+    gm_hash_free(opt->submit_rate_queue_rates);
+    gm_hash_free(opt->submit_rate_queue_bursts);
+    free(opt->journal_file);
+    free_list(opt->result_cache_commands, opt->result_cache_commands_num);
+    gm_trie_free(opt->result_cache_commands_trie);
+    free(opt->result_spool);
+    free(opt->cgroup_root);
+    free_list(opt->icmp_commands, opt->icmp_commands_num);
+    gm_trie_free(opt->icmp_commands_trie);
+    free_list(opt->plugin_modules, opt->plugin_modules_num);
     for(i=0;i<GM_NEBTYPESSIZE;i++) {
         for(j=0;j<opt->exports[i]->elem_number;j++) {
           free(opt->exports[i]->name[j]);
         }
         free(opt->exports[i]);
     }
-    for(i=0;i<opt->restrict_path_num;i++) {
-        free(opt->restrict_path[i]);
-    }
+    free_list(opt->restrict_path, opt->restrict_path_num);
+    gm_trie_free(opt->restrict_path_trie);
     free(opt->restrict_command_characters);
     free(opt->crypt_key);
     free(opt->keyfile);
@@ -1263,6 +1738,9 @@ int set_default_job(gm_job_t *job, mod_gm_opt_t *opt) {
     job->start_time.tv_sec   = 0L;
     job->start_time.tv_usec  = 0L;
     job->has_been_sent       = FALSE;
+    job->direct_result       = FALSE;
+    job->ondemand            = FALSE;
+    job->has_rusage          = FALSE;
 
     return(GM_OK);
 }
@@ -1412,19 +1890,109 @@ char *replace_str(const char *str, const char *old, const char *new) {
     return ret;
 }
 
+/* per thread buffer for debug and trace lines written to the logfile */
+static __thread char * log_buffer     = NULL;
+static __thread size_t log_buffer_len = 0;
+static __thread pid_t  log_buffer_pid = 0;
+
+/* timestamp of the last log line, formated once per second */
+static __thread time_t log_time = 0;
+static __thread char   log_timestring[32];
+
+/* write text completely to the given file descriptor */
+static void write_log_fd(int fd, const char * text, size_t len) {
+    ssize_t written;
+    while(len > 0) {
+        written = write(fd, text, len);
+        if(written < 0) {
+            if(errno == EINTR)
+                continue;
+            return;
+        }
+        text += written;
+        len  -= written;
+    }
+    return;
+}
+
+
+/* write all buffered log lines of this thread */
+void gm_log_flush() {
+    FILE * fp = NULL;
+
+    if(log_buffer_len == 0)
+        return;
+
+    /* buffer has been inherited from our parent, which writes it itself */
+    if(log_buffer_pid != getpid()) {
+        log_buffer_len = 0;
+        return;
+    }
+
+    if(mod_gm_opt != NULL)
+        fp = mod_gm_opt->logfile_fp;
+    if(fp != NULL)
+        write_log_fd(fileno(fp), log_buffer, log_buffer_len);
+    log_buffer_len = 0;
+
+    return;
+}
+
+
+/* get the current timestring, flushes buffered lines of the previous second */
+static char * get_log_timestring(void) {
+    struct tm now;
+    time_t t = time(NULL);
+
+    if(t != log_time) {
+        gm_log_flush();
+        localtime_r(&t, &now);
+        strftime(log_timestring, sizeof(log_timestring), "[%Y-%m-%d %H:%M:%S]", &now );
+        log_time = t;
+    }
+
+    return log_timestring;
+}
+
+
+/* add a log line to the logfile */
+static void write_log_file(FILE * fp, int lvl, const char * text, size_t len) {
+    pid_t pid;
+
+    /* errors and infos are written right away */
+    if(lvl < GM_LOG_DEBUG || len > GM_LOG_BUFFER_SIZE) {
+        gm_log_flush();
+        write_log_fd(fileno(fp), text, len);
+        return;
+    }
+
+    pid = getpid();
+    if(log_buffer_pid != pid) {
+        log_buffer_len = 0;
+        log_buffer_pid = pid;
+    }
+    if(log_buffer == NULL)
+        log_buffer = gm_malloc(GM_LOG_BUFFER_SIZE);
+    if(log_buffer_len + len > GM_LOG_BUFFER_SIZE)
+        gm_log_flush();
+
+    memcpy(log_buffer + log_buffer_len, text, len);
+    log_buffer_len += len;
+
+    return;
+}
+
+
 /* generic logger function */
-void gm_log( int lvl, const char *text, ... ) {
+void gm_log_write( int lvl, const char *text, ... ) {
     FILE * fp       = NULL;
     int debug_level = GM_LOG_ERROR;
     int logmode     = GM_LOG_MODE_STDOUT;
     int slevel;
+    int len = 0;
     char * level;
-    char buffer1[GM_BUFFERSIZE];
-    char buffer2[GM_BUFFERSIZE];
-    char buffer3[GM_BUFFERSIZE];
-    time_t t;
+    char buffer[GM_BUFFERSIZE];
     va_list ap;
-    struct tm now;
 
     if(mod_gm_opt != NULL) {
         debug_level = mod_gm_opt->debug_level;
@@ -1439,19 +2007,19 @@ void gm_log( int lvl, const char *text, ... ) {
             return;
 
         if ( lvl == GM_LOG_ERROR ) {
-            snprintf( buffer1, 22, "mod_gearman: ERROR - " );
+            snprintf( buffer, 22, "mod_gearman: ERROR - " );
         } else {
-            snprintf( buffer1, 14, "mod_gearman: " );
+            snprintf( buffer, 14, "mod_gearman: " );
         }
         va_start( ap, text );
-        vsnprintf( buffer1 + strlen( buffer1 ), sizeof( buffer1 ) - strlen( buffer1 ), text, ap );
+        vsnprintf( buffer + strlen( buffer ), sizeof( buffer ) - strlen( buffer ), text, ap );
         va_end( ap );
 
         if ( debug_level >= GM_LOG_STDOUT ) {
-            printf( "%s", buffer1 );
+            printf( "%s", buffer );
             return;
         }
-        write_core_log( buffer1 );
+        write_core_log( buffer );
         return;
     }
 
@@ -1480,40 +2048,42 @@ void gm_log( int lvl, const char *text, ... ) {
         slevel = LOG_DEBUG;
     }
 
-    /* set timestring */
-    t = time(NULL);
-    localtime_r(&t, &now);
-    strftime(buffer1, sizeof(buffer1), "[%Y-%m-%d %H:%M:%S]", &now );
-
-    /* set timestring */
-    snprintf(buffer2, sizeof(buffer2), "[%i][%s]", getpid(), level );
+    /* set prefix with timestring, pid and level */
+    if ( debug_level >= GM_LOG_STDOUT || logmode == GM_LOG_MODE_TOOLS ) {
+        len = 0;
+    }
+    else if(logmode == GM_LOG_MODE_SYSLOG) {
+        len = snprintf(buffer, sizeof(buffer), "[%i][%s] ", getpid(), level );
+    }
+    else {
+        len = snprintf(buffer, sizeof(buffer), "%s[%i][%s] ", get_log_timestring(), getpid(), level );
+    }
 
     va_start( ap, text );
-    vsnprintf( buffer3, GM_BUFFERSIZE, text, ap );
+    vsnprintf( buffer + len, sizeof(buffer) - len, text, ap );
     va_end( ap );
 
     if ( debug_level >= GM_LOG_STDOUT || logmode == GM_LOG_MODE_TOOLS ) {
-        printf( "%s", buffer3 );
+        printf( "%s", buffer );
         return;
     }
 
     if(logmode == GM_LOG_MODE_FILE && fp != NULL) {
-        fprintf( fp, "%s%s %s", buffer1, buffer2, buffer3 );
-        fflush( fp );
+        write_log_file( fp, lvl, buffer, strlen(buffer) );
     }
     else if(logmode == GM_LOG_MODE_SYSLOG) {
-        syslog(slevel , "%s %s", buffer2, buffer3 );
+        syslog(slevel , "%s", buffer );
     }
     else {
         /* stdout logging */
-        printf( "%s%s %s", buffer1, buffer2, buffer3 );
+        printf( "%s", buffer );
     }
 
     return;
 }
 
 /* check server for duplicates */
-int check_param_server(gm_server_t * new_server, gm_server_t * server_list[GM_LISTSIZE], int server_num) {
+int check_param_server(gm_server_t * new_server, gm_server_t ** server_list, int server_num) {
     int i;
     for(i=0;i<server_num;i++) {
         if ( ! strcmp( new_server->host, server_list[i]->host ) && new_server->port == server_list[i]->port ) {
@@ -1525,11 +2095,235 @@ int check_param_server(gm_server_t * new_server, gm_server_t * server_list[GM_LI
 }
 
 
+/* results collected for a multi-result job */
+static char * result_batch_queue     = NULL;
+static char * result_batch_data      = NULL;
+static size_t result_batch_len       = 0;
+static size_t result_batch_size      = 0;
+static char * result_batch_dup_data  = NULL;
+static size_t result_batch_dup_len   = 0;
+static size_t result_batch_dup_size  = 0;
+static int    result_batch_num       = 0;
+static int    result_batch_bulk      = FALSE;
+static int    result_batch_direct    = FALSE;
+static struct timeval result_batch_start;
+static gm_hash_t * compressed_result_queues = NULL;
+
+#define GM_PASSIVE_PREFIX     "type=passive\n"
+#define GM_PASSIVE_PREFIX_LEN 13
+
+/* append data to a growing batch buffer */
+static void result_batch_append(char ** buf, size_t * len, size_t * size, const char * data, size_t data_len) {
+    if(*len + data_len + 1 > *size) {
+        size_t new_size = *size > 0 ? *size : GM_BUFFERSIZE;
+        while(new_size < *len + data_len + 1)
+            new_size *= 2;
+        *buf  = gm_realloc(*buf, new_size);
+        *size = new_size;
+    }
+    memcpy(*buf + *len, data, data_len);
+    *len += data_len;
+    (*buf)[*len] = '\x0';
+    return;
+}
+
+
+/* remember that the receiver of a result queue accepts compressed results */
+void accept_compressed_results(const char * queue) {
+    if(compressed_result_queues == NULL)
+        compressed_result_queues = gm_hash_new();
+    gm_hash_add(compressed_result_queues, queue, TRUE);
+    return;
+}
+
+
+/* check whether results for this queue may be compressed */
+int accepts_compressed_results(const char * queue) {
+    return gm_hash_get(compressed_result_queues, queue, FALSE);
+}
+
+
+/* send a result payload to the duplicate servers, encodes it unless encoded data is given */
+static void send_dup_result_payload(char * queue, char * dup_data, char * encoded, int size) {
+    char * dup_encoded = encoded;
+
+    if(dup_encoded == NULL)
+        size = mod_gm_encrypt_payload(&dup_encoded, dup_data, mod_gm_opt->transportmode, accepts_compressed_results(queue));
+
+    if( current_client_dup != NULL && add_encoded_job_to_queue( current_client_dup,
+                                  mod_gm_opt->dupserver_list,
+                                  queue,
+                                  NULL,
+                                  dup_encoded,
+                                  size,
+                                  GM_JOB_PRIO_NORMAL,
+                                  GM_DEFAULT_JOB_RETRIES,
+                                  TRUE
+                                ) == GM_OK) {
+        gm_log( GM_LOG_TRACE, "send_result_back() finished successfully for duplicate server.\n" );
+    }
+    else {
+        gm_log( GM_LOG_TRACE, "send_result_back() finished unsuccessfully for duplicate server\n" );
+    }
+
+    if(dup_encoded != encoded)
+        free(dup_encoded);
+    return;
+}
+
+
+/* encode a result payload once and send it to all result servers */
+void send_result_payload(char * queue, char * data, char * dup_data) {
+    char * encoded;
+    int size;
+
+    gm_log( GM_LOG_TRACE, "data:\n%s\n", data);
+
+    /* let the result broker send it */
+    if(result_payload_hook != NULL && result_payload_hook(queue, data, dup_data) == GM_OK)
+        return;
+
+    /* only cores which announced it get compressed results */
+    size = mod_gm_encrypt_payload(&encoded, data, mod_gm_opt->transportmode, accepts_compressed_results(queue));
+    if(current_client != NULL && add_encoded_job_to_queue( current_client,
+                                 mod_gm_opt->server_list,
+                                 queue,
+                                 NULL,
+                                 encoded,
+                                 size,
+                                 GM_JOB_PRIO_NORMAL,
+                                 GM_DEFAULT_JOB_RETRIES,
+                                 TRUE
+                                ) == GM_OK) {
+        gm_log( GM_LOG_TRACE, "send_result_back() finished successfully\n" );
+    }
+    else if(result_spool_hook != NULL && result_spool_hook(queue, encoded, size) == GM_OK) {
+        gm_log( GM_LOG_TRACE, "send_result_back() spooled result\n" );
+    }
+    else {
+        gm_log( GM_LOG_TRACE, "send_result_back() finished unsuccessfully\n" );
+    }
+
+    /* reuse the encoded data unless the duplicate payload differs */
+    if( mod_gm_opt->dupserver_num ) {
+        send_dup_result_payload(queue, dup_data, dup_data == data ? encoded : NULL, size);
+    }
+    else {
+        gm_log( GM_LOG_TRACE, "send_result_back() has no duplicate servers to send to.\n" );
+    }
+    free(encoded);
+    return;
+}
+
+
+/* return a result payload as completion data of the running job */
+static void send_result_direct(char * queue, char * data, char * dup_data) {
+    gearman_return_t ret;
+    char * encoded;
+    int size;
+
+    gm_log( GM_LOG_TRACE, "data:\n%s\n", data);
+
+    size = mod_gm_encrypt_payload(&encoded, data, mod_gm_opt->transportmode, accepts_compressed_results(queue));
+    ret  = gearman_job_send_complete(current_gearman_job, encoded, size);
+    if(ret != GEARMAN_SUCCESS) {
+        gm_log( GM_LOG_ERROR, "returning direct result failed (%d), using result queue %s\n", ret, queue );
+        free(encoded);
+        send_result_payload(queue, data, dup_data);
+        return;
+    }
+    gm_log( GM_LOG_TRACE, "send_result_back() returned result directly\n" );
+
+    if( mod_gm_opt->dupserver_num )
+        send_dup_result_payload(queue, dup_data, dup_data == data ? encoded : NULL, size);
+    free(encoded);
+    return;
+}
+
+
+/* send all collected results as one multi-result job */
+void flush_result_batch() {
+    if(result_batch_num == 0)
+        return;
+
+    gm_log( GM_LOG_TRACE, "flush_result_batch(): %d results for queue %s\n", result_batch_num, result_batch_queue );
+
+    if(result_batch_direct == TRUE && current_gearman_job != NULL)
+        send_result_direct(result_batch_queue, result_batch_data, mod_gm_opt->dupserver_num && mod_gm_opt->dup_results_are_passive ? result_batch_dup_data : result_batch_data);
+    else if(mod_gm_opt->dupserver_num && mod_gm_opt->dup_results_are_passive)
+        send_result_payload(result_batch_queue, result_batch_data, result_batch_dup_data);
+    else
+        send_result_payload(result_batch_queue, result_batch_data, result_batch_data);
+
+    /* keep the buffers for the next batch */
+    free(result_batch_queue);
+    result_batch_queue   = NULL;
+    result_batch_len     = 0;
+    result_batch_dup_len = 0;
+    result_batch_num     = 0;
+    return;
+}
+
+
+/* a bulk job can only return one direct result, so its results use the result queue */
+void set_bulk_results(int enabled) {
+    result_batch_bulk = enabled;
+    return;
+}
+
+
+/* milliseconds until the pending result batch is due */
+int result_batch_timeout() {
+    struct timeval now;
+    int elapsed;
+
+    if(result_batch_num == 0)
+        return -1;
+
+    gettimeofday(&now,NULL);
+    elapsed = (now.tv_sec - result_batch_start.tv_sec) * 1000 + (now.tv_usec - result_batch_start.tv_usec) / 1000;
+    if(elapsed >= mod_gm_opt->result_batch_delay)
+        return 0;
+    return mod_gm_opt->result_batch_delay - elapsed;
+}
+
+
+/* add a serialized result to the pending batch */
+static void add_result_to_batch(char * queue, char * data, size_t len, int direct) {
+
+    /* a batch only goes to one result queue */
+    if(result_batch_num > 0 && (strcmp(result_batch_queue, queue) || result_batch_direct != direct))
+        flush_result_batch();
+
+    if(result_batch_num == 0) {
+        result_batch_queue  = gm_strdup(queue);
+        result_batch_direct = direct;
+        gettimeofday(&result_batch_start,NULL);
+    }
+
+    result_batch_append(&result_batch_data, &result_batch_len, &result_batch_size, data, len);
+    if(mod_gm_opt->dupserver_num && mod_gm_opt->dup_results_are_passive) {
+        result_batch_append(&result_batch_dup_data, &result_batch_dup_len, &result_batch_dup_size, GM_PASSIVE_PREFIX, GM_PASSIVE_PREFIX_LEN);
+        result_batch_append(&result_batch_dup_data, &result_batch_dup_len, &result_batch_dup_size, data, len);
+    }
+    result_batch_num++;
+
+    if(result_batch_num >= mod_gm_opt->result_batch_size || result_batch_timeout() == 0)
+        flush_result_batch();
+
+    return;
+}
+
+
 /* send results back */
 void send_result_back(gm_job_t * exec_job) {
-    char * temp_buffer1;
-    char * temp_buffer2;
-    int result_size;
+    char numbers[GM_BUFFERSIZE];
+    char * buf;
+    char * data;
+    char * error = NULL;
+    char * ptr;
+    int direct, batch;
+    size_t prefix_len = 0, host_len, numbers_len, source_len, svc_len = 0, hostname_len = 0, output_len, error_len = 0, result_len;
     gm_log( GM_LOG_TRACE, "send_result_back()\n" );
 
     /* avoid duplicate returned results */
@@ -1556,14 +2350,16 @@ void send_result_back(gm_job_t * exec_job) {
         return;
     }
 
-    result_size  = strlen(exec_job->output)+GM_BUFFERSIZE;
-    temp_buffer1 = gm_malloc(sizeof(char*)*result_size);
-    temp_buffer2 = gm_malloc(sizeof(char*)*result_size);
-
     gm_log( GM_LOG_TRACE, "queue: %s\n", exec_job->result_queue );
-    temp_buffer1[0]='\x0';
-    snprintf( temp_buffer1, result_size-1, "host_name=%s\ncore_start_time=%i.%i\nstart_time=%i.%i\nfinish_time=%i.%i\nreturn_code=%i\nexited_ok=%i\nsource=%s\n",
-              exec_job->host_name,
+
+    /* stderr has already been escaped when reading it from the plugin */
+    if(mod_gm_opt->show_error_output && exec_job->error != NULL && exec_job->error[0] != '\x0') {
+        error     = exec_job->error;
+        error_len = strlen(error);
+    }
+
+    /* calculate the exact size of the result */
+    numbers_len = snprintf( numbers, sizeof(numbers), "\ncore_start_time=%i.%i\nstart_time=%i.%i\nfinish_time=%i.%i\nreturn_code=%i\nexited_ok=%i",
               ( int )exec_job->next_check.tv_sec,
               ( int )exec_job->next_check.tv_usec,
               ( int )exec_job->start_time.tv_sec,
@@ -1571,89 +2367,94 @@ void send_result_back(gm_job_t * exec_job) {
               ( int )exec_job->finish_time.tv_sec,
               ( int )exec_job->finish_time.tv_usec,
               exec_job->return_code,
-              exec_job->exited_ok,
-              exec_job->source
+              exec_job->exited_ok
             );
-    temp_buffer1[result_size-1]='\x0';
-
+    if(exec_job->has_rusage == TRUE)
+        numbers_len += snprintf( numbers+numbers_len, sizeof(numbers)-numbers_len, "\nrusage_utime=%i.%06i\nrusage_stime=%i.%06i\nrusage_maxrss=%li\nrusage_nvcsw=%li\nrusage_nivcsw=%li",
+              ( int )exec_job->rusage.ru_utime.tv_sec,
+              ( int )exec_job->rusage.ru_utime.tv_usec,
+              ( int )exec_job->rusage.ru_stime.tv_sec,
+              ( int )exec_job->rusage.ru_stime.tv_usec,
+              exec_job->rusage.ru_maxrss,
+              exec_job->rusage.ru_nvcsw,
+              exec_job->rusage.ru_nivcsw
+            );
+    numbers_len += snprintf( numbers+numbers_len, sizeof(numbers)-numbers_len, "\nsource=" );
+    host_len   = exec_job->host_name   == NULL ? 0 : strlen(exec_job->host_name);
+    source_len = exec_job->source      == NULL ? 0 : strlen(exec_job->source);
+    output_len = strlen(exec_job->output);
+    if(exec_job->service_description != NULL)
+        svc_len = strlen(exec_job->service_description);
+    if(mod_gm_opt->debug_result)
+        hostname_len = strlen(hostname);
+
+    /* direct results belong to the running job and the core waits for
+     * on-demand results, so both cannot wait for other results */
+    direct = exec_job->direct_result == TRUE && current_gearman_job != NULL && result_batch_bulk == FALSE;
+    batch  = mod_gm_opt->result_batch_size > 1 && direct == FALSE && exec_job->ondemand == FALSE;
+
+    /* reserve room in front for the passive flag of duplicate results */
+    if(mod_gm_opt->dupserver_num && mod_gm_opt->dup_results_are_passive && batch == FALSE)
+        prefix_len = GM_PASSIVE_PREFIX_LEN;
+
+    result_len = prefix_len
+               + 10 + host_len + numbers_len + source_len + 1
+               + (exec_job->service_description != NULL ? 21 + svc_len : 0)
+               + (exec_job->ondemand == TRUE ? 13 : 0)
+               + 7 + (mod_gm_opt->debug_result ? 1 + hostname_len + 4 : 0) + output_len
+               + (error != NULL ? 2 + 1 + error_len + 2 : 0)
+               + 4;
+
+    buf = gm_malloc(result_len+1);
+    ptr = buf;
+#define GM_APPEND(str, len) { memcpy(ptr, (str), (len)); ptr += (len); }
+    if(prefix_len > 0)
+        GM_APPEND(GM_PASSIVE_PREFIX, GM_PASSIVE_PREFIX_LEN);
+    data = ptr;
+    GM_APPEND("host_name=", 10);
+    if(host_len > 0)
+        GM_APPEND(exec_job->host_name, host_len);
+    GM_APPEND(numbers, numbers_len);
+    if(source_len > 0)
+        GM_APPEND(exec_job->source, source_len);
+    GM_APPEND("\n", 1);
     if(exec_job->service_description != NULL) {
-        temp_buffer2[0]='\x0';
-        strcat(temp_buffer2, "service_description=");
-        strcat(temp_buffer2, exec_job->service_description);
-        strcat(temp_buffer2, "\n");
-
-        strcat(temp_buffer1, temp_buffer2);
-    }
-    temp_buffer1[result_size]='\x0';
-
-    if(exec_job->output != NULL) {
-        temp_buffer2[0]='\x0';
-        strcat(temp_buffer2, "output=");
-        if(mod_gm_opt->debug_result) {
-            strcat(temp_buffer2, "(");
-            strcat(temp_buffer2, hostname);
-            strcat(temp_buffer2, ") - ");
-        }
-        strcat(temp_buffer2, exec_job->output);
-        if(mod_gm_opt->show_error_output && exec_job->error != NULL && strlen(exec_job->error) > 0) {
-            if(strlen(exec_job->output) > 0)
-                strcat(temp_buffer2, "\\n");
-            strcat(temp_buffer2, "[");
-            strcat(temp_buffer2, exec_job->error);
-            strcat(temp_buffer2, "] ");
-        }
-        strcat(temp_buffer2, "\n\n\n");
-        strcat(temp_buffer1, temp_buffer2);
-    }
-    strcat(temp_buffer1, "\n");
-    temp_buffer1[result_size]='\x0';
-
-    gm_log( GM_LOG_TRACE, "data:\n%s\n", temp_buffer1);
-
-    if(add_job_to_queue( current_client,
-                         mod_gm_opt->server_list,
-                         exec_job->result_queue,
-                         NULL,
-                         temp_buffer1,
-                         GM_JOB_PRIO_NORMAL,
-                         GM_DEFAULT_JOB_RETRIES,
-                         mod_gm_opt->transportmode,
-                         TRUE
-                        ) == GM_OK) {
-        gm_log( GM_LOG_TRACE, "send_result_back() finished successfully\n" );
+        GM_APPEND("service_description=", 20);
+        GM_APPEND(exec_job->service_description, svc_len);
+        GM_APPEND("\n", 1);
+    }
+    if(exec_job->ondemand == TRUE)
+        GM_APPEND("ondemand=yes\n", 13);
+    GM_APPEND("output=", 7);
+    if(mod_gm_opt->debug_result) {
+        GM_APPEND("(", 1);
+        GM_APPEND(hostname, hostname_len);
+        GM_APPEND(") - ", 4);
+    }
+    GM_APPEND(exec_job->output, output_len);
+    if(error != NULL) {
+        if(output_len > 0)
+            GM_APPEND("\\n", 2);
+        GM_APPEND("[", 1);
+        GM_APPEND(error, error_len);
+        GM_APPEND("] ", 2);
+    }
+    /* results are terminated by empty lines, so they can be concatenated */
+    GM_APPEND("\n\n\n\n", 4);
+#undef GM_APPEND
+    *ptr = '\x0';
+
+    if(batch == TRUE) {
+        add_result_to_batch(exec_job->result_queue, data, ptr - data, direct);
+    }
+    else if(direct == TRUE) {
+        send_result_direct(exec_job->result_queue, data, prefix_len > 0 ? buf : data);
     }
     else {
-        gm_log( GM_LOG_TRACE, "send_result_back() finished unsuccessfully\n" );
+        send_result_payload(exec_job->result_queue, data, prefix_len > 0 ? buf : data);
     }
 
-    if( mod_gm_opt->dupserver_num ) {
-        temp_buffer2[0]='\x0';
-        if(mod_gm_opt->dup_results_are_passive) {
-            strcat(temp_buffer2, "type=passive\n");
-        }
-        strcat(temp_buffer2, temp_buffer1);
-        temp_buffer2[result_size]='\x0';
-        if( add_job_to_queue( current_client_dup,
-                              mod_gm_opt->dupserver_list,
-                              exec_job->result_queue,
-                              NULL,
-                              temp_buffer2,
-                              GM_JOB_PRIO_NORMAL,
-                              GM_DEFAULT_JOB_RETRIES,
-                              mod_gm_opt->transportmode,
-                              TRUE
-                            ) == GM_OK) {
-            gm_log( GM_LOG_TRACE, "send_result_back() finished successfully for duplicate server.\n" );
-        }
-        else {
-            gm_log( GM_LOG_TRACE, "send_result_back() finished unsuccessfully for duplicate server\n" );
-        }
-    }
-    else {
-        gm_log( GM_LOG_TRACE, "send_result_back() has no duplicate servers to send to.\n" );
-    }
-    free(temp_buffer1);
-    free(temp_buffer2);
+    free(buf);
     return;
 }
 
@@ -1675,7 +2476,7 @@ char *md5sum(char *text) {
 }
 
 /* add parsed server to list */
-void add_server(int * server_num, gm_server_t * server_list[GM_LISTSIZE], char * servername) {
+void add_server(int * server_num, gm_server_t *** server_list, char * servername) {
     gm_server_t *new_server;
     char * server   = gm_strdup( servername );
     char * server_c = server;
@@ -1692,9 +2493,11 @@ void add_server(int * server_num, gm_server_t * server_list[GM_LISTSIZE], char *
         new_server->host = gm_strdup(host);
     }
     new_server->port = port;
-    if(check_param_server(new_server, server_list, *server_num) == GM_OK) {
-        server_list[*server_num] = new_server;
+    if(check_param_server(new_server, *server_list, *server_num) == GM_OK) {
+        *server_list = gm_realloc(*server_list, (*server_num + 2) * sizeof(gm_server_t *));
+        (*server_list)[*server_num] = new_server;
         *server_num = *server_num + 1;
+        (*server_list)[*server_num] = NULL;
     } else {
         free(new_server->host);
         free(new_server);
@@ -1703,6 +2506,24 @@ void add_server(int * server_num, gm_server_t * server_list[GM_LISTSIZE], char *
     return;
 }
 
+
+/* add a copy of item to a NULL terminated list and its position to the index */
+int add_list_item(char *** list, int * num, gm_hash_t * index, const char * item) {
+    if(item == NULL)
+        return(GM_ERROR);
+
+    /* skip duplicates */
+    if(index != NULL && gm_hash_add(index, item, *num) != GM_OK)
+        return(GM_ERROR);
+
+    *list = gm_realloc(*list, (*num + 2) * sizeof(char *));
+    (*list)[*num] = gm_strdup(item);
+    *num = *num + 1;
+    (*list)[*num] = NULL;
+
+    return(GM_OK);
+}
+
 /* check if string starts with another string */
 int starts_with(const char *pre, const char *str) {
     size_t lenpre = strlen(pre),
@@ -12,6 +12,24 @@
  * @{
  */
 
+/* vectorized implementations are selected at runtime */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define GM_BASE64_SIMD
+#endif
+
+#define BASE64_SCALAR   0   /**< table driven implementation */
+#define BASE64_SSSE3    1   /**< 16 characters per step */
+#define BASE64_AVX2     2   /**< 32 characters per step */
+
+/**
+ * select the base64 implementation
+ *
+ * @param level BASE64_SCALAR, BASE64_SSSE3, BASE64_AVX2 or -1 for the best supported one
+ * @return the level which is used from now on
+ */
+int base64_set_simd(int level);
+
 
 /**
  * encode three bytes using base64 (RFC 3548)
@@ -32,6 +50,17 @@ void _base64_encode_triple(unsigned char triple[3], char result[4]);
  */
 int base64_encode(unsigned char *source, size_t sourcelen, char *target, size_t targetlen);
 
+/**
+ * encode an array of bytes without size check. Parts with a multiple of three
+ * bytes can be encoded one after another and simply be concatenated.
+ *
+ * @param source the source buffer
+ * @param sourcelen the length of the source buffer
+ * @param target the target buffer, must hold (sourcelen+2)/3*4+1 characters
+ * @return number of characters written, not counting the terminating zero
+ */
+size_t base64_encode_part(const unsigned char *source, size_t sourcelen, char *target);
+
 /**
  * determine the value of a base64 encoding character
  *
@@ -59,6 +88,18 @@ int _base64_decode_triple(char quadruple[4], unsigned char *result);
  */
 size_t base64_decode(char *source, unsigned char *target, size_t targetlen);
 
+/**
+ * decode the next part of base64 encoded data
+ *
+ * @param source pointer to the encoded data (zero terminated), will be advanced
+ * @param end pointer to the terminating zero of the encoded data
+ * @param target pointer to the target buffer
+ * @param targetlen length of the target buffer, should be a multiple of three
+ * @return length of converted data, less than targetlen once the end of the
+ *         data has been reached
+ */
+size_t base64_decode_part(char **source, char *end, unsigned char *target, size_t targetlen);
+
 /**
  * @}
  */
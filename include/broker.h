@@ -0,0 +1,155 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief header for the worker job broker
+ *
+ *  In broker mode only two processes per worker host talk to gearmand.
+ *  The job broker fetches jobs and hands them to idle children, the
+ *  result broker sends back the results collected from the children.
+ *  All processes share local unix sockets created by the supervisor.
+ *
+ *  @{
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <libgearman/gearman.h>
+
+#include "common.h"
+
+#define GM_BROKER_MAX_MESSAGE   (4*GM_BUFFERSIZE)   /**< largest job or result passed through the broker sockets */
+#define GM_BROKER_BACKLOG_POLL  50                  /**< ms the job broker waits for gearmand while jobs are in its backlog */
+
+int broker_job_fd[2];           /**< jobs from the job broker to the children */
+int broker_result_fd[2];        /**< results from the children to the result broker */
+int broker_idle_fd[2];          /**< idle announcements from the children to the job broker */
+
+/**
+ * broker_setup
+ *
+ * create the sockets shared by brokers and children. Must be called
+ * by the supervisor before any child is forked.
+ *
+ * @return GM_OK on success or GM_ERROR
+ */
+int broker_setup(void);
+
+/**
+ * broker_dispatch
+ *
+ * pass jobs from the backlog to idle children, earliest deadline
+ * first. Returns once the job broker may fetch the next job from
+ * gearmand. Without backlog this blocks until a child is idle.
+ *
+ * @param[in] w - gearman worker of the job broker
+ *
+ * @return nothing
+ */
+void broker_dispatch(gearman_worker_st * w);
+
+/**
+ * broker_flush_backlog
+ *
+ * pass all jobs left in the backlog to the children before the job
+ * broker exits
+ *
+ * @return nothing
+ */
+void broker_flush_backlog(void);
+
+/**
+ * broker_get_job
+ *
+ * gearman callback of the job broker, passes the job unchanged to an
+ * idle child or puts it into the backlog
+ *
+ * @param[in] job - gearman job
+ * @param[in] context - unused
+ * @param[out] result_size - size of the result
+ * @param[out] ret_ptr - gearman return code
+ *
+ * @return NULL
+ */
+void *broker_get_job( gearman_job_st *job, void *context, size_t *result_size, gearman_return_t *ret_ptr );
+
+/**
+ * broker_result_loop
+ *
+ * main loop of the result broker, sends all results received from the
+ * children to gearmand
+ *
+ * @return nothing
+ */
+void broker_result_loop(void);
+
+/**
+ * broker_announce_idle
+ *
+ * tell the job broker that this child is waiting for a job
+ *
+ * @return nothing
+ */
+void broker_announce_idle(void);
+
+/**
+ * broker_withdraw_idle
+ *
+ * take back an idle announcement before an idle child exits
+ *
+ * @return nothing
+ */
+void broker_withdraw_idle(void);
+
+/**
+ * broker_recv_job
+ *
+ * wait for the next job from the job broker
+ *
+ * @param[out] buf - buffer of GM_BROKER_MAX_MESSAGE+1 bytes
+ * @param[out] handle - pointer to the gearman job handle inside buf
+ * @param[out] queue - pointer to the queue name inside buf
+ * @param[out] workload - pointer to the encoded workload inside buf
+ * @param[out] wsize - size of the encoded workload
+ * @param[in] timeout - max milliseconds to wait, -1 waits forever
+ *
+ * @return GM_OK if a job has been received, GM_ERROR otherwise
+ */
+int broker_recv_job(char * buf, char ** handle, char ** queue, char ** workload, int * wsize, int timeout);
+
+/**
+ * broker_send_result
+ *
+ * pass a result to the result broker
+ *
+ * @param[in] queue - result queue
+ * @param[in] data - result payload
+ * @param[in] dup_data - payload for the duplicate servers
+ *
+ * @return GM_OK on success or GM_ERROR if the result has to be sent directly
+ */
+int broker_send_result(char * queue, char * data, char * dup_data);
+
+/**
+ * @}
+ */
@@ -31,6 +31,9 @@
 #include "common.h"
 #include <fcntl.h>
 
+#define GM_TIMEOUT_KILL_GRACE     1000  /**< milliseconds between SIGTERM and SIGKILL for timed out plugins */
+#define GM_MAX_TIMED_OUT_CHECKS     64  /**< number of timed out plugins waiting for their SIGKILL */
+
 /**
  * nr2signal
  *
@@ -66,6 +69,19 @@ char *extract_check_result(FILE *fp, int trimmed);
  */
 int parse_command_line(char *cmd, char *argv[GM_LISTSIZE]);
 
+/**
+ * check_restricted_command
+ *
+ * verify a command line against restrict_path and
+ * restrict_command_characters
+ *
+ * @param[in] command_line - command line of the check
+ * @param[out] output - error message if the command is not allowed, may be NULL
+ *
+ * @return GM_OK if the command may be run, GM_ERROR otherwise
+ */
+int check_restricted_command(const char * command_line, char ** output);
+
 /**
  * run_check
  *
@@ -93,6 +109,19 @@ int run_check(char *processed_command, char **plugin_output, char **plugin_error
  */
 int execute_safe_command(gm_job_t * exec_job, int fork_exec, char * identifier);
 
+/**
+ * finish_check_result
+ *
+ * set finish time and source of an executed job and replace the output
+ * if the job exceeded its timeout
+ *
+ * @param[in] exec_job - job structure
+ * @param[in] identifier - current worker identifier
+ *
+ * @return nothing
+ */
+void finish_check_result(gm_job_t * exec_job, char * identifier);
+
 /**
  *
  * kill_child_checks
@@ -103,6 +132,28 @@ int execute_safe_command(gm_job_t * exec_job, int fork_exec, char * identifier);
  */
 void kill_child_checks(void);
 
+/**
+ * reap_timed_out_checks
+ *
+ * reap timed out plugins and send a SIGKILL to the ones which
+ * did not exit within GM_TIMEOUT_KILL_GRACE after their SIGTERM.
+ * Killed plugins which do not exit are reaped by later calls.
+ *
+ * @param[in] wait - wait until all timed out plugins are gone
+ *
+ * @return milliseconds until the next escalation or -1 if nothing is pending
+ */
+int reap_timed_out_checks(int wait);
+
+/**
+ * setup_plugin_process
+ *
+ * prepare the forked plugin process right before the plugin is executed
+ *
+ * @return nothing
+ */
+void setup_plugin_process(void);
+
 /**
  *
  * check_alarm_handler
@@ -47,8 +47,10 @@
 
 #include <config.h>
 #include <gm_alloc.h>
+#include <gm_hash.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <arpa/inet.h>
 
 #ifndef MOD_GM_COMMON_H
@@ -109,6 +111,10 @@
 #define GM_DEFAULT_JOB_MAX_AGE          0      /**< discard jobs older than that         */
 #define GM_DEFAULT_SPAWN_RATE           1      /**< number of spawned worker per seconds */
 #define GM_DEFAULT_WORKER_LOOP_SLEEP    1      /**< sleep in worker main loop */
+#define GM_DEFAULT_RESULT_BATCH_SIZE    1      /**< number of results sent in one job */
+#define GM_DEFAULT_RESULT_BATCH_DELAY   5      /**< max delay in ms for batched results */
+#define GM_DEFAULT_BULK_JOB_SIZE        1      /**< number of checks sent in one job */
+#define GM_DEFAULT_BULK_JOB_WINDOW     10      /**< max delay in ms for checks waiting for their bulk job */
 
 /* transport modes */
 #define GM_ENCODE_AND_ENCRYPT           1
@@ -128,6 +134,10 @@
 #define GM_PERFDATA_OVERWRITE           1
 #define GM_PERFDATA_APPEND              2
 
+/* cgroup limit scopes */
+#define GM_CGROUP_SCOPE_CHECK           1
+#define GM_CGROUP_SCOPE_QUEUE           2
+
 
 #ifndef TRUE
 #define TRUE                            1
@@ -145,7 +155,7 @@
 #define STATE_CRITICAL                  2    /**< core exit code for critical */
 #define STATE_UNKNOWN                   3    /**< core exit code for unknown  */
 
-#define GM_SHM_SIZE                  4096    /**< size of the shared memory segment */
+#define GM_SHM_SIZE                  12288   /**< size of the shared memory segment */
 
 /** options exports structure
  *
@@ -179,22 +189,26 @@ typedef struct mod_gm_opt_struct {
 
     char         * crypt_key;                               /**< encryption key used for securing the messages sent over gearman */
     char         * keyfile;                                 /**< path to a file where the crypt_key is read from */
-    gm_server_t  * server_list[GM_LISTSIZE];                /**< list of gearmand servers */
+    gm_server_t ** server_list;                             /**< NULL terminated list of gearmand servers */
     int            server_num;                              /**< number of gearmand servers */
-    gm_server_t  * dupserver_list[GM_LISTSIZE];             /**< list of gearmand servers to duplicate results */
+    gm_server_t ** dupserver_list;                          /**< NULL terminated list of gearmand servers to duplicate results */
     int            dupserver_num;                           /**< number of duplicate gearmand servers */
-    char         * hostgroups_list[GM_LISTSIZE];            /**< list of hostgroups which get own queues */
+    char        ** hostgroups_list;                         /**< NULL terminated list of hostgroups which get own queues */
+    gm_hash_t    * hostgroups_index;                        /**< position of each hostgroup in hostgroups_list */
     int            hostgroups_num;                          /**< number of elements in hostgroups_list */
-    char         * servicegroups_list[GM_LISTSIZE];         /**< list of servicegroups which get own queues */
+    char        ** servicegroups_list;                      /**< NULL terminated list of servicegroups which get own queues */
+    gm_hash_t    * servicegroups_index;                     /**< position of each servicegroup in servicegroups_list */
     int            servicegroups_num;                       /**< number of elements in servicegroups_list */
     int            debug_level;                             /**< level of debug output */
     int            hosts;                                   /**< flag wheter host checks are distributed or not */
     int            services;                                /**< flag wheter service checks are distributed or not */
     int            events;                                  /**< flag wheter eventhandlers are distributed or not */
     int            notifications;                           /**< flag wheter notifications are distributed or not */
-    int            job_timeout;                             /**< override job timeout */
+    double         job_timeout;                             /**< override job timeout in seconds, fractions are allowed */
     int            encryption;                              /**< flag wheter messages are encrypted */
     int            transportmode;                           /**< flag for the transportmode, base64 only or base64 and encrypted  */
+    int            binary_transport;                        /**< flag whether jobs and results are sent in the binary format */
+    int            compression_threshold;                   /**< compress payloads of at least this size, 0 disables compression */
     int            logmode;                                 /**< logmode: auto, syslog, file or core */
     char         * logfile;                                 /**< path for the logfile */
     FILE         * logfile_fp;                              /**< filedescriptor for the logfile */
@@ -205,11 +219,13 @@ typedef struct mod_gm_opt_struct {
     int            perfdata;                                /**< flag whether perfdata will be distributed or not */
     int            perfdata_mode;                           /**< flag whether perfdata will be sent with/without uniq set */
     int            perfdata_send_all;                       /**< flag whether perfdata will be sent to all queues */
-    char         * perfdata_queues_list[GM_LISTSIZE];       /**< list of perfdata queue names */
+    char        ** perfdata_queues_list;                    /**< NULL terminated list of perfdata queue names */
     int            perfdata_queues_num;                     /**< number of perfdata queues */
-    char         * local_hostgroups_list[GM_LISTSIZE];      /**< list of hostgroups which will not be distributed */
+    char        ** local_hostgroups_list;                   /**< NULL terminated list of hostgroups which will not be distributed */
+    gm_hash_t    * local_hostgroups_index;                  /**< position of each hostgroup in local_hostgroups_list */
     int            local_hostgroups_num;                    /**< number of elements in local_hostgroups_list */
-    char         * local_servicegroups_list[GM_LISTSIZE];   /**< list of group  which will not be distributed */
+    char        ** local_servicegroups_list;                /**< NULL terminated list of group  which will not be distributed */
+    gm_hash_t    * local_servicegroups_index;               /**< position of each servicegroup in local_servicegroups_list */
     int            local_servicegroups_num;                 /**< number of elements in local_servicegroups_list */
     int            do_hostchecks;                           /**< flag whether mod-gearman will process hostchecks at all */
     int            route_eventhandler_like_checks;          /**< flag whether mod-gearman will route like normal checks */
@@ -244,10 +260,57 @@ typedef struct mod_gm_opt_struct {
     int            use_perl_cache;                          /**< cache embedded perl scripts */
     char         * p1_file;                                 /**< path to p1 file, needed for embedded perl */
 #endif
-    char         * restrict_path[GM_LISTSIZE];              /**< list of path restrictions */
+    char        ** restrict_path;                           /**< NULL terminated list of path restrictions */
+    gm_trie_t    * restrict_path_trie;                      /**< prefix trie of all path restrictions */
     int            restrict_path_num;                       /**< number of path restrictions */
     char         * restrict_command_characters;             /**< forbidden characters in command lines */
     int            workaround_rc_25;                        /**< optional workaround for plugins returning exit code 25 */
+    int            result_batch_size;                       /**< number of results combined into one result job */
+    int            result_batch_delay;                      /**< max milliseconds a result waits for its batch */
+    int            broker_mode;                             /**< flag whether only the brokers talk to gearmand */
+    int            job_deadline;                            /**< seconds after next_check a job must be started */
+    int            job_backlog;                             /**< number of jobs the job broker keeps ordered by deadline */
+    int            promote_latency_normal;                  /**< latency in seconds after which checks get normal priority */
+    int            promote_latency_high;                    /**< latency in seconds after which checks get high priority */
+    int            bulk_job_size;                           /**< number of checks combined into one bulk job */
+    int            bulk_job_window;                         /**< max milliseconds a check waits for its bulk job */
+    char        ** bulk_job_queues_list;                    /**< NULL terminated list of queues with their own bulk job settings */
+    gm_hash_t    * bulk_job_queue_sizes;                    /**< bulk job size of each queue in bulk_job_queues_list */
+    gm_hash_t    * bulk_job_queue_windows;                  /**< bulk job window of each queue in bulk_job_queues_list */
+    int            bulk_job_queues_num;                     /**< number of elements in bulk_job_queues_list */
+    int            direct_results;                          /**< receive check results as completion data of foreground jobs */
+    int            submit_rate;                             /**< max host and service checks per second and queue, 0 disables pacing */
+    int            submit_burst;                            /**< number of checks a queue may send at once before pacing starts */
+    char        ** submit_rate_queues_list;                 /**< NULL terminated list of queues with their own submit rate */
+    gm_hash_t    * submit_rate_queue_rates;                 /**< submit rate of each queue in submit_rate_queues_list */
+    gm_hash_t    * submit_rate_queue_bursts;                /**< submit burst of each queue in submit_rate_queues_list */
+    int            submit_rate_queues_num;                  /**< number of elements in submit_rate_queues_list */
+    char         * journal_file;                            /**< path of the journal of in-flight checks, NULL disables the journal */
+    int            journal_max_age;                         /**< age in seconds after which journaled checks are considered lost */
+    int            target_limit;                            /**< max concurrent checks per host */
+    char        ** target_limit_hostgroups_list;            /**< NULL terminated list of hostgroups with their own per host limit */
+    gm_hash_t    * target_limit_hostgroups;                 /**< per host limit of each hostgroup in target_limit_hostgroups_list */
+    int            target_limit_hostgroups_num;             /**< number of elements in target_limit_hostgroups_list */
+    int            result_cache_ttl;                        /**< seconds a cached plugin result may be reused */
+    char        ** result_cache_commands;                   /**< NULL terminated list of commands whose results may be cached */
+    gm_trie_t    * result_cache_commands_trie;              /**< prefix trie of all result_cache_commands */
+    int            result_cache_commands_num;               /**< number of elements in result_cache_commands */
+    char         * result_spool;                            /**< path of the spool file for results which could not be sent */
+    int            result_spool_size;                       /**< size of the result spool in megabytes */
+    int            plugin_rusage;                           /**< flag whether resource usage of plugins is collected and returned */
+    char         * cgroup_root;                             /**< cgroup v2 directory for the plugin cgroups, NULL disables cgroups */
+    int            cgroup_scope;                            /**< apply the cgroup limits per check or per queue */
+    int            cgroup_cpu_weight;                       /**< cpu.weight of the plugin cgroups, 0 keeps the default */
+    int            cgroup_memory_max;                       /**< memory.max of the plugin cgroups in megabytes, 0 is unlimited */
+    int            cgroup_pids_max;                         /**< pids.max of the plugin cgroups, 0 is unlimited */
+    int            icmp_engine;                             /**< flag whether host alive checks are run by the icmp engine */
+    char        ** icmp_commands;                           /**< NULL terminated list of commands run by the icmp engine */
+    gm_trie_t    * icmp_commands_trie;                      /**< prefix trie of all icmp_commands */
+    int            icmp_commands_num;                       /**< number of elements in icmp_commands */
+    char        ** plugin_modules;                          /**< NULL terminated list of plugin modules to load */
+    int            plugin_modules_num;                      /**< number of elements in plugin_modules */
+    int            plugin_isolation;                        /**< flag whether plugin module checks run in a helper process */
+    int            builtin_checks;                          /**< flag whether @tcp, @http and @dns checks are run */
 /* send_gearman */
     int            timeout;                                 /**< timeout for waiting reading on stdin */
     int            return_code;                             /**< return code */
@@ -283,13 +346,17 @@ typedef struct gm_job_struct {
     int            scheduled_check;     /**< normal scheduled check? */
     int            reschedule_check;    /**< rescheduled check? */
     int            exited_ok;           /**< did the plugin exit normally? */
-    int            timeout;             /**< timeout for this job */
+    double         timeout;             /**< timeout for this job in seconds, fractions are allowed */
     double         latency;             /**< latency for from this job */
     struct timeval next_check;          /**< next_check value of host / service */
     struct timeval core_time;           /**< time when the core started the job */
     struct timeval start_time;          /**< time when the job really started */
     struct timeval finish_time;         /**< time when the job was finished */
     int            has_been_sent;       /**< flag if job has been sent back */
+    int            direct_result;       /**< return the result as completion data of the gearman job */
+    int            ondemand;            /**< on-demand host check the core is waiting for */
+    int            has_rusage;          /**< flag whether rusage has been collected */
+    struct rusage  rusage;              /**< resource usage of the plugin */
 } gm_job_t;
 
 
@@ -6,6 +6,8 @@
 #include <stddef.h>
 #include <include/utils.h>
 
+extern unsigned long gm_alloc_count; /* number of allocations, not thread safe, used by tests */
+
 void *gm_malloc(size_t size);
 void *gm_realloc(void *ptr, size_t size);
 void *gm_calloc(size_t count, size_t size);
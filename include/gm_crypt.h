@@ -35,6 +35,13 @@
 
 #define KEYBITS     256     /**< key size */
 #define BLOCKSIZE    16     /**< block size for encryption */
+#define GM_CRYPT_CHUNK 3072 /**< chunk size for streaming en/decoding, multiple of BLOCKSIZE and 3 */
+
+/* aes instructions are used if the cpu supports them */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define GM_AESNI
+#endif
 
 /**
  * initialize crypto module
@@ -45,6 +52,23 @@
  */
 void mod_gm_aes_init(char * password);
 
+/**
+ * check for hardware aes support
+ *
+ * @return true if the cpu supports the aes instructions
+ */
+int mod_gm_aes_hw_available(void);
+
+/**
+ * enable or disable the aes instructions, mainly for tests and
+ * benchmarks. Both implementations produce the same output.
+ *
+ * @param[in] enable - use aes instructions if available
+ *
+ * @return true if aes instructions are used now
+ */
+int mod_gm_aes_use_hw(int enable);
+
 /**
  * encrypt text
  *
@@ -55,10 +79,30 @@ void mod_gm_aes_init(char * password);
  */
 int mod_gm_aes_encrypt(unsigned char ** encrypted, char * text);
 
+/**
+ * encrypt blocks in place
+ *
+ * @param[in,out] data - data which should be encrypted
+ * @param[in] blocks   - number of blocks
+ *
+ * @return nothing
+ */
+void mod_gm_aes_encrypt_blocks(unsigned char * data, int blocks);
+
+/**
+ * decrypt blocks in place
+ *
+ * @param[in,out] data - data which should be decrypted
+ * @param[in] blocks   - number of blocks
+ *
+ * @return nothing
+ */
+void mod_gm_aes_decrypt_blocks(unsigned char * data, int blocks);
+
 /**
  * decrypt text
  *
- * @param[out] decrypted - pointer to decrypted text
+ * @param[out] decrypted - pointer to decrypted text, must hold at least size+1 bytes
  * @param[in] encrypted  - text which should be decrypted
  * @param[in] size       - size of encrypted text
  *
@@ -0,0 +1,142 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/** @file
+ *  @brief hash tables and prefix tries for configuration lists
+ *
+ *  @{
+ */
+
+#ifndef _GM_HASH_H
+#define _GM_HASH_H
+
+#include <stddef.h>
+
+/** hash table entry */
+typedef struct gm_hash_entry_struct {
+    char * key;                     /**< key of this entry, NULL for unused entries */
+    int    value;                   /**< value stored for the key */
+} gm_hash_entry_t;
+
+/** hash table from strings to int values */
+typedef struct gm_hash_struct {
+    gm_hash_entry_t * entries;      /**< open addressing table */
+    size_t            size;         /**< number of entries, always a power of two */
+    size_t            num;          /**< number of used entries */
+} gm_hash_t;
+
+/** node of a prefix trie */
+typedef struct gm_trie_struct {
+    unsigned char           chr;        /**< character of this node */
+    int                     terminal;   /**< flag whether a prefix ends here */
+    struct gm_trie_struct * child;      /**< first node of the next character */
+    struct gm_trie_struct * next;       /**< next node with the same parent */
+} gm_trie_t;
+
+/**
+ * gm_hash_new
+ *
+ * create an empty hash table
+ *
+ * @return new hash table
+ */
+gm_hash_t * gm_hash_new(void);
+
+/**
+ * gm_hash_add
+ *
+ * add a key unless it exists already
+ *
+ * @param[in] hash - hash table
+ * @param[in] key - key to add, will be copied
+ * @param[in] value - value for this key
+ *
+ * @return GM_OK if the key has been added or GM_ERROR if it existed already
+ */
+int gm_hash_add(gm_hash_t * hash, const char * key, int value);
+
+/**
+ * gm_hash_get
+ *
+ * look up a key
+ *
+ * @param[in] hash - hash table, may be NULL
+ * @param[in] key - key to look up
+ * @param[in] dfl - returned if the key does not exist
+ *
+ * @return value of the key or dfl
+ */
+int gm_hash_get(gm_hash_t * hash, const char * key, int dfl);
+
+/**
+ * gm_hash_free
+ *
+ * free a hash table and all its keys
+ *
+ * @param[in] hash - hash table, may be NULL
+ *
+ * @return nothing
+ */
+void gm_hash_free(gm_hash_t * hash);
+
+/**
+ * gm_trie_add
+ *
+ * add a prefix to a trie
+ *
+ * @param[in] trie - pointer to the root of the trie, may point to NULL
+ * @param[in] prefix - prefix to add
+ *
+ * @return nothing
+ */
+void gm_trie_add(gm_trie_t ** trie, const char * prefix);
+
+/**
+ * gm_trie_match
+ *
+ * check whether a string starts with any prefix of the trie
+ *
+ * @param[in] trie - root of the trie, may be NULL
+ * @param[in] str - string to check
+ *
+ * @return true if a prefix matches
+ */
+int gm_trie_match(gm_trie_t * trie, const char * str);
+
+/**
+ * gm_trie_free
+ *
+ * free a trie
+ *
+ * @param[in] trie - root of the trie, may be NULL
+ *
+ * @return nothing
+ */
+void gm_trie_free(gm_trie_t * trie);
+
+#endif
+
+/**
+ * @}
+ */
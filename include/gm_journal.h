@@ -0,0 +1,121 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/** @file
+ *  @brief journal of in-flight host and service checks
+ *
+ *  The neb module appends every submitted check to a memory mapped
+ *  file and marks it done once its result arrives. Checks which are
+ *  still in flight when the core stops or crashes are read back after
+ *  the next start. Their results are adopted and the core does not
+ *  run them again, unless they are older than the max age.
+ *
+ *  file:   magic(8) used bytes(8) records
+ *  record: size(4) state(4) next_check(8) core_time(8+8)
+ *          host name \0 service description \0, padded to 8 bytes
+ *
+ *  @{
+ */
+
+#ifndef _GM_JOURNAL_H
+#define _GM_JOURNAL_H
+
+#include <sys/time.h>
+
+#define GM_JOURNAL_SIZE         8388608     /**< size of the journal file */
+#define GM_JOURNAL_MAGIC        "GMJRNL1"   /**< first bytes of a journal file */
+
+#define GM_JOURNAL_NONE         0           /**< check is not journaled */
+#define GM_JOURNAL_CURRENT      1           /**< check has been submitted by this core */
+#define GM_JOURNAL_ADOPTED      2           /**< check of a previous core which is still in flight */
+#define GM_JOURNAL_EXPIRED      3           /**< check of a previous core which is too old */
+
+/**
+ * gm_journal_open
+ *
+ * map the journal file and read back the checks which were in flight
+ * when the previous core stopped.
+ *
+ * @param[in] path    - journal file, will be created if it does not exist
+ * @param[in] max_age - seconds after which journaled checks are too old
+ *
+ * @return GM_OK on success or GM_ERROR
+ */
+int gm_journal_open(const char * path, int max_age);
+
+/**
+ * gm_journal_add
+ *
+ * journal a submitted check
+ *
+ * @param[in] host_name           - host name
+ * @param[in] service_description - service description or NULL for host checks
+ * @param[in] next_check          - scheduled time of the check
+ * @param[in] core_time           - time the check has been submitted
+ *
+ * @return GM_OK on success or GM_ERROR if the journal is closed or full
+ */
+int gm_journal_add(const char * host_name, const char * service_description, time_t next_check, struct timeval * core_time);
+
+/**
+ * gm_journal_done
+ *
+ * mark the check of a received result as done
+ *
+ * @param[in] host_name           - host name
+ * @param[in] service_description - service description or NULL for host checks
+ * @param[in] next_check          - scheduled time of the check as returned by the worker
+ *
+ * @return GM_JOURNAL_NONE, GM_JOURNAL_CURRENT, GM_JOURNAL_ADOPTED or GM_JOURNAL_EXPIRED
+ */
+int gm_journal_done(const char * host_name, const char * service_description, time_t next_check);
+
+/**
+ * gm_journal_in_flight
+ *
+ * check whether a check of a previous core is still in flight, so
+ * the core must not run it again
+ *
+ * @param[in] host_name           - host name
+ * @param[in] service_description - service description or NULL for host checks
+ *
+ * @return true if an adopted check is in flight
+ */
+int gm_journal_in_flight(const char * host_name, const char * service_description);
+
+/**
+ * gm_journal_close
+ *
+ * log statistics and unmap the journal, checks still in flight remain
+ * in the file
+ *
+ * @return nothing
+ */
+void gm_journal_close(void);
+
+#endif
+
+/**
+ * @}
+ */
@@ -0,0 +1,88 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/** @file
+ *  @brief token buckets to pace the submission of checks per queue
+ *
+ *  Every queue with a submit rate gets a token bucket which is
+ *  refilled with rate tokens per second up to its burst size. Checks
+ *  which find the bucket empty are deferred in their original order
+ *  and released once tokens are available again. Released checks get
+ *  a new core_time, the delay is intended and must not count against
+ *  max_age on the workers.
+ *
+ *  @{
+ */
+
+#ifndef _GM_PACE_H
+#define _GM_PACE_H
+
+/** send a check to gearmand, returns GM_OK on success */
+typedef int (*gm_pace_submit_t)(char * queue, char * uniq, char * data, int prio);
+
+/**
+ * gm_pace_check
+ *
+ * send a check if the token bucket of its queue allows it, otherwise
+ * defer it until tokens are available
+ *
+ * @param[in] queue  - queue name
+ * @param[in] rate   - checks per second, checks are sent right away if zero
+ * @param[in] burst  - size of the token bucket
+ * @param[in] uniq   - unique id of the check or NULL
+ * @param[in] data   - job data
+ * @param[in] prio   - job priority
+ * @param[in] submit - function to send the check
+ *
+ * @return result of submit or GM_OK if the check has been deferred
+ */
+int gm_pace_check(char * queue, int rate, int burst, char * uniq, char * data, int prio, gm_pace_submit_t submit);
+
+/**
+ * gm_pace_release
+ *
+ * refill the token buckets and send deferred checks
+ *
+ * @param[in] all    - send all deferred checks regardless of their tokens
+ * @param[in] submit - function to send the checks
+ *
+ * @return number of checks which are still deferred
+ */
+int gm_pace_release(int all, gm_pace_submit_t submit);
+
+/**
+ * gm_pace_free
+ *
+ * log statistics and free all queues, deferred checks have to be
+ * released before
+ *
+ * @return nothing
+ */
+void gm_pace_free(void);
+
+#endif
+
+/**
+ * @}
+ */
@@ -0,0 +1,114 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/** @file
+ *  @brief binary transport format
+ *
+ *  Jobs and results are sent as length prefixed binary records instead of
+ *  base64 encoded text. A binary payload starts with a version byte which
+ *  can never be the first character of a base64 payload, so both formats
+ *  can be told apart and are accepted at the same time.
+ *
+ *  frame:  version(1) flags(1) body length(4, big endian) body
+ *  body:   records, padded to full aes blocks and encrypted if flagged
+ *          compressed bodies start with the size of the records (4, big
+ *          endian) followed by the zlib compressed records
+ *  record: GM_WIRE_FIELD key length(1) key \0 value length(4) value \0
+ *          GM_WIRE_END ends one result of a multi-result job
+ *
+ *  @{
+ */
+
+#ifndef _GM_WIRE_H
+#define _GM_WIRE_H
+
+#define GM_WIRE_VERSION         0x01        /**< first byte of a binary payload */
+#define GM_WIRE_ENCRYPTED       0x01        /**< flag for an aes encrypted body */
+#define GM_WIRE_COMPRESSED      0x02        /**< flag for a zlib compressed body */
+#define GM_WIRE_MAX_RECORDS     (64*GM_BUFFERSIZE) /**< max size of decompressed records */
+#define GM_WIRE_HEADER_SIZE     6           /**< version, flags and body length */
+#define GM_WIRE_FIELD           0x1f        /**< starts a key/value record */
+#define GM_WIRE_END             0x1e        /**< separates multiple results */
+#define GM_WIRE_NULL            0xffffffff  /**< value length of a key without value */
+
+/** compression statistics of this process */
+typedef struct gm_wire_stats_struct {
+    unsigned long long compressed;          /**< number of compressed payloads */
+    unsigned long long raw_bytes;           /**< size of these payloads before compression */
+    unsigned long long compressed_bytes;    /**< size of these payloads after compression */
+    unsigned long long usec;                /**< cpu time spent for compression and decompression */
+} gm_wire_stats_t;
+
+extern gm_wire_stats_t gm_wire_stats;      /**< compression statistics */
+
+/**
+ * gm_wire_encode
+ *
+ * convert a text payload of key=value lines into a binary frame
+ *
+ * @param[out] encoded - pointer to the allocated frame
+ * @param[in] text     - key=value lines, an empty line ends a result
+ * @param[in] encrypt  - encrypt the body
+ * @param[in] compress - compress the body unless that does not make it smaller
+ *
+ * @return size of the frame or -1 if a key is longer than 255 bytes
+ */
+int gm_wire_encode(char ** encoded, char * text, int encrypt, int compress);
+
+/**
+ * gm_wire_decode
+ *
+ * check, decrypt and decompress a binary frame. Unencrypted frames are only
+ * accepted if the transport mode allows clear text.
+ *
+ * @param[in,out] decoded - records followed by a zero byte, needs size bytes.
+ *                          Replaced by a larger buffer for compressed frames
+ * @param[in] data     - the binary frame
+ * @param[in] size     - size of the frame
+ * @param[in] mode     - transport mode
+ *
+ * @return GM_OK on success, GM_ERROR for invalid frames
+ */
+int gm_wire_decode(char ** decoded, char * data, int size, int mode);
+
+/**
+ * gm_wire_next
+ *
+ * get the next key/value pair of a decoded text or binary payload. Keys
+ * without value return NULL as value, the end of a result returns an empty
+ * key.
+ *
+ * @param[in,out] data - current position, set to NULL at the end
+ * @param[out] key     - the key
+ * @param[out] value   - the value
+ *
+ * @return TRUE if a pair has been found, FALSE at the end of the payload
+ */
+int gm_wire_next(char ** data, char ** key, char ** value);
+
+#endif
+
+/**
+ * @}
+ */
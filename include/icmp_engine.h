@@ -0,0 +1,143 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/** @file
+ *  @brief header for the worker icmp engine
+ *
+ *  Host alive checks like check_icmp and check_ping are not forked.
+ *  The worker children pass the resolved targets to a single icmp
+ *  engine process which pings all targets of all running checks
+ *  concurrently with one icmp socket and returns the statistics. The
+ *  socket and the request channel are created by the supervisor.
+ *
+ *  @{
+ */
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "common.h"
+
+#define GM_ICMP_MAX_TARGETS       32    /**< max hosts of a single check */
+#define GM_ICMP_MAX_CHECKS      1024    /**< max checks handled by the engine at the same time */
+#define GM_ICMP_DEFAULT_PACKETS    5    /**< packets sent to each host */
+#define GM_ICMP_DEFAULT_INTERVAL  80    /**< ms between two packets to the same host */
+#define GM_ICMP_STATS_INTERVAL    60    /**< seconds between two throughput log entries */
+
+#define GM_ICMP_FLAVOR_ICMP        0    /**< output like check_icmp */
+#define GM_ICMP_FLAVOR_PING        1    /**< output like check_ping */
+
+/** a host alive check passed to the icmp engine */
+typedef struct gm_icmp_request_struct {
+    int            packets;                         /**< packets sent to each host */
+    int            interval;                        /**< ms between two packets to the same host */
+    int            wait;                            /**< ms to wait for replies after the last packet */
+    int            timeout;                         /**< ms after which the check is finished anyway */
+    int            num_targets;                     /**< number of hosts */
+    struct in_addr targets[GM_ICMP_MAX_TARGETS];    /**< addresses of all hosts */
+} gm_icmp_request_t;
+
+/** statistics of a single host */
+typedef struct gm_icmp_target_struct {
+    int            sent;                            /**< number of sent packets */
+    int            received;                        /**< number of received replies */
+    double         rta;                             /**< sum of all round trip times in ms, average after the check */
+    double         rtmin;                           /**< min round trip time in ms */
+    double         rtmax;                           /**< max round trip time in ms */
+} gm_icmp_target_t;
+
+/** answer of the icmp engine */
+typedef struct gm_icmp_reply_struct {
+    int              num_targets;                   /**< number of hosts */
+    gm_icmp_target_t targets[GM_ICMP_MAX_TARGETS];  /**< statistics of each host */
+} gm_icmp_reply_t;
+
+/** throughput counters shared by the engine and the status worker */
+typedef struct gm_icmp_stats_struct {
+    volatile pid_t    engine_pid;                   /**< pid of the running engine */
+    volatile uint64_t checks;                       /**< finished checks */
+    volatile uint64_t probes;                       /**< sent echo requests */
+    volatile uint64_t replies;                      /**< received echo replies */
+} gm_icmp_stats_t;
+
+/**
+ * icmp_engine_setup
+ *
+ * open the icmp socket, the request channel and the shared
+ * statistics. Must be called by the supervisor before any child is
+ * forked.
+ *
+ * @return GM_OK on success or GM_ERROR if no icmp socket can be opened
+ */
+int icmp_engine_setup(void);
+
+/**
+ * icmp_engine_loop
+ *
+ * main loop of the icmp engine process
+ *
+ * @return nothing
+ */
+void icmp_engine_loop(void);
+
+/**
+ * is_icmp_check
+ *
+ * check whether a command line is a host alive check handled by the
+ * icmp engine. Uses the icmp_command list or check_icmp and
+ * check_ping if the list is empty.
+ *
+ * @param[in] command_line - command line of the job
+ *
+ * @return TRUE or FALSE
+ */
+int is_icmp_check(const char * command_line);
+
+/**
+ * icmp_engine_check
+ *
+ * run a host alive check through the icmp engine and set output and
+ * return code of the job
+ *
+ * @param[in] job - job to run
+ *
+ * @return GM_OK if the check has been run or GM_ERROR if the plugin has
+ * to be executed instead
+ */
+int icmp_engine_check(gm_job_t * job);
+
+/**
+ * icmp_engine_append_stats
+ *
+ * add the engine throughput counters to a status result
+ *
+ * @param[in,out] result - status result of GM_BUFFERSIZE bytes
+ *
+ * @return nothing
+ */
+void icmp_engine_append_stats(char * result);
+
+/**
+ * @}
+ */
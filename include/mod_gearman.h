@@ -106,6 +106,16 @@ int nebmodule_deinit( int flags, int reason );
  */
 void mod_gm_add_result_to_list(check_result * newcheckresult);
 
+/** adds an on-demand host check result which the core processes
+ *  ahead of the normal result list
+ *
+ * @param[in] newcheckresult - new checkresult structure to add to list
+ * @param[in] core_start_time - time when the core submitted the check
+ *
+ * @return nothing
+ */
+void mod_gm_add_fast_result_to_list(check_result * newcheckresult, struct timeval * core_start_time);
+
 /** wraps the nm_log / write_to_all_logs core logger
  *
  * @param[in] type - type of the log event
@@ -0,0 +1,96 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief interface of in-process plugin modules
+ *
+ *  Plugin modules are shared objects listed with plugin_module in the
+ *  worker config. The worker loads them once with dlopen and calls
+ *  gm_plugin_init(), which registers all checks of the module. Command
+ *  lines like "@so:mycheck -w 5" then call the registered function of
+ *  "mycheck" inside the worker instead of forking a plugin.
+ *
+ *  This header is the whole interface, modules must not use any other
+ *  worker symbol. New fields are only appended to the structures and
+ *  GM_PLUGIN_ABI_VERSION is raised on incompatible changes.
+ *
+ *  @{
+ */
+
+#ifndef _MOD_GEARMAN_PLUGIN_H
+#define _MOD_GEARMAN_PLUGIN_H
+
+#include <stddef.h>
+#include <sys/time.h>
+
+#define GM_PLUGIN_ABI_VERSION   1                   /**< version of this interface */
+#define GM_PLUGIN_INIT_SYMBOL   "gm_plugin_init"    /**< entry point of every module */
+
+/** arguments of a single check call */
+typedef struct gm_plugin_call_struct {
+    int              abi_version;   /**< GM_PLUGIN_ABI_VERSION of the worker */
+    int              argc;          /**< number of arguments */
+    char          ** argv;          /**< NULL terminated arguments, argv[0] is the check name */
+    struct timeval   deadline;      /**< the check must return before this time */
+    char           * output;        /**< buffer for plugin output and performance data */
+    size_t           output_size;   /**< size of the output buffer */
+} gm_plugin_call_t;
+
+/**
+ * check function of a module
+ *
+ * @param[in,out] call - arguments and output buffer
+ *
+ * @return plugin return code 0-3
+ */
+typedef int (*gm_plugin_check_t)(gm_plugin_call_t * call);
+
+/**
+ * registers a check function, passed to gm_plugin_init()
+ *
+ * @param[in] name - name used in "@so:<name>" command lines
+ * @param[in] check - check function
+ *
+ * @return 0 on success
+ */
+typedef int (*gm_plugin_register_t)(const char * name, gm_plugin_check_t check);
+
+/**
+ * gm_plugin_init
+ *
+ * entry point of every module, called once after the module has been
+ * loaded. Modules should refuse to load if abi_version is not the
+ * version they were built against.
+ *
+ * @param[in] abi_version - GM_PLUGIN_ABI_VERSION of the worker
+ * @param[in] register_check - function to register checks
+ *
+ * @return 0 on success
+ */
+int gm_plugin_init(int abi_version, gm_plugin_register_t register_check);
+
+#endif
+
+/**
+ * @}
+ */
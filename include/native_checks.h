@@ -0,0 +1,71 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief built-in network checks
+ *
+ *  Command lines starting with @tcp, @http or @dns are run inside the
+ *  worker process with non-blocking sockets instead of forking a plugin.
+ *  Arguments, output and performance data follow check_tcp, check_http
+ *  and check_dns from the monitoring plugins.
+ *
+ *  @{
+ */
+
+#ifndef _NATIVE_CHECKS_H
+#define _NATIVE_CHECKS_H
+
+#define NATIVE_CHECK_PREFIX     '@'         /**< first character of built-in check command lines */
+#define NATIVE_MAX_RESPONSE     65536       /**< max bytes read from a tcp or http response */
+#define NATIVE_DNS_PORT         53          /**< default port of the name server */
+#define NATIVE_RESOLV_CONF      "/etc/resolv.conf"  /**< default name server is taken from here */
+
+/**
+ * is_native_check
+ *
+ * check whether a command line is run by the built-in check engine
+ *
+ * @param[in] command_line - command line of the job
+ *
+ * @return TRUE for @tcp, @http and @dns command lines
+ */
+int is_native_check(const char * command_line);
+
+/**
+ * run_native_check
+ *
+ * run a built-in check
+ *
+ * @param[in] command_line - command line of the job
+ * @param[in] timeout - timeout of the job in seconds
+ * @param[out] output - allocated plugin output with performance data
+ *
+ * @return plugin return code
+ */
+int run_native_check(const char * command_line, double timeout, char ** output);
+
+#endif
+
+/**
+ * @}
+ */
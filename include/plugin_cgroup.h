@@ -0,0 +1,133 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/** @file
+ *  @brief header for the cgroup v2 isolation of plugins
+ *
+ *  Each worker process runs its plugins in its own leaf cgroup below a
+ *  cgroup of the queue the job came from:
+ *
+ *  cgroup_root/<queue>/worker_<pid>
+ *
+ *  Cpu weight, memory and pids limits are applied either to the leaf,
+ *  which limits every single check, or to the queue cgroup, which
+ *  limits all checks of that queue together. Timeouts kill the whole
+ *  leaf by cgroup.kill, including processes which left the process
+ *  group of the plugin.
+ *
+ *  @{
+ */
+
+#include "common.h"
+
+#define GM_CGROUP_LEAF_PREFIX   "worker_"                   /**< prefix of the leaf cgroup of each worker process */
+#define GM_CGROUP_CONTROLLERS   { "cpu", "memory", "pids" } /**< controllers used for the limits */
+
+/**
+ * plugin_cgroup_setup
+ *
+ * verify the cgroup root and enable the controllers of all configured
+ * limits. Must be called by the supervisor before any child is forked.
+ * Does nothing when cgroup_root is not set.
+ *
+ * @return GM_OK on success or GM_ERROR
+ */
+int plugin_cgroup_setup(void);
+
+/**
+ * plugin_cgroup_prepare
+ *
+ * create the queue and leaf cgroup for the next plugin of this worker
+ * process. Nothing has to be done when the previous job came from the
+ * same queue.
+ *
+ * @param[in] queue - queue of the current job
+ *
+ * @return GM_OK on success or GM_ERROR
+ */
+int plugin_cgroup_prepare(const char * queue);
+
+/**
+ * plugin_cgroup_enter
+ *
+ * move the calling process into the prepared leaf cgroup. Called by
+ * the forked child right before the plugin is exec'd, all processes
+ * started by the plugin stay in the cgroup. The worker and its
+ * fork_on_exec child stay outside, so they are neither limited nor
+ * killed together with the plugin.
+ *
+ * @return nothing
+ */
+void plugin_cgroup_enter(void);
+
+/**
+ * plugin_cgroup_kill
+ *
+ * kill all processes in the prepared leaf cgroup at once. Safe to be
+ * called from a signal handler.
+ *
+ * @return GM_OK if the cgroup has been killed, GM_ERROR if the caller
+ *         has to kill the plugin by itself because there is no cgroup
+ *         or no process could be moved into it
+ */
+int plugin_cgroup_kill(void);
+
+/**
+ * plugin_cgroup_cleanup
+ *
+ * remove the leaf cgroups of this worker process
+ *
+ * @return nothing
+ */
+void plugin_cgroup_cleanup(void);
+
+/**
+ * plugin_cgroup_remove_stale
+ *
+ * remove the leaf cgroups of worker processes which died without
+ * calling plugin_cgroup_cleanup(). Leftover plugins in those cgroups
+ * are killed and their cgroups removed by a later call. Called by the
+ * supervisor after collecting exited workers.
+ *
+ * @param[in] worker_exited - TRUE if a worker has exited since the last call
+ *
+ * @return nothing
+ */
+void plugin_cgroup_remove_stale(int worker_exited);
+
+/**
+ * plugin_cgroup_append_stats
+ *
+ * append cpu, memory and io pressure and the number of oom kills of all
+ * plugins to the status text
+ *
+ * @param[in,out] result - status text of GM_BUFFERSIZE bytes
+ *
+ * @return nothing
+ */
+void plugin_cgroup_append_stats(char * result);
+
+/**
+ * @}
+ */
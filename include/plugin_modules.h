@@ -0,0 +1,105 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief loader for in-process plugin modules
+ *
+ *  Modules are loaded by the supervisor so all children inherit them.
+ *  Checks run either directly in the worker process or, with
+ *  plugin_isolation, in a helper process which is forked once per
+ *  worker and replaced after a crash or timeout.
+ *
+ *  @{
+ */
+
+#ifndef _PLUGIN_MODULES_H
+#define _PLUGIN_MODULES_H
+
+#include <stdint.h>
+
+#include "common.h"
+#include "mod_gearman_plugin.h"
+
+#define GM_PLUGIN_PREFIX        "@so:"          /**< command line prefix of module checks */
+#define GM_PLUGIN_MAX_CHECKS    64              /**< max number of registered checks */
+#define GM_PLUGIN_OUTPUT_SIZE   GM_BUFFERSIZE   /**< size of the output buffer passed to the modules */
+
+/** resource usage of a registered check, shared by all workers */
+typedef struct gm_plugin_stats_struct {
+    volatile uint64_t calls;        /**< number of calls */
+    volatile uint64_t failures;     /**< crashes, timeouts and invalid return codes */
+    volatile uint64_t cpu_usec;     /**< user and system time in microseconds */
+    volatile uint64_t wall_usec;    /**< elapsed time in microseconds */
+} gm_plugin_stats_t;
+
+/**
+ * load_plugin_modules
+ *
+ * load all modules from the plugin_module list which are not loaded
+ * yet. Must be called by the supervisor before any child is forked.
+ *
+ * @return GM_OK if all modules have been loaded or GM_ERROR
+ */
+int load_plugin_modules(void);
+
+/**
+ * is_plugin_module_check
+ *
+ * check whether a command line calls a module check
+ *
+ * @param[in] command_line - command line of the job
+ *
+ * @return TRUE for @so: command lines
+ */
+int is_plugin_module_check(const char * command_line);
+
+/**
+ * run_plugin_module_check
+ *
+ * run a module check in this process or in the isolation helper and
+ * set return code and output of the job
+ *
+ * @param[in,out] job - job with a @so: command line
+ * @param[in] identifier - worker identifier used in error messages
+ *
+ * @return GM_OK or GM_ERROR if the check crashed or timed out
+ */
+int run_plugin_module_check(gm_job_t * job, char * identifier);
+
+/**
+ * plugin_modules_append_stats
+ *
+ * add calls and resource usage of all registered checks to a status
+ * result
+ *
+ * @param[in,out] result - status result of GM_BUFFERSIZE bytes
+ *
+ * @return nothing
+ */
+void plugin_modules_append_stats(char * result);
+
+#endif
+
+/**
+ * @}
+ */
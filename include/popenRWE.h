@@ -19,6 +19,8 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 
 int popenRWE(int *rwepipe, char *command);
 int pcloseRWE(int pid, int *rwepipe);
+int pcloseRWE_rusage(int pid, int *rwepipe, struct rusage *usage);
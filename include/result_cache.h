@@ -0,0 +1,90 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/** @file
+ *  @brief header for the worker plugin result cache
+ *
+ *  Identical command lines which ran successfully within the
+ *  result_cache_ttl are answered from a shared memory segment instead
+ *  of forking the plugin again. The segment is created by the
+ *  supervisor and inherited by all children.
+ *
+ *  @{
+ */
+
+#include <stdint.h>
+
+#include "common.h"
+
+#define GM_RESULT_CACHE_SLOTS    256    /**< number of cached results */
+#define GM_RESULT_CACHE_DATA    8192    /**< max size of output and error of a cached result */
+
+/**
+ * result_cache_setup
+ *
+ * create the shared memory segment of the result cache. Must be
+ * called by the supervisor before any child is forked. Does nothing
+ * when result_cache_ttl is not set or the cache already exists.
+ *
+ * @return GM_OK on success or GM_ERROR
+ */
+int result_cache_setup(void);
+
+/**
+ * result_cache_lookup
+ *
+ * fill the job with a cached result of the same command line
+ *
+ * @param[in] job - job to look up
+ *
+ * @return GM_OK if a cached result has been used, GM_ERROR otherwise
+ */
+int result_cache_lookup(gm_job_t * job);
+
+/**
+ * result_cache_store
+ *
+ * store the result of a finished job, only successful host and
+ * service checks of allowed commands are cached
+ *
+ * @param[in] job - finished job
+ *
+ * @return nothing
+ */
+void result_cache_store(gm_job_t * job);
+
+/**
+ * result_cache_append_stats
+ *
+ * append hit and miss counters as performance data
+ *
+ * @param[in] result - status text of GM_BUFFERSIZE bytes
+ *
+ * @return nothing
+ */
+void result_cache_append_stats(char * result);
+
+/**
+ * @}
+ */
@@ -0,0 +1,106 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/** @file
+ *  @brief header for the worker result spool
+ *
+ *  Results which could not be sent to gearmand are appended to a ring
+ *  buffer in a memory mapped file which is shared by all worker
+ *  processes of this host. They are sent again in their original order
+ *  as soon as gearmand can be reached again. The oldest results are
+ *  dropped when the spool is full.
+ *
+ *  file:   magic(8) head(8) tail(8) spooled(8) replayed(8) dropped(8)
+ *  record: size(4) queue length(4) queue \0 encoded result, padded to 8 bytes
+ *
+ *  @{
+ */
+
+#include <stdint.h>
+
+#include "common.h"
+
+#define GM_RESULT_SPOOL_MAGIC   "GMSPOOL"   /**< first bytes of a spool file */
+#define GM_RESULT_SPOOL_BATCH   100         /**< max number of results sent again at once */
+#define GM_RESULT_SPOOL_RETRY   5000        /**< ms between tries to send spooled results while idle */
+
+/**
+ * result_spool_setup
+ *
+ * open and map the spool file. Must be called by the supervisor before
+ * any child is forked. Does nothing when result_spool is not set or the
+ * spool has been opened already.
+ *
+ * @return GM_OK on success or GM_ERROR
+ */
+int result_spool_setup(void);
+
+/**
+ * result_spool_add
+ *
+ * append a result which could not be sent, used as result_spool_hook
+ *
+ * @param[in] queue   - result queue
+ * @param[in] encoded - encoded result
+ * @param[in] size    - size of the encoded result
+ *
+ * @return GM_OK if the result has been spooled or GM_ERROR
+ */
+int result_spool_add(char * queue, char * encoded, int size);
+
+/**
+ * result_spool_pending
+ *
+ * check whether there are spooled results
+ *
+ * @return TRUE if results are waiting to be sent again
+ */
+int result_spool_pending(void);
+
+/**
+ * result_spool_replay
+ *
+ * send up to GM_RESULT_SPOOL_BATCH spooled results again with the
+ * current client, stops at the first result which cannot be sent.
+ * The results are copied out of the spool, so it is not locked while
+ * sending them, and only one process replays at a time.
+ *
+ * @return number of results sent
+ */
+int result_spool_replay(void);
+
+/**
+ * result_spool_append_stats
+ *
+ * append spooled, replayed and dropped counters as performance data
+ *
+ * @param[in] result - status text of GM_BUFFERSIZE bytes
+ *
+ * @return nothing
+ */
+void result_spool_append_stats(char * result);
+
+/**
+ * @}
+ */
@@ -37,7 +37,13 @@
 #include "nagios4/nagios.h"
 #endif
 
+/** milliseconds the direct result thread waits for results before it looks for new checks */
+#define GM_DIRECT_RESULT_POLL 10
+
 void *result_worker(void *);
+void *direct_result_worker(void *);
+int submit_direct_job( char * queue, char * uniq, char * data, int prio );
+void stop_direct_results(void);
 int set_worker( gearman_worker_st *worker );
 void *get_results( gearman_job_st *, void *, size_t *, gearman_return_t * );
 #ifdef GM_DEBUG
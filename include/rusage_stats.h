@@ -0,0 +1,95 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/** @file
+ *  @brief header for the worker plugin resource usage statistics
+ *
+ *  Cpu time, max rss and context switches of all plugin executions are
+ *  summed up per command basename in a shared memory segment, so the
+ *  status queue can tell which plugins use most of the worker
+ *  resources. The segment is created by the supervisor and inherited by
+ *  all children.
+ *
+ *  @{
+ */
+
+#include <stdint.h>
+
+#include "common.h"
+
+#define GM_RUSAGE_SLOTS          512    /**< number of commands with statistics */
+#define GM_RUSAGE_PROBES          16    /**< number of slots tried for a command */
+#define GM_RUSAGE_NAME_SIZE       64    /**< max size of a command basename */
+#define GM_RUSAGE_TOP             20    /**< number of commands reported by the status queue */
+
+/**
+ * rusage_stats_setup
+ *
+ * create the shared memory segment of the statistics. Must be called
+ * by the supervisor before any child is forked. Does nothing when
+ * plugin_rusage is not enabled or the segment already exists.
+ *
+ * @return GM_OK on success or GM_ERROR
+ */
+int rusage_stats_setup(void);
+
+/**
+ * rusage_stats_basename
+ *
+ * get the basename of the plugin of a command line
+ *
+ * @param[in] command_line - command line of the check
+ * @param[out] name        - buffer of GM_RUSAGE_NAME_SIZE bytes
+ *
+ * @return nothing
+ */
+void rusage_stats_basename(const char * command_line, char * name);
+
+/**
+ * rusage_stats_store
+ *
+ * add the resource usage of a finished job to the statistics of its
+ * command
+ *
+ * @param[in] job - finished job with rusage
+ *
+ * @return nothing
+ */
+void rusage_stats_store(gm_job_t * job);
+
+/**
+ * rusage_stats_append_stats
+ *
+ * append the statistics of the commands with the most cpu time as
+ * performance data
+ *
+ * @param[in] result - status text of GM_BUFFERSIZE bytes
+ *
+ * @return nothing
+ */
+void rusage_stats_append_stats(char * result);
+
+/**
+ * @}
+ */
@@ -45,6 +45,7 @@
 #include "common.h"
 
 #define GM_PERFDATA_QUEUE    "perfdata"  /**< default performance data queue */
+#define GM_LOG_BUFFER_SIZE   16384       /**< size of the per thread buffer for debug log lines */
 
 /**
  * escpae newlines
@@ -81,26 +82,45 @@ void mod_gm_crypt_init(char * key);
 /**
  * mod_gm_encrypt
  *
- * wrapper to encrypt text
+ * wrapper to encrypt text, always base64 encoded for readers which
+ * only know the text format like perfdata and export queues
  *
  * @param[out] encrypted - pointer to encrypted text
  * @param[in] text - text to encrypt
  * @param[in] mode - encryption mode (base64 or aes64 with base64)
  *
- * @return base64 encoded text or aes encrypted text based on mode
+ * @return size of the base64 encoded text
  */
 int mod_gm_encrypt(char ** encrypted, char * text, int mode);
 
+/**
+ * mod_gm_encrypt_payload
+ *
+ * encrypt a check job or result, which is sent in the binary format if
+ * binary_transport is enabled or the text has been compressed
+ *
+ * @param[out] encrypted - pointer to encrypted payload
+ * @param[in] text - text to encrypt
+ * @param[in] mode - encryption mode (base64 or aes64 with base64)
+ * @param[in] compress - TRUE if the receiver accepts compressed payloads
+ *
+ * @return size of the base64 encoded text or of the binary frame
+ */
+int mod_gm_encrypt_payload(char ** encrypted, char * text, int mode, int compress);
+
 /**
  * mod_gm_decrypt
  *
- * @param[out] decrypted - pointer to decrypted text
- * @param[in] text - text to decrypt
+ * @param[in,out] decrypted - pointer to decrypted text, must hold text_size+1 bytes.
+ *                            Compressed payloads replace it with a larger buffer
+ * @param[in] text - base64 text or binary frame to decrypt, binary frames
+ *                   are only accepted with binary_transport or compression
+ * @param[in] text_size - size of the text
  * @param[in] mode - do only base64 decoding or decryption too
  *
  * @return decrypted text
  */
-void mod_gm_decrypt(char ** decrypted, char * text, int mode);
+void mod_gm_decrypt(char ** decrypted, char * text, int text_size, int mode);
 
 /**
  * file_exists
@@ -406,14 +426,39 @@ char * eventtype2str(int i);
 /**
  * gm_log
  *
- * general logger
+ * general logger, arguments are only evaluated if the level is enabled
+ *
+ * @param[in] lvl  - debug level for this message
+ * @param[in] ...  - format and arguments of the text to log
+ *
+ * @return nothing
+ */
+#define gm_log(lvl, ...) do { if(gm_log_enabled(lvl)) gm_log_write(lvl, __VA_ARGS__); } while(0)
+
+/** true if messages of this level will be logged */
+#define gm_log_enabled(lvl) ((lvl) == GM_LOG_ERROR || (mod_gm_opt != NULL && (lvl) <= mod_gm_opt->debug_level))
+
+/**
+ * gm_log_write
+ *
+ * write a log line, use gm_log() instead
  *
  * @param[in] lvl  - debug level for this message
  * @param[in] text - text to log
  *
  * @return nothing
  */
-void gm_log( int lvl, const char *text, ... );
+void gm_log_write( int lvl, const char *text, ... );
+
+/**
+ * gm_log_flush
+ *
+ * write buffered debug and trace lines of the current thread
+ * to the logfile
+ *
+ * @return nothing
+ */
+void gm_log_flush(void);
 
 /**
  * write_core_log
@@ -437,7 +482,7 @@ void write_core_log(char *data);
  *
  * @returns the new server name or NULL
  */
-int check_param_server(gm_server_t * new_server, gm_server_t * server_list[GM_LISTSIZE], int server_num);
+int check_param_server(gm_server_t * new_server, gm_server_t ** server_list, int server_num);
 
 /**
  * send_result_back
@@ -450,6 +495,82 @@ int check_param_server(gm_server_t * new_server, gm_server_t * server_list[GM_LI
  */
 void send_result_back(gm_job_t * exec_job);
 
+/**
+ * flush_result_batch
+ *
+ * send all results collected by send_result_back() as one
+ * multi-result job. Only used with result_batch_size > 1.
+ *
+ * @return nothing
+ */
+void flush_result_batch(void);
+
+/**
+ * set_bulk_results
+ *
+ * while enabled, send_result_back() sends each result of a bulk job
+ * to the result queue as soon as its check finished, instead of
+ * returning it as direct result of the bulk job.
+ *
+ * @param[in] enabled - TRUE at the start, FALSE at the end of a bulk job
+ *
+ * @return nothing
+ */
+void set_bulk_results(int enabled);
+
+/**
+ * result_batch_timeout
+ *
+ * get the time left until the pending result batch has to be sent
+ *
+ * @return milliseconds till the batch is due or -1 if there is no pending batch
+ */
+int result_batch_timeout(void);
+
+/**
+ * send_result_payload
+ *
+ * encode a result payload once and send it to the result servers
+ * and the duplicate servers
+ *
+ * @param[in] queue - result queue
+ * @param[in] data - result payload
+ * @param[in] dup_data - payload for the duplicate servers, may be data itself
+ *
+ * @return nothing
+ */
+void send_result_payload(char * queue, char * data, char * dup_data);
+
+/** optional hook which takes over results before they are sent to gearmand,
+ *  returns GM_OK if the result has been handled */
+int (*result_payload_hook)(char * queue, char * data, char * dup_data);
+
+/** optional hook which keeps encoded results that could not be sent to
+ *  gearmand, returns GM_OK if the result has been kept */
+int (*result_spool_hook)(char * queue, char * encoded, int size);
+
+/**
+ * accept_compressed_results
+ *
+ * remember that the receiver of a result queue accepts compressed results
+ *
+ * @param[in] queue - result queue
+ *
+ * @return nothing
+ */
+void accept_compressed_results(const char * queue);
+
+/**
+ * accepts_compressed_results
+ *
+ * check whether results for this queue may be compressed
+ *
+ * @param[in] queue - result queue
+ *
+ * @return TRUE if the receiver accepts compressed results
+ */
+int accepts_compressed_results(const char * queue);
+
 /**
  * md5sum
  *
@@ -467,12 +588,26 @@ char *md5sum(char *text);
  * adds parsed server to list
  *
  * @param[in] server_num - insert server at that point
- * @param[in] server_list - add server to this list
+ * @param[in] server_list - pointer to the NULL terminated list, grows when the server is added
  * @param[in] servername - parse and add this server
  *
  * @return nothing
  */
-void add_server(int * server_num, gm_server_t * server_list[GM_LISTSIZE], char * servername);
+void add_server(int * server_num, gm_server_t *** server_list, char * servername);
+
+/**
+ * add_list_item
+ *
+ * adds a copy of an item to a NULL terminated list
+ *
+ * @param[in] list - pointer to the list, grows when the item is added
+ * @param[in] num - number of items in the list, will be increased
+ * @param[in] index - optional hash table which stores the position of each item, duplicates are skipped
+ * @param[in] item - item to add
+ *
+ * @return GM_OK if the item has been added or GM_ERROR
+ */
+int add_list_item(char *** list, int * num, gm_hash_t * index, const char * item);
 
 /**
  * starts_with
@@ -46,12 +46,35 @@
 
 int mod_gm_shm_key;             /**< key for the shared memory segment */
 
-#define SHM_SHIFT             5 /**< nr of global counter              */
+#define SHM_SHIFT             9 /**< nr of global counter              */
 #define SHM_JOBS_DONE         0 /**< shm id for jobs done counter      */
 #define SHM_WORKER_TOTAL      1 /**< shm id for total worker counter   */
 #define SHM_WORKER_RUNNING    2 /**< shm id for running worker counter */
 #define SHM_STATUS_WORKER_PID 3 /**< shm id for status worker pid      */
 #define SHM_WORKER_LAST_CHECK 4 /**< shm time of last check executed   */
+#define SHM_BROKER_PID        5 /**< shm id for job broker pid         */
+#define SHM_RESULT_BROKER_PID 6 /**< shm id for result broker pid      */
+#define SHM_JOBS_THROTTLED    7 /**< shm id for throttled jobs counter */
+#define SHM_ICMP_ENGINE_PID   8 /**< shm id for icmp engine pid        */
+
+#define SHM_WORKER_SLOTS   1024 /**< max nr of worker, one pid per worker after the global counters */
+#define SHM_OWNER_SHIFT      (SHM_SHIFT + SHM_WORKER_SLOTS) /**< shm id of the per host slot held by the first worker */
+
+#define SHM_QUEUE_SLOTS      64 /**< nr of per queue counters at the end of the shm segment */
+#define SHM_QUEUE_SHIFT      ((int)(GM_SHM_SIZE/sizeof(int)) - SHM_QUEUE_SLOTS) /**< shm id of the first per queue counter */
+#define SHM_TARGET_SLOTS    128 /**< nr of per host counters, each one uses 64bit */
+#define SHM_TARGET_PROBES     8 /**< nr of slots tried for a host */
+#define SHM_TARGET_SHIFT     (SHM_QUEUE_SHIFT - 2*SHM_TARGET_SLOTS) /**< shm id of the first per host counter */
+#define SHM_COMPRESS_SLOTS    4 /**< nr of compression counters, each one uses 64bit */
+#define SHM_COMPRESS_SHIFT   (SHM_TARGET_SHIFT - 2*SHM_COMPRESS_SLOTS) /**< shm id of the first compression counter */
+#define SHM_COMPRESSED        0 /**< compression counter of compressed payloads */
+#define SHM_COMPRESS_RAW      1 /**< compression counter of bytes before compression */
+#define SHM_COMPRESS_BYTES    2 /**< compression counter of bytes after compression */
+#define SHM_COMPRESS_USEC     3 /**< compression counter of cpu time in microseconds */
+#define SHM_BULK_SLOTS        2 /**< nr of bulk job counters */
+#define SHM_BULK_SHIFT       (SHM_COMPRESS_SHIFT - SHM_BULK_SLOTS) /**< shm id of the first bulk job counter */
+#define SHM_BULK_JOBS         0 /**< bulk job counter of received bulk jobs */
+#define SHM_BULK_CHECKS       1 /**< bulk job counter of checks in bulk jobs */
 
 /** Mod-Gearman Worker
  *
@@ -97,6 +120,25 @@ int parse_arguments(int argc, char **argv);
  */
 int make_new_child(int mode);
 
+/**
+ * start_broker
+ *
+ * start the job and result broker if broker mode is enabled and
+ * they are not running yet
+ *
+ * @return nothing
+ */
+void start_broker(void);
+
+/**
+ * start_icmp_engine
+ *
+ * start the icmp engine if it is enabled and not running yet
+ *
+ * @return nothing
+ */
+void start_icmp_engine(void);
+
 /**
  * print the usage and exit
  *
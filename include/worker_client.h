@@ -32,6 +32,7 @@
 #include <errno.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <stdint.h>
 #include <libgearman/gearman.h>
 
 #define MOD_GM_WORKER
@@ -44,6 +45,14 @@
 #define GM_WORKER_MULTI         0
 #define GM_WORKER_STANDALONE    1
 #define GM_WORKER_STATUS        2
+#define GM_WORKER_BROKER        3
+#define GM_WORKER_RESULT_BROKER 4
+#define GM_WORKER_ICMP_ENGINE   5
+
+#define GM_TARGET_UNTRACKED     -1      /**< check runs without per host limit */
+#define GM_TARGET_THROTTLED     -2      /**< too many checks running for this host */
+#define GM_TARGET_WAIT        1000      /**< ms to wait for a free per host slot before the job is requeued */
+#define GM_TARGET_WAIT_STEP     50      /**< ms between two tries to get a per host slot */
 
 #ifdef EMBEDDEDPERL
 void worker_client(int worker_mode, int indx, int shid, char**env);
@@ -51,8 +60,25 @@ void worker_client(int worker_mode, int indx, int shid, char**env);
 void worker_client(int worker_mode, int indx, int shid);
 #endif
 void worker_loop(void);
+void broker_worker_loop(void);
+int create_result_clients(void);
+int broker_result_hook(char * queue, char * data, char * dup_data);
 void *get_job( gearman_job_st *, void *, size_t *, gearman_return_t * );
+int process_job( gearman_job_st *job, char * workload, int wsize, const char * queue, const char * handle );
+int parse_job(char ** data, gm_job_t * job, int * accept_compressed);
+int has_next_job(char ** data);
+void do_exec_bulk_job(char ** data);
 void do_exec_job(void);
+void discard_job(void);
+int get_queue_index(const char * queue);
+void count_missed_deadline(const char * queue);
+void append_missed_deadlines(char * result, int * shm);
+void update_compression_stats(void);
+void append_compression_stats(char * result, int * shm);
+int get_target_limit(const char * queue);
+int acquire_target_slot(const char * host_name, int limit);
+void release_target_slot(int indx);
+void requeue_job(void);
 int set_worker( gearman_worker_st *worker );
 void exit_sighandler(int sig);
 void idle_sighandler(int sig);
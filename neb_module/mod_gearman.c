@@ -25,6 +25,11 @@
 #include "result_thread.h"
 #include "mod_gearman.h"
 #include "gearman_utils.h"
+#include "gm_wire.h"
+#include "gm_journal.h"
+#include "gm_pace.h"
+
+#include <fcntl.h>
 
 /* specify event broker API version (required) */
 NEB_API_VERSION( CURRENT_NEB_API_VERSION )
@@ -52,6 +57,9 @@ extern int            process_performance_data;
 extern check_result   check_result_info;
 extern check_result * check_result_list;
 #endif
+#if defined(USENAEMON) || defined(USENAGIOS4)
+extern iobroker_set * nagios_iobs;
+#endif
 extern int            log_notifications;
 
 /* global variables */
@@ -62,15 +70,57 @@ static check_result * mod_gm_result_list = 0;
 static objectlist * mod_gm_result_list = 0;
 #endif
 static pthread_mutex_t mod_gm_result_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* results of on-demand host checks which bypass the normal result list */
+typedef struct gm_fast_result {
+    check_result          * result;           /**< check result for the core */
+    struct timeval          core_start_time;  /**< time when the core submitted the check */
+    struct gm_fast_result * next;             /**< next result */
+} gm_fast_result_t;
+static gm_fast_result_t * mod_gm_fast_results      = NULL;
+static gm_fast_result_t * mod_gm_fast_results_tail = NULL;
+static int fast_result_pipe[2]                     = { -1, -1 };
+static unsigned long long ondemand_results         = 0;
+static double             ondemand_latency_sum     = 0;
+static double             ondemand_latency_max     = 0;
 void *gearman_module_handle=NULL;
 gearman_client_st client;
 
 int send_now, result_threads_running;
 pthread_t result_thr[GM_LISTSIZE];
+static pthread_t direct_thr;
+static int direct_thread_running = FALSE;
 char target_queue[GM_BUFFERSIZE];
 char temp_buffer[GM_BUFFERSIZE];
 char uniq[GM_BUFFERSIZE];
 
+/* checks submitted with a raised priority */
+static int promoted_host_checks    = 0;
+static int promoted_service_checks = 0;
+static int priority_host_checks    = 0;
+
+/* gearman packet headers of submit, created, assign and complete saved per check in a bulk job */
+#define GM_BULK_JOB_OVERHEAD 48
+
+/* checks of a queue waiting to be sent as one bulk job */
+typedef struct gm_bulk_job_struct {
+    char           * queue;
+    char           * data;
+    size_t           len;
+    size_t           size;
+    int              num;
+    int              prio;
+    struct timeval   start;
+} gm_bulk_job_t;
+
+static gm_bulk_job_t * bulk_jobs           = NULL;
+static int             bulk_jobs_num       = 0;
+static gm_hash_t     * bulk_jobs_index     = NULL;
+static unsigned long long bulk_jobs_sent   = 0;
+static unsigned long long bulk_checks_sent = 0;
+static unsigned long long bulk_checks_lost = 0;
+static unsigned long long bulk_bytes_saved = 0;
+
 static void  register_neb_callbacks(void);
 static int   read_arguments( const char * );
 static int   verify_options(mod_gm_opt_t *opt);
@@ -81,11 +131,22 @@ static int   handle_notifications( int,void * );
 static int   handle_perfdata(int e, void *);
 static int   handle_export(int e, void *);
 static void  set_target_queue( host *, service * );
+static int   first_hostgroup( gm_hash_t *, host * );
+static int   first_servicegroup( gm_hash_t *, service * );
+static int   promote_check_prio( int, int, double, int * );
+static int   pace_check_job( char *, char *, char *, int, int );
+static int   submit_check_job( char *, char *, char *, int );
+static int   send_check_job( char *, char *, char *, int );
+static void  flush_bulk_job( int );
+static void  flush_bulk_jobs( int );
 static int   handle_process_events( int, void * );
 #ifdef USENAGIOS
 static int   handle_timed_events( int, void * );
 #endif
 static void  start_threads(void);
+static void  start_fast_results(void);
+static void  stop_fast_results(void);
+static void  move_fast_results_to_core(void);
 #ifdef USENAGIOS3
 static check_result * merge_result_lists(check_result * lista, check_result * listb);
 static void move_results_to_core_3x(void);
@@ -283,11 +344,47 @@ int nebmodule_deinit( int flags, int reason ) {
         pthread_join(result_thr[x], NULL);
     }
 
+    /* send remaining deferred checks and bulk jobs */
+    gm_pace_release(TRUE, submit_check_job);
+    gm_pace_free();
+    flush_bulk_jobs(TRUE);
+    if(bulk_jobs_sent > 0 || bulk_checks_lost > 0)
+        gm_log( GM_LOG_INFO, "sent %llu checks in %llu bulk jobs, saved %llu gearman round trips and %llu bytes, lost %llu checks\n",
+                bulk_checks_sent, bulk_jobs_sent, bulk_checks_sent - bulk_jobs_sent, bulk_bytes_saved, bulk_checks_lost );
+    for(x = 0; x < bulk_jobs_num; x++) {
+        free(bulk_jobs[x].queue);
+        free(bulk_jobs[x].data);
+    }
+    free(bulk_jobs);
+    gm_hash_free(bulk_jobs_index);
+
+    /* stop direct result thread */
+    if(direct_thread_running == TRUE) {
+        stop_direct_results();
+        pthread_join(direct_thr, NULL);
+    }
+
+    /* checks still in flight stay in the journal for the next start */
+    gm_journal_close();
+
+    if(promoted_host_checks > 0 || promoted_service_checks > 0 || priority_host_checks > 0)
+        gm_log( GM_LOG_INFO, "promoted %d host and %d service checks because of latency, %d on-demand host checks\n", promoted_host_checks, promoted_service_checks, priority_host_checks );
+    stop_fast_results();
+    if(ondemand_results > 0)
+        gm_log( GM_LOG_INFO, "got %llu on-demand host check results, end-to-end latency avg %.3fs, max %.3fs\n",
+                ondemand_results, ondemand_latency_sum / ondemand_results, ondemand_latency_max );
+    if(gm_wire_stats.usec > 0)
+        gm_log( GM_LOG_INFO, "compressed %llu payloads with ratio %.2f, %.3fs spent for compression and decompression\n",
+                gm_wire_stats.compressed,
+                gm_wire_stats.compressed_bytes > 0 ? (double)gm_wire_stats.raw_bytes / gm_wire_stats.compressed_bytes : 1.0,
+                (double)gm_wire_stats.usec / 1000000 );
+
     /* cleanup */
     free_client(&client);
 
     /* close old logfile */
     if(mod_gm_opt->logfile_fp != NULL) {
+        gm_log_flush();
         fclose(mod_gm_opt->logfile_fp);
     }
 
@@ -306,6 +403,16 @@ static int handle_timed_events( int event_type, void *data ) {
     if (event_type != NEBCALLBACK_TIMED_EVENT_DATA || ted == 0)
         return NEB_ERROR;
 
+    /* deferred checks and bulk jobs are sent even if no further checks come in */
+    gm_pace_release(FALSE, submit_check_job);
+    flush_bulk_jobs(FALSE);
+
+    /* the core waits for on-demand results, do not wait for the reaper */
+    move_fast_results_to_core();
+
+    /* lines logged by the callbacks of the core thread */
+    gm_log_flush();
+
     /* we only care about REAPER events */
     if (ted->event_type != EVENT_CHECK_REAPER)
         return NEB_OK;
@@ -319,6 +426,8 @@ static int handle_timed_events( int event_type, void *data ) {
     move_results_to_core();
 #endif
 
+    gm_log_flush();
+
     return NEB_OK;
 }
 #endif
@@ -355,6 +464,8 @@ static void move_results_to_core() {
 #ifdef USENAEMON
     if(evprop->execution_type == EVENT_EXEC_NORMAL) {
 #endif
+    move_fast_results_to_core();
+
     /* safely save off currently local list */
     pthread_mutex_lock(&mod_gm_result_list_mutex);
 
@@ -370,6 +481,12 @@ static void move_results_to_core() {
 
     pthread_mutex_unlock(&mod_gm_result_list_mutex);
 #ifdef USENAEMON
+        /* deferred checks and bulk jobs are sent even if no further checks come in */
+        gm_pace_release(FALSE, submit_check_job);
+        flush_bulk_jobs(FALSE);
+
+        /* lines logged by the callbacks of the core thread */
+        gm_log_flush();
         schedule_event(1, move_results_to_core, NULL);
     }
 #endif
@@ -421,6 +538,149 @@ void mod_gm_add_result_to_list(check_result * newcr) {
 }
 #endif
 
+/* add an on-demand host check result and wake up the core */
+void mod_gm_add_fast_result_to_list(check_result * newcr, struct timeval * core_start_time) {
+    gm_fast_result_t * fast = gm_malloc(sizeof *fast);
+    fast->result          = newcr;
+    fast->core_start_time = *core_start_time;
+    fast->next            = NULL;
+
+    pthread_mutex_lock(&mod_gm_result_list_mutex);
+    if(mod_gm_fast_results_tail != NULL)
+        mod_gm_fast_results_tail->next = fast;
+    else
+        mod_gm_fast_results = fast;
+    mod_gm_fast_results_tail = fast;
+    pthread_mutex_unlock(&mod_gm_result_list_mutex);
+
+    /* a full pipe already wakes up the core */
+    if(fast_result_pipe[1] != -1 && write(fast_result_pipe[1], "x", 1) < 0 && errno != EAGAIN)
+        gm_log( GM_LOG_DEBUG, "waking up the core failed: %s\n", strerror(errno) );
+}
+
+
+/* put on-demand host check results into the core ahead of all other results */
+static void move_fast_results_to_core(void) {
+    gm_fast_result_t * fast, * next;
+    struct timeval now;
+    double latency;
+#ifdef USENAGIOS3
+    check_result * first = NULL;
+    check_result * last  = NULL;
+#endif
+
+    pthread_mutex_lock(&mod_gm_result_list_mutex);
+    fast = mod_gm_fast_results;
+    mod_gm_fast_results      = NULL;
+    mod_gm_fast_results_tail = NULL;
+    pthread_mutex_unlock(&mod_gm_result_list_mutex);
+
+    if(fast == NULL)
+        return;
+
+    gettimeofday(&now, NULL);
+    for( ; fast != NULL; fast = next) {
+        next = fast->next;
+
+        /* end-to-end latency from submitting the check till the core gets the result */
+        latency = (double)(now.tv_sec - fast->core_start_time.tv_sec) + (double)(now.tv_usec - fast->core_start_time.tv_usec) / 1000000;
+        if(latency < 0)
+            latency = 0;
+        ondemand_results++;
+        ondemand_latency_sum += latency;
+        if(latency > ondemand_latency_max)
+            ondemand_latency_max = latency;
+        gm_log( GM_LOG_DEBUG, "on-demand host check result for %s after %.3fs\n", fast->result->host_name, latency );
+
+#ifdef USENAGIOS3
+        fast->result->next = NULL;
+        if(last != NULL)
+            last->next = fast->result;
+        else
+            first = fast->result;
+        last = fast->result;
+#else
+        process_check_result(fast->result);
+        free_check_result(fast->result);
+        free(fast->result);
+#endif
+        free(fast);
+    }
+
+#ifdef USENAGIOS3
+    /* nagios 3 has no way to process single results, so put them in front of the reaper list */
+    last->next        = check_result_list;
+    check_result_list = first;
+#endif
+}
+
+
+#if defined(USENAEMON) || defined(USENAGIOS4)
+/* the result thread got on-demand host check results */
+static int handle_fast_results(int sd, int events, void *arg) {
+    char buf[GM_BUFFERSIZE];
+
+    /* unused */
+    events = events;
+    arg    = arg;
+
+    while(read(sd, buf, sizeof(buf)) > 0)
+        ;
+    move_fast_results_to_core();
+
+    return 0;
+}
+#endif
+
+
+/* let the core process on-demand host check results as soon as they arrive */
+static void start_fast_results(void) {
+#if defined(USENAEMON) || defined(USENAGIOS4)
+    if(fast_result_pipe[0] != -1)
+        return;
+    if(pipe(fast_result_pipe) != 0) {
+        gm_log( GM_LOG_ERROR, "cannot create pipe for on-demand host check results: %s\n", strerror(errno) );
+        fast_result_pipe[0] = fast_result_pipe[1] = -1;
+        return;
+    }
+    fcntl(fast_result_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(fast_result_pipe[1], F_SETFL, O_NONBLOCK);
+    if(iobroker_register(nagios_iobs, fast_result_pipe[0], NULL, handle_fast_results) != 0) {
+        gm_log( GM_LOG_ERROR, "cannot register pipe for on-demand host check results, using the result timer instead\n" );
+        close(fast_result_pipe[0]);
+        close(fast_result_pipe[1]);
+        fast_result_pipe[0] = fast_result_pipe[1] = -1;
+    }
+#endif
+}
+
+
+/* unregister the wake up pipe and drop remaining on-demand results */
+static void stop_fast_results(void) {
+    gm_fast_result_t * fast, * next;
+
+#if defined(USENAEMON) || defined(USENAGIOS4)
+    if(fast_result_pipe[0] != -1) {
+        iobroker_unregister(nagios_iobs, fast_result_pipe[0]);
+        close(fast_result_pipe[0]);
+        close(fast_result_pipe[1]);
+        fast_result_pipe[0] = fast_result_pipe[1] = -1;
+    }
+#endif
+
+    pthread_mutex_lock(&mod_gm_result_list_mutex);
+    for(fast = mod_gm_fast_results; fast != NULL; fast = next) {
+        next = fast->next;
+        free_check_result(fast->result);
+        free(fast->result);
+        free(fast);
+    }
+    mod_gm_fast_results      = NULL;
+    mod_gm_fast_results_tail = NULL;
+    pthread_mutex_unlock(&mod_gm_result_list_mutex);
+}
+
+
 /* handle process events */
 static int handle_process_events( int event_type, void *data ) {
     int x=0;
@@ -431,7 +691,12 @@ static int handle_process_events( int event_type, void *data ) {
     ps = ( struct nebstruct_process_struct * )data;
     if ( ps->type == NEBTYPE_PROCESS_EVENTLOOPSTART ) {
 
+        /* read back checks still in flight before the first result arrives */
+        if(mod_gm_opt->journal_file != NULL)
+            gm_journal_open(mod_gm_opt->journal_file, mod_gm_opt->journal_max_age);
+
         register_neb_callbacks();
+        start_fast_results();
         start_threads();
         send_now = TRUE;
 
@@ -919,6 +1184,9 @@ static int handle_host_check( int event_type, void *data ) {
     char *raw_command=NULL;
     char *processed_command=NULL;
     host * hst;
+    int prio = GM_JOB_PRIO_NORMAL;
+    int ondemand = FALSE;
+    int options;
 #ifdef USENAGIOS
     check_result * chk_result;
     int check_options;
@@ -964,6 +1232,14 @@ static int handle_host_check( int event_type, void *data ) {
 
     gm_log( GM_LOG_DEBUG, "received job for queue %s: %s\n", target_queue, hostdata->host_name );
 
+    /* still running since before the core restarted, the result will be adopted */
+    if(gm_journal_in_flight(hst->name, NULL) == TRUE) {
+        gm_log( GM_LOG_DEBUG, "host check for %s is still in flight\n", hst->name );
+        currently_running_host_checks++;
+        hst->is_executing=TRUE;
+        return NEBERROR_CALLBACKOVERRIDE;
+    }
+
     /* as we have to intercept host checks so early
      * (we cannot cancel checks otherwise)
      * we have to do some host check logic here
@@ -973,6 +1249,9 @@ static int handle_host_check( int event_type, void *data ) {
     /* clear check options - we don't want old check options retained */
     check_options = hst->check_options;
     hst->check_options = CHECK_OPTION_NONE;
+    options = check_options;
+#else
+    options = hst->check_options;
 #endif
 
     /* unset the freshening flag, otherwise only the first freshness check would be run */
@@ -1046,7 +1325,20 @@ static int handle_host_check( int event_type, void *data ) {
 
     gm_log( GM_LOG_TRACE, "cmd_line: %s\n", processed_command );
 
-    snprintf( temp_buffer,GM_BUFFERSIZE-1,"type=host\nresult_queue=%s\nhost_name=%s\nstart_time=%i.0\nnext_check=%i.0\ntimeout=%d\ncore_time=%i.%i\ncommand_line=%s\n\n\n",
+    /* on-demand host checks are needed for dependency and reachability logic */
+    if(   hostdata->type == NEBTYPE_HOSTCHECK_SYNC_PRECHECK
+#ifdef CHECK_OPTION_DEPENDENCY_CHECK
+       || options & CHECK_OPTION_DEPENDENCY_CHECK
+#endif
+       || options & CHECK_OPTION_FORCE_EXECUTION) {
+        prio     = GM_JOB_PRIO_HIGH;
+        ondemand = TRUE;
+        priority_host_checks++;
+    } else {
+        prio = promote_check_prio(prio, (int)core_time.tv_sec - (int)hst->next_check, hst->latency, &promoted_host_checks);
+    }
+
+    snprintf( temp_buffer,GM_BUFFERSIZE-1,"type=host\nresult_queue=%s\nhost_name=%s\nstart_time=%i.0\nnext_check=%i.0\ntimeout=%d\ncore_time=%i.%i\n%s%s%scommand_line=%s\n\n\n",
               mod_gm_opt->result_queue,
               hst->name,
               (int)hst->next_check,
@@ -1054,21 +1346,21 @@ static int handle_host_check( int event_type, void *data ) {
               host_check_timeout,
               (int)core_time.tv_sec,
               (int)core_time.tv_usec,
+              mod_gm_opt->compression_threshold > 0 ? "accept_compressed=yes\n" : "",
+              mod_gm_opt->direct_results == GM_ENABLED ? "direct_result=yes\n" : "",
+              ondemand == TRUE ? "ondemand=yes\n" : "",
               processed_command
             );
 
-    if(add_job_to_queue( &client,
-                         mod_gm_opt->server_list,
-                         target_queue,
+    /* journal before submitting, the result may arrive before submit_check_job() returns */
+    gm_journal_add(hst->name, NULL, hst->next_check, &core_time);
+    if(pace_check_job( target_queue,
                         (mod_gm_opt->use_uniq_jobs == GM_ENABLED ? hst->name : NULL),
                          temp_buffer,
-                         GM_JOB_PRIO_NORMAL,
-                         GM_DEFAULT_JOB_RETRIES,
-                         mod_gm_opt->transportmode,
-                         TRUE
-                        ) == GM_OK) {
-    }
-    else {
+                         prio,
+                         ondemand
+                        ) != GM_OK) {
+        gm_journal_done(hst->name, NULL, hst->next_check);
         my_free(raw_command);
         my_free(processed_command);
 #if defined(USENAEMON)
@@ -1124,6 +1416,176 @@ static int handle_host_check( int event_type, void *data ) {
 }
 
 
+/* raise the priority of checks which are already late */
+static int promote_check_prio( int prio, int lateness, double last_latency, int * promoted ) {
+    int new_prio = prio;
+    double latency = lateness;
+
+    /* a high latency of the last check indicates a backlog too */
+    if(last_latency > latency)
+        latency = last_latency;
+
+    if(mod_gm_opt->promote_latency_high > 0 && latency >= mod_gm_opt->promote_latency_high)
+        new_prio = GM_JOB_PRIO_HIGH;
+    else if(mod_gm_opt->promote_latency_normal > 0 && latency >= mod_gm_opt->promote_latency_normal && prio < GM_JOB_PRIO_NORMAL)
+        new_prio = GM_JOB_PRIO_NORMAL;
+
+    if(new_prio > prio) {
+        gm_log( GM_LOG_TRACE, "promoted check with latency %.2f to priority %d\n", latency, new_prio );
+        (*promoted)++;
+        return new_prio;
+    }
+
+    return prio;
+}
+
+
+/* send a check unless its queue exceeds the submit rate, on-demand checks are never paced */
+static int pace_check_job( char * queue, char * uniq, char * data, int prio, int ondemand ) {
+    int rate, burst;
+
+    rate = gm_hash_get(mod_gm_opt->submit_rate_queue_rates, queue, mod_gm_opt->submit_rate);
+    if(rate <= 0 || ondemand == TRUE)
+        return submit_check_job( queue, uniq, data, prio );
+
+    burst = gm_hash_get(mod_gm_opt->submit_rate_queue_bursts, queue, 0);
+    if(burst <= 0)
+        burst = mod_gm_opt->submit_burst;
+    return gm_pace_check( queue, rate, burst, uniq, data, prio, submit_check_job );
+}
+
+
+/* send a host or service check, either as single job or packed into a bulk job */
+static int submit_check_job( char * queue, char * uniq, char * data, int prio ) {
+    gm_bulk_job_t * bulk;
+    size_t len;
+    int size, indx;
+
+    size = gm_hash_get(mod_gm_opt->bulk_job_queue_sizes, queue, mod_gm_opt->bulk_job_size);
+
+    /* high priority checks must not wait for other checks and
+     * unique checks must keep their own job */
+    if(size <= 1 || prio == GM_JOB_PRIO_HIGH || uniq != NULL) {
+        flush_bulk_jobs(FALSE);
+        return send_check_job( queue, uniq, data, prio );
+    }
+
+    if(bulk_jobs_index == NULL)
+        bulk_jobs_index = gm_hash_new();
+    indx = gm_hash_get(bulk_jobs_index, queue, -1);
+    if(indx == -1) {
+        indx      = bulk_jobs_num++;
+        bulk_jobs = gm_realloc(bulk_jobs, bulk_jobs_num * sizeof(gm_bulk_job_t));
+        memset(&bulk_jobs[indx], 0, sizeof(gm_bulk_job_t));
+        bulk_jobs[indx].queue = gm_strdup(queue);
+        gm_hash_add(bulk_jobs_index, queue, indx);
+    }
+    bulk = &bulk_jobs[indx];
+
+    /* jobs are terminated by empty lines, so they can be concatenated */
+    len = strlen(data);
+    if(bulk->len + len + 1 > bulk->size) {
+        bulk->size = bulk->size > 0 ? bulk->size : GM_BUFFERSIZE;
+        while(bulk->len + len + 1 > bulk->size)
+            bulk->size *= 2;
+        bulk->data = gm_realloc(bulk->data, bulk->size);
+    }
+    memcpy(bulk->data + bulk->len, data, len + 1);
+    bulk->len += len;
+
+    if(bulk->num == 0) {
+        gettimeofday(&bulk->start, NULL);
+        bulk->prio = prio;
+    }
+    else {
+        bulk_bytes_saved += GM_BULK_JOB_OVERHEAD + 2 * (strlen(queue) + 1);
+    }
+    if(prio > bulk->prio)
+        bulk->prio = prio;
+    bulk->num++;
+
+    gm_log( GM_LOG_TRACE, "added check to bulk job for queue %s: %d/%d\n", queue, bulk->num, size );
+    if(bulk->num >= size || bulk->len >= GM_BUFFERSIZE)
+        flush_bulk_job(indx);
+    flush_bulk_jobs(FALSE);
+
+    return GM_OK;
+}
+
+
+/* send a check job, the direct result thread waits for its result if enabled */
+static int send_check_job( char * queue, char * uniq, char * data, int prio ) {
+    char * encoded;
+    int size, rc;
+
+    if(mod_gm_opt->direct_results == GM_ENABLED)
+        return submit_direct_job( queue, uniq, data, prio );
+
+    /* only check jobs may be compressed or sent in the binary format */
+    size = mod_gm_encrypt_payload(&encoded, data, mod_gm_opt->transportmode, TRUE);
+    rc   = add_encoded_job_to_queue( &client,
+                                     mod_gm_opt->server_list,
+                                     queue,
+                                     uniq,
+                                     encoded,
+                                     size,
+                                     prio,
+                                     GM_DEFAULT_JOB_RETRIES,
+                                     TRUE
+                                    );
+    free(encoded);
+    return rc;
+}
+
+
+/* send all checks collected for a queue as one job */
+static void flush_bulk_job( int indx ) {
+    gm_bulk_job_t * bulk = &bulk_jobs[indx];
+
+    if(bulk->num == 0)
+        return;
+
+    gm_log( GM_LOG_DEBUG, "sending bulk job with %d checks to queue %s\n", bulk->num, bulk->queue );
+    if(send_check_job( bulk->queue, NULL, bulk->data, bulk->prio ) == GM_OK) {
+        bulk_jobs_sent++;
+        bulk_checks_sent += bulk->num;
+    }
+    else {
+        /* the core treats these checks as orphaned later */
+        gm_log( GM_LOG_ERROR, "sending bulk job with %d checks to queue %s failed\n", bulk->num, bulk->queue );
+        bulk_checks_lost += bulk->num;
+    }
+
+    bulk->len  = 0;
+    bulk->num  = 0;
+    return;
+}
+
+
+/* send bulk jobs whose window has passed, or all of them */
+static void flush_bulk_jobs( int all ) {
+    struct timeval now;
+    int x, window, elapsed;
+
+    if(bulk_jobs_num == 0)
+        return;
+
+    gettimeofday(&now, NULL);
+    for(x = 0; x < bulk_jobs_num; x++) {
+        if(bulk_jobs[x].num == 0)
+            continue;
+        window  = gm_hash_get(mod_gm_opt->bulk_job_queue_windows, bulk_jobs[x].queue, -1);
+        if(window < 0)
+            window = mod_gm_opt->bulk_job_window;
+        elapsed = (now.tv_sec - bulk_jobs[x].start.tv_sec) * 1000 + (now.tv_usec - bulk_jobs[x].start.tv_usec) / 1000;
+        if(all || elapsed >= window)
+            flush_bulk_job(x);
+    }
+
+    return;
+}
+
+
 /* handle service check events */
 static int handle_svc_check( int event_type, void *data ) {
     host * hst   = NULL;
@@ -1132,6 +1594,10 @@ static int handle_svc_check( int event_type, void *data ) {
     char *processed_command=NULL;
     nebstruct_service_check_data * svcdata;
     int prio = GM_JOB_PRIO_LOW;
+    int ondemand = FALSE;
+#if defined(USENAEMON) || defined(USENAGIOS4)
+    int check_options;
+#endif
 #ifdef USENAGIOS
     check_result * chk_result;
 #endif
@@ -1175,6 +1641,14 @@ static int handle_svc_check( int event_type, void *data ) {
 
     gm_log( GM_LOG_DEBUG, "received job for queue %s: %s - %s\n", target_queue, svcdata->host_name, svcdata->service_description );
 
+    /* still running since before the core restarted, the result will be adopted */
+    if(gm_journal_in_flight(svcdata->host_name, svcdata->service_description) == TRUE) {
+        gm_log( GM_LOG_DEBUG, "service check %s - %s is still in flight\n", svcdata->host_name, svcdata->service_description );
+        currently_running_service_checks++;
+        svc->is_executing=TRUE;
+        return NEBERROR_CALLBACKOVERRIDE;
+    }
+
     temp_buffer[0]='\x0';
 
     /* as we have to intercept service checks so early
@@ -1183,6 +1657,9 @@ static int handle_svc_check( int event_type, void *data ) {
      * taken from checks.c:
      */
     /* clear check options - we don't want old check options retained */
+#if defined(USENAEMON) || defined(USENAGIOS4)
+    check_options = svc->check_options;
+#endif
     svc->check_options=CHECK_OPTION_NONE;
 
     /* unset the freshening flag, otherwise only the first freshness check would be run */
@@ -1248,7 +1725,7 @@ static int handle_svc_check( int event_type, void *data ) {
 
     gm_log( GM_LOG_TRACE, "cmd_line: %s\n", processed_command );
 
-    snprintf( temp_buffer,GM_BUFFERSIZE-1,"type=service\nresult_queue=%s\nhost_name=%s\nservice_description=%s\nstart_time=%i.0\nnext_check=%i.0\ncore_time=%i.%i\ntimeout=%d\ncommand_line=%s\n\n\n",
+    snprintf( temp_buffer,GM_BUFFERSIZE-1,"type=service\nresult_queue=%s\nhost_name=%s\nservice_description=%s\nstart_time=%i.0\nnext_check=%i.0\ncore_time=%i.%i\ntimeout=%d\n%s%scommand_line=%s\n\n\n",
               mod_gm_opt->result_queue,
               svcdata->host_name,
               svcdata->service_description,
@@ -1257,6 +1734,8 @@ static int handle_svc_check( int event_type, void *data ) {
               (int)core_time.tv_sec,
               (int)core_time.tv_usec,
               service_check_timeout,
+              mod_gm_opt->compression_threshold > 0 ? "accept_compressed=yes\n" : "",
+              mod_gm_opt->direct_results == GM_ENABLED ? "direct_result=yes\n" : "",
               processed_command
             );
 
@@ -1268,23 +1747,28 @@ static int handle_svc_check( int event_type, void *data ) {
     if(check_result_info.check_options & CHECK_OPTION_FORCE_EXECUTION)
 #endif
 #if defined(USENAEMON) || defined(USENAGIOS4)
-    if(svc->check_options & CHECK_OPTION_FORCE_EXECUTION)
+    if(check_options & CHECK_OPTION_FORCE_EXECUTION)
 #endif
-        prio = GM_JOB_PRIO_HIGH;
+    {
+        prio     = GM_JOB_PRIO_HIGH;
+        ondemand = TRUE;
+    }
 
-    if(add_job_to_queue( &client,
-                         mod_gm_opt->server_list,
-                         target_queue,
+    /* late checks should not wait behind fresh ones */
+    prio = promote_check_prio(prio, (int)core_time.tv_sec - (int)svc->next_check, svc->latency, &promoted_service_checks);
+
+    /* journal before submitting, the result may arrive before submit_check_job() returns */
+    gm_journal_add(svcdata->host_name, svcdata->service_description, svc->next_check, &core_time);
+    if(pace_check_job( target_queue,
                         (mod_gm_opt->use_uniq_jobs == GM_ENABLED ? uniq : NULL),
                          temp_buffer,
                          prio,
-                         GM_DEFAULT_JOB_RETRIES,
-                         mod_gm_opt->transportmode,
-                         TRUE
+                         ondemand
                         ) == GM_OK) {
         gm_log( GM_LOG_TRACE, "handle_svc_check() finished successfully\n" );
     }
     else {
+        gm_journal_done(svcdata->host_name, svcdata->service_description, svc->next_check);
         my_free(raw_command);
         my_free(processed_command);
 #if defined(USENAEMON)
@@ -1466,51 +1950,36 @@ static void set_target_queue( host *hst, service *svc ) {
 
     /* look for matching local servicegroups */
     if ( svc ) {
-        while ( mod_gm_opt->local_servicegroups_list[x] != NULL ) {
-            servicegroup * temp_servicegroup = find_servicegroup( mod_gm_opt->local_servicegroups_list[x] );
-            if ( temp_servicegroup != NULL && is_service_member_of_servicegroup( temp_servicegroup,svc )==TRUE ) {
-                gm_log( GM_LOG_TRACE, "service is member of local servicegroup: %s\n", mod_gm_opt->local_servicegroups_list[x] );
-                return;
-            }
-            x++;
+        x = first_servicegroup( mod_gm_opt->local_servicegroups_index, svc );
+        if ( x >= 0 ) {
+            gm_log( GM_LOG_TRACE, "service is member of local servicegroup: %s\n", mod_gm_opt->local_servicegroups_list[x] );
+            return;
         }
     }
 
     /* look for matching local hostgroups */
-    x = 0;
-    while ( mod_gm_opt->local_hostgroups_list[x] != NULL ) {
-        hostgroup * temp_hostgroup = find_hostgroup( mod_gm_opt->local_hostgroups_list[x] );
-        if ( temp_hostgroup != NULL && is_host_member_of_hostgroup( temp_hostgroup,hst )==TRUE ) {
-            gm_log( GM_LOG_TRACE, "server is member of local hostgroup: %s\n", mod_gm_opt->local_hostgroups_list[x] );
-            return;
-        }
-        x++;
+    x = first_hostgroup( mod_gm_opt->local_hostgroups_index, hst );
+    if ( x >= 0 ) {
+        gm_log( GM_LOG_TRACE, "server is member of local hostgroup: %s\n", mod_gm_opt->local_hostgroups_list[x] );
+        return;
     }
 
     /* look for matching servicegroups */
-    x = 0;
     if ( svc ) {
-        while ( mod_gm_opt->servicegroups_list[x] != NULL ) {
-            servicegroup * temp_servicegroup = find_servicegroup( mod_gm_opt->servicegroups_list[x] );
-            if ( temp_servicegroup != NULL && is_service_member_of_servicegroup( temp_servicegroup,svc )==TRUE ) {
-                gm_log( GM_LOG_TRACE, "service is member of servicegroup: %s\n", mod_gm_opt->servicegroups_list[x] );
-                snprintf( target_queue, GM_BUFFERSIZE-1, "servicegroup_%s", mod_gm_opt->servicegroups_list[x] );
-                return;
-            }
-            x++;
+        x = first_servicegroup( mod_gm_opt->servicegroups_index, svc );
+        if ( x >= 0 ) {
+            gm_log( GM_LOG_TRACE, "service is member of servicegroup: %s\n", mod_gm_opt->servicegroups_list[x] );
+            snprintf( target_queue, GM_BUFFERSIZE-1, "servicegroup_%s", mod_gm_opt->servicegroups_list[x] );
+            return;
         }
     }
 
     /* look for matching hostgroups */
-    x = 0;
-    while ( mod_gm_opt->hostgroups_list[x] != NULL ) {
-        hostgroup * temp_hostgroup = find_hostgroup( mod_gm_opt->hostgroups_list[x] );
-        if ( temp_hostgroup != NULL && is_host_member_of_hostgroup( temp_hostgroup,hst )==TRUE ) {
-            gm_log( GM_LOG_TRACE, "server is member of hostgroup: %s\n", mod_gm_opt->hostgroups_list[x] );
-            snprintf( target_queue, GM_BUFFERSIZE-1, "hostgroup_%s", mod_gm_opt->hostgroups_list[x] );
-            return;
-        }
-        x++;
+    x = first_hostgroup( mod_gm_opt->hostgroups_index, hst );
+    if ( x >= 0 ) {
+        gm_log( GM_LOG_TRACE, "server is member of hostgroup: %s\n", mod_gm_opt->hostgroups_list[x] );
+        snprintf( target_queue, GM_BUFFERSIZE-1, "hostgroup_%s", mod_gm_opt->hostgroups_list[x] );
+        return;
     }
 
     if ( svc ) {
@@ -1532,6 +2001,45 @@ static void set_target_queue( host *hst, service *svc ) {
 }
 
 
+/* get the position of the first configured hostgroup the host is member of */
+static int first_hostgroup( gm_hash_t * index, host * hst ) {
+    objectlist * temp_objectlist;
+    int x, first = -1;
+
+    if ( index == NULL || index->num == 0 )
+        return -1;
+
+    /* configuration order decides if the host is member of several groups */
+    for ( temp_objectlist = hst->hostgroups_ptr; temp_objectlist != NULL; temp_objectlist = temp_objectlist->next ) {
+        hostgroup * temp_hostgroup = (hostgroup *)temp_objectlist->object_ptr;
+        x = gm_hash_get( index, temp_hostgroup->group_name, -1 );
+        if ( x >= 0 && ( first == -1 || x < first ) )
+            first = x;
+    }
+
+    return first;
+}
+
+
+/* get the position of the first configured servicegroup the service is member of */
+static int first_servicegroup( gm_hash_t * index, service * svc ) {
+    objectlist * temp_objectlist;
+    int x, first = -1;
+
+    if ( index == NULL || index->num == 0 )
+        return -1;
+
+    for ( temp_objectlist = svc->servicegroups_ptr; temp_objectlist != NULL; temp_objectlist = temp_objectlist->next ) {
+        servicegroup * temp_servicegroup = (servicegroup *)temp_objectlist->object_ptr;
+        x = gm_hash_get( index, temp_servicegroup->group_name, -1 );
+        if ( x >= 0 && ( first == -1 || x < first ) )
+            first = x;
+    }
+
+    return first;
+}
+
+
 /* start our threads */
 static void start_threads(void) {
     if ( result_threads_running < mod_gm_opt->result_workers ) {
@@ -1542,6 +2050,10 @@ static void start_threads(void) {
             pthread_create ( &result_thr[x], NULL, result_worker, (void *)&result_threads_running);
         }
     }
+    if ( mod_gm_opt->direct_results == GM_ENABLED && direct_thread_running == FALSE ) {
+        if(pthread_create ( &direct_thr, NULL, direct_result_worker, NULL ) == 0)
+            direct_thread_running = TRUE;
+    }
 }
 
 
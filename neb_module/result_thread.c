@@ -27,6 +27,8 @@
 #include "utils.h"
 #include "mod_gearman.h"
 #include "gearman_utils.h"
+#include "gm_wire.h"
+#include "gm_journal.h"
 
 #ifdef USENAEMON
 static const char *gearman_worker_source_name(void *source) {
@@ -45,6 +47,9 @@ struct check_engine mod_gearman_check_engine = {
 };
 #endif
 
+static int process_results( const void *payload, size_t wsize, const char *handle );
+static int process_result( char **data, struct timeval *now, char *decrypted_orig );
+
 /* cleanup and exit this thread */
 static void cancel_worker_thread (void * data) {
 
@@ -55,6 +60,7 @@ static void cancel_worker_thread (void * data) {
     gearman_worker_free(worker);
 
     gm_log( GM_LOG_DEBUG, "worker thread finished\n" );
+    gm_log_flush();
 
     return;
 }
@@ -75,6 +81,7 @@ void *result_worker( void * data ) {
     pthread_cleanup_push ( cancel_worker_thread, (void*) &worker);
 
     while ( 1 ) {
+        gm_log_flush();
         ret = gearman_worker_work( &worker );
         if ( ret != GEARMAN_SUCCESS && ret != GEARMAN_WORK_FAIL ) {
             if ( ret != GEARMAN_TIMEOUT)
@@ -98,21 +105,6 @@ void *result_worker( void * data ) {
 
 /* put back the result into the core */
 void *get_results( gearman_job_st *job, void *context, size_t *result_size, gearman_return_t *ret_ptr ) {
-    int wsize, transportmode;
-    char *workload;
-    char *decrypted_data;
-    char *decrypted_data_c;
-#ifdef GM_DEBUG
-    char *decrypted_orig;
-#endif
-    struct timeval now, core_start_time;
-    check_result * chk_result;
-    int active_check = TRUE;
-    char *ptr;
-    double now_f, core_starttime_f, starttime_f, finishtime_f, exec_time, latency;
-
-    /* for calculating real latency */
-    gettimeofday(&now,NULL);
 
     /* contect is unused */
     context = context;
@@ -123,34 +115,51 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
     /* set result pointer to success */
     *ret_ptr = GEARMAN_SUCCESS;
 
+    gm_log( GM_LOG_TRACE, "got result %s\n", gearman_job_handle( job ));
+    if(process_results(gearman_job_workload(job), gearman_job_workload_size(job), gearman_job_handle( job )) != GM_OK)
+        *ret_ptr = GEARMAN_WORK_FAIL;
+
+    return NULL;
+}
+
+
+/* decrypt a result payload and add all contained results to the result list */
+static int process_results( const void * payload, size_t wsize, const char * handle ) {
+    int transportmode, results, rc = GM_OK;
+    char *workload;
+    char *decrypted_data;
+    char *decrypted_data_c;
+    char *decrypted_orig = NULL;
+    struct timeval now;
+
+    /* for calculating real latency */
+    gettimeofday(&now,NULL);
+
     /* get the data */
-    wsize = gearman_job_workload_size(job);
-    workload = gm_malloc(sizeof(char*)*wsize+1);
-    strncpy(workload, (const char*)gearman_job_workload(job), wsize);
+    workload = gm_malloc(wsize+1);
+    memcpy(workload, payload, wsize);
     workload[wsize] = '\x0';
-    gm_log( GM_LOG_TRACE, "got result %s\n", gearman_job_handle( job ));
     gm_log( GM_LOG_TRACE, "%d +++>\n%s\n<+++\n", strlen(workload), workload );
 
     /* decrypt data */
     decrypted_data   = gm_malloc(wsize*2);
-    decrypted_data_c = decrypted_data;
 
     if(mod_gm_opt->transportmode == GM_ENCODE_AND_ENCRYPT && mod_gm_opt->accept_clear_results == GM_ENABLED) {
         transportmode = GM_ENCODE_ACCEPT_ALL;
     } else {
         transportmode = mod_gm_opt->transportmode;
     }
-    mod_gm_decrypt(&decrypted_data, workload, transportmode);
+    mod_gm_decrypt(&decrypted_data, workload, wsize, transportmode);
+    decrypted_data_c = decrypted_data;
+    free(workload);
 
     if(decrypted_data == NULL) {
-        *ret_ptr = GEARMAN_WORK_FAIL;
-        return NULL;
+        return GM_ERROR;
     }
     gm_log( GM_LOG_TRACE, "%d --->\n%s\n<---\n", strlen(decrypted_data), decrypted_data );
 #ifdef GM_DEBUG
     decrypted_orig   = gm_strdup(decrypted_data);
 #endif
-    free(workload);
 
     /*
      * save this result to a file, so when nagios crashes,
@@ -167,16 +176,47 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
     }
 #endif
 
-    /* nagios will free it after processing */
-    if ( ( chk_result = ( check_result * )gm_malloc( sizeof *chk_result ) ) == 0 ) {
-        *ret_ptr = GEARMAN_WORK_FAIL;
+    /* workers may send several results in one job, each one is terminated by an empty line */
+    results = 0;
+    while ( decrypted_data != NULL ) {
+        while ( *decrypted_data == '\n' || *decrypted_data == GM_WIRE_END )
+            decrypted_data++;
+        if ( *decrypted_data == '\x0' )
+            break;
+        if ( process_result( &decrypted_data, &now, decrypted_orig ) != GM_OK ) {
+            rc = GM_ERROR;
+            gm_log( GM_LOG_ERROR, "discarded invalid job (%s), check your encryption settings\n", handle );
+        }
+        results++;
+    }
+    if ( results > 1 )
+        gm_log( GM_LOG_TRACE, "job %s contained %d results\n", handle, results );
+
+    free(decrypted_data_c);
 #ifdef GM_DEBUG
     free(decrypted_orig);
 #endif
-#ifdef USENAEMON
-        free(decrypted_data);
-#endif
-        return NULL;
+
+    return rc;
+}
+
+
+/* parse a single result and add it to the result list */
+static int process_result( char **data, struct timeval *now, char *decrypted_orig ) {
+    struct timeval core_start_time;
+    check_result * chk_result;
+    int active_check = TRUE;
+    int ondemand     = FALSE;
+    char *key;
+    char *value;
+    double now_f, core_starttime_f, starttime_f, finishtime_f, exec_time, latency;
+
+    /* decrypted_orig is only used for debugging */
+    decrypted_orig = decrypted_orig;
+
+    /* nagios will free it after processing */
+    if ( ( chk_result = ( check_result * )gm_malloc( sizeof *chk_result ) ) == 0 ) {
+        return GM_ERROR;
     }
     init_check_result(chk_result);
     chk_result->scheduled_check     = TRUE;
@@ -191,13 +231,14 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
     core_start_time.tv_sec          = 0;
     core_start_time.tv_usec         = 0;
 
-    while ( (ptr = strsep(&decrypted_data, "\n" )) != NULL ) {
-        char *key   = strsep( &ptr, "=" );
-        char *value = strsep( &ptr, "\x0" );
-
+    while ( gm_wire_next(data, &key, &value) ) {
         if ( key == NULL )
             continue;
 
+        /* an empty line terminates this result */
+        if ( value == NULL && !strcmp( key, "" ) )
+            break;
+
         if ( !strcmp( key, "output" ) ) {
             if ( value == NULL ) {
                 chk_result->output = gm_strdup("(null)");
@@ -220,7 +261,7 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
         }
 
         if ( value == NULL || !strcmp( value, "") )
-            break;
+            continue;
 
         if ( !strcmp( key, "host_name" ) ) {
             chk_result->host_name = gm_strdup( value );
@@ -254,16 +295,28 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
             string2timeval(value, &chk_result->finish_time);
         } else if ( !strcmp( key, "latency" ) ) {
             chk_result->latency = atof( value );
+        } else if ( !strcmp( key, "ondemand" ) ) {
+            ondemand = parse_yes_or_no( value, GM_DISABLED );
         }
     }
 
     if ( chk_result->host_name == NULL || chk_result->output == NULL ) {
-        *ret_ptr= GEARMAN_WORK_FAIL;
-        gm_log( GM_LOG_ERROR, "discarded invalid job (%s), check your encryption settings\n", gearman_job_handle( job ) );
-#ifdef GM_DEBUG
-    free(decrypted_orig);
-#endif
-        return NULL;
+        free(chk_result->host_name);
+        free(chk_result->service_description);
+        free(chk_result->output);
+        free(chk_result);
+        return GM_ERROR;
+    }
+
+    /* results of checks journaled before a core restart are adopted unless they are too old */
+    if ( active_check == TRUE && core_start_time.tv_sec != 0
+      && gm_journal_done( chk_result->host_name, chk_result->service_description, core_start_time.tv_sec ) == GM_JOURNAL_EXPIRED ) {
+        gm_log( GM_LOG_DEBUG, "discarding too old result of the previous core: %s %s\n", chk_result->host_name, chk_result->service_description != NULL ? chk_result->service_description : "" );
+        free(chk_result->host_name);
+        free(chk_result->service_description);
+        free(chk_result->output);
+        free(chk_result);
+        return GM_OK;
     }
 
     if ( chk_result->service_description != NULL ) {
@@ -290,7 +343,7 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
     }
 
     /* calculate real latency */
-    now_f            = (double)now.tv_sec + (double)now.tv_usec / 1000000;
+    now_f            = (double)now->tv_sec + (double)now->tv_usec / 1000000;
     core_starttime_f = (double)core_start_time.tv_sec + (double)core_start_time.tv_usec / 1000000;
     starttime_f      = (double)chk_result->start_time.tv_sec + (double)chk_result->start_time.tv_usec / 1000000;
     finishtime_f     = (double)chk_result->finish_time.tv_sec + (double)chk_result->finish_time.tv_usec / 1000000;
@@ -319,7 +372,7 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
         if(svc == NULL) {
             write_debug_file(&decrypted_orig);
             gm_log( GM_LOG_ERROR, "service '%s' on host '%s' could not be found\n", chk_result->service_description, chk_result->host_name );
-            return NULL;
+            return GM_OK;
         }
 #endif
         gm_log( GM_LOG_DEBUG, "service job completed: %s %s: %d\n", chk_result->host_name, chk_result->service_description, chk_result->return_code );
@@ -331,7 +384,7 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
         if(hst == NULL) {
             write_debug_file(&decrypted_orig);
             gm_log( GM_LOG_ERROR, "host '%s' could not be found\n", chk_result->host_name );
-            return NULL;
+            return GM_OK;
         }
 #endif
 #if defined(USENAEMON)
@@ -345,18 +398,13 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
         gm_log( GM_LOG_DEBUG, "host job completed: %s: %d\n", chk_result->host_name, chk_result->return_code );
     }
 
-    /* add result to result list */
-    mod_gm_add_result_to_list( chk_result );
+    /* the core waits for on-demand host checks, so they skip the normal result list */
+    if ( ondemand == TRUE && chk_result->service_description == NULL )
+        mod_gm_add_fast_result_to_list( chk_result, &core_start_time );
+    else
+        mod_gm_add_result_to_list( chk_result );
 
-    /* reset pointer */
-    chk_result = NULL;
-
-    free(decrypted_data_c);
-#ifdef GM_DEBUG
-    free(decrypted_orig);
-#endif
-
-    return NULL;
+    return GM_OK;
 }
 
 
@@ -385,6 +433,217 @@ int set_worker( gearman_worker_st *worker ) {
     return GM_OK;
 }
 
+/* checks waiting to be submitted by the direct result thread */
+typedef struct gm_direct_job {
+    char                 * queue;
+    char                 * uniq;
+    char                 * encoded;
+    int                    size;
+    int                    prio;
+    struct gm_direct_job * next;
+} gm_direct_job_t;
+
+static gm_direct_job_t * direct_jobs             = NULL;
+static gm_direct_job_t * direct_jobs_last        = NULL;
+static pthread_mutex_t   direct_jobs_mutex       = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    direct_jobs_cond        = PTHREAD_COND_INITIALIZER;
+static int               direct_jobs_stop        = FALSE;
+static int               direct_jobs_in_flight   = 0;
+static unsigned long long direct_results_received = 0;
+static unsigned long long direct_results_queued   = 0;
+static unsigned long long direct_jobs_lost        = 0;
+
+/* free a direct job and all following ones */
+static void free_direct_jobs( gm_direct_job_t * job ) {
+    gm_direct_job_t * next;
+    while ( job != NULL ) {
+        next = job->next;
+        free(job->queue);
+        free(job->uniq);
+        free(job->encoded);
+        free(job);
+        job = next;
+    }
+    return;
+}
+
+
+/* queue a check for the direct result thread */
+int submit_direct_job( char * queue, char * uniq, char * data, int prio ) {
+    gm_direct_job_t * job;
+
+    /* check too long queue names */
+    if(strlen(queue) > GEARMAN_FUNCTION_MAX_SIZE - 1) {
+        gm_log( GM_LOG_ERROR, "queue name too long: '%s'\n", queue );
+        return GM_ERROR;
+    }
+
+    job          = gm_malloc(sizeof *job);
+    job->queue   = gm_strdup(queue);
+    job->uniq    = NULL;
+    if(uniq != NULL)
+        job->uniq = strlen(uniq) > GEARMAN_MAX_UNIQUE_SIZE - 1 ? md5sum(uniq) : gm_strdup(uniq);
+    job->size    = mod_gm_encrypt_payload(&job->encoded, data, mod_gm_opt->transportmode, TRUE);
+    job->prio    = prio;
+    job->next    = NULL;
+
+    pthread_mutex_lock(&direct_jobs_mutex);
+    if(direct_jobs_last != NULL)
+        direct_jobs_last->next = job;
+    else
+        direct_jobs = job;
+    direct_jobs_last = job;
+    pthread_cond_signal(&direct_jobs_cond);
+    pthread_mutex_unlock(&direct_jobs_mutex);
+
+    return GM_OK;
+}
+
+
+/* let the direct result thread exit */
+void stop_direct_results(void) {
+    pthread_mutex_lock(&direct_jobs_mutex);
+    direct_jobs_stop = TRUE;
+    pthread_cond_signal(&direct_jobs_cond);
+    pthread_mutex_unlock(&direct_jobs_mutex);
+    return;
+}
+
+
+/* a direct job has been finished, its completion data contains the results */
+static gearman_return_t direct_result_complete( gearman_task_st *task ) {
+    direct_jobs_in_flight--;
+
+    /* older workers and workers in broker mode use the result queue instead */
+    if(gearman_task_data_size(task) == 0) {
+        direct_results_queued++;
+        return GEARMAN_SUCCESS;
+    }
+
+    gm_log( GM_LOG_TRACE, "got direct result %s\n", gearman_task_job_handle( task ));
+    process_results(gearman_task_data(task), gearman_task_data_size(task), gearman_task_job_handle( task ));
+    direct_results_received++;
+
+    return GEARMAN_SUCCESS;
+}
+
+
+/* a worker failed a direct job */
+static gearman_return_t direct_result_fail( gearman_task_st *task ) {
+    direct_jobs_in_flight--;
+    direct_jobs_lost++;
+    gm_log( GM_LOG_ERROR, "direct job %s failed\n", gearman_task_job_handle( task ));
+    return GEARMAN_SUCCESS;
+}
+
+
+/* create the client of the direct result thread */
+static int set_direct_client( gearman_client_st *client ) {
+    if(create_client( mod_gm_opt->server_list, client ) != GM_OK)
+        return GM_ERROR;
+
+    /* tasks are collected by one thread, so it must never block on a single one */
+    gearman_client_add_options(client, GEARMAN_CLIENT_NON_BLOCKING | GEARMAN_CLIENT_FREE_TASKS);
+    gearman_client_set_complete_fn(client, direct_result_complete);
+    gearman_client_set_fail_fn(client, direct_result_fail);
+    gearman_client_set_timeout(client, GM_DIRECT_RESULT_POLL);
+
+    return GM_OK;
+}
+
+
+/* submit a foreground job, the worker answers with the results */
+static void add_direct_task( gearman_client_st *client, gm_direct_job_t *job ) {
+    gearman_task_st *task = NULL;
+    gearman_return_t ret  = GEARMAN_SUCCESS;
+
+    if( job->prio == GM_JOB_PRIO_LOW )
+        task = gearman_client_add_task_low( client, NULL, NULL, job->queue, job->uniq, ( void * )job->encoded, ( size_t )job->size, &ret );
+    else if( job->prio == GM_JOB_PRIO_HIGH )
+        task = gearman_client_add_task_high( client, NULL, NULL, job->queue, job->uniq, ( void * )job->encoded, ( size_t )job->size, &ret );
+    else
+        task = gearman_client_add_task( client, NULL, NULL, job->queue, job->uniq, ( void * )job->encoded, ( size_t )job->size, &ret );
+
+    if(task == NULL || ret != GEARMAN_SUCCESS) {
+        gm_log( GM_LOG_ERROR, "sending direct job to gearmand failed: %s\n", gearman_client_error(client) );
+        direct_jobs_lost++;
+        return;
+    }
+
+    /* the task takes ownership of the workload */
+    gearman_task_give_workload(task, job->encoded, job->size);
+    job->encoded = NULL;
+    direct_jobs_in_flight++;
+
+    return;
+}
+
+
+/* submit checks as foreground jobs and collect their results from the completion data */
+void *direct_result_worker( void * data ) {
+    gearman_client_st client;
+    gm_direct_job_t * jobs, * job;
+    gearman_return_t ret;
+    int stop;
+
+    /* data is unused */
+    data = data;
+
+    gm_log( GM_LOG_DEBUG, "started direct result thread\n" );
+    while(set_direct_client(&client) != GM_OK)
+        sleep(1);
+
+    while ( 1 ) {
+        gm_log_flush();
+
+        /* take over new checks, sleep if there is nothing to do */
+        pthread_mutex_lock(&direct_jobs_mutex);
+        while(direct_jobs == NULL && direct_jobs_in_flight == 0 && direct_jobs_stop == FALSE)
+            pthread_cond_wait(&direct_jobs_cond, &direct_jobs_mutex);
+        jobs             = direct_jobs;
+        direct_jobs      = NULL;
+        direct_jobs_last = NULL;
+        stop             = direct_jobs_stop;
+        pthread_mutex_unlock(&direct_jobs_mutex);
+
+        if(stop == TRUE) {
+            free_direct_jobs(jobs);
+            break;
+        }
+
+        for(job = jobs; job != NULL; job = job->next)
+            add_direct_task(&client, job);
+        free_direct_jobs(jobs);
+
+        /* wait a short moment only, so new checks do not get delayed */
+        ret = gearman_client_run_tasks(&client);
+        if(ret == GEARMAN_SUCCESS)
+            direct_jobs_in_flight = 0;
+        else if(ret == GEARMAN_IO_WAIT)
+            ret = gearman_client_wait(&client);
+        if(ret == GEARMAN_SUCCESS || ret == GEARMAN_IO_WAIT || ret == GEARMAN_TIMEOUT)
+            continue;
+
+        /* the core handles the lost checks as orphaned */
+        gm_log( GM_LOG_ERROR, "direct result client error, lost %d running checks: %s\n", direct_jobs_in_flight, gearman_client_error(&client) );
+        direct_jobs_lost     += direct_jobs_in_flight;
+        direct_jobs_in_flight = 0;
+        gearman_client_free(&client);
+        sleep(1);
+        while(set_direct_client(&client) != GM_OK)
+            sleep(1);
+    }
+
+    gearman_client_free(&client);
+    if(direct_results_received > 0 || direct_results_queued > 0 || direct_jobs_lost > 0)
+        gm_log( GM_LOG_INFO, "received %llu direct results, %llu checks answered through the result queue, %llu checks lost\n",
+                direct_results_received, direct_results_queued, direct_jobs_lost + direct_jobs_in_flight );
+    gm_log( GM_LOG_DEBUG, "direct result thread finished\n" );
+
+    return NULL;
+}
+
+
 #ifdef GM_DEBUG
 /* write text to a debug file */
 void write_debug_file(char ** text) {
@@ -9,7 +9,7 @@ Source0:       mod_gearman-%{version}.tar.gz
 Group:         Applications/Monitoring
 BuildRoot:     %{_tmppath}/%{name}-%{version}-root-%(%{__id_u} -n)
 BuildRequires: autoconf, automake, ncurses-devel
-BuildRequires: libtool, libtool-ltdl-devel, libevent-devel
+BuildRequires: libtool, libtool-ltdl-devel, libevent-devel, zlib-devel
 BuildRequires: gearmand-devel
 Summary:       Gearman module for Naemon
 Requires(pre,post): /sbin/ldconfig
@@ -128,6 +128,8 @@ fi
 %{_libdir}/mod_gearman/mod_gearman_nagios3.o
 %{_libdir}/mod_gearman/mod_gearman_nagios4.o
 
+%{_includedir}/mod_gearman/mod_gearman_plugin.h
+
 %attr(755,naemon,root) %{_localstatedir}/mod_gearman
 %attr(755,naemon,root) %{_localstatedir}/log/mod_gearman
 
@@ -7,9 +7,25 @@
 #include <common.h>
 #include <utils.h>
 #include <check_utils.h>
+#include <worker_client.h>
+#include <gm_wire.h>
+#include <gm_journal.h>
+#include <gm_pace.h>
 
 #include <worker_dummy_functions.c>
 
+/* remember the order and data of checks sent by the token buckets */
+static char pace_sent[GM_BUFFERSIZE];
+static char pace_data[GM_BUFFERSIZE];
+static int pace_submit(char * queue, char * uniq, char * data, int prio);
+static int pace_submit(char * queue, char * uniq, char * data, int prio) {
+    queue = queue;
+    prio  = prio;
+    strcat(pace_sent, uniq);
+    snprintf(pace_data, sizeof(pace_data), "%s", data);
+    return GM_OK;
+}
+
 void printf_hex(char*, int);
 void printf_hex(char* text, int length) {
     int i;
@@ -30,7 +46,7 @@ mod_gm_opt_t * renew_opts() {
 }
 
 int main(void) {
-    plan(69);
+    plan(107);
 
     /* lowercase */
     char test[100];
@@ -115,7 +131,7 @@ int main(void) {
 
     /* decrypt */
     char * decrypted = malloc(GM_BUFFERSIZE);
-    mod_gm_decrypt(&decrypted, encrypted, GM_ENCODE_AND_ENCRYPT);
+    mod_gm_decrypt(&decrypted, encrypted, len, GM_ENCODE_AND_ENCRYPT);
     like(decrypted, text, "decrypted text");
     free(decrypted);
     free(encrypted);
@@ -128,7 +144,7 @@ int main(void) {
 
     /* debase 64 */
     char * debase64 = malloc(GM_BUFFERSIZE);
-    mod_gm_decrypt(&debase64, base64, GM_ENCODE_ONLY);
+    mod_gm_decrypt(&debase64, base64, len, GM_ENCODE_ONLY);
     like(debase64, text, "debase64 text");
     free(debase64);
     free(base64);
@@ -203,6 +219,25 @@ int main(void) {
     ok(mod_gm_opt->server_list[1]->port == 4730, "duplicate server");
     ok(mod_gm_opt->server_num == 2, "server_number = %d", mod_gm_opt->server_num);
 
+    /* hostgroups are not limited and duplicates are skipped */
+    mod_gm_free_opt(mod_gm_opt);
+    mod_gm_opt = renew_opts();
+    for(i = 0; i < 1000; i++) {
+        snprintf(test, 100, "hostgroups=group%d,group%d", i, i/2);
+        parse_args_line(mod_gm_opt, test, 0);
+    }
+    ok(mod_gm_opt->hostgroups_num == 1000, "hostgroups_num = %d", mod_gm_opt->hostgroups_num);
+    ok(gm_hash_get(mod_gm_opt->hostgroups_index, "group999", -1) == 999, "hostgroup index lookup");
+    ok(gm_hash_get(mod_gm_opt->hostgroups_index, "group1000", -1) == -1, "unknown hostgroup lookup");
+
+    /* restrict_path prefix lookup */
+    strcpy(test, "restrict_path=/usr/lib/nagios/");
+    parse_args_line(mod_gm_opt, test, 0);
+    strcpy(test, "restrict_path=/opt/plugins/");
+    parse_args_line(mod_gm_opt, test, 0);
+    ok(gm_trie_match(mod_gm_opt->restrict_path_trie, "/opt/plugins/check_ping") == TRUE, "restrict_path match");
+    ok(gm_trie_match(mod_gm_opt->restrict_path_trie, "/opt/plugin") == FALSE, "restrict_path no match");
+
     /* escape newlines */
     char * escaped = gm_escape_newlines(" test\n", GM_DISABLED);
     is(escaped, " test\\n", "untrimmed escape string");
@@ -238,6 +273,104 @@ int main(void) {
     is(starts_with(test2, test), FALSE,  "starts_with(xyz, test123)");
     free(test2);
 
+    /* per queue bulk job settings */
+    strcpy(test, "bulk_job_queue=hostgroup_fast:20:5, servicegroup_ping:10");
+    parse_args_line(mod_gm_opt, test, 0);
+    ok(mod_gm_opt->bulk_job_queues_num == 2, "bulk_job_queues_num = %d", mod_gm_opt->bulk_job_queues_num);
+    ok(gm_hash_get(mod_gm_opt->bulk_job_queue_sizes, "hostgroup_fast", 1) == 20, "bulk job size of queue");
+    ok(gm_hash_get(mod_gm_opt->bulk_job_queue_windows, "hostgroup_fast", -1) == 5, "bulk job window of queue");
+    ok(gm_hash_get(mod_gm_opt->bulk_job_queue_windows, "servicegroup_ping", -1) == -1, "bulk job without window uses bulk_job_window");
+
+    /* per queue submit rates */
+    strcpy(test, "submit_rate_queue=hostgroup_switches:50:200, servicegroup_slow:5");
+    parse_args_line(mod_gm_opt, test, 0);
+    ok(mod_gm_opt->submit_rate_queues_num == 2 && gm_hash_get(mod_gm_opt->submit_rate_queue_rates, "hostgroup_switches", 0) == 50 && gm_hash_get(mod_gm_opt->submit_rate_queue_bursts, "hostgroup_switches", 0) == 200, "parsing submit_rate_queue with burst");
+    ok(gm_hash_get(mod_gm_opt->submit_rate_queue_rates, "servicegroup_slow", 0) == 5 && gm_hash_get(mod_gm_opt->submit_rate_queue_bursts, "servicegroup_slow", -1) == 0, "submit_rate_queue without burst uses submit_burst");
+
+    /* direct results */
+    strcpy(test, "direct_results=yes");
+    parse_args_line(mod_gm_opt, test, 0);
+    ok(mod_gm_opt->direct_results == GM_ENABLED, "parsing direct_results");
+
+    /* bulk jobs in text and binary format */
+    char bulk[] = "type=service\nhost_name=host1\nservice_description=svc1\nservice_output=\ncommand_line=/bin/true\n\n\n"
+                  "type=host\nhost_name=host2\ndirect_result=yes\nondemand=yes\ncommand_line=/bin/false\n\n\n";
+    char * encoded, * decoded, * data;
+    int accept_compressed = GM_DISABLED, size;
+    for(i = 0; i < 2; i++) {
+        gm_job_t * job1 = malloc(sizeof(gm_job_t));
+        gm_job_t * job2 = malloc(sizeof(gm_job_t));
+        set_default_job(job1, mod_gm_opt);
+        set_default_job(job2, mod_gm_opt);
+        if(i == 0) {
+            decoded = strdup(bulk);
+            encoded = NULL;
+        } else {
+            size    = gm_wire_encode(&encoded, bulk, FALSE, FALSE);
+            decoded = malloc(size + 1);
+            gm_wire_decode(&decoded, encoded, size, GM_ENCODE_ONLY);
+        }
+        data = decoded;
+        ok(parse_job(&data, job1, &accept_compressed) == 4 && !strcmp(job1->service_description, "svc1"), "%s bulk job: first check", i == 0 ? "text" : "binary");
+        ok(has_next_job(&data) == TRUE, "%s bulk job: has second check", i == 0 ? "text" : "binary");
+        ok(parse_job(&data, job2, &accept_compressed) == 3 && !strcmp(job2->host_name, "host2") && !strcmp(job2->command_line, "/bin/false"), "%s bulk job: second check", i == 0 ? "text" : "binary");
+        ok(has_next_job(&data) == FALSE, "%s bulk job: no further checks", i == 0 ? "text" : "binary");
+        ok(job1->direct_result == FALSE && job2->direct_result == TRUE, "%s bulk job: direct result flag", i == 0 ? "text" : "binary");
+        ok(job1->ondemand == FALSE && job2->ondemand == TRUE, "%s bulk job: on-demand flag", i == 0 ? "text" : "binary");
+        free_job(job1);
+        free_job(job2);
+        free(decoded);
+        free(encoded);
+    }
+
+    /* journal of in-flight checks */
+    char journal_file[] = "/tmp/mod_gm_journal.XXXXXX";
+    struct timeval core_time;
+    int fd = mkstemp(journal_file);
+    close(fd);
+    gettimeofday(&core_time, NULL);
+    ok(gm_journal_open(journal_file, 60) == GM_OK, "journal opened");
+    gm_journal_add("host1", "svc1", 1000, &core_time);
+    gm_journal_add("host1", NULL, 1001, &core_time);
+    core_time.tv_sec -= 120;
+    gm_journal_add("host2", "svc2", 1002, &core_time);
+    ok(gm_journal_done("host1", "svc1", 1000) == GM_JOURNAL_CURRENT && gm_journal_done("host1", "svc1", 1000) == GM_JOURNAL_NONE, "journal: result of current check");
+    ok(gm_journal_in_flight("host1", NULL) == FALSE, "journal: current checks are not adopted");
+    /* checks are journaled before they are submitted, fast results and failed submits remove them again */
+    gettimeofday(&core_time, NULL);
+    gm_journal_add("host3", "svc3", 1003, &core_time);
+    gm_journal_done("host3", "svc3", 1003);
+    gm_journal_add("host3", NULL, 1004, &core_time);
+    gm_journal_done("host3", NULL, 1004);
+    gm_journal_close();
+    gm_journal_open(journal_file, 60);
+    ok(gm_journal_in_flight("host1", NULL) == TRUE && gm_journal_in_flight("host1", "svc1") == FALSE, "journal: check of previous core still in flight");
+    ok(gm_journal_in_flight("host3", "svc3") == FALSE && gm_journal_in_flight("host3", NULL) == FALSE, "journal: checks with result before submit returned are not adopted");
+    ok(gm_journal_done("host1", NULL, 1000) == GM_JOURNAL_NONE && gm_journal_done("host1", NULL, 1001) == GM_JOURNAL_ADOPTED, "journal: result of previous core adopted");
+    ok(gm_journal_in_flight("host2", "svc2") == FALSE && gm_journal_done("host2", "svc2", 1002) == GM_JOURNAL_EXPIRED, "journal: too old result of previous core");
+    gm_journal_close();
+    unlink(journal_file);
+
+    /* token buckets */
+    pace_sent[0] = '\x0';
+    gm_pace_check("paced", 1, 2, "a", "host_name=a\ncore_time=1.0\n\n\n", GM_JOB_PRIO_LOW, pace_submit);
+    gm_pace_check("paced", 1, 2, "b", "host_name=b\ncore_time=1.0\n\n\n", GM_JOB_PRIO_LOW, pace_submit);
+    gm_pace_check("paced", 1, 2, "c", "host_name=c\ncore_time=1.0\n\n\n", GM_JOB_PRIO_LOW, pace_submit);
+    gm_pace_check("paced", 1, 2, "d", "host_name=d\ncore_time=1.0\n\n\n", GM_JOB_PRIO_LOW, pace_submit);
+    is(pace_sent, "ab", "pace: burst is sent right away");
+    ok(gm_pace_release(FALSE, pace_submit) == 2 && !strcmp(pace_sent, "ab"), "pace: checks are deferred without tokens");
+    gm_pace_check("unpaced", 0, 0, "x", "host_name=x\n\n\n", GM_JOB_PRIO_LOW, pace_submit);
+    is(pace_sent, "abx", "pace: queues without rate are not paced");
+    gm_pace_check("paced", 1, 2, "e", "host_name=e\ncore_time=1.0\n\n\n", GM_JOB_PRIO_LOW, pace_submit);
+    ok(gm_pace_release(TRUE, pace_submit) == 0, "pace: all deferred checks released");
+    is(pace_sent, "abxcde", "pace: deferred checks keep their order");
+    like(pace_data, "^host_name=e\ncore_time=1.0\ncore_time=[0-9]+\\.[0-9]+\n\n\n$", "pace: released checks get a new core_time");
+    gm_pace_check("refill", 100, 1, "f", "host_name=f\n\n\n", GM_JOB_PRIO_LOW, pace_submit);
+    gm_pace_check("refill", 100, 1, "g", "host_name=g\n\n\n", GM_JOB_PRIO_LOW, pace_submit);
+    usleep(50000);
+    ok(gm_pace_release(FALSE, pace_submit) == 0 && !strcmp(pace_sent, "abxcdefg"), "pace: buckets are refilled over time");
+    gm_pace_free();
+
     mod_gm_free_opt(mod_gm_opt);
 
     return exit_status();
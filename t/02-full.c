@@ -177,7 +177,7 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
 
     /* decrypt data */
     decrypted_data   = malloc(GM_BUFFERSIZE);
-    mod_gm_decrypt(&decrypted_data, workload, mod_gm_opt->transportmode);
+    mod_gm_decrypt(&decrypted_data, workload, wsize, mod_gm_opt->transportmode);
 
     if(decrypted_data == NULL) {
         *ret_ptr = GEARMAN_WORK_FAIL;
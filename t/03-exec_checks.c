@@ -12,6 +12,10 @@
 #include <epn_utils.h>
 #endif
 #include "gearman_utils.h"
+#include "result_cache.h"
+#include "result_spool.h"
+#include "rusage_stats.h"
+#include "plugin_cgroup.h"
 
 #include <worker_dummy_functions.c>
 
@@ -26,7 +30,7 @@ int main (int argc, char **argv, char **env) {
     char cwd[1024];
     struct stat st;
 
-    plan(80);
+    plan(109);
 
     /* set hostname and cwd */
     gethostname(hostname, GM_BUFFERSIZE-1);
@@ -63,6 +67,15 @@ int main (int argc, char **argv, char **env) {
     like(args[2], "blub", "parsing args cmd 2");
     like(args[3], "foo", "parsing args cmd 2");
 
+    /*****************************************
+     * arg parsing test 3
+     */
+    strcpy(cmd, "@tcp -s 'GET / HTTP/1.0' -e \"HTTP/1.1 200\"");
+    parse_command_line(cmd,args);
+    is(args[2], "GET / HTTP/1.0", "parsing args with single quotes");
+    is(args[4], "HTTP/1.1 200", "parsing args with double quotes");
+    ok(args[5] == NULL, "parsing args with quotes ends");
+
     /*****************************************
      * send_gearman 1
      */
@@ -300,16 +313,18 @@ int main (int argc, char **argv, char **env) {
      */
     free(exec_job->command_line);
     exec_job->command_line = strdup("./t/sleep 30");
-    exec_job->timeout      = 1;
+    exec_job->timeout      = 0.5;
     fork_on_exec           = 1;
 
     signal(SIGTERM, SIG_IGN);
     signal(SIGINT, SIG_IGN);
     setenv("MODGEARMANTEST", "1", TRUE);
 
+    exec_job->start_time.tv_sec = 0;
     execute_safe_command(exec_job, fork_on_exec, hostname);
     cmp_ok(exec_job->return_code, "==", 2, "cmd '%s' returns rc 2", exec_job->command_line);
     like(exec_job->output, "\\(Service Check Timed Out On Worker: ", "returned result string");
+    ok(timeval2double(&exec_job->finish_time) - timeval2double(&exec_job->start_time) < 1.0, "result is not delayed by killing the plugin");
     free(exec_job->output);
     free(exec_job->error);
 
@@ -317,11 +332,14 @@ int main (int argc, char **argv, char **env) {
     fork_on_exec = 0;
     free(exec_job->command_line);
     exec_job->command_line = strdup("./t/sleep 30 2>&1");
+    exec_job->start_time.tv_sec = 0;
     execute_safe_command(exec_job, fork_on_exec, hostname);
     cmp_ok(exec_job->return_code, "==", 2, "cmd '%s' returns rc 2", exec_job->command_line);
     like(exec_job->output, "\\(Service Check Timed Out On Worker: ", "returned result string");
+    ok(timeval2double(&exec_job->finish_time) - timeval2double(&exec_job->start_time) < 1.0, "result is not delayed by killing the plugin");
     free(exec_job->output);
     free(exec_job->error);
+    reap_timed_out_checks(TRUE);
 
     signal(SIGTERM, SIG_DFL);
     signal(SIGINT, SIG_DFL);
@@ -454,6 +472,129 @@ int main (int argc, char **argv, char **env) {
     free(result);
     free(error);
 
+    /*****************************************
+     * restricted paths (7)
+     */
+    free(exec_job->command_line);
+    exec_job->command_line = strdup("@tcp -H 127.0.0.1 -p 22");
+    execute_safe_command(exec_job, fork_on_exec, hostname);
+    cmp_ok(exec_job->return_code, "==", 3, "cmd '%s' returns rc 3", exec_job->command_line);
+    like(exec_job->output, "ERROR: restricted paths in affect, but command does not start with an absolute path: @tcp -H ...", "built-in check is refused with restricted paths");
+    free(exec_job->error);
+    exec_job->error = NULL;
+
+    /*****************************************
+     * result cache
+     */
+    gm_job_t * cached_job;
+    snprintf(res, 150, "--result_cache_ttl=60");
+    rc = parse_args_line(mod_gm_opt, res, 0);
+    cmp_ok(rc, "==", GM_OK, "parsed result_cache_ttl option");
+    snprintf(res, 150, "--result_cache_command=/bin/cached");
+    parse_args_line(mod_gm_opt, res, 0);
+    cmp_ok(mod_gm_opt->result_cache_commands_num, "==", 1, "result cache command is set in opts");
+    rc = result_cache_setup();
+    cmp_ok(rc, "==", GM_OK, "created result cache");
+
+    free(exec_job->command_line);
+    free(exec_job->output);
+    exec_job->command_line = strdup("/bin/cached -H localhost");
+    exec_job->output       = strdup("cached OK");
+    exec_job->return_code  = 0;
+    exec_job->early_timeout= 0;
+    gettimeofday(&exec_job->finish_time, NULL);
+    result_cache_store(exec_job);
+
+    cached_job = ( gm_job_t * )malloc( sizeof *cached_job );
+    set_default_job(cached_job, mod_gm_opt);
+    cached_job->command_line = strdup("/bin/cached -H localhost");
+    cached_job->type         = strdup("service");
+    rc = result_cache_lookup(cached_job);
+    cmp_ok(rc, "==", GM_OK, "result cache hit");
+    like(cached_job->output, "cached OK", "cached result string");
+    cmp_ok(cached_job->return_code, "==", 0, "cached return code");
+
+    free(cached_job->command_line);
+    cached_job->command_line = strdup("/bin/cached -H otherhost");
+    rc = result_cache_lookup(cached_job);
+    cmp_ok(rc, "==", GM_ERROR, "result cache miss for different command");
+
+    free(cached_job->command_line);
+    cached_job->command_line = strdup("/bin/notcached -H localhost");
+    result_cache_store(cached_job);
+    rc = result_cache_lookup(cached_job);
+    cmp_ok(rc, "==", GM_ERROR, "result cache skips commands not in the allow list");
+
+    free(cached_job->command_line);
+    cached_job->command_line = strdup("/bin/cached -H localhost");
+    mod_gm_opt->result_cache_commands_num = 0;
+    rc = result_cache_lookup(cached_job);
+    mod_gm_opt->result_cache_commands_num = 1;
+    cmp_ok(rc, "==", GM_ERROR, "result cache is not used without allow list");
+    free_job(cached_job);
+
+    /*****************************************
+     * result spool
+     */
+    char spool_file[] = "/tmp/mod_gm_spool.XXXXXX";
+    char spool_stats[GM_BUFFERSIZE];
+    char * spooled_result = malloc(300000);
+    int fd = mkstemp(spool_file), x;
+    close(fd);
+    memset(spooled_result, 'x', 300000);
+    snprintf(res, 150, "--result_spool=%s", spool_file);
+    parse_args_line(mod_gm_opt, res, 0);
+    snprintf(res, 150, "--result_spool_size=1");
+    parse_args_line(mod_gm_opt, res, 0);
+    rc = result_spool_setup();
+    cmp_ok(rc, "==", GM_OK, "opened result spool");
+    ok(result_spool_hook == result_spool_add, "result spool hook is set");
+    for(x = 0; x < 20; x++)
+        result_spool_add("results", spooled_result, 100000);
+    spool_stats[0] = '\x0';
+    result_spool_append_stats(spool_stats);
+    like(spool_stats, "spooled=20c replayed=0c dropped=1[01]c", "full spool drops oldest results");
+    rc = result_spool_add("results", spooled_result, 300000);
+    cmp_ok(rc, "==", GM_ERROR, "result spool rejects too large results");
+    cmp_ok(result_spool_replay(), "==", 0, "spooled results are not sent without client");
+    ok(result_spool_pending() == TRUE, "spool has results to send");
+    free(spooled_result);
+    unlink(spool_file);
+
+    /*****************************************
+     * plugin rusage
+     */
+    char rusage_name[GM_RUSAGE_NAME_SIZE];
+    rusage_stats_basename("LANG=C  /usr/lib/nagios/plugins/check_http -H localhost", rusage_name);
+    is(rusage_name, "check_http", "rusage statistics use the plugin basename");
+    snprintf(res, 150, "--plugin_rusage=yes");
+    parse_args_line(mod_gm_opt, res, 0);
+    rc = rusage_stats_setup();
+    cmp_ok(rc, "==", GM_OK, "created rusage statistics");
+    for(fork_on_exec = 0; fork_on_exec <= 1; fork_on_exec++) {
+        snprintf(cmd, sizeof(cmd), "%s/t/ok.pl", cwd);
+        free(exec_job->command_line);
+        exec_job->command_line = strdup(cmd);
+        exec_job->has_rusage   = FALSE;
+        execute_safe_command(exec_job, fork_on_exec, hostname);
+        ok(exec_job->has_rusage == TRUE, "got rusage of the plugin with fork_on_exec=%d", fork_on_exec);
+        free(exec_job->output);
+        free(exec_job->error);
+        exec_job->output = NULL;
+        exec_job->error  = NULL;
+    }
+    spool_stats[0] = '\x0';
+    rusage_stats_append_stats(spool_stats);
+    like(spool_stats, "'ok.pl_runs'=2c 'ok.pl_cpu_ms'=[0-9]+c 'ok.pl_maxrss'=[0-9]+KB", "status reports plugin rusage");
+
+    /*****************************************
+     * plugin cgroups
+     */
+    snprintf(res, 150, "--cgroup_root=/tmp");
+    parse_args_line(mod_gm_opt, res, 0);
+    cmp_ok(plugin_cgroup_setup(), "==", GM_ERROR, "cgroup_root must be a cgroup v2 directory");
+    cmp_ok(plugin_cgroup_kill(), "==", GM_ERROR, "timeouts fall back to signals without cgroup");
+
     /*****************************************
      * clean up
      */
@@ -14,9 +14,20 @@
 
 mod_gm_opt_t *mod_gm_opt;
 
+/* counts evaluated log arguments */
+int evaluated = 0;
+static int log_argument(void) {
+    evaluated++;
+    return evaluated;
+}
+
 /* main tests */
 int main(void) {
-    int tests = 4;
+    int tests = 7;
+    char logfile[] = "/tmp/mod_gm_test_log.XXXXXX";
+    char buffer[1024];
+    int fd;
+    ssize_t len;
     plan(tests);
 
     mod_gm_opt = malloc(sizeof(mod_gm_opt_t));
@@ -34,6 +45,26 @@ int main(void) {
     mod_gm_opt->logmode = GM_LOG_MODE_CORE;
     lives_ok({gm_log(GM_LOG_INFO, "info message core\n");}, "info message in core mode");
 
+    /* disabled levels do not evaluate their arguments */
+    mod_gm_opt->logmode     = GM_LOG_MODE_FILE;
+    mod_gm_opt->debug_level = GM_LOG_DEBUG;
+    fd = mkstemp(logfile);
+    mod_gm_opt->logfile_fp = fdopen(fd, "a+");
+    gm_log(GM_LOG_TRACE, "trace message %d\n", log_argument());
+    cmp_ok(evaluated, "==", 0, "trace arguments have not been evaluated");
+
+    /* debug lines are buffered until the next info or error line */
+    gm_log(GM_LOG_DEBUG, "debug message %d\n", log_argument());
+    cmp_ok((int)lseek(fd, 0, SEEK_END), "==", 0, "debug message is buffered");
+    gm_log(GM_LOG_INFO, "info message file\n");
+    len = pread(fd, buffer, sizeof(buffer)-1, 0);
+    buffer[len > 0 ? len : 0] = '\x0';
+    like(buffer, "\\[DEBUG\\] debug message 1\n.*\\[INFO \\] info message file\n", "debug and info message written in order");
+
+    fclose(mod_gm_opt->logfile_fp);
+    mod_gm_opt->logfile_fp = NULL;
+    unlink(logfile);
+
     return exit_status();
 }
 
@@ -3,7 +3,8 @@
 use warnings;
 use strict;
 use File::Temp qw/tempfile/;
-use Test::More tests => 9;
+use Compress::Zlib qw/compress uncompress/;
+use Test::More tests => 15;
 
 alarm(60); # hole test should not take longer than 60 seconds
 $SIG{'ALRM'} = sub { cleanup(); die("ALARM"); };
@@ -28,7 +29,7 @@ chomp(my $gearmand_pid = `cat ./gearman.pid`);
 isnt($gearmand_pid, '', 'gearmand running: '.$gearmand_pid) or BAIL_OUT("no gearmand");
 
 # start worker
-my $cmd = "./mod_gearman_worker --server=localhost:$TESTPORT --debug=4 --max-worker=1 --encryption=off --p1_file=./worker/mod_gearman_p1.pl --daemon --pidfile=./worker.pid --logfile=$LOGFILE";
+my $cmd = "./mod_gearman_worker --server=localhost:$TESTPORT --debug=4 --max-worker=1 --encryption=off --compression_threshold=4096 --p1_file=./worker/mod_gearman_p1.pl --daemon --pidfile=./worker.pid --logfile=$LOGFILE";
 system($cmd);
 chomp(my $worker_pid = `cat ./worker.pid 2>/dev/null`);
 isnt($worker_pid, '', 'worker running: '.$worker_pid);
@@ -59,11 +60,74 @@ like($top2, '/host \s*\|\s*1\s*|\s*0\s*|\s*0/', "worker alive and empty queue");
 my $killed = kill(0, $worker_pid);
 is($killed, 1, "worker still alive");
 
+################################################################################
+# COMPRESSION
+# plugin output of a few hundred KB
+my($ofh, $outputfile) = tempfile();
+print $ofh "OK - inventory\n";
+print $ofh "item $_: serial 0000-$_ firmware 1.2.3 location rack ".($_ % 42)."\n" for 1..5000;
+close($ofh);
+
+# compressed job from a core which accepts compressed results
+my $job = wire_frame(1, [ type => 'host', result_queue => 'large_results', host_name => 'test', accept_compressed => 'yes',
+                          start_time => time().'.0', timeout => 30, command_line => "/bin/cat $outputfile" ]);
+my $result = submit_and_fetch($job, 'large_results');
+is(substr($result, 0, 1), chr(1), "result sent in binary format");
+ok(ord(substr($result, 1, 1)) & 2, "result compressed: ".length($result)." bytes for ".(-s $outputfile)." bytes output");
+my $records = wire_decode($result);
+like($records, "/host_name\0\0\0\0\x04test\0/", "decompressed result contains host name");
+like($records, "/item 5000: serial 0000-5000/", "decompressed result contains full output");
+
+# plain text job from an old core
+$job = "type=host\nresult_queue=old_results\nhost_name=test\nstart_time=".time().".0\ntimeout=30\ncommand_line=/bin/cat $outputfile\n\n\n";
+$result = submit_and_fetch($job, 'old_results', 1);
+isnt(substr($result, 0, 1), chr(1), "uncompressed base64 result for old cores");
+is(kill(0, $worker_pid), 1, "worker still alive");
+unlink($outputfile);
+
 ################################################################################
 # CLEAN UP
 cleanup();
 exit(0);
 
+################################################################################
+# build a binary frame from key/value pairs, optionally compressed
+sub wire_frame {
+    my($compress, $pairs) = @_;
+    my $records = '';
+    for(my $x = 0; $x < scalar @{$pairs}; $x += 2) {
+        my($key, $value) = ($pairs->[$x], $pairs->[$x+1]);
+        $records .= chr(0x1f).chr(length $key).$key."\0".pack("N", length $value).$value."\0";
+    }
+    $records .= chr(0x1e);
+    my $body = $compress ? pack("N", length $records).compress($records) : $records;
+    return(pack("CCN", 1, $compress ? 2 : 0, length $body).$body);
+}
+
+################################################################################
+# get the records of an unencrypted binary frame
+sub wire_decode {
+    my($frame) = @_;
+    my($version, $flags, $len) = unpack("CCN", $frame);
+    my $body = substr($frame, 6, $len);
+    return($flags & 2 ? uncompress(substr($body, 4)) : $body);
+}
+
+################################################################################
+# submit a host job and return the first result from the result queue
+sub submit_and_fetch {
+    my($job, $queue, $base64) = @_;
+    my($jfh, $jobfile) = tempfile();
+    binmode($jfh);
+    print $jfh $job;
+    close($jfh);
+    my $encode = $base64 ? "base64 -w 0 < $jobfile" : "cat $jobfile";
+    `$encode | gearman -f host -h localhost -p $TESTPORT -b`;
+    my $result = `timeout 20 gearman -w -f $queue -c 1 -h localhost -p $TESTPORT`;
+    unlink($jobfile);
+    return($result);
+}
+
 ################################################################################
 sub cleanup {
     `kill $worker_pid`;
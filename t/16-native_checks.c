@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <t/tap.h>
+#include <config.h>
+#include <common.h>
+#include <utils.h>
+#include <check_utils.h>
+#include <native_checks.h>
+#include "gearman_utils.h"
+
+#include <worker_dummy_functions.c>
+
+mod_gm_opt_t *mod_gm_opt;
+
+/* open a listening socket on a random loopback port */
+static int listen_socket(int type, int * port) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, type, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        perror("bind");
+    if(type == SOCK_STREAM && listen(fd, 5) != 0)
+        perror("listen");
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/* answer a single tcp connection with the given response */
+static pid_t tcp_server(const char * response, int read_request, int * port) {
+    char buf[4096];
+    int client;
+    int fd = listen_socket(SOCK_STREAM, port);
+    pid_t pid = fork();
+    if(pid == 0) {
+        client = accept(fd, NULL, NULL);
+        if(read_request && recv(client, buf, sizeof(buf), 0) < 0)
+            perror("recv");
+        if(response != NULL && write(client, response, strlen(response)) < 0)
+            perror("write");
+        close(client);
+        _exit(0);
+    }
+    close(fd);
+    return pid;
+}
+
+/* answer a single dns query with the given rcode and A records */
+static pid_t dns_server(int rcode, int answers, int * port) {
+    unsigned char buf[512];
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof(peer);
+    int len, x;
+    int fd = listen_socket(SOCK_DGRAM, port);
+    pid_t pid = fork();
+    if(pid == 0) {
+        len = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&peer, &peer_len);
+        buf[2] = 0x81;
+        buf[3] = 0x80 | rcode;
+        buf[7] = answers;
+        for(x = 1; x <= answers; x++) {
+            unsigned char rr[] = { 0xC0, 0x0C, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 10, 0, 0, x };
+            memcpy(buf + len, rr, sizeof(rr));
+            len += sizeof(rr);
+        }
+        if(sendto(fd, buf, len, 0, (struct sockaddr *)&peer, peer_len) < 0)
+            perror("sendto");
+        _exit(0);
+    }
+    close(fd);
+    return pid;
+}
+
+int main (void) {
+    int rc, port, fd;
+    pid_t pid;
+    char cmd[GM_BUFFERSIZE];
+    char expected[GM_BUFFERSIZE];
+    char hostname[GM_BUFFERSIZE];
+    char *output;
+
+    plan(36);
+
+    gethostname(hostname, GM_BUFFERSIZE-1);
+    mod_gm_opt = malloc(sizeof(mod_gm_opt_t));
+    set_default_options(mod_gm_opt);
+    mod_gm_opt->debug_level = 0;
+
+    /*****************************************
+     * detect built-in checks
+     */
+    ok(is_native_check("@tcp -H localhost -p 22") == TRUE, "@tcp is a built-in check");
+    ok(is_native_check("@tcpx -H localhost") == FALSE, "@tcpx is not a built-in check");
+    ok(is_native_check("/usr/lib/nagios/plugins/check_tcp -H localhost") == FALSE, "plugins are not built-in checks");
+
+    /*****************************************
+     * tcp checks
+     */
+    pid = tcp_server(NULL, 0, &port);
+    snprintf(cmd, sizeof(cmd), "@tcp -H 127.0.0.1 -p %d", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_OK, "tcp check returns ok");
+    snprintf(expected, sizeof(expected), "^TCP OK - [0-9.]+ second response time on 127.0.0.1 port %d\\|time=[0-9.]+s;;;0.000000;10.000000$", port);
+    like(output, expected, "tcp check output");
+    free(output);
+    waitpid(pid, NULL, 0);
+
+    pid = tcp_server(NULL, 0, &port);
+    snprintf(cmd, sizeof(cmd), "@tcp -H localhost -p %d", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_OK, "tcp check by host name returns ok: %s", output);
+    free(output);
+    waitpid(pid, NULL, 0);
+
+    pid = tcp_server("SSH-2.0-OpenSSH\r\n", 1, &port);
+    snprintf(cmd, sizeof(cmd), "@tcp -H 127.0.0.1 --port=%d -s 'QUIT\r\n' -e \"SSH-2.0\"", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_OK, "tcp check with expected response returns ok: %s", output);
+    free(output);
+    waitpid(pid, NULL, 0);
+
+    pid = tcp_server("220 smtp ready\r\n", 0, &port);
+    snprintf(cmd, sizeof(cmd), "@tcp -H 127.0.0.1 -p%d -e SSH", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_WARNING, "tcp check with unexpected response returns warning");
+    like(output, "^TCP WARNING - Unexpected response from host/socket: 220 smtp ready$", "unexpected response output");
+    free(output);
+    waitpid(pid, NULL, 0);
+
+    pid = tcp_server("220 smtp ready\r\n", 0, &port);
+    snprintf(cmd, sizeof(cmd), "@tcp -H 127.0.0.1 -p%d -e SSH -M crit", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_CRITICAL, "tcp check with unexpected response and -M crit returns critical");
+    free(output);
+    waitpid(pid, NULL, 0);
+
+    rc = run_native_check("@tcp -H 127.0.0.1 -p 22 -e SSH -M maybe", 10, &output);
+    cmp_ok(rc, "==", STATE_UNKNOWN, "tcp check with invalid -M returns unknown");
+    free(output);
+
+    fd = listen_socket(SOCK_STREAM, &port);
+    close(fd);
+    snprintf(cmd, sizeof(cmd), "@tcp -H 127.0.0.1 -p %d", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_CRITICAL, "tcp check on closed port returns critical");
+    snprintf(expected, sizeof(expected), "^connect to address 127.0.0.1 and port %d: Connection refused$", port);
+    like(output, expected, "connection refused output");
+    free(output);
+
+    fd = listen_socket(SOCK_STREAM, &port);
+    snprintf(cmd, sizeof(cmd), "@tcp -H 127.0.0.1 -p %d -e banner -t 1", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_CRITICAL, "tcp check without response returns critical");
+    like(output, "^CRITICAL - Socket timeout after 1 seconds$", "socket timeout output");
+    free(output);
+    close(fd);
+
+    fd = listen_socket(SOCK_STREAM, &port);
+    snprintf(cmd, sizeof(cmd), "@tcp -H 127.0.0.1 -p %d -e banner -t 0.5", port);
+    rc = run_native_check(cmd, 10, &output);
+    like(output, "^CRITICAL - Socket timeout after 0.5 seconds$", "fractional timeout");
+    free(output);
+    close(fd);
+
+    rc = run_native_check("@tcp -H 127.0.0.1 -p 22 -t 1x", 10, &output);
+    cmp_ok(rc, "==", STATE_UNKNOWN, "tcp check with invalid timeout returns unknown");
+    free(output);
+
+    rc = run_native_check("@tcp -H 127.0.0.1", 10, &output);
+    cmp_ok(rc, "==", STATE_UNKNOWN, "tcp check without port returns unknown");
+    free(output);
+
+    /*****************************************
+     * http checks
+     */
+    pid = tcp_server("HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nhello world", 1, &port);
+    snprintf(cmd, sizeof(cmd), "@http -H 127.0.0.1 -p %d -u /index.html -s world", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_OK, "http check returns ok");
+    like(output, "^HTTP OK: HTTP/1.1 200 OK - 50 bytes in [0-9.]+ second response time \\|time=[0-9.]+s;;;0.000000;10.000000 size=50B;;;0$", "http check output");
+    free(output);
+    waitpid(pid, NULL, 0);
+
+    pid = tcp_server("HTTP/1.1 404 Not Found\r\n\r\n", 1, &port);
+    snprintf(cmd, sizeof(cmd), "@http -H 127.0.0.1 -p %d", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_WARNING, "http check with 404 returns warning");
+    free(output);
+    waitpid(pid, NULL, 0);
+
+    pid = tcp_server("HTTP/1.1 500 Internal Server Error\r\n\r\n", 1, &port);
+    snprintf(cmd, sizeof(cmd), "@http -H 127.0.0.1 -p %d", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_CRITICAL, "http check with 500 returns critical");
+    free(output);
+    waitpid(pid, NULL, 0);
+
+    pid = tcp_server("HTTP/1.1 200 OK\r\n\r\nhello world", 1, &port);
+    snprintf(cmd, sizeof(cmd), "@http -H 127.0.0.1 -p %d -s nomatch", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_CRITICAL, "http check with missing string returns critical");
+    like(output, "^HTTP CRITICAL: HTTP/1.1 200 OK - string 'nomatch' not found on", "missing string output");
+    free(output);
+    waitpid(pid, NULL, 0);
+
+    rc = run_native_check("@http -H 127.0.0.1 -S", 10, &output);
+    cmp_ok(rc, "==", STATE_UNKNOWN, "http check with ssl returns unknown");
+    free(output);
+
+    /*****************************************
+     * dns checks
+     */
+    pid = dns_server(0, 2, &port);
+    snprintf(cmd, sizeof(cmd), "@dns -H example.com -s 127.0.0.1:%d", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_OK, "dns check returns ok");
+    like(output, "^DNS OK: [0-9.]+ seconds response time. example.com returns 10.0.0.1,10.0.0.2\\|time=[0-9.]+s;;;0.000000$", "dns check output");
+    free(output);
+    waitpid(pid, NULL, 0);
+
+    pid = dns_server(0, 1, &port);
+    snprintf(cmd, sizeof(cmd), "@dns -H example.com -s 127.0.0.1:%d -a 10.0.0.9", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_CRITICAL, "dns check with unexpected address returns critical");
+    like(output, "^DNS CRITICAL - expected '10.0.0.9' but got '10.0.0.1'$", "unexpected address output");
+    free(output);
+    waitpid(pid, NULL, 0);
+
+    pid = dns_server(0, 2, &port);
+    snprintf(cmd, sizeof(cmd), "@dns -H example.com -s 127.0.0.1:%d -a 10.0.0.2,10.0.0.1", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_OK, "dns check compares expected addresses in any order: %s", output);
+    free(output);
+    waitpid(pid, NULL, 0);
+
+    pid = dns_server(0, 2, &port);
+    snprintf(cmd, sizeof(cmd), "@dns -H example.com -s 127.0.0.1:%d -a 10.0.0.1", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_CRITICAL, "dns check with additional addresses returns critical");
+    free(output);
+    waitpid(pid, NULL, 0);
+
+    pid = dns_server(3, 0, &port);
+    snprintf(cmd, sizeof(cmd), "@dns -H nx.example.com -s 127.0.0.1:%d", port);
+    rc = run_native_check(cmd, 10, &output);
+    cmp_ok(rc, "==", STATE_CRITICAL, "dns check for unknown domain returns critical");
+    like(output, "^Domain nx.example.com was not found by the server$", "unknown domain output");
+    free(output);
+    waitpid(pid, NULL, 0);
+
+    /*****************************************
+     * built-in checks from execute_safe_command
+     */
+    gm_job_t * exec_job;
+    exec_job = ( gm_job_t * )malloc( sizeof *exec_job );
+    set_default_job(exec_job, mod_gm_opt);
+    pid = tcp_server(NULL, 0, &port);
+    snprintf(cmd, sizeof(cmd), "@tcp -H 127.0.0.1 -p %d", port);
+    exec_job->command_line = strdup(cmd);
+    exec_job->type         = strdup("service");
+    exec_job->timeout      = 10;
+    execute_safe_command(exec_job, GM_ENABLED, hostname);
+    cmp_ok(exec_job->return_code, "==", STATE_OK, "built-in check returns ok");
+    like(exec_job->output, "^TCP OK - ", "built-in check output");
+    like(exec_job->source, "^Mod-Gearman Worker @", "built-in check source");
+    waitpid(pid, NULL, 0);
+
+    /*****************************************
+     * clean up
+     */
+    free_job(exec_job);
+    mod_gm_free_opt(mod_gm_opt);
+    return exit_status();
+}
+
+/* core log wrapper */
+void write_core_log(char *data) {
+    printf("core logger is not available for tests: %s", data);
+    return;
+}
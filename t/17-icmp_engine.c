@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <t/tap.h>
+#include <config.h>
+#include <common.h>
+#include <utils.h>
+#include <check_utils.h>
+#include <icmp_engine.h>
+#include "gearman_utils.h"
+
+#include <worker_dummy_functions.c>
+
+mod_gm_opt_t *mod_gm_opt;
+
+/* run a check through the engine, retry until the engine is up */
+static int run_icmp_check(gm_job_t * job, char * command_line) {
+    int x, rc = GM_ERROR;
+    free(job->command_line);
+    free(job->output);
+    free(job->error);
+    job->command_line = strdup(command_line);
+    job->output       = NULL;
+    job->error        = NULL;
+    job->return_code  = -1;
+    job->start_time.tv_sec = 0;
+    for(x = 0; x < 50; x++) {
+        rc = icmp_engine_check(job);
+        if(rc == GM_OK || x > 0)
+            break;
+        usleep(100000);
+    }
+    return rc;
+}
+
+int main (void) {
+    int rc;
+    pid_t pid;
+    char result[GM_BUFFERSIZE];
+    char option[GM_BUFFERSIZE];
+    gm_job_t * job;
+
+    mod_gm_opt = malloc(sizeof(mod_gm_opt_t));
+    set_default_options(mod_gm_opt);
+    mod_gm_opt->debug_level = 0;
+    mod_gm_opt->icmp_engine = GM_ENABLED;
+
+    if(icmp_engine_setup() != GM_OK) {
+        plan(SKIP_ALL, "cannot open icmp socket");
+        return exit_status();
+    }
+    plan(18);
+
+    /*****************************************
+     * detect host alive checks
+     */
+    ok(is_icmp_check("/usr/lib/nagios/plugins/check_icmp -H 127.0.0.1") == TRUE, "check_icmp is run by the icmp engine");
+    ok(is_icmp_check("check_ping -H 127.0.0.1 -w 100,20% -c 500,60%") == TRUE, "check_ping is run by the icmp engine");
+    ok(is_icmp_check("/usr/lib/nagios/plugins/check_http -H 127.0.0.1") == FALSE, "check_http is not run by the icmp engine");
+
+    /*****************************************
+     * run checks against loopback addresses
+     */
+    pid = fork();
+    if(pid == 0) {
+        icmp_engine_loop();
+        _exit(0);
+    }
+
+    job = ( gm_job_t * )malloc( sizeof *job );
+    set_default_job(job, mod_gm_opt);
+    job->type    = strdup("host");
+    job->timeout = 10;
+
+    /* engine needs a moment to start */
+    for(rc = 0; rc < 50 && run_icmp_check(job, "/usr/lib/nagios/plugins/check_icmp -H 127.0.0.1 -H 127.0.0.2 -n 3") != GM_OK; rc++)
+        usleep(100000);
+    cmp_ok(job->return_code, "==", STATE_OK, "check_icmp returns ok");
+    like(job->output, "^OK - 127.0.0.1: rta [0-9.]+ms, lost 0% :: 127.0.0.2: rta [0-9.]+ms, lost 0%\\|", "check_icmp output");
+    like(job->output, "\\|127.0.0.1rta=[0-9.]+ms;200.000;500.000;0; 127.0.0.1pl=0%;40;80;; 127.0.0.1rtmax=[0-9.]+ms;;;; 127.0.0.1rtmin=[0-9.]+ms;;;; 127.0.0.2rta=", "check_icmp perfdata");
+
+    rc = run_icmp_check(job, "/usr/lib/nagios/plugins/check_ping -H 127.0.0.3 -w 100,20% -c 500,60% -p 2");
+    cmp_ok(job->return_code, "==", STATE_OK, "check_ping returns ok");
+    like(job->output, "^PING OK - Packet loss = 0%, RTA = [0-9.]+ ms\\|rta=[0-9.]+ms;100.000000;500.000000;0.000000 pl=0%;20;60;0$", "check_ping output");
+
+    rc = run_icmp_check(job, "/usr/lib/nagios/plugins/check_icmp -H 240.0.0.1 -n 1 -c 200,80% -t 2");
+    cmp_ok(job->return_code, "==", STATE_CRITICAL, "unreachable host returns critical");
+    like(job->output, "^CRITICAL - 240.0.0.1: rta nan, lost 100%\\|rta=0.000ms;200.000;200.000;0; pl=100%;40;80;;", "unreachable host output");
+
+    rc = run_icmp_check(job, "/usr/lib/nagios/plugins/check_icmp -H 127.0.0.1 -b 100");
+    cmp_ok(rc, "==", GM_ERROR, "unsupported options run the plugin");
+    rc = run_icmp_check(job, "/usr/lib/nagios/plugins/check_icmp -H 127.0.0.1 > /dev/null");
+    cmp_ok(rc, "==", GM_ERROR, "shell redirects run the plugin");
+
+    result[0] = '\x0';
+    icmp_engine_append_stats(result);
+    like(result, "^ icmp_checks=3c icmp_packets=9c icmp_replies=8c$", "icmp engine throughput");
+
+    rc = run_icmp_check(job, "/usr/lib/nagios/plugins/check_icmp -H 127.0.0.1 -i 2x");
+    cmp_ok(rc, "==", GM_ERROR, "invalid interval runs the plugin");
+    rc = run_icmp_check(job, "/usr/lib/nagios/plugins/check_icmp -H 127.0.0.1 -n 1 -i 0.5s");
+    cmp_ok(rc, "==", GM_OK, "interval in seconds");
+
+    snprintf(option, sizeof(option), "restrict_path=/opt/plugins/");
+    parse_args_line(mod_gm_opt, option, 0);
+    rc = run_icmp_check(job, "/usr/lib/nagios/plugins/check_icmp -H 127.0.0.1");
+    cmp_ok(rc, "==", GM_ERROR, "restricted paths are checked by the plugin path");
+
+    /*****************************************
+     * configured host alive commands
+     */
+    snprintf(option, sizeof(option), "icmp_command=/opt/bin/fping");
+    parse_args_line(mod_gm_opt, option, 0);
+    ok(is_icmp_check("/opt/bin/fping -H 127.0.0.1") == TRUE, "configured command is run by the icmp engine");
+    ok(is_icmp_check("/usr/lib/nagios/plugins/check_icmp -H 127.0.0.1") == FALSE, "check_icmp is not run when commands are configured");
+
+    /*****************************************
+     * clean up
+     */
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    free_job(job);
+    mod_gm_free_opt(mod_gm_opt);
+    return exit_status();
+}
+
+/* core log wrapper */
+void write_core_log(char *data) {
+    printf("core logger is not available for tests: %s", data);
+    return;
+}
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <t/tap.h>
+#include <config.h>
+#include <common.h>
+#include <utils.h>
+#include <check_utils.h>
+#include <plugin_modules.h>
+#include "gearman_utils.h"
+
+#include <worker_dummy_functions.c>
+
+mod_gm_opt_t *mod_gm_opt;
+
+/* run a command line through execute_safe_command */
+static void run_module_check(gm_job_t * job, char * command_line, int timeout) {
+    free(job->command_line);
+    free(job->output);
+    free(job->error);
+    job->command_line = strdup(command_line);
+    job->output       = NULL;
+    job->error        = NULL;
+    job->return_code  = -1;
+    job->timeout      = timeout;
+    job->start_time.tv_sec = 0;
+    execute_safe_command(job, mod_gm_opt->fork_on_exec, "test");
+}
+
+int main (void) {
+    char result[GM_BUFFERSIZE];
+    char option[GM_BUFFERSIZE];
+    char * big;
+    gm_job_t * job;
+
+    plan(23);
+
+    mod_gm_opt = malloc(sizeof(mod_gm_opt_t));
+    set_default_options(mod_gm_opt);
+    mod_gm_opt->debug_level = 0;
+
+    /*****************************************
+     * load modules
+     */
+    snprintf(option, sizeof(option), "plugin_module=./t/so_plugin.so");
+    parse_args_line(mod_gm_opt, option, 0);
+    cmp_ok(load_plugin_modules(), "==", GM_OK, "plugin module loaded");
+    cmp_ok(load_plugin_modules(), "==", GM_OK, "loaded plugin modules are skipped");
+    snprintf(option, sizeof(option), "plugin_module=./t/does_not_exist.so");
+    parse_args_line(mod_gm_opt, option, 0);
+    cmp_ok(load_plugin_modules(), "==", GM_ERROR, "missing plugin module");
+
+    ok(is_plugin_module_check("@so:echo 0 test") == TRUE, "@so: checks are run by plugin modules");
+    ok(is_plugin_module_check("/usr/lib/nagios/plugins/check_dummy 0") == FALSE, "plugins are not run by plugin modules");
+
+    job = ( gm_job_t * )malloc( sizeof *job );
+    set_default_job(job, mod_gm_opt);
+    job->type = strdup("service");
+
+    /*****************************************
+     * in process checks
+     */
+    run_module_check(job, "@so:echo 1 'warning output' |perf=1", 10);
+    cmp_ok(job->return_code, "==", STATE_WARNING, "in process return code");
+    is(job->output, "1 warning output |perf=1", "in process output");
+
+    run_module_check(job, "@so:echo 5 out", 10);
+    cmp_ok(job->return_code, "==", STATE_CRITICAL, "invalid return code");
+    like(job->output, "^CRITICAL: Return code of 5 is out of bounds. \\(worker: test\\)", "invalid return code output");
+
+    run_module_check(job, "@so:missing", 10);
+    cmp_ok(job->return_code, "==", STATE_UNKNOWN, "unknown check");
+    is(job->output, "UNKNOWN - no plugin module provides check 'missing'", "unknown check output");
+
+    big = malloc(GM_BUFFERSIZE + 64);
+    memset(big, 'x', GM_BUFFERSIZE + 64);
+    memcpy(big, "@so:echo 0 ", 11);
+    big[GM_BUFFERSIZE + 63] = '\x0';
+    run_module_check(job, big, 10);
+    free(big);
+    cmp_ok(job->return_code, "==", STATE_UNKNOWN, "oversized arguments");
+    like(job->output, "^UNKNOWN - arguments of plugin module check 'echo' exceed [0-9]+ bytes$", "oversized arguments output");
+
+    /*****************************************
+     * isolated checks
+     */
+    mod_gm_opt->plugin_isolation = GM_ENABLED;
+    run_module_check(job, "@so:echo 0 isolated", 10);
+    cmp_ok(job->return_code, "==", STATE_OK, "isolated return code");
+    is(job->output, "0 isolated", "isolated output");
+
+    run_module_check(job, "@so:crash", 10);
+    cmp_ok(job->return_code, "==", STATE_CRITICAL, "crashed check");
+    like(job->output, "^CRITICAL: Return code of 139 is out of bounds. Plugin exited by signal SIGSEGV. \\(worker: test\\)", "crashed check output");
+
+    run_module_check(job, "@so:sleep 5", 1);
+    cmp_ok(job->return_code, "==", mod_gm_opt->timeout_return, "timed out check");
+    is(job->output, "(Service Check Timed Out On Worker: test)", "timed out check output");
+
+    result[0] = '\x0';
+    plugin_modules_append_stats(result);
+    like(result, "^ so_echo_calls=3c so_echo_failed=1c so_echo_cpu=[0-9.]+s so_echo_time=[0-9.]+s so_sleep_calls=1c so_sleep_failed=1c so_sleep_cpu=0.000s so_sleep_time=1.[0-9]+s so_crash_calls=1c so_crash_failed=1c ", "plugin module statistics");
+
+    /* fork_on_exec always uses the helper, hanging checks must not kill the worker */
+    mod_gm_opt->plugin_isolation = GM_DISABLED;
+    mod_gm_opt->fork_on_exec     = GM_ENABLED;
+    run_module_check(job, "@so:sleep 5", 1);
+    is(job->output, "(Service Check Timed Out On Worker: test)", "timed out check with fork_on_exec");
+    mod_gm_opt->fork_on_exec     = GM_DISABLED;
+
+    /*****************************************
+     * restricted paths
+     */
+    snprintf(option, sizeof(option), "restrict_path=/usr/lib/nagios/plugins/");
+    parse_args_line(mod_gm_opt, option, 0);
+    run_module_check(job, "@so:echo 0 restricted", 10);
+    cmp_ok(job->return_code, "==", STATE_UNKNOWN, "module outside of restricted paths");
+    is(job->output, "ERROR: plugin module of check 'echo' is not below any of the restricted paths", "module outside of restricted paths output");
+
+    /*****************************************
+     * clean up
+     */
+    free_job(job);
+    mod_gm_free_opt(mod_gm_opt);
+    return exit_status();
+}
+
+/* core log wrapper */
+void write_core_log(char *data) {
+    printf("core logger is not available for tests: %s", data);
+    return;
+}
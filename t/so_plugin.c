@@ -0,0 +1,38 @@
+/* plugin module used by t/18-plugin_modules.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <mod_gearman_plugin.h>
+
+/* print all arguments, exit code is taken from the first one */
+static int check_echo(gm_plugin_call_t * call) {
+    int i;
+    size_t len = 0;
+    for(i = 1; i < call->argc; i++)
+        len += snprintf(call->output+len, len < call->output_size ? call->output_size-len : 0, "%s%s", i > 1 ? " " : "", call->argv[i]);
+    return(call->argc > 1 ? atoi(call->argv[1]) : 0);
+}
+
+static int check_sleep(gm_plugin_call_t * call) {
+    sleep(call->argc > 1 ? atoi(call->argv[1]) : 1);
+    snprintf(call->output, call->output_size, "OK - slept");
+    return(0);
+}
+
+static int check_crash(gm_plugin_call_t * call) {
+    snprintf(call->output, call->output_size, "about to crash");
+    raise(SIGSEGV);
+    return(0);
+}
+
+int gm_plugin_init(int abi_version, gm_plugin_register_t register_check) {
+    if(abi_version != GM_PLUGIN_ABI_VERSION)
+        return(-1);
+    register_check("echo", check_echo);
+    register_check("sleep", check_sleep);
+    register_check("crash", check_crash);
+    return(0);
+}
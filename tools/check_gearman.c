@@ -41,7 +41,7 @@ char * opt_unique_id     = NULL;
 int opt_crit_zero_worker = 0;
 int send_async           = 0;
 
-gm_server_t  * server_list[GM_LISTSIZE];
+gm_server_t ** server_list = NULL;
 int server_list_num = 0;
 
 gearman_client_st client;
@@ -76,7 +76,7 @@ int main (int argc, char **argv) {
                         break;
             case 'C':   opt_worker_critical = atoi(optarg);
                         break;
-            case 'H':   add_server(&server_list_num, server_list, optarg);
+            case 'H':   add_server(&server_list_num, &server_list, optarg);
                         break;
             case 's':   opt_send = optarg;
                         break;
@@ -0,0 +1,424 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* include header */
+#include <poll.h>
+#include <sys/uio.h>
+
+#include "broker.h"
+#include "worker_client.h"
+#include "utils.h"
+#include "gm_wire.h"
+#include "result_spool.h"
+
+static int broker_ready   = FALSE;
+static int has_idle_child = FALSE;
+static int idle_announced = FALSE;
+
+/* local backlog of the job broker, ordered by deadline */
+typedef struct broker_job_struct {
+    double   deadline;
+    char   * msg;
+    size_t   len;
+} broker_job_t;
+static broker_job_t * backlog     = NULL;
+static int            backlog_num = 0;
+
+/* raise the socket buffers so a full job fits into one message */
+static void set_socket_buffer(int fd) {
+    int size = 2*GM_BROKER_MAX_MESSAGE;
+    if(setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) < 0)
+        gm_log( GM_LOG_DEBUG, "setsockopt(SO_SNDBUF) failed: %s\n", strerror(errno));
+    if(setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0)
+        gm_log( GM_LOG_DEBUG, "setsockopt(SO_RCVBUF) failed: %s\n", strerror(errno));
+    return;
+}
+
+
+/* create the broker sockets */
+int broker_setup() {
+    int x;
+    int * fds[3];
+
+    if(broker_ready == TRUE)
+        return GM_OK;
+
+    gm_log( GM_LOG_TRACE, "broker_setup()\n" );
+
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, broker_job_fd) < 0) {
+        gm_log( GM_LOG_ERROR, "cannot create broker job socket: %s\n", strerror(errno));
+        return GM_ERROR;
+    }
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, broker_result_fd) < 0) {
+        gm_log( GM_LOG_ERROR, "cannot create broker result socket: %s\n", strerror(errno));
+        close(broker_job_fd[0]);
+        close(broker_job_fd[1]);
+        return GM_ERROR;
+    }
+    if(socketpair(AF_UNIX, SOCK_DGRAM, 0, broker_idle_fd) < 0) {
+        gm_log( GM_LOG_ERROR, "cannot create broker idle socket: %s\n", strerror(errno));
+        close(broker_job_fd[0]);
+        close(broker_job_fd[1]);
+        close(broker_result_fd[0]);
+        close(broker_result_fd[1]);
+        return GM_ERROR;
+    }
+
+    fds[0] = broker_job_fd;
+    fds[1] = broker_result_fd;
+    fds[2] = broker_idle_fd;
+    for(x = 0; x < 3; x++) {
+        set_socket_buffer(fds[x][0]);
+        set_socket_buffer(fds[x][1]);
+    }
+
+    broker_ready = TRUE;
+    return GM_OK;
+}
+
+
+/* wait till a child is ready for the next job */
+static int wait_for_idle_child(int flags) {
+    char c;
+
+    while(has_idle_child == FALSE) {
+        if(recv(broker_idle_fd[1], &c, 1, flags) == 1) {
+            has_idle_child = TRUE;
+        }
+        else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return FALSE;
+        }
+        else if(errno != EINTR) {
+            gm_log( GM_LOG_ERROR, "broker cannot read idle socket: %s\n", strerror(errno));
+            sleep(1);
+        }
+    }
+    return TRUE;
+}
+
+
+/* pass a message to the children */
+static int pass_job(char * msg, size_t len, int flags) {
+    while(send(broker_job_fd[0], msg, len, flags) < 0) {
+        if(errno == EINTR)
+            continue;
+        if(errno != EAGAIN && errno != EWOULDBLOCK)
+            gm_log( GM_LOG_ERROR, "broker cannot pass job %s: %s\n", msg, strerror(errno));
+        return GM_ERROR;
+    }
+    return GM_OK;
+}
+
+
+/* extract the scheduled check time from an encoded job */
+static double get_job_deadline(char * msg, size_t len) {
+    char * workload = msg + strlen(msg) + 1;
+    char * decrypted_data;
+    char * decrypted_data_c;
+    char * key;
+    char * value;
+    struct timeval next_check;
+    double deadline = 0;
+
+    workload += strlen(workload) + 1;
+    decrypted_data = gm_malloc(len*2);
+    mod_gm_decrypt(&decrypted_data, workload, len - (workload - msg), mod_gm_opt->transportmode);
+    decrypted_data_c = decrypted_data;
+    while ( gm_wire_next(&decrypted_data, &key, &value) ) {
+        if ( key == NULL || value == NULL )
+            continue;
+        if ( !strcmp( key, "next_check" ) || !strcmp( key, "start_time" ) ) {
+            string2timeval(value, &next_check);
+            deadline = timeval2double(&next_check);
+            break;
+        }
+    }
+    free(decrypted_data_c);
+
+    return deadline + mod_gm_opt->job_deadline;
+}
+
+
+/* add job to the backlog heap */
+static void backlog_push(char * msg, size_t len, double deadline) {
+    int x = backlog_num++;
+
+    if(backlog == NULL)
+        backlog = gm_malloc(sizeof(broker_job_t) * mod_gm_opt->job_backlog);
+
+    while(x > 0 && backlog[(x-1)/2].deadline > deadline) {
+        backlog[x] = backlog[(x-1)/2];
+        x = (x-1)/2;
+    }
+    backlog[x].deadline = deadline;
+    backlog[x].msg      = msg;
+    backlog[x].len      = len;
+    return;
+}
+
+
+/* remove most urgent job from the backlog heap */
+static broker_job_t backlog_pop(void) {
+    broker_job_t first = backlog[0];
+    broker_job_t last  = backlog[--backlog_num];
+    int x = 0;
+
+    while(2*x+1 < backlog_num) {
+        int child = 2*x+1;
+        if(child+1 < backlog_num && backlog[child+1].deadline < backlog[child].deadline)
+            child++;
+        if(last.deadline <= backlog[child].deadline)
+            break;
+        backlog[x] = backlog[child];
+        x = child;
+    }
+    backlog[x] = last;
+    return first;
+}
+
+
+/* hand out jobs from the backlog */
+void broker_dispatch(gearman_worker_st * w) {
+
+    /* without backlog, fetch jobs only when a child can take them */
+    if(mod_gm_opt->job_backlog <= 0) {
+        wait_for_idle_child(0);
+        return;
+    }
+
+    /* block only if the backlog is full */
+    while(backlog_num > 0 && wait_for_idle_child(backlog_num >= mod_gm_opt->job_backlog ? 0 : MSG_DONTWAIT) == TRUE) {
+        broker_job_t job = backlog_pop();
+        gm_log( GM_LOG_TRACE, "broker passes job %s, %d jobs left in backlog\n", job.msg, backlog_num );
+        if(pass_job(job.msg, job.len, 0) == GM_OK)
+            has_idle_child = FALSE;
+        free(job.msg);
+    }
+
+    /* come back soon to pass waiting jobs */
+    gearman_worker_set_timeout( w, backlog_num > 0 ? GM_BROKER_BACKLOG_POLL : -1 );
+    return;
+}
+
+
+/* pass remaining backlog to the children */
+void broker_flush_backlog() {
+    while(backlog_num > 0) {
+        broker_job_t job = backlog_pop();
+        if(pass_job(job.msg, job.len, MSG_DONTWAIT) != GM_OK)
+            gm_log( GM_LOG_INFO, "broker dropped job %s from backlog\n", job.msg );
+        free(job.msg);
+    }
+    return;
+}
+
+
+/* pass a job to the next idle child */
+void *broker_get_job( gearman_job_st *job, void *context, size_t *result_size, gearman_return_t *ret_ptr ) {
+    const char * handle   = gearman_job_handle(job);
+    const char * queue    = gearman_job_function_name(job);
+    size_t handle_len     = strlen(handle)+1;
+    size_t queue_len      = strlen(queue)+1;
+    size_t wsize          = gearman_job_workload_size(job);
+    size_t len            = handle_len + queue_len + wsize;
+    char * msg;
+
+    /* contect is unused */
+    context = context;
+
+    /* set size of result */
+    *result_size = 0;
+    *ret_ptr     = GEARMAN_SUCCESS;
+
+    gm_log( GM_LOG_TRACE, "broker got new job %s\n", handle );
+
+    if(len > GM_BROKER_MAX_MESSAGE) {
+        gm_log( GM_LOG_ERROR, "broker cannot pass job %s: job too large\n", handle);
+        *ret_ptr = GEARMAN_WORK_FAIL;
+        return NULL;
+    }
+
+    /* message is handle\0queue\0workload */
+    msg = gm_malloc(len+1);
+    memcpy(msg, handle, handle_len);
+    memcpy(msg+handle_len, queue, queue_len);
+    memcpy(msg+handle_len+queue_len, gearman_job_workload(job), wsize);
+    msg[len] = '\x0';
+
+    if(mod_gm_opt->job_backlog > 0) {
+        backlog_push(msg, len, get_job_deadline(msg, len));
+        return NULL;
+    }
+
+    if(pass_job(msg, len, 0) != GM_OK)
+        *ret_ptr = GEARMAN_WORK_FAIL;
+    else
+        has_idle_child = FALSE;
+    free(msg);
+
+    return NULL;
+}
+
+
+/* send all results from the children */
+void broker_result_loop() {
+    char * buf = gm_malloc(GM_BROKER_MAX_MESSAGE+1);
+
+    while(1) {
+        char * queue, * data, * dup_data, * flags;
+        ssize_t len;
+        gm_log_flush();
+        len = recv(broker_result_fd[1], buf, GM_BROKER_MAX_MESSAGE, 0);
+        if(len < 0) {
+            if(errno == EINTR)
+                continue;
+            gm_log( GM_LOG_ERROR, "result broker cannot read result socket: %s\n", strerror(errno));
+            sleep(1);
+            continue;
+        }
+        buf[len] = '\x0';
+
+        /* message is queue\0data\0dup_data\0flags\0, empty dup_data means same as data */
+        queue    = buf;
+        data     = queue + strlen(queue) + 1;
+        if(data >= buf + len) {
+            gm_log( GM_LOG_ERROR, "result broker discarded invalid result\n");
+            continue;
+        }
+        dup_data = data + strlen(data) + 1;
+        flags    = dup_data < buf + len ? dup_data + strlen(dup_data) + 1 : buf + len;
+        if(dup_data >= buf + len || *dup_data == '\x0')
+            dup_data = data;
+
+        /* the child knows whether the core accepts compressed results */
+        if(flags < buf + len && strchr(flags, 'c') != NULL)
+            accept_compressed_results(queue);
+
+        send_result_payload(queue, data, dup_data);
+        update_compression_stats();
+        result_spool_replay();
+    }
+
+    return;
+}
+
+
+/* announce that we are waiting for a job */
+void broker_announce_idle() {
+    char c = 1;
+
+    if(idle_announced == TRUE)
+        return;
+
+    while(send(broker_idle_fd[0], &c, 1, 0) < 0) {
+        if(errno == EINTR)
+            continue;
+        gm_log( GM_LOG_ERROR, "cannot write broker idle socket: %s\n", strerror(errno));
+        return;
+    }
+    idle_announced = TRUE;
+    return;
+}
+
+
+/* take back our idle announcement */
+void broker_withdraw_idle() {
+    char c;
+
+    if(idle_announced == FALSE)
+        return;
+
+    /* any announcement will do, the broker only counts them */
+    if(recv(broker_idle_fd[1], &c, 1, MSG_DONTWAIT) < 0)
+        gm_log( GM_LOG_TRACE, "broker_withdraw_idle(): %s\n", strerror(errno));
+    idle_announced = FALSE;
+    return;
+}
+
+
+/* receive next job from the job broker */
+int broker_recv_job(char * buf, char ** handle, char ** queue, char ** workload, int * wsize, int timeout) {
+    struct pollfd pfd;
+    ssize_t len;
+
+    pfd.fd      = broker_job_fd[1];
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+    if(poll(&pfd, 1, timeout) <= 0)
+        return GM_ERROR;
+
+    /* other children are waiting on the same socket too */
+    len = recv(broker_job_fd[1], buf, GM_BROKER_MAX_MESSAGE, MSG_DONTWAIT);
+    if(len <= 0)
+        return GM_ERROR;
+    buf[len] = '\x0';
+    idle_announced = FALSE;
+
+    *handle   = buf;
+    *queue    = buf + strlen(buf) + 1;
+    if(*queue >= buf + len) {
+        gm_log( GM_LOG_ERROR, "discarded invalid job from broker\n");
+        return GM_ERROR;
+    }
+    *workload = *queue + strlen(*queue) + 1;
+    if(*workload > buf + len) {
+        gm_log( GM_LOG_ERROR, "discarded invalid job from broker\n");
+        return GM_ERROR;
+    }
+    *wsize = buf + len - *workload;
+
+    return GM_OK;
+}
+
+
+/* pass a result to the result broker */
+int broker_send_result(char * queue, char * data, char * dup_data) {
+    struct msghdr msg;
+    struct iovec iov[4];
+
+    iov[0].iov_base = queue;
+    iov[0].iov_len  = strlen(queue)+1;
+    iov[1].iov_base = data;
+    iov[1].iov_len  = strlen(data)+1;
+    iov[2].iov_base = dup_data == data ? "" : dup_data;
+    iov[2].iov_len  = dup_data == data ? 1 : strlen(dup_data)+1;
+    iov[3].iov_base = accepts_compressed_results(queue) ? "c" : "";
+    iov[3].iov_len  = strlen(iov[3].iov_base)+1;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = 4;
+
+    /* large results are sent directly */
+    if(iov[0].iov_len + iov[1].iov_len + iov[2].iov_len + iov[3].iov_len > GM_BROKER_MAX_MESSAGE)
+        return GM_ERROR;
+
+    while(sendmsg(broker_result_fd[0], &msg, 0) < 0) {
+        if(errno == EINTR)
+            continue;
+        gm_log( GM_LOG_DEBUG, "cannot pass result to the result broker: %s\n", strerror(errno));
+        return GM_ERROR;
+    }
+
+    return GM_OK;
+}
@@ -0,0 +1,771 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* include header */
+#include <limits.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+
+#include "icmp_engine.h"
+#include "check_utils.h"
+#include "utils.h"
+#include "gm_alloc.h"
+
+#define ICMP_PROBE_SLOTS    65536   /* one slot per sequence number */
+#define ICMP_PACKET_SIZE       64   /* echo request size like ping */
+
+static int               icmp_socket        = -1;
+static int               icmp_raw           = FALSE;
+static int               icmp_request_fd[2] = { -1, -1 };
+static gm_icmp_stats_t * icmp_stats         = NULL;
+
+/* a check in progress inside the engine */
+typedef struct icmp_job_struct {
+    unsigned int      id;               /* 0 marks a free slot */
+    int               reply_fd;
+    int               rounds;           /* packets sent to each target so far */
+    double            start;
+    double            last_send;
+    gm_icmp_request_t request;
+    gm_icmp_reply_t   reply;
+} icmp_job_t;
+
+/* an echo request waiting for its reply */
+typedef struct icmp_probe_struct {
+    unsigned int      job_id;
+    int               job;
+    int               target;
+    double            sent;
+} icmp_probe_t;
+
+static icmp_job_t   * icmp_jobs       = NULL;
+static icmp_probe_t * icmp_probes     = NULL;
+static int            icmp_jobs_num   = 0;
+static unsigned int   icmp_next_id    = 1;
+static unsigned short icmp_next_seq   = 0;
+static unsigned short icmp_ident      = 0;
+
+/* parsed command line of a host alive check */
+typedef struct icmp_check_struct {
+    int               flavor;
+    int               num_hosts;
+    char            * hosts[GM_ICMP_MAX_TARGETS];
+    double            warn_rta;
+    double            crit_rta;
+    int               warn_pl;
+    int               crit_pl;
+    int               timeout;
+} icmp_check_t;
+
+
+/* current time in milliseconds */
+static double now_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return((double)tv.tv_sec * 1000 + (double)tv.tv_usec / 1000);
+}
+
+
+/* open icmp socket, request channel and statistics */
+int icmp_engine_setup() {
+    int id;
+
+    if(icmp_socket >= 0)
+        return GM_OK;
+
+    gm_log( GM_LOG_TRACE, "icmp_engine_setup()\n" );
+
+    /* unprivileged ping sockets first, raw sockets need root or cap_net_raw */
+    icmp_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP);
+    if(icmp_socket < 0) {
+        icmp_socket = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+        icmp_raw    = TRUE;
+    }
+    if(icmp_socket < 0) {
+        gm_log( GM_LOG_ERROR, "cannot open icmp socket: %s\n", strerror(errno));
+        return GM_ERROR;
+    }
+
+    if(socketpair(AF_UNIX, SOCK_DGRAM, 0, icmp_request_fd) < 0) {
+        gm_log( GM_LOG_ERROR, "cannot create icmp engine socket: %s\n", strerror(errno));
+        close(icmp_socket);
+        icmp_socket = -1;
+        return GM_ERROR;
+    }
+
+    if((id = shmget(IPC_PRIVATE, sizeof(gm_icmp_stats_t), IPC_CREAT | 0600)) < 0
+       || (icmp_stats = shmat(id, NULL, 0)) == (void *) -1) {
+        gm_log( GM_LOG_ERROR, "failed to create icmp engine statistics: %s\n", strerror(errno));
+        if(id >= 0)
+            shmctl(id, IPC_RMID, 0);
+        icmp_stats = NULL;
+        close(icmp_socket);
+        close(icmp_request_fd[0]);
+        close(icmp_request_fd[1]);
+        icmp_socket = -1;
+        return GM_ERROR;
+    }
+
+    /* segment stays attached in all children and is removed with the last one */
+    if(shmctl(id, IPC_RMID, 0) == -1)
+        gm_log( GM_LOG_ERROR, "failed to mark icmp engine statistics for removal: %s\n", strerror(errno));
+    memset((void *)icmp_stats, 0, sizeof(gm_icmp_stats_t));
+
+    gm_log( GM_LOG_DEBUG, "opened %s icmp socket\n", icmp_raw ? "raw" : "datagram");
+
+    return GM_OK;
+}
+
+
+/* internet checksum of an icmp packet */
+static unsigned short icmp_checksum(const unsigned char * data, int len) {
+    uint32_t sum = 0;
+    int x;
+    for(x = 0; x + 1 < len; x += 2)
+        sum += (data[x] << 8) | data[x+1];
+    if(len & 1)
+        sum += data[len-1] << 8;
+    while(sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return(htons(~sum & 0xFFFF));
+}
+
+
+/* send one echo request to a target of a job */
+static void send_probe(int indx, int target, double now) {
+    unsigned char packet[ICMP_PACKET_SIZE];
+    struct icmp * icmp = (struct icmp *)packet;
+    struct sockaddr_in addr;
+    icmp_job_t * job = &icmp_jobs[indx];
+
+    memset(packet, 0, sizeof(packet));
+    icmp->icmp_type  = ICMP_ECHO;
+    icmp->icmp_id    = htons(icmp_ident);
+    icmp->icmp_seq   = htons(icmp_next_seq);
+    icmp->icmp_cksum = icmp_checksum(packet, sizeof(packet));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr   = job->request.targets[target];
+
+    icmp_probes[icmp_next_seq].job_id = job->id;
+    icmp_probes[icmp_next_seq].job    = indx;
+    icmp_probes[icmp_next_seq].target = target;
+    icmp_probes[icmp_next_seq].sent   = now;
+    icmp_next_seq++;
+
+    /* unreachable targets simply count as lost packets */
+    if(sendto(icmp_socket, packet, sizeof(packet), 0, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        gm_log( GM_LOG_TRACE, "icmp sendto %s failed: %s\n", inet_ntoa(addr.sin_addr), strerror(errno));
+
+    job->reply.targets[target].sent++;
+    icmp_stats->probes++;
+    return;
+}
+
+
+/* read all pending echo replies */
+static void read_replies(void) {
+    unsigned char buf[1500];
+    struct sockaddr_in from;
+    socklen_t from_len;
+    struct icmp * icmp;
+    icmp_probe_t * probe;
+    gm_icmp_target_t * target;
+    icmp_job_t * job;
+    double rtt;
+    int len, offset;
+
+    while(1) {
+        from_len = sizeof(from);
+        len = recvfrom(icmp_socket, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+        if(len < 0)
+            return;
+
+        /* raw sockets include the ip header and see all echo replies of this host */
+        offset = icmp_raw ? (buf[0] & 0x0F) * 4 : 0;
+        if(len < offset + ICMP_MINLEN)
+            continue;
+        icmp = (struct icmp *)(buf + offset);
+        if(icmp->icmp_type != ICMP_ECHOREPLY)
+            continue;
+        if(icmp_raw && ntohs(icmp->icmp_id) != icmp_ident)
+            continue;
+
+        probe = &icmp_probes[ntohs(icmp->icmp_seq)];
+        if(probe->job_id == 0)
+            continue;
+        job = &icmp_jobs[probe->job];
+        if(job->id != probe->job_id || job->request.targets[probe->target].s_addr != from.sin_addr.s_addr)
+            continue;
+
+        rtt    = now_ms() - probe->sent;
+        target = &job->reply.targets[probe->target];
+        if(target->received == 0 || rtt < target->rtmin)
+            target->rtmin = rtt;
+        if(rtt > target->rtmax)
+            target->rtmax = rtt;
+        target->rta += rtt;
+        target->received++;
+        probe->job_id = 0;
+        icmp_stats->replies++;
+    }
+}
+
+
+/* accept new checks from the children */
+static void read_requests(double now) {
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr * cmsg;
+    icmp_job_t * job;
+    int len, x, fd;
+
+    while(icmp_jobs_num < GM_ICMP_MAX_CHECKS) {
+        for(x = 0; icmp_jobs[x].id != 0; x++)
+            ;
+        job = &icmp_jobs[x];
+
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base       = &job->request;
+        iov.iov_len        = sizeof(job->request);
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        len = recvmsg(icmp_request_fd[1], &msg, MSG_DONTWAIT);
+        if(len < 0)
+            return;
+
+        fd   = -1;
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if(cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        if(fd < 0)
+            continue;
+        if(len != sizeof(job->request) || job->request.num_targets < 1 || job->request.num_targets > GM_ICMP_MAX_TARGETS || job->request.packets < 1) {
+            gm_log( GM_LOG_ERROR, "icmp engine received invalid request\n");
+            close(fd);
+            continue;
+        }
+
+        memset(&job->reply, 0, sizeof(job->reply));
+        job->reply.num_targets = job->request.num_targets;
+        job->reply_fd          = fd;
+        job->rounds            = 0;
+        job->start             = now;
+        job->last_send         = now;
+        job->id                = icmp_next_id++;
+        if(icmp_next_id == 0)
+            icmp_next_id = 1;
+        icmp_jobs_num++;
+    }
+}
+
+
+/* send due packets and return answers of finished checks, returns ms till the next event */
+static int process_jobs(double now) {
+    icmp_job_t * job;
+    double next = -1, event;
+    int x, t, done;
+
+    for(x = 0; x < GM_ICMP_MAX_CHECKS && icmp_jobs_num > 0; x++) {
+        job = &icmp_jobs[x];
+        if(job->id == 0)
+            continue;
+
+        /* next round of packets to all targets */
+        if(job->rounds < job->request.packets && now >= job->start + job->rounds * job->request.interval) {
+            for(t = 0; t < job->request.num_targets; t++)
+                send_probe(x, t, now);
+            job->rounds++;
+            job->last_send = now;
+        }
+
+        done = TRUE;
+        for(t = 0; t < job->request.num_targets; t++) {
+            if(job->reply.targets[t].received < job->request.packets)
+                done = FALSE;
+        }
+        if(job->rounds == job->request.packets && now >= job->last_send + job->request.wait)
+            done = TRUE;
+        if(now >= job->start + job->request.timeout)
+            done = TRUE;
+
+        if(done) {
+            for(t = 0; t < job->request.num_targets; t++) {
+                if(job->reply.targets[t].received > 0)
+                    job->reply.targets[t].rta /= job->reply.targets[t].received;
+            }
+            if(send(job->reply_fd, &job->reply, sizeof(job->reply), MSG_NOSIGNAL) < 0)
+                gm_log( GM_LOG_DEBUG, "icmp engine cannot answer check: %s\n", strerror(errno));
+            close(job->reply_fd);
+            job->id = 0;
+            icmp_jobs_num--;
+            icmp_stats->checks++;
+            continue;
+        }
+
+        /* wake up for the next round or the end of the check */
+        if(job->rounds < job->request.packets)
+            event = job->start + job->rounds * job->request.interval;
+        else
+            event = job->last_send + job->request.wait;
+        if(event > job->start + job->request.timeout)
+            event = job->start + job->request.timeout;
+        if(next < 0 || event < next)
+            next = event;
+    }
+
+    if(next < 0)
+        return(-1);
+    return(next > now ? (int)(next - now) + 1 : 0);
+}
+
+
+/* log the throughput since the last call */
+static void log_throughput(double now) {
+    static double   last   = 0;
+    static uint64_t checks = 0;
+    static uint64_t probes = 0;
+    double seconds;
+
+    if(last == 0)
+        last = now;
+    seconds = (now - last) / 1000;
+    if(seconds < GM_ICMP_STATS_INTERVAL)
+        return;
+
+    if(icmp_stats->checks != checks)
+        gm_log( GM_LOG_DEBUG, "icmp engine: %.1f checks/s, %.1f packets/s, %d checks running\n",
+                (double)(icmp_stats->checks - checks) / seconds, (double)(icmp_stats->probes - probes) / seconds, icmp_jobs_num);
+    checks = icmp_stats->checks;
+    probes = icmp_stats->probes;
+    last   = now;
+    return;
+}
+
+
+/* main loop of the icmp engine */
+void icmp_engine_loop() {
+    struct pollfd pfd[2];
+    int timeout;
+
+    gm_log( GM_LOG_TRACE, "icmp_engine_loop()\n" );
+
+    if(icmp_socket < 0 || icmp_stats == NULL) {
+        gm_log( GM_LOG_ERROR, "icmp engine has not been set up\n" );
+        return;
+    }
+
+    icmp_jobs   = gm_calloc(GM_ICMP_MAX_CHECKS, sizeof(icmp_job_t));
+    icmp_probes = gm_calloc(ICMP_PROBE_SLOTS, sizeof(icmp_probe_t));
+    icmp_ident  = getpid() & 0xFFFF;
+    icmp_stats->engine_pid = getpid();
+
+    while(1) {
+        timeout = process_jobs(now_ms());
+        if(timeout < 0 || timeout > GM_ICMP_STATS_INTERVAL*1000)
+            timeout = GM_ICMP_STATS_INTERVAL*1000;
+
+        pfd[0].fd      = icmp_socket;
+        pfd[0].events  = POLLIN;
+        pfd[0].revents = 0;
+        pfd[1].fd      = icmp_request_fd[1];
+        pfd[1].events  = icmp_jobs_num < GM_ICMP_MAX_CHECKS ? POLLIN : 0;
+        pfd[1].revents = 0;
+        if(poll(pfd, 2, timeout) < 0 && errno != EINTR) {
+            gm_log( GM_LOG_ERROR, "icmp engine poll failed: %s\n", strerror(errno));
+            sleep(1);
+            continue;
+        }
+
+        if(pfd[0].revents & POLLIN)
+            read_replies();
+        if(pfd[1].revents & POLLIN)
+            read_requests(now_ms());
+        log_throughput(now_ms());
+    }
+}
+
+
+/* check whether the command line is handled by the icmp engine */
+int is_icmp_check(const char * command_line) {
+    const char * name;
+    size_t len;
+
+    if(command_line == NULL)
+        return FALSE;
+    if(mod_gm_opt->icmp_commands_num > 0)
+        return gm_trie_match(mod_gm_opt->icmp_commands_trie, command_line);
+
+    /* basename of the first word */
+    len  = strcspn(command_line, " \t");
+    name = command_line + len;
+    while(name > command_line && *(name-1) != '/')
+        name--;
+    len -= name - command_line;
+    if(len == 10 && (!strncmp(name, "check_icmp", 10) || !strncmp(name, "check_ping", 10)))
+        return TRUE;
+    return FALSE;
+}
+
+
+/* parse rta,pl% thresholds */
+static int parse_icmp_threshold(const char * value, double * rta, int * pl) {
+    if(sscanf(value, "%lf,%d%%", rta, pl) != 2)
+        return GM_ERROR;
+    return GM_OK;
+}
+
+
+/* parse a positive number like check_icmp, times are milliseconds unless they end in s or us */
+static int parse_icmp_number(const char * value, int is_time, int * number) {
+    char * end;
+    double num;
+
+    errno = 0;
+    num = strtod(value, &end);
+    if(errno != 0 || end == value || num < 0)
+        return GM_ERROR;
+    if(is_time == TRUE) {
+        if(!strcmp(end, "s"))
+            num *= 1000;
+        else if(!strcmp(end, "us"))
+            num /= 1000;
+        else if(*end != '\x0' && strcmp(end, "ms"))
+            return GM_ERROR;
+    }
+    else if(*end != '\x0')
+        return GM_ERROR;
+    if(num > INT_MAX)
+        return GM_ERROR;
+    *number = (int)num;
+    return GM_OK;
+}
+
+
+/* parse a check_icmp or check_ping command line, GM_ERROR means unsupported */
+static int parse_icmp_command(char * command_line, icmp_check_t * check, gm_icmp_request_t * request) {
+    char * argv[MAX_CMD_ARGS];
+    char * arg;
+    char * value;
+    char flag;
+    int i;
+
+    /* anything the shell would interpret needs the real plugin */
+    if(strpbrk(command_line, "$&;<>|`\\") != NULL)
+        return GM_ERROR;
+    parse_command_line(command_line, argv);
+    if(argv[0] == NULL)
+        return GM_ERROR;
+
+    memset(check, 0, sizeof(icmp_check_t));
+    memset(request, 0, sizeof(gm_icmp_request_t));
+    check->flavor     = strstr(argv[0], "check_ping") != NULL ? GM_ICMP_FLAVOR_PING : GM_ICMP_FLAVOR_ICMP;
+    check->warn_rta   = 200.0;
+    check->warn_pl    = 40;
+    check->crit_rta   = 500.0;
+    check->crit_pl    = 80;
+    check->timeout    = 10;
+    request->packets  = GM_ICMP_DEFAULT_PACKETS;
+    request->interval = GM_ICMP_DEFAULT_INTERVAL;
+
+    for(i = 1; argv[i] != NULL; i++) {
+        arg = argv[i];
+        if(arg[0] != '-') {
+            /* check_icmp takes hosts without -H as well */
+            if(check->flavor != GM_ICMP_FLAVOR_ICMP || check->num_hosts >= GM_ICMP_MAX_TARGETS)
+                return GM_ERROR;
+            check->hosts[check->num_hosts++] = arg;
+            continue;
+        }
+        flag  = arg[1];
+        value = NULL;
+        if(arg[1] == '-') {
+            value = strchr(arg, '=');
+            if(value != NULL)
+                *value++ = '\x0';
+            if(!strcmp(arg, "--hostname"))      flag = 'H';
+            else if(!strcmp(arg, "--warning"))  flag = 'w';
+            else if(!strcmp(arg, "--critical")) flag = 'c';
+            else if(!strcmp(arg, "--packets"))  flag = 'p';
+            else if(!strcmp(arg, "--timeout"))  flag = 't';
+            else if(!strcmp(arg, "--use-ipv4")) flag = '4';
+            else return GM_ERROR;
+        }
+        else if(arg[2] != '\x0') {
+            value = arg + 2;
+        }
+        if(flag == '4')
+            continue;
+        if(value == NULL)
+            value = argv[++i];
+        if(value == NULL)
+            return GM_ERROR;
+
+        switch(flag) {
+            case 'H':
+                if(check->num_hosts >= GM_ICMP_MAX_TARGETS)
+                    return GM_ERROR;
+                check->hosts[check->num_hosts++] = value;
+                break;
+            case 'w':
+                if(parse_icmp_threshold(value, &check->warn_rta, &check->warn_pl) != GM_OK)
+                    return GM_ERROR;
+                break;
+            case 'c':
+                if(parse_icmp_threshold(value, &check->crit_rta, &check->crit_pl) != GM_OK)
+                    return GM_ERROR;
+                break;
+            case 'n':
+            case 'p':
+                if(parse_icmp_number(value, FALSE, &request->packets) != GM_OK)
+                    return GM_ERROR;
+                break;
+            case 'i':
+                if(parse_icmp_number(value, TRUE, &request->interval) != GM_OK)
+                    return GM_ERROR;
+                break;
+            case 't':
+                if(parse_icmp_number(value, FALSE, &check->timeout) != GM_OK)
+                    return GM_ERROR;
+                break;
+            default:
+                return GM_ERROR;
+        }
+    }
+
+    /* check_ping reports a single host and requires thresholds */
+    if(check->num_hosts == 0 || request->packets < 1 || request->packets > 100 || request->interval < 0 || check->timeout <= 0)
+        return GM_ERROR;
+    if(check->flavor == GM_ICMP_FLAVOR_PING && check->num_hosts != 1)
+        return GM_ERROR;
+
+    return GM_OK;
+}
+
+
+/* resolve all hosts, only ipv4 is supported by the engine */
+static int resolve_icmp_targets(icmp_check_t * check, gm_icmp_request_t * request) {
+    struct addrinfo hints, *res;
+    int x;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    for(x = 0; x < check->num_hosts; x++) {
+        if(inet_pton(AF_INET, check->hosts[x], &request->targets[x]) == 1)
+            continue;
+        if(getaddrinfo(check->hosts[x], NULL, &hints, &res) != 0)
+            return GM_ERROR;
+        request->targets[x] = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+        freeaddrinfo(res);
+    }
+    request->num_targets = check->num_hosts;
+    return GM_OK;
+}
+
+
+/* pass the request to the engine and wait for the answer */
+static int query_icmp_engine(gm_icmp_request_t * request, gm_icmp_reply_t * reply) {
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr * cmsg;
+    struct pollfd pfd;
+    int fds[2];
+    int rc;
+
+    if(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0)
+        return GM_ERROR;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    iov.iov_base       = request;
+    iov.iov_len        = sizeof(gm_icmp_request_t);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg               = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level   = SOL_SOCKET;
+    cmsg->cmsg_type    = SCM_RIGHTS;
+    cmsg->cmsg_len     = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fds[1], sizeof(int));
+
+    rc = sendmsg(icmp_request_fd[0], &msg, MSG_NOSIGNAL);
+    close(fds[1]);
+    if(rc < 0) {
+        close(fds[0]);
+        return GM_ERROR;
+    }
+
+    /* a restarted engine picks up queued requests, so wait a bit longer */
+    pfd.fd     = fds[0];
+    pfd.events = POLLIN;
+    do {
+        rc = poll(&pfd, 1, request->timeout + 1000);
+    } while(rc < 0 && errno == EINTR);
+    if(rc == 1)
+        rc = recv(fds[0], reply, sizeof(gm_icmp_reply_t), 0);
+    close(fds[0]);
+
+    if(rc != sizeof(gm_icmp_reply_t) || reply->num_targets != request->num_targets)
+        return GM_ERROR;
+    return GM_OK;
+}
+
+
+/* state of a single host */
+static int icmp_target_state(icmp_check_t * check, gm_icmp_target_t * target, int pl) {
+    if(target->received == 0 || pl >= check->crit_pl || target->rta >= check->crit_rta)
+        return STATE_CRITICAL;
+    if(pl >= check->warn_pl || target->rta >= check->warn_rta)
+        return STATE_WARNING;
+    return STATE_OK;
+}
+
+
+/* create plugin output and return code like check_icmp or check_ping */
+static int format_icmp_result(icmp_check_t * check, gm_icmp_reply_t * reply, char ** output) {
+    static const char * states[] = { "OK", "WARNING", "CRITICAL", "UNKNOWN" };
+    char text[GM_BUFFERSIZE];
+    char perf[GM_BUFFERSIZE];
+    gm_icmp_target_t * target;
+    const char * prefix;
+    int x, pl, state, rc = STATE_OK;
+    size_t tlen = 0, plen = 0;
+
+    text[0] = '\x0';
+    perf[0] = '\x0';
+    for(x = 0; x < reply->num_targets; x++) {
+        target = &reply->targets[x];
+        pl     = target->sent > 0 ? (target->sent - target->received) * 100 / target->sent : 100;
+        state  = icmp_target_state(check, target, pl);
+        if(state > rc)
+            rc = state;
+
+        if(check->flavor == GM_ICMP_FLAVOR_PING) {
+            if(target->received == 0) {
+                snprintf(text, sizeof(text), "Packet loss = %d%%", pl);
+                snprintf(perf, sizeof(perf), "pl=%d%%;%d;%d;0", pl, check->warn_pl, check->crit_pl);
+            } else {
+                snprintf(text, sizeof(text), "Packet loss = %d%%, RTA = %.2f ms", pl, target->rta);
+                snprintf(perf, sizeof(perf), "rta=%fms;%f;%f;%f pl=%d%%;%d;%d;0", target->rta, check->warn_rta, check->crit_rta, 0.0, pl, check->warn_pl, check->crit_pl);
+            }
+            continue;
+        }
+
+        if(target->received == 0)
+            tlen += snprintf(text+tlen, tlen < sizeof(text) ? sizeof(text)-tlen : 0, "%s%s: rta nan, lost 100%%", x > 0 ? " :: " : "", check->hosts[x]);
+        else
+            tlen += snprintf(text+tlen, tlen < sizeof(text) ? sizeof(text)-tlen : 0, "%s%s: rta %0.3fms, lost %d%%", x > 0 ? " :: " : "", check->hosts[x], target->rta, pl);
+
+        prefix = reply->num_targets > 1 ? check->hosts[x] : "";
+        plen += snprintf(perf+plen, plen < sizeof(perf) ? sizeof(perf)-plen : 0, "%s%srta=%0.3fms;%0.3f;%0.3f;0; %spl=%d%%;%d;%d;; %srtmax=%0.3fms;;;; %srtmin=%0.3fms;;;;",
+                         x > 0 ? " " : "", prefix, target->rta, check->warn_rta, check->crit_rta, prefix, pl, check->warn_pl, check->crit_pl,
+                         prefix, target->rtmax, prefix, target->rtmin);
+    }
+
+    if(check->flavor == GM_ICMP_FLAVOR_PING)
+        gm_asprintf(output, "PING %s - %s|%s", states[rc], text, perf);
+    else
+        gm_asprintf(output, "%s - %s|%s", states[rc], text, perf);
+    return(rc);
+}
+
+
+/* run a host alive check through the icmp engine */
+int icmp_engine_check(gm_job_t * job) {
+    icmp_check_t check;
+    gm_icmp_request_t request;
+    gm_icmp_reply_t reply;
+    struct timeval start_time;
+    char * command_line;
+
+    if(mod_gm_opt->icmp_engine != GM_ENABLED || icmp_stats == NULL || job->command_line == NULL || job->type == NULL)
+        return GM_ERROR;
+    if(strcmp(job->type, "host") && strcmp(job->type, "service"))
+        return GM_ERROR;
+    if(!is_icmp_check(job->command_line))
+        return GM_ERROR;
+    /* restricted commands are refused by execute_safe_command() */
+    if(check_restricted_command(job->command_line, NULL) != GM_OK)
+        return GM_ERROR;
+    if(icmp_stats->engine_pid <= 0 || kill(icmp_stats->engine_pid, 0) != 0)
+        return GM_ERROR;
+
+    command_line = gm_strdup(job->command_line);
+    if(parse_icmp_command(command_line, &check, &request) != GM_OK || resolve_icmp_targets(&check, &request) != GM_OK) {
+        gm_log( GM_LOG_TRACE, "icmp engine cannot run: %s\n", job->command_line);
+        free(command_line);
+        return GM_ERROR;
+    }
+
+    request.timeout = job->timeout > 0 && job->timeout < check.timeout ? (int)(job->timeout * 1000) : check.timeout * 1000;
+    request.wait    = (int)check.crit_rta < request.timeout ? (int)check.crit_rta : request.timeout;
+
+    if(job->start_time.tv_sec == 0) {
+        gettimeofday(&start_time, NULL);
+        job->start_time = start_time;
+    }
+
+    if(query_icmp_engine(&request, &reply) != GM_OK) {
+        gm_log( GM_LOG_ERROR, "icmp engine did not answer, running plugin instead: %s\n", job->command_line);
+        free(command_line);
+        return GM_ERROR;
+    }
+
+    free(job->output);
+    job->return_code = format_icmp_result(&check, &reply, &job->output);
+    free(job->error);
+    job->error       = gm_strdup("");
+    free(command_line);
+
+    finish_check_result(job, mod_gm_opt->identifier);
+    return GM_OK;
+}
+
+
+/* add the icmp engine counters to the status */
+void icmp_engine_append_stats(char * result) {
+    int len;
+
+    if(icmp_stats == NULL || mod_gm_opt->icmp_engine != GM_ENABLED)
+        return;
+
+    len = strlen(result);
+    snprintf(result+len, len < GM_BUFFERSIZE ? GM_BUFFERSIZE-len : 0, " icmp_checks=%lluc icmp_packets=%lluc icmp_replies=%lluc",
+             (unsigned long long)icmp_stats->checks, (unsigned long long)icmp_stats->probes, (unsigned long long)icmp_stats->replies);
+
+    return;
+}
@@ -0,0 +1,380 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/* include header */
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "plugin_cgroup.h"
+#include "gm_hash.h"
+#include "utils.h"
+
+static const char * controllers[] = GM_CGROUP_CONTROLLERS;
+#define GM_CGROUP_CONTROLLERS_NUM (int)(sizeof(controllers)/sizeof(controllers[0]))
+
+static int         available = FALSE;
+static int         controller_used[GM_CGROUP_CONTROLLERS_NUM];
+static gm_hash_t * prepared_queues = NULL;
+static pid_t       prepared_pid = 0;
+static int         entered = FALSE;
+static int         stale_leaves = FALSE;
+static char        leaf_path[PATH_MAX] = "";
+
+
+/* write a value into a cgroup control file, only uses async signal safe calls besides snprintf */
+static int write_control(const char * dir, const char * file, const char * value) {
+    char path[PATH_MAX];
+    size_t len = strlen(value);
+    int fd, rc;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    if((fd = open(path, O_WRONLY | O_CLOEXEC)) < 0)
+        return GM_ERROR;
+    rc = write(fd, value, len) == (ssize_t)len ? GM_OK : GM_ERROR;
+    close(fd);
+    return rc;
+}
+
+
+/* read a cgroup control file */
+static int read_control(const char * dir, const char * file, char * buf, size_t size) {
+    char path[PATH_MAX];
+    ssize_t len;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return GM_ERROR;
+    len = read(fd, buf, size - 1);
+    close(fd);
+    if(len < 0)
+        return GM_ERROR;
+    buf[len] = '\x0';
+    return GM_OK;
+}
+
+
+/* returns true if the controller has a configured limit */
+static int controller_needed(int x) {
+    if(!strcmp(controllers[x], "cpu"))
+        return mod_gm_opt->cgroup_cpu_weight > 0;
+    if(!strcmp(controllers[x], "memory"))
+        return mod_gm_opt->cgroup_memory_max > 0;
+    return mod_gm_opt->cgroup_pids_max > 0;
+}
+
+
+/* returns true if the space separated list contains the controller */
+static int has_controller(const char * list, const char * name) {
+    size_t len = strlen(name);
+    const char * c = list;
+
+    while((c = strstr(c, name)) != NULL) {
+        if((c == list || c[-1] == ' ') && (c[len] == ' ' || c[len] == '\n' || c[len] == '\x0'))
+            return TRUE;
+        c += len;
+    }
+    return FALSE;
+}
+
+
+/* make the used controllers available to the children of a cgroup */
+static void enable_controllers(const char * dir) {
+    char value[32];
+    int x;
+
+    for(x = 0; x < GM_CGROUP_CONTROLLERS_NUM; x++) {
+        if(controller_used[x] == FALSE)
+            continue;
+        snprintf(value, sizeof(value), "+%s", controllers[x]);
+        if(write_control(dir, "cgroup.subtree_control", value) != GM_OK)
+            gm_log( GM_LOG_ERROR, "failed to enable cgroup controller %s in %s: %s\n", controllers[x], dir, strerror(errno));
+    }
+}
+
+
+/* write the configured limits into a cgroup */
+static void apply_limits(const char * dir) {
+    char value[32];
+
+    if(controller_used[0] == TRUE) {
+        snprintf(value, sizeof(value), "%d", mod_gm_opt->cgroup_cpu_weight);
+        if(write_control(dir, "cpu.weight", value) != GM_OK)
+            gm_log( GM_LOG_ERROR, "failed to set cpu.weight of %s: %s\n", dir, strerror(errno));
+    }
+    if(controller_used[1] == TRUE) {
+        snprintf(value, sizeof(value), "%llu", (unsigned long long)mod_gm_opt->cgroup_memory_max * 1024 * 1024);
+        if(write_control(dir, "memory.max", value) != GM_OK)
+            gm_log( GM_LOG_ERROR, "failed to set memory.max of %s: %s\n", dir, strerror(errno));
+    }
+    if(controller_used[2] == TRUE) {
+        snprintf(value, sizeof(value), "%d", mod_gm_opt->cgroup_pids_max);
+        if(write_control(dir, "pids.max", value) != GM_OK)
+            gm_log( GM_LOG_ERROR, "failed to set pids.max of %s: %s\n", dir, strerror(errno));
+    }
+}
+
+
+/* create a cgroup, existing cgroups are fine */
+static int create_cgroup(const char * dir) {
+    if(mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        gm_log( GM_LOG_ERROR, "failed to create cgroup %s: %s\n", dir, strerror(errno));
+        return GM_ERROR;
+    }
+    return GM_OK;
+}
+
+
+/* verify the cgroup root and enable the controllers */
+int plugin_cgroup_setup() {
+    char list[1024];
+    int x;
+
+    available = FALSE;
+    if(mod_gm_opt->cgroup_root == NULL)
+        return GM_OK;
+
+    if(read_control(mod_gm_opt->cgroup_root, "cgroup.controllers", list, sizeof(list)) != GM_OK) {
+        gm_log( GM_LOG_ERROR, "cgroup_root %s is not a cgroup v2 directory: %s\n", mod_gm_opt->cgroup_root, strerror(errno));
+        return GM_ERROR;
+    }
+
+    for(x = 0; x < GM_CGROUP_CONTROLLERS_NUM; x++) {
+        controller_used[x] = FALSE;
+        if(!controller_needed(x))
+            continue;
+        if(!has_controller(list, controllers[x])) {
+            gm_log( GM_LOG_ERROR, "cgroup controller %s is not available in %s, ignoring its limit\n", controllers[x], mod_gm_opt->cgroup_root);
+            continue;
+        }
+        controller_used[x] = TRUE;
+    }
+    enable_controllers(mod_gm_opt->cgroup_root);
+
+    /* queue cgroups may be left from a previous configuration */
+    if(prepared_queues != NULL)
+        gm_hash_free(prepared_queues);
+    prepared_queues = NULL;
+    leaf_path[0]    = '\x0';
+
+    /* a previous instance may have left leaf cgroups behind */
+    stale_leaves = TRUE;
+
+    available = TRUE;
+    gm_log( GM_LOG_DEBUG, "running plugins in cgroups below %s\n", mod_gm_opt->cgroup_root);
+    return GM_OK;
+}
+
+
+/* create the queue and leaf cgroup of this worker */
+int plugin_cgroup_prepare(const char * queue) {
+    char name[NAME_MAX];
+    char queue_path[PATH_MAX];
+    pid_t pid = getpid();
+    int x;
+
+    if(available == FALSE)
+        return GM_ERROR;
+    if(queue == NULL)
+        queue = "unknown";
+
+    if(prepared_pid != pid) {
+        if(prepared_queues != NULL)
+            gm_hash_free(prepared_queues);
+        prepared_queues = gm_hash_new();
+        prepared_pid    = pid;
+    }
+
+    /* slashes and a leading dot cannot be used in cgroup names */
+    snprintf(name, sizeof(name), "%s", queue);
+    for(x = 0; name[x] != '\x0'; x++) {
+        if(name[x] == '/' || (x == 0 && name[x] == '.'))
+            name[x] = '_';
+    }
+    snprintf(queue_path, sizeof(queue_path), "%s/%s", mod_gm_opt->cgroup_root, name);
+    snprintf(leaf_path, sizeof(leaf_path), "%s/%s%d", queue_path, GM_CGROUP_LEAF_PREFIX, (int)pid);
+
+    if(gm_hash_get(prepared_queues, name, FALSE) == TRUE)
+        return GM_OK;
+
+    if(create_cgroup(queue_path) != GM_OK || create_cgroup(leaf_path) != GM_OK) {
+        leaf_path[0] = '\x0';
+        return GM_ERROR;
+    }
+    if(mod_gm_opt->cgroup_scope == GM_CGROUP_SCOPE_QUEUE) {
+        apply_limits(queue_path);
+    } else {
+        enable_controllers(queue_path);
+        apply_limits(leaf_path);
+    }
+    gm_hash_add(prepared_queues, name, TRUE);
+
+    return GM_OK;
+}
+
+
+/* move this process into the leaf cgroup */
+void plugin_cgroup_enter() {
+    if(leaf_path[0] == '\x0' || entered == TRUE)
+        return;
+    entered = TRUE;
+    if(write_control(leaf_path, "cgroup.procs", "0") != GM_OK)
+        gm_log( GM_LOG_ERROR, "failed to move plugin into cgroup %s: %s\n", leaf_path, strerror(errno));
+    return;
+}
+
+
+/* kill all processes of the leaf cgroup */
+int plugin_cgroup_kill() {
+    char events[256];
+
+    if(leaf_path[0] == '\x0')
+        return GM_ERROR;
+
+    /* the plugin could not be moved into an empty cgroup */
+    if(read_control(leaf_path, "cgroup.events", events, sizeof(events)) != GM_OK || strstr(events, "populated 1") == NULL)
+        return GM_ERROR;
+
+    return write_control(leaf_path, "cgroup.kill", "1");
+}
+
+
+/* remove the leaf cgroups of this worker process from all queue cgroups */
+void plugin_cgroup_cleanup() {
+    char leaf[NAME_MAX];
+    char path[PATH_MAX];
+    struct dirent * entry;
+    DIR * dir;
+
+    if(available == FALSE || prepared_pid != getpid())
+        return;
+
+    if((dir = opendir(mod_gm_opt->cgroup_root)) == NULL)
+        return;
+    snprintf(leaf, sizeof(leaf), "%s%d", GM_CGROUP_LEAF_PREFIX, (int)prepared_pid);
+    while((entry = readdir(dir)) != NULL) {
+        if(entry->d_type != DT_DIR || entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s/%s", mod_gm_opt->cgroup_root, entry->d_name, leaf);
+        if(rmdir(path) != 0 && errno != ENOENT)
+            gm_log( GM_LOG_DEBUG, "failed to remove cgroup %s: %s\n", path, strerror(errno));
+    }
+    closedir(dir);
+
+    leaf_path[0] = '\x0';
+    return;
+}
+
+
+/* remove the leaf cgroups of one queue cgroup whose worker is gone, returns the number left over */
+static int remove_stale_leaves(const char * queue_path) {
+    char path[PATH_MAX];
+    struct dirent * entry;
+    size_t prefix_len = strlen(GM_CGROUP_LEAF_PREFIX);
+    pid_t pid;
+    int left = 0;
+    DIR * dir;
+
+    if((dir = opendir(queue_path)) == NULL)
+        return 0;
+    while((entry = readdir(dir)) != NULL) {
+        if(entry->d_type != DT_DIR || strncmp(entry->d_name, GM_CGROUP_LEAF_PREFIX, prefix_len))
+            continue;
+        pid = (pid_t)atoi(entry->d_name + prefix_len);
+        if(pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", queue_path, entry->d_name);
+        if(rmdir(path) == 0 || errno == ENOENT)
+            continue;
+        /* orphaned plugins are still running, kill them and try again next time */
+        gm_log( GM_LOG_DEBUG, "failed to remove cgroup %s: %s\n", path, strerror(errno));
+        write_control(path, "cgroup.kill", "1");
+        left++;
+    }
+    closedir(dir);
+    return left;
+}
+
+
+/* remove the leaf cgroups of worker processes which exited without cleaning up */
+void plugin_cgroup_remove_stale(int worker_exited) {
+    char path[PATH_MAX];
+    struct dirent * entry;
+    int left = 0;
+    DIR * dir;
+
+    if(available == FALSE || (worker_exited == FALSE && stale_leaves == FALSE))
+        return;
+
+    if((dir = opendir(mod_gm_opt->cgroup_root)) == NULL)
+        return;
+    while((entry = readdir(dir)) != NULL) {
+        if(entry->d_type != DT_DIR || entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", mod_gm_opt->cgroup_root, entry->d_name);
+        left += remove_stale_leaves(path);
+    }
+    closedir(dir);
+
+    stale_leaves = left > 0 ? TRUE : FALSE;
+    return;
+}
+
+
+/* read the avg10 value of the some line of a pressure file */
+static double read_pressure(const char * file) {
+    char buf[512];
+    double avg10 = 0;
+
+    if(read_control(mod_gm_opt->cgroup_root, file, buf, sizeof(buf)) == GM_OK)
+        sscanf(buf, "some avg10=%lf", &avg10);
+    return avg10;
+}
+
+
+/* append pressure and oom kills of all plugins to the status text */
+void plugin_cgroup_append_stats(char * result) {
+    char buf[1024];
+    char * oom;
+    size_t len;
+
+    if(available == FALSE)
+        return;
+
+    len = strlen(result);
+    snprintf(result+len, len < GM_BUFFERSIZE ? GM_BUFFERSIZE-len : 0, " cgroup_cpu_pressure=%.2f%% cgroup_memory_pressure=%.2f%% cgroup_io_pressure=%.2f%%",
+             read_pressure("cpu.pressure"),
+             read_pressure("memory.pressure"),
+             read_pressure("io.pressure")
+            );
+
+    /* memory.events only exists with the memory controller */
+    if(read_control(mod_gm_opt->cgroup_root, "memory.events", buf, sizeof(buf)) == GM_OK && (oom = strstr(buf, "oom_kill ")) != NULL) {
+        len = strlen(result);
+        snprintf(result+len, len < GM_BUFFERSIZE ? GM_BUFFERSIZE-len : 0, " cgroup_oom_kills=%lluc", strtoull(oom+9, NULL, 10));
+    }
+    return;
+}
@@ -0,0 +1,244 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/* include header */
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "result_cache.h"
+#include "utils.h"
+#include "gm_alloc.h"
+
+/* one cached result, guarded by a sequence counter which is odd while the slot is written */
+typedef struct result_cache_entry_struct {
+    volatile uint32_t seq;
+    volatile time_t   locked;
+    int               return_code;
+    uint64_t          key;
+    time_t            stored;
+    int               output_len;
+    int               error_len;
+    char              data[GM_RESULT_CACHE_DATA];
+} result_cache_entry_t;
+
+typedef struct result_cache_struct {
+    volatile int         hits;
+    volatile int         misses;
+    result_cache_entry_t entries[GM_RESULT_CACHE_SLOTS];
+} result_cache_t;
+
+static result_cache_t * cache = NULL;
+
+/* fnv-1a hash of the command line */
+static uint64_t command_key(const char * command_line) {
+    uint64_t key = 14695981039346656037ULL;
+    const unsigned char * c;
+    for(c = (const unsigned char *)command_line; *c != '\x0'; c++) {
+        key ^= *c;
+        key *= 1099511628211ULL;
+    }
+    return key;
+}
+
+
+/* returns true if results of this job may be cached */
+static int is_cacheable(gm_job_t * job) {
+    if(cache == NULL || mod_gm_opt->result_cache_ttl <= 0)
+        return FALSE;
+    if(job->command_line == NULL || job->type == NULL)
+        return FALSE;
+    if(strcmp(job->type, "service") && strcmp(job->type, "host"))
+        return FALSE;
+
+    /* only explicitly allowed commands, most checks must not be served stale */
+    if(mod_gm_opt->result_cache_commands_num == 0)
+        return FALSE;
+    return gm_trie_match(mod_gm_opt->result_cache_commands_trie, job->command_line);
+}
+
+
+/* create the result cache segment */
+int result_cache_setup() {
+    int id;
+
+    if(cache != NULL || mod_gm_opt->result_cache_ttl <= 0)
+        return GM_OK;
+
+    if(mod_gm_opt->result_cache_commands_num == 0) {
+        gm_log( GM_LOG_INFO, "result_cache_ttl is set without result_cache_command, result cache disabled\n");
+        return GM_OK;
+    }
+
+    if((id = shmget(IPC_PRIVATE, sizeof(result_cache_t), IPC_CREAT | 0600)) < 0) {
+        gm_log( GM_LOG_ERROR, "failed to create result cache: %s\n", strerror(errno));
+        return GM_ERROR;
+    }
+    if((cache = shmat(id, NULL, 0)) == (void *) -1) {
+        gm_log( GM_LOG_ERROR, "failed to attach result cache: %s\n", strerror(errno));
+        cache = NULL;
+        shmctl(id, IPC_RMID, 0);
+        return GM_ERROR;
+    }
+
+    /* segment stays attached in all children and is removed with the last one */
+    if(shmctl(id, IPC_RMID, 0) == -1)
+        gm_log( GM_LOG_ERROR, "failed to mark result cache for removal: %s\n", strerror(errno));
+
+    memset(cache, 0, sizeof(result_cache_t));
+    gm_log( GM_LOG_DEBUG, "created result cache with %d slots\n", GM_RESULT_CACHE_SLOTS);
+
+    return GM_OK;
+}
+
+
+/* use cached result of the same command */
+int result_cache_lookup(gm_job_t * job) {
+    result_cache_entry_t * entry;
+    uint64_t key;
+    uint32_t seq;
+    int return_code, output_len, error_len;
+    char * data;
+    char source[GM_BUFFERSIZE];
+    struct timeval now;
+
+    if(is_cacheable(job) == FALSE)
+        return GM_ERROR;
+
+    key   = command_key(job->command_line);
+    entry = &cache->entries[key % GM_RESULT_CACHE_SLOTS];
+
+    seq = entry->seq;
+    __sync_synchronize();
+    if(seq == 0 || seq & 1 || entry->key != key || entry->stored + mod_gm_opt->result_cache_ttl < time(NULL)) {
+        __sync_fetch_and_add(&cache->misses, 1);
+        return GM_ERROR;
+    }
+    return_code = entry->return_code;
+    output_len  = entry->output_len;
+    error_len   = entry->error_len;
+    if(output_len < 0 || error_len < 0 || output_len + error_len + 2 > GM_RESULT_CACHE_DATA) {
+        __sync_fetch_and_add(&cache->misses, 1);
+        return GM_ERROR;
+    }
+    data = gm_malloc(output_len + error_len + 2);
+    memcpy(data, entry->data, output_len + error_len + 2);
+    __sync_synchronize();
+
+    /* slot has been rewritten meanwhile */
+    if(entry->seq != seq) {
+        free(data);
+        __sync_fetch_and_add(&cache->misses, 1);
+        return GM_ERROR;
+    }
+    __sync_fetch_and_add(&cache->hits, 1);
+
+    gm_log( GM_LOG_DEBUG, "using cached result for: %s\n", job->command_line);
+
+    data[output_len] = '\x0';
+    data[output_len + error_len + 1] = '\x0';
+    free(job->output);
+    free(job->error);
+    job->output      = gm_strdup(data);
+    job->error       = gm_strdup(data + output_len + 1);
+    job->return_code = return_code;
+    free(data);
+
+    gettimeofday(&now, NULL);
+    job->start_time  = now;
+    job->finish_time = now;
+
+    snprintf( source, sizeof( source )-1, "Mod-Gearman Worker @ %s", mod_gm_opt->identifier);
+    free(job->source);
+    job->source = gm_strdup(source);
+
+    return GM_OK;
+}
+
+
+/* store result of a finished job */
+void result_cache_store(gm_job_t * job) {
+    result_cache_entry_t * entry;
+    uint64_t key;
+    uint32_t seq;
+    int output_len, error_len;
+
+    if(is_cacheable(job) == FALSE)
+        return;
+
+    /* only cache successful checks */
+    if(job->return_code != STATE_OK || job->early_timeout != 0 || job->output == NULL)
+        return;
+
+    output_len = strlen(job->output);
+    error_len  = job->error != NULL ? strlen(job->error) : 0;
+    if(output_len + error_len + 2 > GM_RESULT_CACHE_DATA)
+        return;
+
+    key   = command_key(job->command_line);
+    entry = &cache->entries[key % GM_RESULT_CACHE_SLOTS];
+
+    /* somebody else is writing this slot, skip it unless the writer
+     * has been killed while writing and left the slot locked */
+    seq = entry->seq;
+    if(seq & 1) {
+        if(entry->locked + mod_gm_opt->result_cache_ttl >= time(NULL))
+            return;
+        gm_log( GM_LOG_DEBUG, "taking over result cache slot locked since %d\n", (int)entry->locked);
+    }
+    entry->locked = time(NULL);
+    __sync_synchronize();
+    if(!__sync_bool_compare_and_swap(&entry->seq, seq, seq & 1 ? seq+2 : seq+1))
+        return;
+    seq = seq & 1 ? seq+1 : seq;
+
+    entry->key         = key;
+    entry->return_code = job->return_code;
+    entry->stored      = job->finish_time.tv_sec;
+    entry->output_len  = output_len;
+    entry->error_len   = error_len;
+    memcpy(entry->data, job->output, output_len + 1);
+    if(error_len > 0)
+        memcpy(entry->data + output_len + 1, job->error, error_len + 1);
+    else
+        entry->data[output_len + 1] = '\x0';
+
+    __sync_synchronize();
+    entry->seq = seq+2;
+
+    return;
+}
+
+
+/* append cache statistics to the status text */
+void result_cache_append_stats(char * result) {
+    int len;
+
+    if(cache == NULL)
+        return;
+
+    len = strlen(result);
+    snprintf(result+len, len < GM_BUFFERSIZE ? GM_BUFFERSIZE-len : 0, " cache_hits=%ic cache_misses=%ic", cache->hits, cache->misses);
+
+    return;
+}
@@ -0,0 +1,306 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/* include header */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "result_spool.h"
+#include "gearman_utils.h"
+#include "utils.h"
+#include "gm_alloc.h"
+
+/* ring buffer shared by all processes, head and tail offsets only grow */
+typedef struct result_spool_header_struct {
+    char              magic[8];
+    volatile uint64_t head;
+    volatile uint64_t tail;
+    volatile uint64_t spooled;
+    volatile uint64_t replayed;
+    volatile uint64_t dropped;
+} result_spool_header_t;
+
+/* a queue length of zero marks the unused space at the end of the ring */
+typedef struct result_spool_record_struct {
+    uint32_t size;
+    uint32_t queue_len;
+    uint32_t data_len;
+    uint32_t reserved;
+    char     data[];
+} result_spool_record_t;
+
+static result_spool_header_t * spool = NULL;
+static char * ring                   = NULL;
+static uint64_t capacity             = 0;
+static int spool_fd                  = -1;
+
+/* lock the spool against the other worker processes */
+static void spool_lock(short type) {
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type   = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start  = 0;
+    fl.l_len    = 1;
+    while(fcntl(spool_fd, F_SETLKW, &fl) == -1 && errno == EINTR)
+        ;
+
+    return;
+}
+
+
+/* only one process replays at a time, the others do not wait for it */
+static int replay_lock(short type) {
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type   = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start  = 1;
+    fl.l_len    = 1;
+    if(fcntl(spool_fd, F_SETLK, &fl) == -1)
+        return GM_ERROR;
+
+    return GM_OK;
+}
+
+
+/* return the oldest record or NULL if the spool is corrupt */
+static result_spool_record_t * head_record(void) {
+    result_spool_record_t * rec = (result_spool_record_t *)(ring + spool->head % capacity);
+
+    if(   rec->size < 2 * sizeof(uint32_t)
+       || rec->size % 8 != 0
+       || spool->head % capacity + rec->size > capacity
+       || spool->head + rec->size > spool->tail) {
+        gm_log( GM_LOG_ERROR, "result spool is corrupt, dropping %llu spooled results\n", (unsigned long long)(spool->spooled - spool->replayed - spool->dropped));
+        spool->dropped = spool->spooled - spool->replayed;
+        spool->head    = spool->tail;
+        return NULL;
+    }
+
+    return rec;
+}
+
+
+/* open and map the spool file */
+int result_spool_setup() {
+    struct stat st;
+    off_t size;
+    void * map;
+
+    if(spool != NULL || mod_gm_opt->result_spool == NULL)
+        return GM_OK;
+
+    size = (off_t)mod_gm_opt->result_spool_size * 1024 * 1024;
+    if((spool_fd = open(mod_gm_opt->result_spool, O_RDWR | O_CREAT, 0600)) < 0) {
+        gm_log( GM_LOG_ERROR, "failed to open result spool %s: %s\n", mod_gm_opt->result_spool, strerror(errno));
+        return GM_ERROR;
+    }
+    if(fstat(spool_fd, &st) != 0 || (st.st_size != size && ftruncate(spool_fd, size) != 0)) {
+        gm_log( GM_LOG_ERROR, "failed to resize result spool %s: %s\n", mod_gm_opt->result_spool, strerror(errno));
+        close(spool_fd);
+        spool_fd = -1;
+        return GM_ERROR;
+    }
+    if((map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, spool_fd, 0)) == MAP_FAILED) {
+        gm_log( GM_LOG_ERROR, "failed to map result spool %s: %s\n", mod_gm_opt->result_spool, strerror(errno));
+        close(spool_fd);
+        spool_fd = -1;
+        return GM_ERROR;
+    }
+
+    spool    = map;
+    ring     = (char *)map + sizeof(result_spool_header_t);
+    capacity = size - sizeof(result_spool_header_t);
+
+    /* results of a resized spool cannot be found anymore */
+    if(   memcmp(spool->magic, GM_RESULT_SPOOL_MAGIC, sizeof(spool->magic))
+       || st.st_size != size
+       || spool->tail < spool->head
+       || spool->tail - spool->head > capacity) {
+        memset(spool, 0, sizeof(result_spool_header_t));
+        memcpy(spool->magic, GM_RESULT_SPOOL_MAGIC, sizeof(spool->magic));
+    }
+
+    /* children inherit the hook */
+    result_spool_hook = result_spool_add;
+
+    if(spool->head != spool->tail)
+        gm_log( GM_LOG_INFO, "result spool %s contains %llu results to send\n", mod_gm_opt->result_spool, (unsigned long long)(spool->spooled - spool->replayed - spool->dropped));
+    else
+        gm_log( GM_LOG_DEBUG, "opened result spool %s with %dMB\n", mod_gm_opt->result_spool, mod_gm_opt->result_spool_size);
+
+    return GM_OK;
+}
+
+
+/* append a result which could not be sent, drops the oldest results if the spool is full */
+int result_spool_add(char * queue, char * encoded, int size) {
+    result_spool_record_t * rec;
+    uint32_t queue_len = strlen(queue);
+    uint64_t need      = (sizeof(result_spool_record_t) + queue_len + 1 + size + 7) & ~7;
+    uint64_t pos, wrap = 0;
+
+    if(spool == NULL || size <= 0)
+        return GM_ERROR;
+
+    spool_lock(F_WRLCK);
+    if(need > capacity / 4) {
+        spool->dropped++;
+        spool_lock(F_UNLCK);
+        gm_log( GM_LOG_ERROR, "result of %d bytes is too large for the result spool\n", size);
+        return GM_ERROR;
+    }
+
+    /* records never wrap around the end of the ring */
+    pos = spool->tail % capacity;
+    if(capacity - pos < need)
+        wrap = capacity - pos;
+
+    while(spool->head != spool->tail && spool->tail - spool->head + wrap + need > capacity) {
+        if((rec = head_record()) == NULL)
+            break;
+        if(rec->queue_len > 0)
+            spool->dropped++;
+        spool->head += rec->size;
+    }
+
+    if(wrap > 0) {
+        rec            = (result_spool_record_t *)(ring + pos);
+        rec->size      = wrap;
+        rec->queue_len = 0;
+        spool->tail   += wrap;
+    }
+
+    rec            = (result_spool_record_t *)(ring + spool->tail % capacity);
+    rec->size      = need;
+    rec->queue_len = queue_len;
+    rec->data_len  = size;
+    rec->reserved  = 0;
+    memcpy(rec->data, queue, queue_len + 1);
+    memcpy(rec->data + queue_len + 1, encoded, size);
+    spool->tail += need;
+    spool->spooled++;
+    spool_lock(F_UNLCK);
+
+    gm_log( GM_LOG_DEBUG, "spooled result for queue %s\n", queue);
+
+    return GM_OK;
+}
+
+
+/* check whether there are spooled results */
+int result_spool_pending() {
+    return(spool != NULL && spool->head != spool->tail);
+}
+
+
+/* send spooled results again in their original order */
+int result_spool_replay() {
+    result_spool_record_t * rec;
+    result_spool_record_t * batch[GM_RESULT_SPOOL_BATCH];
+    uint64_t ends[GM_RESULT_SPOOL_BATCH];
+    uint64_t pos;
+    int num = 0, sent = 0, x;
+
+    /* nothing spooled, no need to lock */
+    if(spool == NULL || current_client == NULL || spool->head == spool->tail)
+        return 0;
+
+    /* another process is replaying already */
+    if(replay_lock(F_WRLCK) != GM_OK)
+        return 0;
+
+    /* copy the oldest results, so the spool is not locked while sending them */
+    spool_lock(F_WRLCK);
+    if(spool->head != spool->tail && head_record() != NULL) {
+        for(pos = spool->head; num < GM_RESULT_SPOOL_BATCH && pos != spool->tail; pos += rec->size) {
+            rec = (result_spool_record_t *)(ring + pos % capacity);
+            if(rec->size < 2 * sizeof(uint32_t) || rec->size % 8 != 0 || pos % capacity + rec->size > capacity || pos + rec->size > spool->tail)
+                break;
+            if(rec->queue_len > 0) {
+                batch[num] = gm_malloc(rec->size);
+                memcpy(batch[num], rec, rec->size);
+                ends[num]  = pos + rec->size;
+                num++;
+            }
+        }
+    }
+    spool_lock(F_UNLCK);
+
+    for(x = 0; x < num; x++) {
+        if(sent == x && add_encoded_job_to_queue( current_client,
+                                                  mod_gm_opt->server_list,
+                                                  batch[x]->data,
+                                                  NULL,
+                                                  batch[x]->data + batch[x]->queue_len + 1,
+                                                  batch[x]->data_len,
+                                                  GM_JOB_PRIO_NORMAL,
+                                                  0,
+                                                  TRUE
+                                                ) == GM_OK)
+            sent++;
+        free(batch[x]);
+    }
+
+    /* new results may have pushed out some of the sent ones meanwhile */
+    if(sent > 0) {
+        spool_lock(F_WRLCK);
+        for(x = 0; x < sent; x++) {
+            if(ends[x] <= spool->head && spool->dropped > 0)
+                spool->dropped--;
+        }
+        if(spool->head < ends[sent-1])
+            spool->head = ends[sent-1];
+        spool->replayed += sent;
+        spool_lock(F_UNLCK);
+    }
+    replay_lock(F_UNLCK);
+
+    if(sent > 0)
+        gm_log( GM_LOG_DEBUG, "sent %d spooled results, %llu left\n", sent, (unsigned long long)(spool->spooled - spool->replayed - spool->dropped));
+
+    return sent;
+}
+
+
+/* append spool statistics to the status text */
+void result_spool_append_stats(char * result) {
+    int len;
+
+    if(spool == NULL)
+        return;
+
+    len = strlen(result);
+    snprintf(result+len, len < GM_BUFFERSIZE ? GM_BUFFERSIZE-len : 0, " spooled=%lluc replayed=%lluc dropped=%lluc spool=%llu",
+             (unsigned long long)spool->spooled,
+             (unsigned long long)spool->replayed,
+             (unsigned long long)spool->dropped,
+             (unsigned long long)(spool->spooled - spool->replayed - spool->dropped));
+
+    return;
+}
@@ -0,0 +1,192 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+/* include header */
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "rusage_stats.h"
+#include "utils.h"
+#include "gm_alloc.h"
+
+/* statistics of one command, the name is set right after the key has been claimed */
+typedef struct rusage_stats_entry_struct {
+    volatile uint64_t key;
+    char              name[GM_RUSAGE_NAME_SIZE];
+    volatile uint64_t runs;
+    volatile uint64_t cpu_usec;
+    volatile uint64_t maxrss;
+    volatile uint64_t csw;
+} rusage_stats_entry_t;
+
+static rusage_stats_entry_t * stats = NULL;
+
+/* fnv-1a hash of the command basename, never 0 */
+static uint64_t name_key(const char * name) {
+    uint64_t key = 14695981039346656037ULL;
+    const unsigned char * c;
+    for(c = (const unsigned char *)name; *c != '\x0'; c++) {
+        key ^= *c;
+        key *= 1099511628211ULL;
+    }
+    return key == 0 ? 1 : key;
+}
+
+
+/* sort commands by cpu time, most expensive first */
+static int compare_cpu(const void * a, const void * b) {
+    const rusage_stats_entry_t * ea = a;
+    const rusage_stats_entry_t * eb = b;
+    if(ea->cpu_usec == eb->cpu_usec)
+        return 0;
+    return ea->cpu_usec < eb->cpu_usec ? 1 : -1;
+}
+
+
+/* create the statistics segment */
+int rusage_stats_setup() {
+    int id;
+
+    if(stats != NULL || mod_gm_opt->plugin_rusage != GM_ENABLED)
+        return GM_OK;
+
+    if((id = shmget(IPC_PRIVATE, sizeof(rusage_stats_entry_t) * GM_RUSAGE_SLOTS, IPC_CREAT | 0600)) < 0) {
+        gm_log( GM_LOG_ERROR, "failed to create rusage statistics: %s\n", strerror(errno));
+        return GM_ERROR;
+    }
+    if((stats = shmat(id, NULL, 0)) == (void *) -1) {
+        gm_log( GM_LOG_ERROR, "failed to attach rusage statistics: %s\n", strerror(errno));
+        stats = NULL;
+        shmctl(id, IPC_RMID, 0);
+        return GM_ERROR;
+    }
+
+    /* segment stays attached in all children and is removed with the last one */
+    if(shmctl(id, IPC_RMID, 0) == -1)
+        gm_log( GM_LOG_ERROR, "failed to mark rusage statistics for removal: %s\n", strerror(errno));
+
+    memset(stats, 0, sizeof(rusage_stats_entry_t) * GM_RUSAGE_SLOTS);
+    gm_log( GM_LOG_DEBUG, "created rusage statistics for %d commands\n", GM_RUSAGE_SLOTS);
+
+    return GM_OK;
+}
+
+
+/* basename of the first word which is not an environment variable */
+void rusage_stats_basename(const char * command_line, char * name) {
+    const char * start = command_line;
+    const char * end;
+    const char * slash;
+    size_t len;
+
+    while(1) {
+        while(*start == ' ' || *start == '\t')
+            start++;
+        end = start + strcspn(start, " \t");
+        if(*end == '\x0' || memchr(start, '=', end - start) == NULL)
+            break;
+        start = end;
+    }
+
+    for(slash = start; slash < end; slash++) {
+        if(*slash == '/')
+            start = slash + 1;
+    }
+
+    len = end - start;
+    if(len > GM_RUSAGE_NAME_SIZE - 1)
+        len = GM_RUSAGE_NAME_SIZE - 1;
+    memcpy(name, start, len);
+    name[len] = '\x0';
+
+    return;
+}
+
+
+/* add the resource usage of a job to its command */
+void rusage_stats_store(gm_job_t * job) {
+    rusage_stats_entry_t * entry = NULL;
+    char name[GM_RUSAGE_NAME_SIZE];
+    uint64_t key, maxrss, old;
+    int x;
+
+    if(stats == NULL || job->has_rusage == FALSE || job->command_line == NULL)
+        return;
+
+    rusage_stats_basename(job->command_line, name);
+    key = name_key(name);
+    for(x = 0; x < GM_RUSAGE_PROBES; x++) {
+        entry = &stats[(key + x) % GM_RUSAGE_SLOTS];
+        if(entry->key == key)
+            break;
+        if(entry->key == 0 && __sync_bool_compare_and_swap(&entry->key, 0, key)) {
+            strcpy(entry->name, name);
+            break;
+        }
+        entry = NULL;
+    }
+    if(entry == NULL) {
+        gm_log( GM_LOG_DEBUG, "no free rusage statistics slot for %s\n", name);
+        return;
+    }
+
+    __sync_fetch_and_add(&entry->runs, 1);
+    __sync_fetch_and_add(&entry->cpu_usec, (uint64_t)job->rusage.ru_utime.tv_sec * 1000000 + job->rusage.ru_utime.tv_usec
+                                         + (uint64_t)job->rusage.ru_stime.tv_sec * 1000000 + job->rusage.ru_stime.tv_usec);
+    __sync_fetch_and_add(&entry->csw, (uint64_t)(job->rusage.ru_nvcsw + job->rusage.ru_nivcsw));
+    maxrss = job->rusage.ru_maxrss;
+    while((old = entry->maxrss) < maxrss && !__sync_bool_compare_and_swap(&entry->maxrss, old, maxrss))
+        ;
+
+    return;
+}
+
+
+/* append statistics of the most expensive commands to the status text */
+void rusage_stats_append_stats(char * result) {
+    rusage_stats_entry_t * sorted;
+    int x, num = 0, len;
+
+    if(stats == NULL)
+        return;
+
+    sorted = gm_malloc(sizeof(rusage_stats_entry_t) * GM_RUSAGE_SLOTS);
+    for(x = 0; x < GM_RUSAGE_SLOTS; x++) {
+        if(stats[x].key != 0 && stats[x].name[0] != '\x0')
+            sorted[num++] = stats[x];
+    }
+    qsort(sorted, num, sizeof(rusage_stats_entry_t), compare_cpu);
+
+    for(x = 0; x < num && x < GM_RUSAGE_TOP; x++) {
+        len = strlen(result);
+        snprintf(result+len, len < GM_BUFFERSIZE ? GM_BUFFERSIZE-len : 0, " '%s_runs'=%lluc '%s_cpu_ms'=%lluc '%s_maxrss'=%lluKB '%s_csw'=%lluc",
+                 sorted[x].name, (unsigned long long)sorted[x].runs,
+                 sorted[x].name, (unsigned long long)(sorted[x].cpu_usec / 1000),
+                 sorted[x].name, (unsigned long long)sorted[x].maxrss,
+                 sorted[x].name, (unsigned long long)sorted[x].csw);
+    }
+    free(sorted);
+
+    return;
+}
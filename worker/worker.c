@@ -26,6 +26,13 @@
 #include "worker.h"
 #include "utils.h"
 #include "worker_client.h"
+#include "broker.h"
+#include "icmp_engine.h"
+#include "result_cache.h"
+#include "result_spool.h"
+#include "rusage_stats.h"
+#include "plugin_cgroup.h"
+#include "plugin_modules.h"
 
 int current_number_of_workers                = 0;
 volatile sig_atomic_t current_number_of_jobs = 0;  /* must be signal safe */
@@ -141,6 +148,9 @@ int main (int argc, char **argv) {
 
     gm_log( GM_LOG_DEBUG, "main process started\n");
 
+    /* load plugin modules, all workers inherit them */
+    load_plugin_modules();
+
     /* start a single non forked standalone worker */
     if(mod_gm_opt->debug_level >= 10) {
         gm_log( GM_LOG_TRACE, "starting standalone worker\n");
@@ -154,10 +164,20 @@ int main (int argc, char **argv) {
 
     /* setup shared memory */
     setup_child_communicator();
+    result_cache_setup();
+    result_spool_setup();
+    rusage_stats_setup();
+    plugin_cgroup_setup();
 
     /* start status worker */
     make_new_child(GM_WORKER_STATUS);
 
+    /* start job and result broker */
+    start_broker();
+
+    /* start icmp engine */
+    start_icmp_engine();
+
     /* setup children */
     for(x=0; x < mod_gm_opt->min_worker; x++) {
         make_new_child(GM_WORKER_MULTI);
@@ -187,6 +207,26 @@ void monitor_loop() {
 }
 
 
+/* give back the per host slot held by a worker which is gone */
+static void release_worker_target_slot(int x) {
+    uint64_t * slots = (uint64_t *)(shm + SHM_TARGET_SHIFT);
+    uint64_t slot;
+    int indx = __sync_lock_test_and_set(&shm[SHM_OWNER_SHIFT + x - SHM_SHIFT], 0) - 1;
+
+    if(indx < 0 || indx >= SHM_TARGET_SLOTS)
+        return;
+
+    gm_log( GM_LOG_TRACE, "released per host slot %d of stale worker %d\n", indx, x);
+    do {
+        slot = slots[indx];
+        if((slot & 0xffffffff) == 0)
+            return;
+    } while(!__sync_bool_compare_and_swap(&slots[indx], slot, slot-1));
+
+    return;
+}
+
+
 /* count current worker and jobs */
 void count_current_worker(int restart) {
     int x;
@@ -208,6 +248,22 @@ void count_current_worker(int restart) {
     }
     gm_log( GM_LOG_TRACE3, "status worker: shm[SHM_STATUS_WORKER_PID] = %d\n", shm[SHM_STATUS_WORKER_PID]);
 
+    /* check if broker died */
+    if( shm[SHM_BROKER_PID] != -1 && pid_alive(shm[SHM_BROKER_PID]) == FALSE ) {
+        gm_log( GM_LOG_TRACE, "removed stale job broker, old pid: %d\n", shm[SHM_BROKER_PID] );
+        shm[SHM_BROKER_PID] = -1;
+    }
+    if( shm[SHM_RESULT_BROKER_PID] != -1 && pid_alive(shm[SHM_RESULT_BROKER_PID]) == FALSE ) {
+        gm_log( GM_LOG_TRACE, "removed stale result broker, old pid: %d\n", shm[SHM_RESULT_BROKER_PID] );
+        shm[SHM_RESULT_BROKER_PID] = -1;
+    }
+
+    /* check if icmp engine died */
+    if( shm[SHM_ICMP_ENGINE_PID] != -1 && pid_alive(shm[SHM_ICMP_ENGINE_PID]) == FALSE ) {
+        gm_log( GM_LOG_TRACE, "removed stale icmp engine, old pid: %d\n", shm[SHM_ICMP_ENGINE_PID] );
+        shm[SHM_ICMP_ENGINE_PID] = -1;
+    }
+
     /* check all known worker */
     current_number_of_workers = 0;
     current_number_of_jobs    = 0;
@@ -216,6 +272,7 @@ void count_current_worker(int restart) {
         gm_log( GM_LOG_TRACE3, "worker slot:   shm[%d] = %d\n", x, shm[x]);
         if( shm[x] != -1 && pid_alive(shm[x]) == FALSE ) {
             gm_log( GM_LOG_TRACE, "removed stale worker %d, old pid: %d\n", x, shm[x]);
+            release_worker_target_slot(x);
             shm[x] = -1;
             /* immediately start new worker, otherwise the fork rate cannot be guaranteed */
             if(restart == GM_ENABLED) {
@@ -242,14 +299,20 @@ void count_current_worker(int restart) {
 /* start new worker if needed */
 void check_worker_population() {
     int x, now, status, target_number_of_workers;
+    int exited = FALSE;
 
     gm_log( GM_LOG_TRACE3, "check_worker_population()\n");
 
     now = (int)time(NULL);
 
     /* collect finished workers */
-    while(waitpid(-1, &status, WNOHANG) > 0)
+    while(waitpid(-1, &status, WNOHANG) > 0) {
         gm_log( GM_LOG_TRACE, "waitpid() worker exited with: %d\n", status);
+        exited = TRUE;
+    }
+
+    /* killed workers leave their plugin cgroups behind */
+    plugin_cgroup_remove_stale(exited);
 
     /* set current worker number */
     count_current_worker(GM_ENABLED);
@@ -264,6 +327,7 @@ void check_worker_population() {
         sleep(3);
         for(x=SHM_SHIFT; x < mod_gm_opt->max_worker+SHM_SHIFT; x++) {
             save_kill(shm[x], SIGKILL);
+            release_worker_target_slot(x);
             shm[x] = -1;
         }
     }
@@ -273,6 +337,12 @@ void check_worker_population() {
         make_new_child(GM_WORKER_STATUS);
     }
 
+    /* check if broker died */
+    start_broker();
+
+    /* check if icmp engine died */
+    start_icmp_engine();
+
     /* keep up minimum population */
     for (x = current_number_of_workers; x < mod_gm_opt->min_worker; x++) {
         make_new_child(GM_WORKER_MULTI);
@@ -303,6 +373,15 @@ int make_new_child(int mode) {
     if(mode == GM_WORKER_STATUS) {
         gm_log( GM_LOG_TRACE, "forking status worker\n");
         next_shm_index = 3;
+    } else if(mode == GM_WORKER_BROKER) {
+        gm_log( GM_LOG_TRACE, "forking job broker\n");
+        next_shm_index = SHM_BROKER_PID;
+    } else if(mode == GM_WORKER_RESULT_BROKER) {
+        gm_log( GM_LOG_TRACE, "forking result broker\n");
+        next_shm_index = SHM_RESULT_BROKER_PID;
+    } else if(mode == GM_WORKER_ICMP_ENGINE) {
+        gm_log( GM_LOG_TRACE, "forking icmp engine\n");
+        next_shm_index = SHM_ICMP_ENGINE_PID;
     } else {
         gm_log( GM_LOG_TRACE, "forking worker\n");
         next_shm_index = get_next_shm_index();
@@ -348,6 +427,46 @@ int make_new_child(int mode) {
 }
 
 
+/* start job and result broker unless running */
+void start_broker() {
+    if(mod_gm_opt->broker_mode != GM_ENABLED)
+        return;
+
+    /* sockets must exist before the children are forked */
+    if(broker_setup() != GM_OK) {
+        gm_log( GM_LOG_ERROR, "disabled broker mode\n" );
+        mod_gm_opt->broker_mode = GM_DISABLED;
+        return;
+    }
+
+    if( shm[SHM_BROKER_PID] == -1 )
+        make_new_child(GM_WORKER_BROKER);
+    if( shm[SHM_RESULT_BROKER_PID] == -1 )
+        make_new_child(GM_WORKER_RESULT_BROKER);
+
+    return;
+}
+
+
+/* start icmp engine unless running */
+void start_icmp_engine() {
+    if(mod_gm_opt->icmp_engine != GM_ENABLED)
+        return;
+
+    /* socket must exist before the children are forked */
+    if(icmp_engine_setup() != GM_OK) {
+        gm_log( GM_LOG_ERROR, "disabled icmp engine\n" );
+        mod_gm_opt->icmp_engine = GM_DISABLED;
+        return;
+    }
+
+    if( shm[SHM_ICMP_ENGINE_PID] == -1 )
+        make_new_child(GM_WORKER_ICMP_ENGINE);
+
+    return;
+}
+
+
 /* parse command line arguments */
 int parse_arguments(int argc, char **argv) {
     int i;
@@ -381,6 +500,7 @@ int parse_arguments(int argc, char **argv) {
 
     /* close old logfile */
     if(mod_gm_opt->logfile_fp != NULL) {
+        gm_log_flush();
         fclose(mod_gm_opt->logfile_fp);
         mod_gm_opt->logfile_fp = NULL;
     }
@@ -462,6 +582,12 @@ int verify_options(mod_gm_opt_t *opt) {
         return(GM_ERROR);
     }
 
+    /* there is one slot per worker in the shared memory segment */
+    if(opt->max_worker > SHM_WORKER_SLOTS) {
+        gm_log( GM_LOG_ERROR, "max-worker %d exceeds the maximum of %d worker, using %d\n", opt->max_worker, SHM_WORKER_SLOTS, SHM_WORKER_SLOTS );
+        opt->max_worker = SHM_WORKER_SLOTS;
+    }
+
     if(opt->min_worker > opt->max_worker)
         opt->min_worker = opt->max_worker;
 
@@ -498,6 +624,8 @@ void print_usage() {
     printf("       --encryption=<yes|no>                        \n");
     printf("       --key=<string>                               \n");
     printf("       --keyfile=<file>                             \n");
+    printf("       --binary_transport=<yes|no>                  \n");
+    printf("       --compression_threshold=<bytes>              \n");
     printf("\n");
     printf("Job Control:\n");
     printf("       --hosts                                      \n");
@@ -508,6 +636,11 @@ void print_usage() {
     printf("       --servicegroup=<name>                        \n");
     printf("       --do_hostchecks                              \n");
     printf("       --max-age=<sec>                              \n");
+    printf("       --job_deadline=<sec>                         \n");
+    printf("       --target_limit=<nr>                          \n");
+    printf("       --target_limit_hostgroup=<name>:<nr>         \n");
+    printf("       --result_cache_ttl=<sec>                     \n");
+    printf("       --result_cache_command=<command>             \n");
     printf("       --timeout                                    \n");
     printf("\n");
     printf("Worker Control:\n");
@@ -521,6 +654,23 @@ void print_usage() {
     printf("       --load_limit5=load5                          \n");
     printf("       --load_limit15=load15                        \n");
     printf("       --show_error_output                          \n");
+    printf("       --result_batch_size=<nr>                     \n");
+    printf("       --result_batch_delay=<ms>                    \n");
+    printf("       --result_spool=<file>                        \n");
+    printf("       --result_spool_size=<mb>                     \n");
+    printf("       --plugin_rusage                              \n");
+    printf("       --cgroup_root=<dir>                          \n");
+    printf("       --cgroup_scope=<check|queue>                 \n");
+    printf("       --cgroup_cpu_weight=<weight>                 \n");
+    printf("       --cgroup_memory_max=<mb>                     \n");
+    printf("       --cgroup_pids_max=<nr>                       \n");
+    printf("       --broker_mode                                \n");
+    printf("       --job_backlog=<nr>                           \n");
+    printf("       --icmp_engine                                \n");
+    printf("       --icmp_command=<command>                     \n");
+    printf("       --plugin_module=<path>                       \n");
+    printf("       --plugin_isolation                           \n");
+    printf("       --builtin_checks                             \n");
     printf("\n");
 #ifdef EMBEDDEDPERL
     printf("Embedded Perl:\n");
@@ -565,9 +715,28 @@ void setup_child_communicator() {
     shm[SHM_WORKER_RUNNING]    = 0;   /* running worker    */
     shm[SHM_STATUS_WORKER_PID] = -1;  /* status worker pid */
     shm[SHM_WORKER_LAST_CHECK] = now; /* time of last check */
+    shm[SHM_BROKER_PID]        = -1;  /* job broker pid    */
+    shm[SHM_RESULT_BROKER_PID] = -1;  /* result broker pid */
+    shm[SHM_JOBS_THROTTLED]    = 0;   /* throttled jobs    */
+    shm[SHM_ICMP_ENGINE_PID]   = -1;  /* icmp engine pid   */
     for(x = 0; x < mod_gm_opt->max_worker; x++) {
         shm[x+SHM_SHIFT] = -1; /* normal worker   */
     }
+    for(x = 0; x < SHM_WORKER_SLOTS; x++) {
+        shm[x+SHM_OWNER_SHIFT] = 0; /* per host slot held by each worker */
+    }
+    for(x = 0; x < 2*SHM_TARGET_SLOTS; x++) {
+        shm[x+SHM_TARGET_SHIFT] = 0; /* running checks per host */
+    }
+    for(x = 0; x < 2*SHM_COMPRESS_SLOTS; x++) {
+        shm[x+SHM_COMPRESS_SHIFT] = 0; /* compression statistics */
+    }
+    for(x = 0; x < SHM_BULK_SLOTS; x++) {
+        shm[x+SHM_BULK_SHIFT] = 0; /* bulk job statistics */
+    }
+    for(x = 0; x < SHM_QUEUE_SLOTS; x++) {
+        shm[x+SHM_QUEUE_SHIFT] = 0; /* missed deadlines per queue */
+    }
 
     return;
 }
@@ -678,6 +847,9 @@ void stop_children(int mode) {
 
         gm_log( GM_LOG_TRACE, "send SIGTERM\n");
         save_kill(shm[SHM_STATUS_WORKER_PID], SIGTERM);
+        save_kill(shm[SHM_BROKER_PID], SIGTERM);
+        save_kill(shm[SHM_RESULT_BROKER_PID], SIGTERM);
+        save_kill(shm[SHM_ICMP_ENGINE_PID], SIGTERM);
         for(x=SHM_SHIFT; x < mod_gm_opt->max_worker+SHM_SHIFT; x++) {
             save_kill(shm[x], SIGTERM);
         }
@@ -707,6 +879,9 @@ void stop_children(int mode) {
 
         gm_log( GM_LOG_TRACE, "sending SIGINT...\n");
         save_kill(shm[SHM_STATUS_WORKER_PID], SIGINT);
+        save_kill(shm[SHM_BROKER_PID], SIGINT);
+        save_kill(shm[SHM_RESULT_BROKER_PID], SIGINT);
+        save_kill(shm[SHM_ICMP_ENGINE_PID], SIGINT);
         for(x=SHM_SHIFT; x < mod_gm_opt->max_worker+SHM_SHIFT; x++) {
             save_kill(shm[x], SIGINT);
         }
@@ -724,6 +899,9 @@ void stop_children(int mode) {
         if(current_number_of_workers == 0)
             return;
         save_kill(shm[SHM_STATUS_WORKER_PID], SIGKILL);
+        save_kill(shm[SHM_BROKER_PID], SIGKILL);
+        save_kill(shm[SHM_RESULT_BROKER_PID], SIGKILL);
+        save_kill(shm[SHM_ICMP_ENGINE_PID], SIGKILL);
         for(x=SHM_SHIFT; x < mod_gm_opt->max_worker+SHM_SHIFT; x++) {
             save_kill(shm[x], SIGKILL);
         }
@@ -817,10 +995,19 @@ void reload_config(int sig) {
      */
     stop_children(GM_WORKER_RESTART);
 
+    /* result cache, spool, plugin rusage and cgroups may have been enabled */
+    result_cache_setup();
+    result_spool_setup();
+    rusage_stats_setup();
+    plugin_cgroup_setup();
+
+    /* new plugin modules may have been added */
+    load_plugin_modules();
+
     /* start status worker */
     make_new_child(GM_WORKER_STATUS);
 
-    /* start normal worker */
+    /* start normal worker and broker */
     check_worker_population();
 
     gm_log( GM_LOG_INFO, "reloading config was successful\n");
@@ -28,6 +28,14 @@
 #include "utils.h"
 #include "check_utils.h"
 #include "gearman_utils.h"
+#include "broker.h"
+#include "result_cache.h"
+#include "result_spool.h"
+#include "rusage_stats.h"
+#include "plugin_cgroup.h"
+#include "icmp_engine.h"
+#include "plugin_modules.h"
+#include "gm_wire.h"
 #ifdef EMBEDDEDPERL
 #include "epn_utils.h"
 #endif
@@ -44,6 +52,15 @@ int sleep_time_after_error = 1;
 int worker_run_mode;
 int shm_index = 0;
 volatile sig_atomic_t shmid;
+int worker_created = FALSE;
+int client_created = FALSE;
+int job_running    = FALSE;
+const char * current_queue = NULL;
+char * current_workload = NULL;
+int current_workload_size = 0;
+int current_target_slot = GM_TARGET_UNTRACKED;
+int bulk_job_running = FALSE;
+int * target_shm = NULL;
 
 /* callback for task completed */
 #ifdef EMBEDDEDPERL
@@ -52,7 +69,10 @@ void worker_client(int worker_mode, int indx, int shid, char **env) {
 void worker_client(int worker_mode, int indx, int shid) {
 #endif
 
-    gm_log( GM_LOG_TRACE, "%s worker client started\n", (worker_mode == GM_WORKER_STATUS ? "status" : "job" ));
+    int use_worker = TRUE;
+    int use_client = TRUE;
+
+    gm_log( GM_LOG_TRACE, "%s worker client started\n", (worker_mode == GM_WORKER_STATUS ? "status" : (worker_mode == GM_WORKER_BROKER ? "broker" : (worker_mode == GM_WORKER_RESULT_BROKER ? "result broker" : (worker_mode == GM_WORKER_ICMP_ENGINE ? "icmp engine" : "job" )))));
 
     /* set signal handlers for a clean exit */
     signal(SIGINT, clean_worker_exit);
@@ -65,19 +85,73 @@ void worker_client(int worker_mode, int indx, int shid) {
 
     gethostname(hostname, GM_BUFFERSIZE-1);
 
+    /* in broker mode only the brokers talk to gearmand */
+    if(mod_gm_opt->broker_mode == GM_ENABLED) {
+        if(worker_mode == GM_WORKER_MULTI) {
+            use_worker = FALSE;
+            use_client = FALSE;
+        }
+        else if(worker_mode == GM_WORKER_BROKER) {
+            use_client = FALSE;
+        }
+        else if(worker_mode == GM_WORKER_RESULT_BROKER) {
+            use_worker = FALSE;
+        }
+    }
+
+    /* the icmp engine only talks to the children */
+    if(worker_mode == GM_WORKER_ICMP_ENGINE) {
+        use_worker = FALSE;
+        use_client = FALSE;
+    }
+
     /* create worker */
-    if(set_worker(&worker) != GM_OK) {
-        gm_log( GM_LOG_ERROR, "cannot start worker\n" );
+    if(use_worker == TRUE) {
+        if(set_worker(&worker) != GM_OK) {
+            gm_log( GM_LOG_ERROR, "cannot start worker\n" );
+            clean_worker_exit(0);
+            _exit( EXIT_FAILURE );
+        }
+        worker_created = TRUE;
+    }
+
+    /* create client */
+    if(use_client == TRUE && create_result_clients() != GM_OK) {
         clean_worker_exit(0);
         _exit( EXIT_FAILURE );
     }
 
-    /* create client */
+#ifdef EMBEDDEDPERL
+    if(init_embedded_perl(env) == GM_ERROR) {
+        _exit( EXIT_FAILURE );
+    }
+#endif
+
+    if(worker_run_mode == GM_WORKER_RESULT_BROKER) {
+        broker_result_loop();
+    }
+    else if(worker_run_mode == GM_WORKER_ICMP_ENGINE) {
+        icmp_engine_loop();
+    }
+    else if(use_worker == FALSE) {
+        result_payload_hook = broker_result_hook;
+        broker_worker_loop();
+    }
+    else {
+        worker_loop();
+    }
+
+    return;
+}
+
+
+/* create the clients to send back results */
+int create_result_clients() {
     if ( create_client( mod_gm_opt->server_list, &client ) != GM_OK ) {
         gm_log( GM_LOG_ERROR, "cannot start client\n" );
-        clean_worker_exit(0);
-        _exit( EXIT_FAILURE );
+        return GM_ERROR;
     }
+    client_created = TRUE;
 
     /* create duplicate client */
     if( mod_gm_opt->dupserver_num ) {
@@ -87,20 +161,39 @@ void worker_client(int worker_mode, int indx, int shid) {
         }
     }
 
-#ifdef EMBEDDEDPERL
-    if(init_embedded_perl(env) == GM_ERROR) {
-        _exit( EXIT_FAILURE );
-    }
-#endif
+    return GM_OK;
+}
 
-    worker_loop();
 
-    return;
+/* hand results over to the result broker, send them directly if that fails */
+int broker_result_hook(char * queue, char * data, char * dup_data) {
+    if(broker_send_result(queue, data, dup_data) == GM_OK)
+        return GM_OK;
+
+    /* the result is spooled by the caller if there is no client to send it */
+    if(client_created == FALSE && create_result_clients() != GM_OK)
+        gm_log( GM_LOG_ERROR, "result broker unavailable and no gearmand client, cannot send result directly\n" );
+
+    return GM_ERROR;
+}
+
+
+/* milliseconds until batched results have to be sent, timed out plugins have to be killed or spooled results have to be sent again */
+static int next_wakeup(void) {
+    int batch_ms = mod_gm_opt->result_batch_size > 1 ? result_batch_timeout() : -1;
+    int kill_ms  = reap_timed_out_checks(FALSE);
+
+    if(batch_ms < 0 || (kill_ms >= 0 && kill_ms < batch_ms))
+        batch_ms = kill_ms;
+    if(result_spool_pending() && (batch_ms < 0 || batch_ms > GM_RESULT_SPOOL_RETRY))
+        batch_ms = GM_RESULT_SPOOL_RETRY;
+    return batch_ms;
 }
 
 
 /* main loop of jobs */
 void worker_loop() {
+    int wakeup = -1;
 
     while ( 1 ) {
         gearman_return_t ret;
@@ -111,22 +204,47 @@ void worker_loop() {
             alarm(mod_gm_opt->idle_timeout);
         }
 
+        /* wake up in time to send batched results and to kill timed out plugins */
+        if(worker_run_mode != GM_WORKER_BROKER) {
+            wakeup = next_wakeup();
+            gearman_worker_set_timeout( &worker, wakeup );
+        }
+
+        /* fetch jobs only when a child can take them */
+        if(worker_run_mode == GM_WORKER_BROKER)
+            broker_dispatch(&worker);
+
         signal(SIGPIPE, SIG_IGN);
+        gm_log_flush();
         ret = gearman_worker_work( &worker );
 
+        if(mod_gm_opt->result_batch_size > 1 && result_batch_timeout() == 0)
+            flush_result_batch();
+        update_compression_stats();
+
+        /* gearmand is back, send results which could not be sent before */
+        if(ret == GEARMAN_SUCCESS || ret == GEARMAN_TIMEOUT)
+            result_spool_replay();
+
         if (mod_gm_opt->max_jobs > 0 && jobs_done >= mod_gm_opt->max_jobs) {
             gm_log( GM_LOG_TRACE, "jobs done: %i -> exiting...\n", jobs_done );
             clean_worker_exit(0);
             _exit( EXIT_SUCCESS );
         }
 
+        if ( ret == GEARMAN_TIMEOUT && ( mod_gm_opt->result_batch_size > 1 || worker_run_mode == GM_WORKER_BROKER || wakeup >= 0 )) {
+            continue;
+        }
+
         if ( ret != GEARMAN_SUCCESS ) {
             gm_log( GM_LOG_ERROR, "worker error: %s\n", gearman_worker_error( &worker ) );
             gearman_job_free_all( &worker );
             gearman_worker_free( &worker );
-            gearman_client_free( &client );
-            if( mod_gm_opt->dupserver_num )
-                gearman_client_free( &client_dup );
+            if(client_created == TRUE) {
+                gearman_client_free( &client );
+                if( mod_gm_opt->dupserver_num )
+                    gearman_client_free( &client_dup );
+            }
 
             /* sleep on error to avoid cpu intensive infinite loops */
             sleep(sleep_time_after_error);
@@ -136,9 +254,49 @@ void worker_loop() {
 
             /* create new connections */
             set_worker( &worker );
-            create_client( mod_gm_opt->server_list, &client );
-            if( mod_gm_opt->dupserver_num )
-                create_client_dup( mod_gm_opt->dupserver_list, &client_dup );
+            if(client_created == TRUE) {
+                create_client( mod_gm_opt->server_list, &client );
+                if( mod_gm_opt->dupserver_num )
+                    create_client_dup( mod_gm_opt->dupserver_list, &client_dup );
+            }
+        }
+    }
+
+    return;
+}
+
+
+/* main loop of jobs passed by the job broker */
+void broker_worker_loop() {
+    char * buf = gm_malloc(GM_BROKER_MAX_MESSAGE+1);
+    char * handle;
+    char * queue;
+    char * workload;
+    int wsize;
+
+    while ( 1 ) {
+        /* wait for a job, otherwise exit when hit the idle timeout */
+        if(mod_gm_opt->idle_timeout > 0) {
+            signal(SIGALRM, idle_sighandler);
+            alarm(mod_gm_opt->idle_timeout);
+        }
+
+        signal(SIGPIPE, SIG_IGN);
+        broker_announce_idle();
+        gm_log_flush();
+
+        if(broker_recv_job(buf, &handle, &queue, &workload, &wsize, next_wakeup()) == GM_OK)
+            process_job(NULL, workload, wsize, queue, handle);
+
+        if(mod_gm_opt->result_batch_size > 1 && result_batch_timeout() == 0)
+            flush_result_batch();
+        update_compression_stats();
+
+        if (mod_gm_opt->max_jobs > 0 && jobs_done >= mod_gm_opt->max_jobs) {
+            gm_log( GM_LOG_TRACE, "jobs done: %i -> exiting...\n", jobs_done );
+            free(buf);
+            clean_worker_exit(0);
+            _exit( EXIT_SUCCESS );
         }
     }
 
@@ -148,15 +306,43 @@ void worker_loop() {
 
 /* get a job */
 void *get_job( gearman_job_st *job, void *context, size_t *result_size, gearman_return_t *ret_ptr ) {
-    sigset_t block_mask;
-    int wsize, valid_lines;
+    int wsize;
     char * workload;
+
+    gm_log( GM_LOG_TRACE, "get_job()\n" );
+
+    /* contect is unused */
+    context = context;
+
+    /* set size of result */
+    *result_size = 0;
+
+    /* get the data */
+    wsize = gearman_job_workload_size(job);
+    workload = gm_malloc(wsize+1);
+    memcpy(workload, gearman_job_workload(job), wsize);
+    workload[wsize] = '\0';
+
+    if(process_job(job, workload, wsize, gearman_job_function_name( job ), gearman_job_handle( job )) == GM_OK)
+        *ret_ptr = GEARMAN_SUCCESS;
+    else
+        *ret_ptr = GEARMAN_WORK_FAIL;
+
+    free(workload);
+    return NULL;
+}
+
+
+/* decrypt and run a job */
+int process_job( gearman_job_st *job, char * workload, int wsize, const char * queue, const char * handle ) {
+    sigset_t block_mask;
+    int valid_lines;
     char * decrypted_data;
     char * decrypted_data_c;
     char * decrypted_orig;
-    char *ptr;
     int is_notification_job = FALSE;
     int is_eventhandler_job = FALSE;
+    int accept_compressed   = GM_DISABLED;
 
     /* reset timeout for now, will be set befor execution again */
     alarm(0);
@@ -167,14 +353,6 @@ void *get_job( gearman_job_st *job, void *context, size_t *result_size, gearman_
     /* send start signal to parent */
     set_state(GM_JOB_START);
 
-    gm_log( GM_LOG_TRACE, "get_job()\n" );
-
-    /* contect is unused */
-    context = context;
-
-    /* set size of result */
-    *result_size = 0;
-
     /* reset sleep time */
     sleep_time_after_error = 1;
 
@@ -185,93 +363,35 @@ void *get_job( gearman_job_st *job, void *context, size_t *result_size, gearman_
 
     /* get the data */
     current_gearman_job = job;
-    wsize = gearman_job_workload_size(job);
-    workload = gm_malloc(sizeof(char*)*wsize+1);
-    strncpy(workload, (const char*)gearman_job_workload(job), wsize);
-    workload[wsize] = '\0';
-    gm_log( GM_LOG_TRACE, "got new job %s\n", gearman_job_handle( job ) );
-    gm_log( GM_LOG_TRACE, "%d +++>\n%s\n<+++\n", strlen(workload), workload );
+    current_queue       = queue;
+    current_workload    = workload;
+    current_workload_size = wsize;
+    job_running         = TRUE;
+    gm_log( GM_LOG_TRACE, "got new job %s\n", handle );
+    gm_log( GM_LOG_TRACE, "%d +++>\n%s\n<+++\n", wsize, workload );
 
     /* decrypt data */
     decrypted_data = gm_malloc(wsize*2);
+    mod_gm_decrypt(&decrypted_data, workload, wsize, mod_gm_opt->transportmode);
     decrypted_data_c = decrypted_data;
-    mod_gm_decrypt(&decrypted_data, workload, mod_gm_opt->transportmode);
     decrypted_orig = gm_strdup(decrypted_data);
-    free(workload);
 
     if(decrypted_data == NULL) {
-        *ret_ptr = GEARMAN_WORK_FAIL;
+        current_gearman_job = NULL;
+        job_running         = FALSE;
         free(decrypted_orig);
-        return NULL;
+        return GM_ERROR;
     }
     gm_log( GM_LOG_TRACE, "%d --->\n%s\n<---\n", strlen(decrypted_data), decrypted_data );
 
-    /* set result pointer to success */
-    *ret_ptr= GEARMAN_SUCCESS;
-
     exec_job = ( gm_job_t * )gm_malloc( sizeof *exec_job );
     set_default_job(exec_job, mod_gm_opt);
 
-    valid_lines = 0;
-    while ( (ptr = strsep(&decrypted_data, "\n" )) != NULL ) {
-        char *key   = strsep( &ptr, "=" );
-        char *value = strsep( &ptr, "\x0" );
+    valid_lines = parse_job(&decrypted_data, exec_job, &accept_compressed);
 
-        if ( key == NULL )
-            continue;
-
-        if ( value == NULL || !strcmp( value, "") )
-            break;
-
-        if ( !strcmp( key, "host_name" ) ) {
-            exec_job->host_name = gm_strdup(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "service_description" ) ) {
-            exec_job->service_description = gm_strdup(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "type" ) ) {
-            exec_job->type = gm_strdup(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "result_queue" ) ) {
-            exec_job->result_queue = gm_strdup(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "check_options" ) ) {
-            exec_job->check_options = atoi(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "scheduled_check" ) ) {
-            exec_job->scheduled_check = atoi(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "reschedule_check" ) ) {
-            exec_job->reschedule_check = atoi(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "latency" ) ) {
-            exec_job->latency = atof(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "next_check" ) ) {
-            string2timeval(value, &exec_job->next_check);
-            valid_lines++;
-        } else if ( !strcmp( key, "start_time" ) ) {
-            /* for compatibility reasons... (used by older mod-gearman neb modules) */
-            string2timeval(value, &exec_job->next_check);
-            string2timeval(value, &exec_job->core_time);
-            valid_lines++;
-        } else if ( !strcmp( key, "core_time" ) ) {
-            string2timeval(value, &exec_job->core_time);
-            valid_lines++;
-        } else if ( !strcmp( key, "timeout" ) ) {
-            exec_job->timeout = atoi(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "command_line" ) ) {
-            exec_job->command_line = gm_strdup(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "plugin_output" ) ) {
-            exec_job->output = gm_strdup(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "long_plugin_output" ) ) {
-            exec_job->long_output = gm_strdup(value);
-            valid_lines++;
-        }
-    }
+    /* the core announces that it can read compressed results */
+    if(accept_compressed == GM_ENABLED && exec_job->result_queue != NULL && mod_gm_opt->compression_threshold > 0)
+        accept_compressed_results(exec_job->result_queue);
 
 #ifdef GM_DEBUG
     if(exec_job->next_check.tv_sec < 10000)
@@ -307,12 +427,15 @@ void *get_job( gearman_job_st *job, void *context, size_t *result_size, gearman_
         free(exec_job->output);
 
     if(valid_lines == 0) {
-        gm_log( GM_LOG_ERROR, "discarded invalid job (%s), check your encryption settings\n", gearman_job_handle( job ) );
+        gm_log( GM_LOG_ERROR, "discarded invalid job (%s), check your encryption settings\n", handle );
+    } else if(has_next_job(&decrypted_data)) {
+        do_exec_bulk_job(&decrypted_data);
     } else {
         do_exec_job();
     }
 
     current_gearman_job = NULL;
+    job_running         = FALSE;
 
     /* start listening to SIGTERMs */
     sigprocmask(SIG_UNBLOCK, &block_mask, NULL);
@@ -346,13 +469,166 @@ void *get_job( gearman_job_st *job, void *context, size_t *result_size, gearman_
     /* send finish signal to parent */
     set_state(GM_JOB_END);
 
-    return NULL;
+    return GM_OK;
+}
+
+
+/* parse the next job of a payload, returns the number of known attributes */
+int parse_job(char ** data, gm_job_t * job, int * accept_compressed) {
+    char *key;
+    char *value;
+    int valid_lines = 0;
+
+    while ( gm_wire_next(data, &key, &value) ) {
+        if ( key == NULL )
+            continue;
+
+        /* an empty line terminates this job */
+        if ( value == NULL && !strcmp( key, "" ) )
+            break;
+
+        if ( value == NULL || !strcmp( value, "") )
+            continue;
+
+        if ( !strcmp( key, "host_name" ) ) {
+            job->host_name = gm_strdup(value);
+            valid_lines++;
+        } else if ( !strcmp( key, "service_description" ) ) {
+            job->service_description = gm_strdup(value);
+            valid_lines++;
+        } else if ( !strcmp( key, "type" ) ) {
+            job->type = gm_strdup(value);
+            valid_lines++;
+        } else if ( !strcmp( key, "result_queue" ) ) {
+            job->result_queue = gm_strdup(value);
+            valid_lines++;
+        } else if ( !strcmp( key, "check_options" ) ) {
+            job->check_options = atoi(value);
+            valid_lines++;
+        } else if ( !strcmp( key, "scheduled_check" ) ) {
+            job->scheduled_check = atoi(value);
+            valid_lines++;
+        } else if ( !strcmp( key, "reschedule_check" ) ) {
+            job->reschedule_check = atoi(value);
+            valid_lines++;
+        } else if ( !strcmp( key, "latency" ) ) {
+            job->latency = atof(value);
+            valid_lines++;
+        } else if ( !strcmp( key, "next_check" ) ) {
+            string2timeval(value, &job->next_check);
+            valid_lines++;
+        } else if ( !strcmp( key, "start_time" ) ) {
+            /* for compatibility reasons... (used by older mod-gearman neb modules) */
+            string2timeval(value, &job->next_check);
+            string2timeval(value, &job->core_time);
+            valid_lines++;
+        } else if ( !strcmp( key, "core_time" ) ) {
+            string2timeval(value, &job->core_time);
+            valid_lines++;
+        } else if ( !strcmp( key, "timeout" ) ) {
+            job->timeout = atof(value);
+            valid_lines++;
+        } else if ( !strcmp( key, "command_line" ) ) {
+            job->command_line = gm_strdup(value);
+            valid_lines++;
+        } else if ( !strcmp( key, "plugin_output" ) ) {
+            job->output = gm_strdup(value);
+            valid_lines++;
+        } else if ( !strcmp( key, "long_plugin_output" ) ) {
+            job->long_output = gm_strdup(value);
+            valid_lines++;
+        } else if ( !strcmp( key, "accept_compressed" ) ) {
+            *accept_compressed = parse_yes_or_no(value, GM_DISABLED);
+        } else if ( !strcmp( key, "direct_result" ) ) {
+            job->direct_result = parse_yes_or_no(value, GM_DISABLED);
+        } else if ( !strcmp( key, "ondemand" ) ) {
+            job->ondemand = parse_yes_or_no(value, GM_DISABLED);
+        }
+    }
+
+    return valid_lines;
+}
+
+
+/* skip the empty lines after a job, returns TRUE if another job follows */
+int has_next_job(char ** data) {
+    while(*data != NULL && **data == '\n')
+        (*data)++;
+    return(*data != NULL && **data != '\x0');
+}
+
+
+/* answer a check of a bulk job which cannot be run */
+static void reject_bulk_check(void) {
+    gm_log( GM_LOG_ERROR, "discarded invalid check in bulk job\n" );
+
+    if(exec_job->host_name == NULL)
+        return;
+    if(exec_job->type == NULL)
+        exec_job->type = gm_strdup(exec_job->service_description != NULL ? "service" : "host");
+
+    gettimeofday(&exec_job->start_time, NULL);
+    exec_job->finish_time = exec_job->start_time;
+    exec_job->return_code = STATE_UNKNOWN;
+    free(exec_job->output);
+    exec_job->output = gm_strdup("UNKNOWN - invalid check in bulk job");
+    send_result_back(exec_job);
+
+    return;
+}
+
+
+/* run all checks of a bulk job one after another, each result is sent as soon as its check finished */
+void do_exec_bulk_job(char ** data) {
+    int *shm;
+    int accept_compressed = GM_DISABLED;
+    int checks = 0;
+
+    gm_log( GM_LOG_TRACE, "do_exec_bulk_job()\n" );
+
+    set_bulk_results(TRUE);
+    bulk_job_running = TRUE;
+    while(1) {
+        /* a broken check must not cost the results of the following ones */
+        if(exec_job->type == NULL || exec_job->command_line == NULL)
+            reject_bulk_check();
+        else
+            do_exec_job();
+        checks++;
+        if(!has_next_job(data))
+            break;
+
+        free_job(exec_job);
+        exec_job = ( gm_job_t * )gm_malloc( sizeof *exec_job );
+        set_default_job(exec_job, mod_gm_opt);
+        parse_job(data, exec_job, &accept_compressed);
+        if(exec_job->output != NULL) {
+            free(exec_job->output);
+            exec_job->output = NULL;
+        }
+    }
+    bulk_job_running = FALSE;
+    set_bulk_results(FALSE);
+
+    gm_log( GM_LOG_DEBUG, "finished bulk job with %d checks\n", checks );
+    if(worker_run_mode == GM_WORKER_STANDALONE)
+        return;
+    if ((shm = shmat(shmid, NULL, 0)) == (int *) -1) {
+        perror("shmat");
+        return;
+    }
+    __sync_fetch_and_add(&shm[SHM_BULK_SHIFT+SHM_BULK_JOBS], 1);
+    __sync_fetch_and_add(&shm[SHM_BULK_SHIFT+SHM_BULK_CHECKS], checks);
+    if(shmdt(shm) < 0)
+        perror("shmdt");
+
+    return;
 }
 
 
 /* do some job */
 void do_exec_job( ) {
-    struct timeval start_time, end_time;
+    struct timeval start_time;
     int latency, age;
 
     gm_log( GM_LOG_TRACE, "do_exec_job()\n" );
@@ -390,12 +666,10 @@ void do_exec_job( ) {
     latency = start_time.tv_sec - exec_job->next_check.tv_sec;
     age     = start_time.tv_sec - exec_job->core_time.tv_sec;
 
-    gm_log( GM_LOG_TRACE, "timeout: %i, core latency: %i\n", exec_job->timeout, latency);
+    gm_log( GM_LOG_TRACE, "timeout: %g, core latency: %i\n", exec_job->timeout, latency);
 
     /* job is too old */
     if(mod_gm_opt->max_age > 0 && age > mod_gm_opt->max_age) {
-        exec_job->return_code   = 3;
-
         if ( !strcmp( exec_job->type, "service" ) ) {
             gm_log( GM_LOG_INFO, "discarded too old %s job: %i > %i (%s - %s)\n", exec_job->type, (int)age, mod_gm_opt->max_age, exec_job->host_name, exec_job->service_description);
         } else if ( !strcmp( exec_job->type, "host" ) ) {
@@ -403,27 +677,80 @@ void do_exec_job( ) {
         } else {
             gm_log( GM_LOG_INFO, "discarded too old %s job: %i > %i\n", exec_job->type, (int)age, mod_gm_opt->max_age);
         }
+        discard_job();
+        return;
+    }
 
-        gettimeofday(&end_time, NULL);
-        exec_job->finish_time = end_time;
-
-        if ( !strcmp( exec_job->type, "service" ) || !strcmp( exec_job->type, "host" ) ) {
-            exec_job->output = gm_strdup("(Could Not Start Check In Time)");
-            send_result_back(exec_job);
+    /* job cannot meet its deadline anymore */
+    if(mod_gm_opt->job_deadline > 0 && exec_job->next_check.tv_sec > 0 && latency > mod_gm_opt->job_deadline) {
+        if ( !strcmp( exec_job->type, "service" ) ) {
+            gm_log( GM_LOG_INFO, "discarded %s job, missed deadline by %is (%s - %s)\n", exec_job->type, latency - mod_gm_opt->job_deadline, exec_job->host_name, exec_job->service_description);
+        } else if ( !strcmp( exec_job->type, "host" ) ) {
+            gm_log( GM_LOG_INFO, "discarded %s job, missed deadline by %is (%s)\n", exec_job->type, latency - mod_gm_opt->job_deadline, exec_job->host_name);
+        } else {
+            gm_log( GM_LOG_INFO, "discarded %s job, missed deadline by %is\n", exec_job->type, latency - mod_gm_opt->job_deadline);
         }
-
+        discard_job();
         return;
     }
 
     exec_job->early_timeout = 0;
 
+    /* reuse the result of an identical command line */
+    if(result_cache_lookup(exec_job) == GM_OK) {
+        send_result_back(exec_job);
+        return;
+    }
+
+    /* limit concurrent checks against the same host */
+    if ( exec_job->host_name != NULL && ( !strcmp( exec_job->type, "service" ) || !strcmp( exec_job->type, "host" ) ) ) {
+        current_target_slot = acquire_target_slot(exec_job->host_name, get_target_limit(current_queue));
+        if(current_target_slot == GM_TARGET_THROTTLED) {
+            current_target_slot = GM_TARGET_UNTRACKED;
+            /* checks of a bulk job cannot be put back one by one and
+             * direct results have to be returned by the original job */
+            if(bulk_job_running == FALSE && exec_job->direct_result == FALSE) {
+                requeue_job();
+                return;
+            }
+        }
+    }
+
     /* run the command */
     gm_log( GM_LOG_TRACE, "command: %s\n", exec_job->command_line);
     current_job = exec_job;
-    execute_safe_command(exec_job, mod_gm_opt->fork_on_exec, mod_gm_opt->identifier );
+    if(icmp_engine_check(exec_job) != GM_OK) {
+        plugin_cgroup_prepare(current_queue);
+        execute_safe_command(exec_job, mod_gm_opt->fork_on_exec, mod_gm_opt->identifier );
+    }
     current_job = NULL;
 
+    release_target_slot(current_target_slot);
+    current_target_slot = GM_TARGET_UNTRACKED;
+
+    result_cache_store(exec_job);
+
+    if ( !strcmp( exec_job->type, "service" ) || !strcmp( exec_job->type, "host" ) ) {
+        send_result_back(exec_job);
+    }
+
+    return;
+}
+
+
+/* answer a job which cannot be started in time */
+void discard_job() {
+    struct timeval end_time;
+
+    exec_job->return_code = 3;
+
+    gettimeofday(&end_time, NULL);
+    exec_job->finish_time = end_time;
+
+    count_missed_deadline(current_queue);
+
     if ( !strcmp( exec_job->type, "service" ) || !strcmp( exec_job->type, "host" ) ) {
+        exec_job->output = gm_strdup("(Could Not Start Check In Time)");
         send_result_back(exec_job);
     }
 
@@ -431,6 +758,232 @@ void do_exec_job( ) {
 }
 
 
+/* get index of a queue in the per queue shm counters */
+int get_queue_index(const char * queue) {
+    int x, indx = 0;
+
+    if(queue == NULL)
+        return -1;
+
+    if(mod_gm_opt->hosts == GM_ENABLED && !strcmp(queue, "host"))
+        return indx;
+    indx++;
+    if(mod_gm_opt->services == GM_ENABLED && !strcmp(queue, "service"))
+        return indx;
+    indx++;
+    if(mod_gm_opt->events == GM_ENABLED && !strcmp(queue, "eventhandler"))
+        return indx;
+    indx++;
+    if(mod_gm_opt->notifications == GM_ENABLED && !strcmp(queue, "notification"))
+        return indx;
+    indx++;
+
+    if(!strncmp(queue, "hostgroup_", 10)) {
+        x = gm_hash_get(mod_gm_opt->hostgroups_index, queue+10, -1);
+        if(x >= 0 && indx + x < SHM_QUEUE_SLOTS)
+            return indx + x;
+        return -1;
+    }
+    indx += mod_gm_opt->hostgroups_num;
+
+    if(!strncmp(queue, "servicegroup_", 13)) {
+        x = gm_hash_get(mod_gm_opt->servicegroups_index, queue+13, -1);
+        if(x >= 0 && indx + x < SHM_QUEUE_SLOTS)
+            return indx + x;
+    }
+
+    return -1;
+}
+
+
+/* count a missed deadline for the given queue */
+void count_missed_deadline(const char * queue) {
+    int *shm;
+    int indx = get_queue_index(queue);
+
+    if(worker_run_mode == GM_WORKER_STANDALONE || indx < 0)
+        return;
+
+    if ((shm = shmat(shmid, NULL, 0)) == (int *) -1) {
+        perror("shmat");
+        return;
+    }
+
+    shm[SHM_QUEUE_SHIFT+indx]++;
+
+    if(shmdt(shm) < 0)
+        perror("shmdt");
+
+    return;
+}
+
+
+/* add the compression statistics of this process to the shared memory */
+void update_compression_stats() {
+    static gm_wire_stats_t reported;
+    gm_wire_stats_t current = gm_wire_stats;
+    uint64_t * counter;
+    int *shm;
+
+    if(worker_run_mode == GM_WORKER_STANDALONE || (current.compressed == reported.compressed && current.usec == reported.usec))
+        return;
+
+    if ((shm = shmat(shmid, NULL, 0)) == (int *) -1) {
+        perror("shmat");
+        return;
+    }
+
+    counter = (uint64_t *)(shm + SHM_COMPRESS_SHIFT);
+    __sync_fetch_and_add(&counter[SHM_COMPRESSED],     current.compressed       - reported.compressed);
+    __sync_fetch_and_add(&counter[SHM_COMPRESS_RAW],   current.raw_bytes        - reported.raw_bytes);
+    __sync_fetch_and_add(&counter[SHM_COMPRESS_BYTES], current.compressed_bytes - reported.compressed_bytes);
+    __sync_fetch_and_add(&counter[SHM_COMPRESS_USEC],  current.usec             - reported.usec);
+    reported = current;
+
+    if(shmdt(shm) < 0)
+        perror("shmdt");
+
+    return;
+}
+
+
+/* get max number of concurrent checks per host for a queue */
+int get_target_limit(const char * queue) {
+    if(queue != NULL && !strncmp(queue, "hostgroup_", 10))
+        return gm_hash_get(mod_gm_opt->target_limit_hostgroups, queue+10, mod_gm_opt->target_limit);
+
+    return mod_gm_opt->target_limit;
+}
+
+
+/* remember the per host slot of this worker, so the parent can give it back if we get killed */
+static int set_target_slot_owner(int indx) {
+    if(shm_index >= SHM_SHIFT && shm_index < SHM_SHIFT + SHM_WORKER_SLOTS)
+        target_shm[SHM_OWNER_SHIFT + shm_index - SHM_SHIFT] = indx + 1;
+    return indx;
+}
+
+
+/* take a slot from the per host counters, waits a moment when all slots are in use */
+int acquire_target_slot(const char * host_name, int limit) {
+    uint64_t * slots;
+    uint64_t key = 5381;
+    const char * c;
+    int x, wait;
+
+    if(limit <= 0 || worker_run_mode == GM_WORKER_STANDALONE)
+        return GM_TARGET_UNTRACKED;
+
+    if(target_shm == NULL) {
+        if ((target_shm = shmat(shmid, NULL, 0)) == (int *) -1) {
+            perror("shmat");
+            target_shm = NULL;
+            return GM_TARGET_UNTRACKED;
+        }
+    }
+    slots = (uint64_t *)(target_shm + SHM_TARGET_SHIFT);
+
+    /* each slot holds the host hash in the upper and the running checks in the lower 32 bit */
+    for(c = host_name; *c != '\x0'; c++)
+        key = ((key << 5) + key + (unsigned char)*c) & 0xffffffff;
+    if(key == 0)
+        key = 1;
+
+    for(wait = 0; wait <= GM_TARGET_WAIT; wait += GM_TARGET_WAIT_STEP) {
+        int found = -1, empty = -1;
+        for(x = 0; x < SHM_TARGET_PROBES; x++) {
+            int indx = (key + x) % SHM_TARGET_SLOTS;
+            uint64_t slot = slots[indx];
+            if(slot >> 32 == key) {
+                found = indx;
+                break;
+            }
+            if(empty == -1 && (slot & 0xffffffff) == 0)
+                empty = indx;
+        }
+
+        if(found != -1) {
+            uint64_t slot = slots[found];
+            if(slot >> 32 == key && (slot & 0xffffffff) < (uint64_t)limit) {
+                if(__sync_bool_compare_and_swap(&slots[found], slot, slot+1))
+                    return set_target_slot_owner(found);
+                wait -= GM_TARGET_WAIT_STEP;
+                continue;
+            }
+        }
+        else if(empty != -1) {
+            uint64_t slot = slots[empty];
+            if((slot & 0xffffffff) == 0 && __sync_bool_compare_and_swap(&slots[empty], slot, (key << 32) | 1))
+                return set_target_slot_owner(empty);
+            wait -= GM_TARGET_WAIT_STEP;
+            continue;
+        }
+        else {
+            /* no free slot, run without limit */
+            return GM_TARGET_UNTRACKED;
+        }
+
+        usleep(GM_TARGET_WAIT_STEP * 1000);
+    }
+
+    gm_log( GM_LOG_DEBUG, "too many concurrent checks for host %s, limit is %d\n", host_name, limit );
+    __sync_fetch_and_add(&target_shm[SHM_JOBS_THROTTLED], 1);
+
+    return GM_TARGET_THROTTLED;
+}
+
+
+/* give back a slot of the per host counters */
+void release_target_slot(int indx) {
+    uint64_t * slots;
+    uint64_t slot;
+
+    if(indx < 0 || target_shm == NULL)
+        return;
+
+    /* a slot is counted once, either here or by the parent */
+    if(shm_index >= SHM_SHIFT && shm_index < SHM_SHIFT + SHM_WORKER_SLOTS
+       && __sync_lock_test_and_set(&target_shm[SHM_OWNER_SHIFT + shm_index - SHM_SHIFT], 0) != indx + 1)
+        return;
+
+    slots = (uint64_t *)(target_shm + SHM_TARGET_SHIFT);
+    do {
+        slot = slots[indx];
+        if((slot & 0xffffffff) == 0)
+            return;
+    } while(!__sync_bool_compare_and_swap(&slots[indx], slot, slot-1));
+
+    return;
+}
+
+
+/* put a throttled job back into its queue */
+void requeue_job() {
+    gm_log( GM_LOG_TRACE, "requeue_job(%s)\n", current_queue );
+
+    if(current_queue == NULL || current_workload == NULL)
+        return;
+
+    if(client_created == FALSE && create_result_clients() != GM_OK)
+        return;
+
+    if(add_encoded_job_to_queue( &client,
+                                 mod_gm_opt->server_list,
+                                 (char *)current_queue,
+                                 NULL,
+                                 current_workload,
+                                 current_workload_size,
+                                 GM_JOB_PRIO_LOW,
+                                 GM_DEFAULT_JOB_RETRIES,
+                                 TRUE
+                                ) != GM_OK) {
+        gm_log( GM_LOG_ERROR, "failed to requeue throttled job for host %s\n", exec_job->host_name );
+    }
+
+    return;
+}
+
+
 /* create the worker */
 int set_worker( gearman_worker_st *w ) {
     int x = 0;
@@ -446,23 +999,27 @@ int set_worker( gearman_worker_st *w ) {
         worker_add_function( w, status_queue, return_status );
     }
     else {
-        /* normal worker */
+        /* normal worker, the job broker passes the jobs to its children */
+        void *(*job_function)( gearman_job_st *, void *, size_t *, gearman_return_t * ) = get_job;
+        if(worker_run_mode == GM_WORKER_BROKER)
+            job_function = broker_get_job;
+
         if(mod_gm_opt->hosts == GM_ENABLED)
-            worker_add_function( w, "host", get_job );
+            worker_add_function( w, "host", job_function );
 
         if(mod_gm_opt->services == GM_ENABLED)
-            worker_add_function( w, "service", get_job );
+            worker_add_function( w, "service", job_function );
 
         if(mod_gm_opt->events == GM_ENABLED)
-            worker_add_function( w, "eventhandler", get_job );
+            worker_add_function( w, "eventhandler", job_function );
 
         if(mod_gm_opt->notifications == GM_ENABLED)
-            worker_add_function( w, "notification", get_job );
+            worker_add_function( w, "notification", job_function );
 
         while ( mod_gm_opt->hostgroups_list[x] != NULL ) {
             char buffer[GM_BUFFERSIZE];
             snprintf( buffer, (sizeof(buffer)-1), "hostgroup_%s", mod_gm_opt->hostgroups_list[x] );
-            worker_add_function( w, buffer, get_job );
+            worker_add_function( w, buffer, job_function );
             x++;
         }
 
@@ -470,7 +1027,7 @@ int set_worker( gearman_worker_st *w ) {
         while ( mod_gm_opt->servicegroups_list[x] != NULL ) {
             char buffer[GM_BUFFERSIZE];
             snprintf( buffer, (sizeof(buffer)-1), "servicegroup_%s", mod_gm_opt->servicegroups_list[x] );
-            worker_add_function( w, buffer, get_job );
+            worker_add_function( w, buffer, job_function );
             x++;
         }
     }
@@ -484,6 +1041,7 @@ int set_worker( gearman_worker_st *w ) {
 /* called when worker runs into exit timeout */
 void exit_sighandler(int sig) {
     gm_log( GM_LOG_TRACE, "exit_sighandler(%i)\n", sig );
+    gm_log_flush();
     _exit( EXIT_SUCCESS );
 }
 
@@ -560,22 +1118,46 @@ void clean_worker_exit(int sig) {
     gm_log( GM_LOG_TRACE, "clean_worker_exit(%d)\n", sig);
 
     /* clear gearmans job, otherwise it would be retried and retried */
-    if(current_gearman_job != NULL) {
+    if(job_running == TRUE) {
         if(sig == SIGINT) {
             /* if worker stopped with sigint, let the job retry */
         } else {
             send_failed_result(current_job, sig);
-            gearman_job_send_complete(current_gearman_job, NULL, 0);
+            if(current_gearman_job != NULL)
+                gearman_job_send_complete(current_gearman_job, NULL, 0);
         }
         /* make sure no processes are left over */
         kill_child_checks();
     }
 
-    gm_log( GM_LOG_TRACE, "cleaning worker\n");
-    gearman_worker_unregister_all(&worker);
-    gearman_job_free_all( &worker );
-    gm_log( GM_LOG_TRACE, "cleaning client\n");
-    gearman_client_free( &client );
+    /* send remaining batched results */
+    if(mod_gm_opt->result_batch_size > 1)
+        flush_result_batch();
+
+    /* free our per host counter */
+    release_target_slot(current_target_slot);
+
+    /* jobs in the backlog are already taken from gearmand */
+    if(worker_run_mode == GM_WORKER_BROKER)
+        broker_flush_backlog();
+
+    /* give back our idle announcement to the job broker */
+    if(mod_gm_opt->broker_mode == GM_ENABLED && worker_run_mode == GM_WORKER_MULTI)
+        broker_withdraw_idle();
+
+    if(worker_created == TRUE) {
+        gm_log( GM_LOG_TRACE, "cleaning worker\n");
+        gearman_worker_unregister_all(&worker);
+        gearman_job_free_all( &worker );
+    }
+    if(client_created == TRUE) {
+        gm_log( GM_LOG_TRACE, "cleaning client\n");
+        gearman_client_free( &client );
+    }
+
+    /* remove our plugin cgroups */
+    plugin_cgroup_cleanup();
+
     mod_gm_free_opt(mod_gm_opt);
 
 #ifdef EMBEDDEDPERL
@@ -645,6 +1227,40 @@ void *return_status( gearman_job_st *job, void *context, size_t *result_size, ge
 
     snprintf(result, GM_BUFFERSIZE, "%s has %i worker and is working on %i jobs. Version: %s|worker=%i;;;%i;%i jobs=%ic", hostname, shm[SHM_WORKER_TOTAL], shm[SHM_WORKER_RUNNING], GM_VERSION, shm[SHM_WORKER_TOTAL], mod_gm_opt->min_worker, mod_gm_opt->max_worker, shm[SHM_JOBS_DONE] );
 
+    /* add throttled jobs */
+    if(mod_gm_opt->target_limit > 0 || mod_gm_opt->target_limit_hostgroups_num > 0) {
+        size_t len = strlen(result);
+        snprintf(result+len, GM_BUFFERSIZE-len, " throttled=%ic", shm[SHM_JOBS_THROTTLED]);
+    }
+
+    /* add missed deadlines per queue */
+    if(mod_gm_opt->max_age > 0 || mod_gm_opt->job_deadline > 0)
+        append_missed_deadlines(result, shm);
+
+    /* add compression statistics */
+    if(mod_gm_opt->compression_threshold > 0)
+        append_compression_stats(result, shm);
+
+    /* add bulk jobs */
+    if(shm[SHM_BULK_SHIFT+SHM_BULK_JOBS] > 0) {
+        size_t len = strlen(result);
+        snprintf(result+len, len < GM_BUFFERSIZE ? GM_BUFFERSIZE-len : 0, " bulk_jobs=%ic bulk_checks=%ic", shm[SHM_BULK_SHIFT+SHM_BULK_JOBS], shm[SHM_BULK_SHIFT+SHM_BULK_CHECKS]);
+    }
+
+    /* add result cache and spool statistics */
+    result_cache_append_stats(result);
+    result_spool_append_stats(result);
+
+    /* add the most expensive plugins */
+    rusage_stats_append_stats(result);
+
+    /* add pressure of the plugin cgroups */
+    plugin_cgroup_append_stats(result);
+
+    /* add icmp engine throughput */
+    icmp_engine_append_stats(result);
+    plugin_modules_append_stats(result);
+
     /* and increase job counter */
     shm[SHM_JOBS_DONE]++;
 
@@ -658,6 +1274,46 @@ void *return_status( gearman_job_st *job, void *context, size_t *result_size, ge
 }
 
 
+/* append missed deadlines per queue as performance data */
+void append_missed_deadlines(char * result, int * shm) {
+    char queue[GM_BUFFERSIZE];
+    int x, indx = 0;
+    size_t len = strlen(result);
+
+    /* same order as get_queue_index() */
+    const char * queues[4] = { "host", "service", "eventhandler", "notification" };
+    const int enabled[4]   = { mod_gm_opt->hosts, mod_gm_opt->services, mod_gm_opt->events, mod_gm_opt->notifications };
+    for(x = 0; x < 4; x++, indx++) {
+        if(enabled[x] == GM_ENABLED)
+            len += snprintf(result+len, len < GM_BUFFERSIZE ? GM_BUFFERSIZE-len : 0, " '%s_missed'=%ic", queues[x], shm[SHM_QUEUE_SHIFT+indx]);
+    }
+    for(x = 0; mod_gm_opt->hostgroups_list[x] != NULL && indx < SHM_QUEUE_SLOTS; x++, indx++) {
+        snprintf(queue, GM_BUFFERSIZE, "hostgroup_%s", mod_gm_opt->hostgroups_list[x]);
+        len += snprintf(result+len, len < GM_BUFFERSIZE ? GM_BUFFERSIZE-len : 0, " '%s_missed'=%ic", queue, shm[SHM_QUEUE_SHIFT+indx]);
+    }
+    for(x = 0; mod_gm_opt->servicegroups_list[x] != NULL && indx < SHM_QUEUE_SLOTS; x++, indx++) {
+        snprintf(queue, GM_BUFFERSIZE, "servicegroup_%s", mod_gm_opt->servicegroups_list[x]);
+        len += snprintf(result+len, len < GM_BUFFERSIZE ? GM_BUFFERSIZE-len : 0, " '%s_missed'=%ic", queue, shm[SHM_QUEUE_SHIFT+indx]);
+    }
+
+    return;
+}
+
+
+/* append compression ratio and cpu time as performance data */
+void append_compression_stats(char * result, int * shm) {
+    uint64_t * counter = (uint64_t *)(shm + SHM_COMPRESS_SHIFT);
+    size_t len = strlen(result);
+
+    snprintf(result+len, len < GM_BUFFERSIZE ? GM_BUFFERSIZE-len : 0, " compressed=%lluc compression_ratio=%.2f compression_time=%.3fs",
+             (unsigned long long)counter[SHM_COMPRESSED],
+             counter[SHM_COMPRESS_BYTES] > 0 ? (double)counter[SHM_COMPRESS_RAW] / counter[SHM_COMPRESS_BYTES] : 1.0,
+             (double)counter[SHM_COMPRESS_USEC] / 1000000);
+
+    return;
+}
+
+
 #ifdef GM_DEBUG
 /* write text to a debug file */
 void write_debug_file(char ** text) {